@@ -590,6 +590,26 @@ jsmntok_t *toks_alloc(const tal_t *ctx)
 	return toks;
 }
 
+/* Without JSMN_STRICT, jsmn takes a primitive that is cut off at the
+ * end of the input as complete.  Forget it, so that it is parsed
+ * again, whole, once more input arrives.  */
+static void unparse_trailing_primitive(jsmn_parser *parser,
+				       jsmntok_t *toks, int len)
+{
+	jsmntok_t *last;
+
+	if (parser->toknext == 0)
+		return;
+	last = &toks[parser->toknext - 1];
+	if (last->type != JSMN_PRIMITIVE || last->end != len)
+		return;
+
+	if (parser->toksuper != -1)
+		--toks[parser->toksuper].size;
+	parser->pos = last->start;
+	--parser->toknext;
+}
+
 bool json_parse_input(jsmn_parser *parser,
 		      jsmntok_t **toks,
 		      const char *input, int len,
@@ -611,6 +631,7 @@ again:
 	/* Check whether we read at least one full root element, i.e., root
 	 * element has its end set. */
 	if ((*toks)[0].type == JSMN_UNDEFINED || (*toks)[0].end == -1) {
+		unparse_trailing_primitive(parser, *toks, len);
 		*complete = false;
 		return true;
 	}
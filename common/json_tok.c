@@ -32,3 +32,14 @@ struct command_result *param_number(struct command *cmd, const char *name,
 	return command_fail_badparam(cmd, name, buffer, tok,
 				     "should be an integer");
 }
+struct command_result *param_bool(struct command *cmd, const char *name,
+				  const char *buffer, const jsmntok_t *tok,
+				  bool **b)
+{
+	*b = tal(cmd, bool);
+	if (json_to_bool(buffer, tok, *b))
+		return NULL;
+
+	return command_fail_badparam(cmd, name, buffer, tok,
+				     "should be 'true' or 'false'");
+}
@@ -26,5 +26,8 @@ struct command_result *param_string(struct command *cmd, const char *name,
 struct command_result *param_number(struct command *cmd, const char *name,
 				    const char *buffer, const jsmntok_t *tok,
 				    unsigned int **num);
+struct command_result *param_bool(struct command *cmd, const char *name,
+				  const char *buffer, const jsmntok_t *tok,
+				  bool **b);
 
 #endif /* PAYZ_COMMON_JSON_TOK_H */
@@ -1,6 +1,8 @@
 #include"ec.h"
 #include<assert.h>
 #include<ccan/intmap/intmap.h>
+#include<ccan/list/list.h>
+#include<ccan/str/str.h>
 #include<ccan/strmap/strmap.h>
 #include<ccan/tal/str/str.h>
 #include<common/json.h>
@@ -26,6 +28,65 @@ struct ec_cell {
 	jsmntok_t *tok;
 };
 
+/** struct ec_watchslot
+ *
+ * @brief Represents the watches on a component of an entity.
+ * Unlike a cell, it exists whether or not the component is
+ * attached.
+ */
+struct ec_watchslot {
+	struct ec_watchrow *row;
+	u32 entity;
+	char *component;
+	struct list_head watches;
+};
+
+/** struct ec_watchrow
+ *
+ * @brief Represents the watched components of an entity.
+ */
+struct ec_watchrow {
+	STRMAP(struct ec_watchslot *) slot_map;
+};
+
+struct ec_watch {
+	struct ec *ec;
+	struct list_node list;
+	/* The list the watch is on, or NULL once it is firing.  */
+	struct list_head *in;
+	/* The slot it is on, or NULL once it is firing.  */
+	struct ec_watchslot *slot;
+	void (*cb)(void *arg);
+	void *arg;
+};
+
+/** struct ec_index_bucket
+ *
+ * @brief Represents the entities having a particular value
+ * in an index.
+ */
+struct ec_index_bucket {
+	/* The canonical JSON text of the value.  */
+	char *key;
+	/* The entities, in increasing order.  */
+	u32 *entities;
+};
+
+/** struct ec_index
+ *
+ * @brief Represents an index from the values of a component,
+ * or of a field within it, to the entities having them.
+ */
+struct ec_index {
+	const char *component;
+	const char **field;
+	/** Mapping from canonical value to bucket.  */
+	STRMAP(struct ec_index_bucket *) buckets;
+	/** Number of buckets, and of entities in all buckets.  */
+	size_t values;
+	size_t entities;
+};
+
 /** struct ec_entityrow
  *
  * @brief Represents the components attached to an
@@ -49,10 +110,30 @@ struct ec {
 
 	/** Mapping from entity ID to entity row.  */
 	UINTMAP(struct ec_entityrow *) entity_map;
+
+	/** Indexes on component values.
+	 * There are expected to be few, so they are simply
+	 * searched in order.
+	 */
+	struct ec_index **indexes;
+
+	/** Mapping from entity ID to watched components.  */
+	UINTMAP(struct ec_watchrow *) watch_map;
+
+	/** Number of changes so far.  */
+	u64 version;
+	/** Called on every change, or NULL.  */
+	void (*change_hook)(u32 entity, const char *component,
+			    u64 version, void *arg);
+	void *change_hook_arg;
 };
 
 static void destroy_ecs(struct ec *ec);
 static void destroy_entityrow(struct ec_entityrow *entityrow);
+static void ec_index_cell(struct ec *ec, u32 entity,
+			  const struct ec_cell *cell, bool add);
+static void ec_fire_watches(struct ec *ec, u32 entity,
+			    const char *component);
 
 struct ec *ec_new(const tal_t *ctx)
 {
@@ -66,6 +147,11 @@ struct ec *ec_new(const tal_t *ctx)
 	ec->null_tok[0].end = 4;
 	ec->null_tok[0].size = 0;
 	uintmap_init(&ec->entity_map);
+	ec->indexes = tal_arr(ec, struct ec_index *, 0);
+	uintmap_init(&ec->watch_map);
+	ec->version = 0;
+	ec->change_hook = NULL;
+	ec->change_hook_arg = NULL;
 
 	tal_add_destructor(ec, &destroy_ecs);
 
@@ -158,13 +244,13 @@ bool ec_get_component(const struct ec *ec,
 static struct ec_entityrow *ec_entityrow_new(const tal_t *ctx);
 static struct ec_cell *ec_cell_new(const tal_t *ctx,
 				   const char *component,
-				   const char *buffer,
-				   const jsmntok_t *tok);
+				   const char *buffer TAKES,
+				   const jsmntok_t *tok TAKES);
 void ec_set_component(struct ec *ec,
 		       u32 entity,
 		       const char *component,
-		       const char *buffer,
-		       const jsmntok_t *tok)
+		       const char *buffer TAKES,
+		       const jsmntok_t *tok TAKES)
 {
 	bool detach = false;
 	struct ec_entityrow *entityrow;
@@ -178,6 +264,13 @@ void ec_set_component(struct ec *ec,
 	if (!detach && json_tok_is_null(buffer, tok))
 		detach = true;
 
+	if (detach) {
+		if (taken(buffer))
+			tal_free(buffer);
+		if (taken(tok))
+			tal_free(tok);
+	}
+
 	entityrow = uintmap_get(&ec->entity_map, entity);
 
 	if (detach) {
@@ -188,6 +281,7 @@ void ec_set_component(struct ec *ec,
 		if (!cell)
 			return;
 
+		ec_index_cell(ec, entity, cell, false);
 		strmap_del(&entityrow->component_map, component, NULL);
 		tal_free(cell);
 
@@ -207,6 +301,7 @@ void ec_set_component(struct ec *ec,
 
 		/* Detach first if already exist.  */
 		if (cell) {
+			ec_index_cell(ec, entity, cell, false);
 			strmap_del(&entityrow->component_map, component, NULL);
 			cell = tal_free(cell);
 		}
@@ -214,7 +309,30 @@ void ec_set_component(struct ec *ec,
 		/* Now attach.  */
 		cell = ec_cell_new(entityrow, component, buffer, tok);
 		strmap_add(&entityrow->component_map, cell->component, cell);
+		ec_index_cell(ec, entity, cell, true);
 	}
+
+	++ec->version;
+	ec_fire_watches(ec, entity, component);
+	if (ec->change_hook)
+		ec->change_hook(entity, component, ec->version,
+				ec->change_hook_arg);
+}
+
+u64 ec_get_version(const struct ec *ec)
+{
+	return ec->version;
+}
+
+void ec_set_change_hook_(struct ec *ec,
+			 void (*cb)(u32 entity,
+				    const char *component,
+				    u64 version,
+				    void *arg),
+			 void *arg)
+{
+	ec->change_hook = cb;
+	ec->change_hook_arg = arg;
 }
 
 static struct ec_entityrow *ec_entityrow_new(const tal_t *ctx)
@@ -230,8 +348,8 @@ static struct ec_entityrow *ec_entityrow_new(const tal_t *ctx)
 
 static struct ec_cell *ec_cell_new(const tal_t *ctx,
 				   const char *component,
-				   const char *buffer,
-				   const jsmntok_t *tok)
+				   const char *buffer TAKES,
+				   const jsmntok_t *tok TAKES)
 {
 	struct ec_cell *cell = tal(ctx, struct ec_cell);
 
@@ -244,10 +362,15 @@ static struct ec_cell *ec_cell_new(const tal_t *ctx,
 	/* The offset to apply to all copied tokens.  */
 	int offset = to_copy - buffer;
 
-	/* Load the cell.  */
+	/* Load the cell.
+	 * If the buffer and tokens are take()n, tal_dup_arr
+	 * simply adopts them, but the buffer can only be adopted
+	 * if the value starts it.  */
 	cell->component = tal_strdup(cell, component);
 	cell->buffer = tal_dup_arr(cell, char,
-				   to_copy, len, 0);
+				   offset == 0 ? buffer : to_copy, len, 0);
+	if (offset != 0 && taken(buffer))
+		tal_free(buffer);
 	cell->tok = tal_dup_arr(cell, jsmntok_t,
 				tok, tok_end - tok, 0);
 	/* Adjust the copied tokens by the offset.  */
@@ -293,6 +416,408 @@ void ec_set_component_datum(struct ec *ec,
 	ec_set_component_datuml(ec, entity, component, valuez, len);
 }
 
+/*-----------------------------------------------------------------------------
+Indexes
+-----------------------------------------------------------------------------*/
+/*~
+ * An index maps the canonical JSON text of a value to the
+ * entities having that value.
+ * The canonical text has no whitespace outside of strings,
+ * and object members sorted by key, so that values which
+ * json_equal considers equal have the same canonical text.
+ */
+
+static int strcmp_ptr(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+static char *ec_canonical(const tal_t *ctx,
+			  const char *buffer,
+			  const jsmntok_t *tok)
+{
+	const jsmntok_t *t;
+	char **members;
+	char *text;
+	size_t i;
+
+	switch (tok->type) {
+	case JSMN_PRIMITIVE:
+		return tal_strndup(ctx, buffer + tok->start,
+				   tok->end - tok->start);
+	case JSMN_STRING:
+		return tal_fmt(ctx, "\"%.*s\"",
+			       tok->end - tok->start, buffer + tok->start);
+	case JSMN_ARRAY:
+		text = tal_strdup(ctx, "[");
+		json_for_each_arr (i, t, tok) {
+			char *elem = ec_canonical(tmpctx, buffer, t);
+			tal_append_fmt(&text, "%s%s", i ? "," : "", elem);
+			tal_free(elem);
+		}
+		tal_append_fmt(&text, "]");
+		return text;
+	case JSMN_OBJECT:
+		members = tal_arr(tmpctx, char *, tok->size);
+		json_for_each_obj (i, t, tok) {
+			members[i] = tal_fmt(members, "\"%.*s\":",
+					     t->end - t->start,
+					     buffer + t->start);
+			tal_append_fmt(&members[i], "%s",
+				       ec_canonical(members[i],
+						    buffer, t + 1));
+		}
+		qsort(members, tal_count(members), sizeof(members[0]),
+		      &strcmp_ptr);
+		text = tal_strdup(ctx, "{");
+		for (i = 0; i < tal_count(members); ++i)
+			tal_append_fmt(&text, "%s%s", i ? "," : "",
+				       members[i]);
+		tal_append_fmt(&text, "}");
+		tal_free(members);
+		return text;
+	case JSMN_UNDEFINED:
+		break;
+	}
+	abort();
+}
+
+static bool ec_field_eq(const char **field1, const char **field2)
+{
+	size_t i;
+
+	if (tal_count(field1) != tal_count(field2))
+		return false;
+	for (i = 0; i < tal_count(field1); ++i)
+		if (!streq(field1[i], field2[i]))
+			return false;
+	return true;
+}
+
+static struct ec_index *ec_find_index(const struct ec *ec,
+				      const char *component,
+				      const char **field)
+{
+	size_t i;
+
+	for (i = 0; i < tal_count(ec->indexes); ++i)
+		if (streq(ec->indexes[i]->component, component)
+		 && ec_field_eq(ec->indexes[i]->field, field))
+			return ec->indexes[i];
+	return NULL;
+}
+
+/* Get the canonical text of the indexed value, or NULL if the
+ * value does not have the field.  */
+static char *ec_index_key(const tal_t *ctx,
+			  const struct ec_index *index,
+			  const char *buffer,
+			  const jsmntok_t *tok)
+{
+	size_t i;
+
+	for (i = 0; tok && i < tal_count(index->field); ++i) {
+		if (tok->type != JSMN_OBJECT)
+			return NULL;
+		tok = json_get_member(buffer, tok, index->field[i]);
+	}
+	if (!tok)
+		return NULL;
+	return ec_canonical(ctx, buffer, tok);
+}
+
+/* Find where the entity is, or would be, in the bucket.  */
+static size_t ec_bucket_search(const struct ec_index_bucket *bucket,
+			       u32 entity)
+{
+	size_t lo = 0, hi = tal_count(bucket->entities);
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (bucket->entities[mid] < entity)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void ec_index_add(struct ec_index *index, u32 entity,
+			 const char *key)
+{
+	struct ec_index_bucket *bucket;
+	size_t n, pos;
+
+	bucket = strmap_get(&index->buckets, key);
+	if (!bucket) {
+		bucket = tal(index, struct ec_index_bucket);
+		bucket->key = tal_strdup(bucket, key);
+		bucket->entities = tal_arr(bucket, u32, 0);
+		strmap_add(&index->buckets, bucket->key, bucket);
+		++index->values;
+	}
+
+	pos = ec_bucket_search(bucket, entity);
+	n = tal_count(bucket->entities);
+	if (pos < n && bucket->entities[pos] == entity)
+		return;
+	tal_resize(&bucket->entities, n + 1);
+	memmove(bucket->entities + pos + 1, bucket->entities + pos,
+		(n - pos) * sizeof(bucket->entities[0]));
+	bucket->entities[pos] = entity;
+	++index->entities;
+}
+
+static void ec_index_del(struct ec_index *index, u32 entity,
+			 const char *key)
+{
+	struct ec_index_bucket *bucket;
+	size_t n, pos;
+
+	bucket = strmap_get(&index->buckets, key);
+	if (!bucket)
+		return;
+
+	pos = ec_bucket_search(bucket, entity);
+	n = tal_count(bucket->entities);
+	if (pos == n || bucket->entities[pos] != entity)
+		return;
+	memmove(bucket->entities + pos, bucket->entities + pos + 1,
+		(n - pos - 1) * sizeof(bucket->entities[0]));
+	tal_resize(&bucket->entities, n - 1);
+	--index->entities;
+
+	if (n == 1) {
+		strmap_del(&index->buckets, bucket->key, NULL);
+		tal_free(bucket);
+		--index->values;
+	}
+}
+
+/* Add the cell to, or remove it from, the indexes on its
+ * component.  */
+static void ec_index_cell(struct ec *ec, u32 entity,
+			  const struct ec_cell *cell, bool add)
+{
+	struct ec_index *index;
+	char *key;
+	size_t i;
+
+	for (i = 0; i < tal_count(ec->indexes); ++i) {
+		index = ec->indexes[i];
+		if (!streq(index->component, cell->component))
+			continue;
+		key = ec_index_key(tmpctx, index, cell->buffer, cell->tok);
+		if (!key)
+			continue;
+		if (add)
+			ec_index_add(index, entity, key);
+		else
+			ec_index_del(index, entity, key);
+		tal_free(key);
+	}
+}
+
+static void destroy_index(struct ec_index *index)
+{
+	/* Buckets are tal-allocated, so no need to delete the
+	 * contained buckets.  */
+	strmap_clear(&index->buckets);
+}
+
+void ec_create_index(struct ec *ec,
+		     const char *component,
+		     const char **field)
+{
+	struct ec_index *index;
+	struct ec_entityrow *entityrow;
+	struct ec_cell *cell;
+	intmap_index_t entity;
+	char *key;
+	size_t i;
+
+	if (ec_find_index(ec, component, field))
+		return;
+
+	index = tal(ec, struct ec_index);
+	index->component = tal_strdup(index, component);
+	index->field = tal_arr(index, const char *, tal_count(field));
+	for (i = 0; i < tal_count(field); ++i)
+		index->field[i] = tal_strdup(index->field, field[i]);
+	strmap_init(&index->buckets);
+	index->values = 0;
+	index->entities = 0;
+	tal_add_destructor(index, &destroy_index);
+
+	/* Index what is already there.  */
+	for (entityrow = uintmap_first(&ec->entity_map, &entity);
+	     entityrow;
+	     entityrow = uintmap_after(&ec->entity_map, &entity)) {
+		cell = strmap_get(&entityrow->component_map, component);
+		if (!cell)
+			continue;
+		key = ec_index_key(tmpctx, index, cell->buffer, cell->tok);
+		if (!key)
+			continue;
+		ec_index_add(index, (u32) entity, key);
+		tal_free(key);
+	}
+
+	tal_arr_expand(&ec->indexes, index);
+}
+
+u32 *ec_lookup_index(const tal_t *ctx,
+		     const struct ec *ec,
+		     const char *component,
+		     const char **field,
+		     const char *buffer,
+		     const jsmntok_t *tok)
+{
+	struct ec_index *index;
+	struct ec_index_bucket *bucket;
+	char *key;
+
+	index = ec_find_index(ec, component, field);
+	if (!index)
+		return NULL;
+
+	key = ec_canonical(tmpctx, buffer, tok);
+	bucket = strmap_get(&index->buckets, key);
+	tal_free(key);
+	if (!bucket)
+		return tal_arr(ctx, u32, 0);
+	return tal_dup_talarr(ctx, u32, bucket->entities);
+}
+
+bool ec_get_index_size(const struct ec *ec,
+		       const char *component,
+		       const char **field,
+		       size_t *values,
+		       size_t *entities)
+{
+	struct ec_index *index = ec_find_index(ec, component, field);
+
+	if (!index)
+		return false;
+
+	*values = index->values;
+	*entities = index->entities;
+	return true;
+}
+
+/*-----------------------------------------------------------------------------
+Watches
+-----------------------------------------------------------------------------*/
+
+static void destroy_watchrow(struct ec_watchrow *row)
+{
+	strmap_clear(&row->slot_map);
+}
+
+static struct ec_watchslot *ec_get_watchslot(const struct ec *ec,
+					     u32 entity,
+					     const char *component)
+{
+	struct ec_watchrow *row = uintmap_get(&ec->watch_map, entity);
+
+	if (!row)
+		return NULL;
+	return strmap_get(&row->slot_map, component);
+}
+
+/* Delete a slot with no more watches, and its row if that was
+ * its last slot.  */
+static void ec_del_watchslot(struct ec *ec, struct ec_watchslot *slot)
+{
+	struct ec_watchrow *row = slot->row;
+	u32 entity = slot->entity;
+
+	assert(list_empty(&slot->watches));
+	strmap_del(&row->slot_map, slot->component, NULL);
+	tal_free(slot);
+	if (strmap_empty(&row->slot_map)) {
+		uintmap_del(&ec->watch_map, entity);
+		tal_free(row);
+	}
+}
+
+static void destroy_watch(struct ec_watch *watch)
+{
+	if (watch->in)
+		list_del_from(watch->in, &watch->list);
+	if (watch->slot && list_empty(&watch->slot->watches))
+		ec_del_watchslot(watch->ec, watch->slot);
+}
+
+struct ec_watch *ec_watch_(const tal_t *ctx,
+			   struct ec *ec,
+			   u32 entity,
+			   const char *component,
+			   void (*cb)(void *arg),
+			   void *arg)
+{
+	struct ec_watch *watch = tal(ctx, struct ec_watch);
+	struct ec_watchrow *row;
+	struct ec_watchslot *slot;
+
+	row = uintmap_get(&ec->watch_map, entity);
+	if (!row) {
+		row = tal(ec, struct ec_watchrow);
+		strmap_init(&row->slot_map);
+		tal_add_destructor(row, &destroy_watchrow);
+		uintmap_add(&ec->watch_map, entity, row);
+	}
+	slot = strmap_get(&row->slot_map, component);
+	if (!slot) {
+		slot = tal(row, struct ec_watchslot);
+		slot->row = row;
+		slot->entity = entity;
+		slot->component = tal_strdup(slot, component);
+		list_head_init(&slot->watches);
+		strmap_add(&row->slot_map, slot->component, slot);
+	}
+
+	watch->ec = ec;
+	watch->in = &slot->watches;
+	watch->slot = slot;
+	watch->cb = cb;
+	watch->arg = arg;
+	list_add_tail(&slot->watches, &watch->list);
+	tal_add_destructor(watch, &destroy_watch);
+
+	return watch;
+}
+
+static void ec_fire_watches(struct ec *ec, u32 entity,
+			    const char *component)
+{
+	struct ec_watchslot *slot;
+	struct ec_watch *watch;
+	struct list_head firing;
+
+	/* Nobody waiting on anything?  */
+	if (uintmap_empty(&ec->watch_map))
+		return;
+	slot = ec_get_watchslot(ec, entity, component);
+	if (!slot)
+		return;
+
+	/* Move the watches out of the slot, and delete it, so
+	 * that the callbacks can freely add and free watches.  */
+	list_head_init(&firing);
+	while ((watch = list_pop(&slot->watches, struct ec_watch, list))) {
+		watch->slot = NULL;
+		watch->in = &firing;
+		list_add_tail(&firing, &watch->list);
+	}
+	ec_del_watchslot(ec, slot);
+
+	while ((watch = list_pop(&firing, struct ec_watch, list))) {
+		watch->in = NULL;
+		watch->cb(watch->arg);
+	}
+}
+
 /*-----------------------------------------------------------------------------
 EC Destructor
 -----------------------------------------------------------------------------*/
@@ -313,8 +838,32 @@ static void destroy_entityrow(struct ec_entityrow *entityrow)
 	strmap_clear(&entityrow->component_map);
 }
 
+static bool ec_orphan_watches(const char *component,
+			      struct ec_watchslot *slot,
+			      void *unused)
+{
+	struct ec_watch *watch;
+
+	while ((watch = list_pop(&slot->watches, struct ec_watch, list))) {
+		watch->in = NULL;
+		watch->slot = NULL;
+	}
+	return true;
+}
+
 static void destroy_ecs(struct ec *ec)
 {
+	struct ec_watchrow *row;
+	intmap_index_t entity;
+
+	/* Watches may outlive us, so detach them from their
+	 * slots, which are about to be freed.  */
+	for (row = uintmap_first(&ec->watch_map, &entity);
+	     row;
+	     row = uintmap_after(&ec->watch_map, &entity))
+		strmap_iterate(&row->slot_map, &ec_orphan_watches, NULL);
+	uintmap_clear(&ec->watch_map);
+
 	/* Entity rows are tal-allocated, so no need to delete
 	 * the contained rows.
 	 */
@@ -2,7 +2,9 @@
 #define LIGHTNING_PLUGINS_PAYZ_ECS_EC_H
 #include"config.h"
 #include<ccan/short_types/short_types.h>
+#include<ccan/take/take.h>
 #include<ccan/tal/tal.h>
+#include<ccan/typesafe_cb/typesafe_cb.h>
 #include<external/jsmn/jsmn.h>
 #include<stdbool.h>
 #include<stddef.h>
@@ -124,6 +126,8 @@ bool ec_get_component(const struct ec *ec,
  *
  * If attaching or mutating, this creates a copy of the
  * given JSON object, owned by the given EC instance.
+ * If both buffer and tok are take()n, and tok is the first
+ * token of the buffer, they are used as they are instead.
  *
  * @param ec - The EC instance to mutate.
  * @param entity - the numeric ID of the entity to mutate.
@@ -140,8 +144,8 @@ bool ec_get_component(const struct ec *ec,
 void ec_set_component(struct ec *ec,
 		       u32 entity,
 		       const char *component,
-		       const char *buffer,
-		       const jsmntok_t *tok);
+		       const char *buffer TAKES,
+		       const jsmntok_t *tok TAKES);
 
 /** ec_set_component_datuml
  *
@@ -172,4 +176,141 @@ void ec_set_component_datum(struct ec *ec,
 #define ec_detach(ec, entity, component) \
 	ec_set_component((ec), (entity), (component), NULL, NULL)
 
+/** ec_create_index
+ *
+ * @brief Starts maintaining an index from the values of the
+ * given component, or of a field within it, to the entities
+ * having that value.
+ *
+ * @desc Values are compared as JSON, ignoring whitespace
+ * and the order of object keys, as in json_equal.
+ * The index is built from the current contents of the EC
+ * table, and afterwards kept up to date by every
+ * ec_set_component.
+ * Does nothing if the index already exists.
+ *
+ * @param ec - the EC instance to index.
+ * @param component - the name of the component to index.
+ * @param field - the member names to descend into, within
+ * the component value, to get the value to index.
+ * May be empty or NULL to index the entire component value.
+ * Entities whose component value does not have the field
+ * are not indexed.
+ */
+void ec_create_index(struct ec *ec,
+		     const char *component,
+		     const char **field);
+
+/** ec_lookup_index
+ *
+ * @brief Looks up the entities whose given component, or
+ * field within it, has the given value, using an index
+ * created by ec_create_index.
+ *
+ * @param ctx - the tal context to allocate the returned
+ * array from.
+ * @param ec - the EC instance to query.
+ * @param component - the name of the indexed component.
+ * @param field - the field of the index, as given to
+ * ec_create_index.
+ * @param buffer - the string buffer containing the value.
+ * @param tok - the value to look up.
+ *
+ * @return - a tal-allocated array of the entities with that
+ * value, in increasing order, possibly empty.
+ * Return NULL if there is no such index.
+ */
+u32 *ec_lookup_index(const tal_t *ctx,
+		     const struct ec *ec,
+		     const char *component,
+		     const char **field,
+		     const char *buffer,
+		     const jsmntok_t *tok);
+
+/** ec_get_index_size
+ *
+ * @brief Gets the number of distinct values and the number of
+ * entities in an index created by ec_create_index.
+ *
+ * @return - false if there is no such index.
+ */
+bool ec_get_index_size(const struct ec *ec,
+		       const char *component,
+		       const char **field,
+		       size_t *values,
+		       size_t *entities);
+
+/** struct ec_watch
+ *
+ * @brief Represents a one-shot wait for a change of a component
+ * of an entity.
+ */
+struct ec_watch;
+
+/** ec_watch
+ *
+ * @brief Calls the given function the next time the given
+ * component of the given entity is attached, mutated, or
+ * detached, even if it is set to the same value.
+ *
+ * @desc The function is called once, at the end of the
+ * ec_set_component that makes the change.
+ * Watches are kept in a list per entity and component, so a
+ * change only looks at the watches on that component.
+ * Free the returned watch to stop waiting; it may also be
+ * freed from within the function.
+ *
+ * @param ctx - the owner of the returned watch.
+ * @param ec - the EC instance to watch.
+ * @param entity - the entity to watch.
+ * @param component - the component to watch.
+ * @param cb - the function to call.
+ * @param arg - the argument to the function.
+ */
+struct ec_watch *ec_watch_(const tal_t *ctx,
+			   struct ec *ec,
+			   u32 entity,
+			   const char *component,
+			   void (*cb)(void *arg),
+			   void *arg);
+#define ec_watch(ctx, ec, entity, component, cb, arg) \
+	ec_watch_((ctx), (ec), (entity), (component), \
+		  typesafe_cb(void, void *, (cb), (arg)), \
+		  (arg))
+
+/** ec_get_version
+ *
+ * @brief Gets the number of changes made to the EC table so
+ * far.
+ *
+ * @desc Every ec_set_component that attaches, mutates, or
+ * detaches a component increments the version, so a change
+ * made after this call has a greater version.
+ */
+u64 ec_get_version(const struct ec *ec);
+
+/** ec_set_change_hook
+ *
+ * @brief Sets the function to call at the end of every
+ * ec_set_component that attaches, mutates, or detaches a
+ * component, after any watches on it.
+ *
+ * @param ec - the EC instance to hook.
+ * @param cb - the function to call, with the entity and
+ * component changed, and the version of the change; NULL to
+ * remove the hook.
+ * @param arg - the argument to the function.
+ */
+void ec_set_change_hook_(struct ec *ec,
+			 void (*cb)(u32 entity,
+				    const char *component,
+				    u64 version,
+				    void *arg),
+			 void *arg);
+#define ec_set_change_hook(ec, cb, arg) \
+	ec_set_change_hook_((ec), \
+			    typesafe_cb_preargs(void, void *, (cb), (arg), \
+						u32, const char *, u64), \
+			    (arg))
+
 #endif /* LIGHTNING_PLUGINS_PAYZ_EC_H */
@@ -0,0 +1,101 @@
+#include"echist.h"
+#include<assert.h>
+#include<ccan/ilog/ilog.h>
+#include<string.h>
+
+/*~
+ * Values below 2^ECHIST_SUB_BITS get a bucket each.
+ * Above that, each power of two gets 2^ECHIST_SUB_BITS buckets
+ * of equal width, selected by the bits just below the most
+ * significant bit of the value.
+ * This is the same scheme as an HDR histogram, and means the
+ * index of a bucket is just a few shifts away from the value.
+ */
+
+#define ECHIST_SUB ((u64) 1 << ECHIST_SUB_BITS)
+
+static size_t bucket_of(u64 value)
+{
+	unsigned int msb;
+	unsigned int shift;
+
+	if (value < ECHIST_SUB)
+		return value;
+	if (value >= ((u64) 1 << ECHIST_MAX_BITS))
+		return ECHIST_NUM_BUCKETS - 1;
+
+	msb = ilog64(value) - 1;
+	shift = msb - ECHIST_SUB_BITS;
+	return ((size_t) shift << ECHIST_SUB_BITS) + (value >> shift);
+}
+
+void echist_init(struct echist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+void echist_record(struct echist *hist, u64 value)
+{
+	if (hist->count == 0 || value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+	++hist->count;
+	hist->sum += value;
+	++hist->buckets[bucket_of(value)];
+}
+
+u64 echist_percentile(const struct echist *hist, double percentile)
+{
+	u64 target;
+	u64 seen;
+	u64 low, high;
+	size_t i;
+
+	if (hist->count == 0)
+		return 0;
+
+	if (percentile <= 0)
+		target = 1;
+	else if (percentile >= 100)
+		target = hist->count;
+	else {
+		target = (u64) (hist->count * percentile / 100.0 + 0.5);
+		if (target == 0)
+			target = 1;
+	}
+
+	seen = 0;
+	for (i = 0; i < ECHIST_NUM_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			break;
+	}
+	assert(i < ECHIST_NUM_BUCKETS);
+
+	echist_bucket_range(i, &low, &high);
+	return high < hist->max ? high : hist->max;
+}
+
+void echist_bucket_range(size_t index, u64 *low, u64 *high)
+{
+	unsigned int shift;
+	u64 top;
+
+	assert(index < ECHIST_NUM_BUCKETS);
+
+	if (index < ECHIST_SUB) {
+		*low = *high = index;
+		return;
+	}
+
+	shift = (index >> ECHIST_SUB_BITS) - 1;
+	top = (index & (ECHIST_SUB - 1)) + ECHIST_SUB;
+	*low = top << shift;
+	/* The last bucket also counts everything too large for
+	 * the others.  */
+	if (index == ECHIST_NUM_BUCKETS - 1)
+		*high = UINT64_MAX;
+	else
+		*high = ((top + 1) << shift) - 1;
+}
@@ -0,0 +1,78 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_ECS_ECHIST_H
+#define LIGHTNING_PLUGINS_PAYZ_ECS_ECHIST_H
+#include"config.h"
+#include<ccan/short_types/short_types.h>
+#include<stddef.h>
+
+/* Number of sub-buckets each power of two is split into, as a
+ * power of two.  */
+#define ECHIST_SUB_BITS 3
+/* Values at or above 2^ECHIST_MAX_BITS are counted in the
+ * last bucket.  */
+#define ECHIST_MAX_BITS 40
+#define ECHIST_NUM_BUCKETS \
+	((ECHIST_MAX_BITS - ECHIST_SUB_BITS + 1) << ECHIST_SUB_BITS)
+
+/** struct echist
+ *
+ * @brief Represents a histogram of non-negative values, such as
+ * latencies in microseconds.
+ *
+ * @desc Like an HDR histogram, small values are counted
+ * exactly, and larger values are counted in buckets whose width
+ * grows with the value, so that any value is known to within
+ * 1 / 2^ECHIST_SUB_BITS (12.5%) of itself while using a fixed
+ * amount of memory.
+ *
+ * This is a plain structure, to be embedded in whatever it
+ * measures.
+ */
+struct echist {
+	/* Number of values recorded.  */
+	u64 count;
+	/* Sum of the values recorded.  */
+	u64 sum;
+	/* Smallest and largest value recorded, 0 if none.  */
+	u64 min;
+	u64 max;
+	u64 buckets[ECHIST_NUM_BUCKETS];
+};
+
+/** echist_init
+ *
+ * @brief Initializes an empty histogram.
+ */
+void echist_init(struct echist *hist);
+
+/** echist_record
+ *
+ * @brief Records a single value in the histogram.
+ */
+void echist_record(struct echist *hist, u64 value);
+
+/** echist_percentile
+ *
+ * @brief Returns an upper bound on the given percentile of the
+ * recorded values.
+ *
+ * @param hist - the histogram to query.
+ * @param percentile - the percentile, from 0 to 100.
+ *
+ * @return - the largest value that would be counted in the
+ * bucket the percentile falls in, but no larger than the largest
+ * value recorded, or 0 if nothing was recorded.
+ */
+u64 echist_percentile(const struct echist *hist, double percentile);
+
+/** echist_bucket_range
+ *
+ * @brief Gets the range of values counted in a bucket.
+ *
+ * @param index - the index of the bucket, less than
+ * ECHIST_NUM_BUCKETS.
+ * @param low - output, the smallest value of the bucket.
+ * @param high - output, the largest value of the bucket.
+ */
+void echist_bucket_range(size_t index, u64 *low, u64 *high);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_ECS_ECHIST_H */
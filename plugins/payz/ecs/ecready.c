@@ -0,0 +1,292 @@
+/* Without this, gheap is *really* slow!  Comment out for debugging. */
+#define NDEBUG
+#include"ecready.h"
+#include<ccan/intmap/intmap.h>
+#include<ccan/str/str.h>
+#include<common/utils.h>
+#include<gheap.h>
+#include<string.h>
+
+/*~
+ * The ready queue is a set of per-priority-class heaps.
+ *
+ * Priority classes are served strictly: as long as there is an
+ * entry in a more important class, no entry of a less important
+ * class is served.
+ *
+ * Within a priority class we use weighted fair queuing (the
+ * "virtual finish time" formulation).
+ * Every flow remembers the virtual finish time of its most
+ * recently queued entry.
+ * A newly-queued entry finishes one quantum (divided by the
+ * weight of the flow) after the later of the class virtual time
+ * or the last finish time of its flow.
+ * We always serve the entry with the earliest virtual finish
+ * time, and advance the class virtual time to it.
+ *
+ * The effect is that a flow which queues 200 entities at once
+ * gets its entities spread out, interleaved with the entities of
+ * other flows that arrive later, instead of having those later
+ * flows wait for all 200 to be served.
+ */
+
+/* The virtual time an entry of a weight-1 flow takes.  */
+#define ECREADY_QUANTUM ((u64) 1 << 20)
+
+struct ecready_flow {
+	/* Virtual finish time of the most recently queued entry of
+	 * this flow.  */
+	u64 last_finish;
+	/* Number of entries of this flow in the queue.  */
+	size_t count;
+};
+
+struct ecready_entry {
+	u32 entity;
+	void *payload;
+	u32 flow_id;
+	struct ecready_flow *flow;
+
+	/* Virtual finish time.  */
+	u64 finish;
+	/* Tie-breaker, so that equal finish times are FIFO.  */
+	u64 seq;
+
+	/* When it was queued.  */
+	struct timemono enqueued;
+};
+
+struct ecready_class {
+	/* Heap of entries, as a tal-allocated array.  */
+	struct ecready_entry **heap;
+	/* Virtual time of this class.  */
+	u64 vtime;
+	/* Flows with entries in the queue.  */
+	UINTMAP(struct ecready_flow *) flows;
+
+	struct ecready_stats stats;
+};
+
+struct ecready {
+	struct ecready_class classes[ECREADY_NUM_PRIORITIES];
+	u64 next_seq;
+};
+
+static const char *priority_names[ECREADY_NUM_PRIORITIES] = {
+	"interactive",
+	"normal",
+	"background"
+};
+
+/*-----------------------------------------------------------------------------
+Heap
+-----------------------------------------------------------------------------*/
+
+/* gheap is a max-heap, so "less" here means "should be served
+ * later".  */
+static int less_comparer(const void *ctx,
+			 const void *a,
+			 const void *b)
+{
+	const struct ecready_entry *ea = *(struct ecready_entry * const *) a;
+	const struct ecready_entry *eb = *(struct ecready_entry * const *) b;
+
+	if (ea->finish != eb->finish)
+		return ea->finish > eb->finish;
+	return ea->seq > eb->seq;
+}
+
+static void item_mover(void *dst, const void *src)
+{
+	*(struct ecready_entry **) dst = *(struct ecready_entry * const *) src;
+}
+
+static const struct gheap_ctx gheap_ctx = {
+	.fanout = 2,
+	.page_chunks = 1,
+	.item_size = sizeof(struct ecready_entry *),
+	.less_comparer = &less_comparer,
+	.less_comparer_ctx = NULL,
+	.item_mover = &item_mover
+};
+
+/*-----------------------------------------------------------------------------
+Construction
+-----------------------------------------------------------------------------*/
+
+static void destroy_ecready(struct ecready *ready);
+
+struct ecready *ecready_new(const tal_t *ctx)
+{
+	struct ecready *ready = tal(ctx, struct ecready);
+	size_t i;
+
+	for (i = 0; i < ECREADY_NUM_PRIORITIES; ++i) {
+		struct ecready_class *c = &ready->classes[i];
+		c->heap = tal_arr(ready, struct ecready_entry *, 0);
+		c->vtime = 0;
+		uintmap_init(&c->flows);
+		memset(&c->stats, 0, sizeof(c->stats));
+	}
+	ready->next_seq = 0;
+
+	tal_add_destructor(ready, &destroy_ecready);
+
+	return ready;
+}
+
+static void destroy_ecready(struct ecready *ready)
+{
+	size_t i;
+
+	/* Flows and entries are tal-allocated from the ready queue,
+	 * only the intmaps use malloc.  */
+	for (i = 0; i < ECREADY_NUM_PRIORITIES; ++i)
+		uintmap_clear(&ready->classes[i].flows);
+}
+
+/*-----------------------------------------------------------------------------
+Push and Pop
+-----------------------------------------------------------------------------*/
+
+void ecready_push(struct ecready *ready,
+		  struct timemono now,
+		  enum ecready_priority priority,
+		  u32 flow_id,
+		  u32 weight,
+		  u32 entity,
+		  void *payload)
+{
+	struct ecready_class *c = &ready->classes[priority];
+	struct ecready_entry *entry;
+	struct ecready_flow *flow;
+	u64 start;
+	u64 cost;
+
+	flow = uintmap_get(&c->flows, flow_id);
+	if (!flow) {
+		flow = tal(ready, struct ecready_flow);
+		flow->last_finish = c->vtime;
+		flow->count = 0;
+		uintmap_add(&c->flows, flow_id, flow);
+	}
+
+	if (weight == 0)
+		weight = 1;
+	cost = ECREADY_QUANTUM / weight;
+	if (cost == 0)
+		cost = 1;
+	start = flow->last_finish > c->vtime ? flow->last_finish : c->vtime;
+
+	entry = tal(flow, struct ecready_entry);
+	entry->entity = entity;
+	entry->payload = payload;
+	entry->flow_id = flow_id;
+	entry->flow = flow;
+	entry->finish = start + cost;
+	entry->seq = ready->next_seq++;
+	entry->enqueued = now;
+
+	flow->last_finish = entry->finish;
+	++flow->count;
+
+	tal_arr_expand(&c->heap, entry);
+	gheap_push_heap(&gheap_ctx, c->heap, tal_count(c->heap));
+
+	++c->stats.enqueued;
+	++c->stats.depth;
+	if (c->stats.depth > c->stats.max_depth)
+		c->stats.max_depth = c->stats.depth;
+}
+
+bool ecready_pop(struct ecready *ready,
+		 struct timemono now,
+		 u32 *entity,
+		 void **payload,
+		 struct timemono *enqueued)
+{
+	struct ecready_class *c = NULL;
+	struct ecready_entry *entry;
+	struct ecready_flow *flow;
+	struct timerel wait;
+	size_t size;
+	size_t i;
+
+	for (i = 0; i < ECREADY_NUM_PRIORITIES; ++i) {
+		if (tal_count(ready->classes[i].heap) != 0) {
+			c = &ready->classes[i];
+			break;
+		}
+	}
+	if (!c)
+		return false;
+
+	size = tal_count(c->heap);
+	gheap_pop_heap(&gheap_ctx, c->heap, size);
+	entry = c->heap[size - 1];
+	tal_resize(&c->heap, size - 1);
+
+	c->vtime = entry->finish;
+
+	wait = timemono_between(now, entry->enqueued);
+	c->stats.total_wait = timerel_add(c->stats.total_wait, wait);
+	if (time_greater(wait, c->stats.max_wait))
+		c->stats.max_wait = wait;
+	++c->stats.dispatched;
+	--c->stats.depth;
+
+	*entity = entry->entity;
+	*payload = entry->payload;
+	if (enqueued)
+		*enqueued = entry->enqueued;
+
+	/* The flow is forgotten once it has nothing queued; since we
+	 * just served its last entry, its last finish time is the
+	 * class virtual time anyway.  */
+	flow = entry->flow;
+	if (--flow->count == 0) {
+		uintmap_del(&c->flows, entry->flow_id);
+		tal_free(flow);
+	} else
+		tal_free(entry);
+
+	return true;
+}
+
+bool ecready_empty(const struct ecready *ready)
+{
+	size_t i;
+	for (i = 0; i < ECREADY_NUM_PRIORITIES; ++i)
+		if (tal_count(ready->classes[i].heap) != 0)
+			return false;
+	return true;
+}
+
+/*-----------------------------------------------------------------------------
+Statistics and Names
+-----------------------------------------------------------------------------*/
+
+void ecready_get_stats(const struct ecready *ready,
+		       enum ecready_priority priority,
+		       struct ecready_stats *stats)
+{
+	*stats = ready->classes[priority].stats;
+}
+
+const char *ecready_priority_name(enum ecready_priority priority)
+{
+	return priority_names[priority];
+}
+
+bool ecready_priority_from_name(const char *name,
+				enum ecready_priority *priority)
+{
+	size_t i;
+	for (i = 0; i < ECREADY_NUM_PRIORITIES; ++i) {
+		if (streq(name, priority_names[i])) {
+			*priority = (enum ecready_priority) i;
+			return true;
+		}
+	}
+	return false;
+}
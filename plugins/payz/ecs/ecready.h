@@ -0,0 +1,146 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_ECS_ECREADY_H
+#define LIGHTNING_PLUGINS_PAYZ_ECS_ECREADY_H
+#include"config.h"
+#include<ccan/short_types/short_types.h>
+#include<ccan/tal/tal.h>
+#include<ccan/time/time.h>
+#include<stdbool.h>
+#include<stddef.h>
+
+/** enum ecready_priority
+ *
+ * @brief The priority classes of the ready queue.
+ * Lower numeric values are served first.
+ */
+enum ecready_priority {
+	/* Entities a user is actively waiting on, e.g. `pay`.  */
+	ECREADY_PRIORITY_INTERACTIVE = 0,
+	/* The default.  */
+	ECREADY_PRIORITY_NORMAL,
+	/* Probes, rebalances, and other bulk work.  */
+	ECREADY_PRIORITY_BACKGROUND
+};
+#define ECREADY_NUM_PRIORITIES (ECREADY_PRIORITY_BACKGROUND + 1)
+
+/** struct ecready
+ *
+ * @brief Represents a queue of entities that have been matched
+ * to a system, but have not had the system invoked yet.
+ *
+ * @desc Entities are served strictly by priority class.
+ * Within a priority class, entities are grouped into flows
+ * (typically, all entities of one main payment form a single
+ * flow), and flows are served by weighted fair queuing, so
+ * that a single flow with many ready entities cannot starve
+ * other flows of the same class.
+ */
+struct ecready;
+
+/** struct ecready_stats
+ *
+ * @brief Statistics for a single priority class.
+ */
+struct ecready_stats {
+	/* Number of entries currently in the queue.  */
+	size_t depth;
+	/* Largest depth ever observed.  */
+	size_t max_depth;
+	/* Total number of entries ever pushed.  */
+	u64 enqueued;
+	/* Total number of entries ever popped.  */
+	u64 dispatched;
+	/* Sum of the time popped entries spent in the queue.  */
+	struct timerel total_wait;
+	/* Longest time a popped entry spent in the queue.  */
+	struct timerel max_wait;
+};
+
+/** ecready_new
+ *
+ * @brief Constructs an empty ready queue.
+ *
+ * @param ctx - the owner of this ready queue.
+ */
+struct ecready *ecready_new(const tal_t *ctx);
+
+/** ecready_push
+ *
+ * @brief Adds an entry to the ready queue.
+ *
+ * @param ready - the ready queue to add to.
+ * @param now - the current time.
+ * @param priority - the priority class of the entry.
+ * @param flow - the flow the entry belongs to, e.g. the
+ * main payment entity.
+ * @param weight - the share of the flow relative to other
+ * flows of the same priority class.
+ * Must be non-zero.
+ * @param entity - the entity to queue.
+ * @param payload - an arbitrary pointer to store with the
+ * entry, returned by ecready_pop.
+ */
+void ecready_push(struct ecready *ready,
+		  struct timemono now,
+		  enum ecready_priority priority,
+		  u32 flow,
+		  u32 weight,
+		  u32 entity,
+		  void *payload);
+
+/** ecready_pop
+ *
+ * @brief Removes the next entry to serve from the ready
+ * queue.
+ *
+ * @param ready - the ready queue to remove from.
+ * @param now - the current time, used for wait statistics.
+ * @param entity - output, the entity that was queued.
+ * @param payload - output, the payload given to
+ * ecready_push.
+ * @param enqueued - optional output, the time given to
+ * ecready_push.
+ *
+ * @return - false if the queue is empty, true if an entry
+ * was removed.
+ */
+bool ecready_pop(struct ecready *ready,
+		 struct timemono now,
+		 u32 *entity,
+		 void **payload,
+		 struct timemono *enqueued);
+
+/** ecready_empty
+ *
+ * @brief Determine if the ready queue has no entries.
+ */
+bool ecready_empty(const struct ecready *ready);
+
+/** ecready_get_stats
+ *
+ * @brief Get the statistics for a priority class.
+ *
+ * @param ready - the ready queue to query.
+ * @param priority - the priority class to query.
+ * @param stats - output, the statistics.
+ */
+void ecready_get_stats(const struct ecready *ready,
+		       enum ecready_priority priority,
+		       struct ecready_stats *stats);
+
+/** ecready_priority_name
+ *
+ * @brief Return the name of the given priority class, as
+ * used in the `priority` field of `lightningd:systems`.
+ */
+const char *ecready_priority_name(enum ecready_priority priority);
+
+/** ecready_priority_from_name
+ *
+ * @brief Parse the name of a priority class.
+ *
+ * @return - false if the name is not a known priority class.
+ */
+bool ecready_priority_from_name(const char *name,
+				enum ecready_priority *priority);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_ECS_ECREADY_H */
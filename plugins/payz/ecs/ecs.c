@@ -9,6 +9,7 @@
 #include<plugins/libplugin.h>
 #include<plugins/payz/ecs/ec.h>
 #include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/ecs/ecworker.h>
 
 /*-----------------------------------------------------------------------------
 ECS Object Construction
@@ -18,13 +19,26 @@ ECS Object Construction
 struct ecs_system_wrapper {
 	char *name;
 	ecs_system_function func;
+	ecs_pure_function pure;
+	ecs_worker_function worker;
+	struct ecs *ecs;
 	const char **required;
 };
 
+/* A worker system running on an entity.  */
+struct ecs_worker_job {
+	struct ecs_system_wrapper *wrapper;
+	struct plugin *plugin;
+	/* The lease the system was handed the entity under.  */
+	u64 lease;
+};
+
 struct ecs {
 	struct ec *ec;
 	struct ecsys *ecsys;
 	STRMAP(struct ecs_system_wrapper *) system_funcs;
+	/* Threads for worker systems, started on first use.  */
+	struct ecworker *workers;
 };
 
 static void wrapped_plugin_log(struct plugin *plugin,
@@ -36,6 +50,11 @@ static bool wrapped_get_component(const void *ec,
 				  u32 entity,
 				  const char *component);
 
+static void ecs_worker_done(struct ecs *ecs,
+			    u32 entity,
+			    void *payload,
+			    const char *result);
+
 static void ecs_destructor(struct ecs *ecs);
 
 struct ecs *ecs_new(const tal_t *ctx)
@@ -49,8 +68,10 @@ struct ecs *ecs_new(const tal_t *ctx)
 			       ecs->ec,
 			       &plugin_notification_start,
 			       &plugin_notification_end,
-			       &wrapped_plugin_log);
+			       &wrapped_plugin_log,
+			       &plugin_timer_);
 	strmap_init(&ecs->system_funcs);
+	ecs->workers = ecworker_new(ecs, 0, &ecs_worker_done, ecs);
 	tal_add_destructor(ecs, &ecs_destructor);
 
 	return ecs;
@@ -113,10 +134,11 @@ bool ecs_get_component(const struct ecs *ecs,
 void ecs_set_component(struct ecs *ecs,
 		       u32 entity,
 		       const char *component,
-		       const char *buffer,
-		       const jsmntok_t *tok)
+		       const char *buffer TAKES,
+		       const jsmntok_t *tok TAKES)
 {
-	return ec_set_component(ecs->ec, entity, component, buffer, tok);
+	ec_set_component(ecs->ec, entity, component, buffer, tok);
+	ecsys_component_changed(ecs->ecsys, entity, component);
 }
 
 void ecs_set_component_datuml(struct ecs *ecs,
@@ -125,9 +147,10 @@ void ecs_set_component_datuml(struct ecs *ecs,
 			      const char *value,
 			      size_t len)
 {
-	return ec_set_component_datuml(ecs->ec,
-				       entity, component,
-				       value, len);
+	ec_set_component_datuml(ecs->ec,
+				entity, component,
+				value, len);
+	ecsys_component_changed(ecs->ecsys, entity, component);
 }
 
 void ecs_set_component_datum(struct ecs *ecs,
@@ -135,7 +158,60 @@ void ecs_set_component_datum(struct ecs *ecs,
 			     const char *component,
 			     const char *valuez)
 {
-	return ec_set_component_datum(ecs->ec, entity, component, valuez);
+	ec_set_component_datum(ecs->ec, entity, component, valuez);
+	ecsys_component_changed(ecs->ecsys, entity, component);
+}
+
+void ecs_create_index(struct ecs *ecs,
+		      const char *component,
+		      const char **field)
+{
+	ec_create_index(ecs->ec, component, field);
+}
+
+u32 *ecs_lookup_index(const tal_t *ctx,
+		      const struct ecs *ecs,
+		      const char *component,
+		      const char **field,
+		      const char *buffer,
+		      const jsmntok_t *tok)
+{
+	return ec_lookup_index(ctx, ecs->ec, component, field, buffer, tok);
+}
+
+bool ecs_get_index_size(const struct ecs *ecs,
+			const char *component,
+			const char **field,
+			size_t *values,
+			size_t *entities)
+{
+	return ec_get_index_size(ecs->ec, component, field,
+				 values, entities);
+}
+
+struct ec_watch *ecs_watch_component_(const tal_t *ctx,
+				      struct ecs *ecs,
+				      u32 entity,
+				      const char *component,
+				      void (*cb)(void *arg),
+				      void *arg)
+{
+	return ec_watch_(ctx, ecs->ec, entity, component, cb, arg);
+}
+
+u64 ecs_get_version(const struct ecs *ecs)
+{
+	return ec_get_version(ecs->ec);
+}
+
+void ecs_set_change_hook_(struct ecs *ecs,
+			  void (*cb)(u32 entity,
+				     const char *component,
+				     u64 version,
+				     void *arg),
+			  void *arg)
+{
+	ec_set_change_hook_(ecs->ec, cb, arg);
 }
 
 /*-----------------------------------------------------------------------------
@@ -230,6 +306,143 @@ bool ecs_system_exists(const struct ecs *ecs,
 	return ecsys_system_exists(ecs->ecsys, system);
 }
 
+void ecs_set_plugin(struct ecs *ecs,
+		    struct plugin *plugin)
+{
+	ecsys_set_plugin(ecs->ecsys, plugin);
+}
+
+void ecs_set_trace(struct ecs *ecs,
+		   void (*trace)(struct plugin *,
+				 const char *buffer,
+				 const jsmntok_t *params))
+{
+	ecsys_set_trace(ecs->ecsys, trace);
+}
+
+void ecs_set_trace_level(struct ecs *ecs,
+			 enum ecsys_trace_level
+			 (*trace_level)(u32 entity,
+					const char *system))
+{
+	ecsys_set_trace_level(ecs->ecsys, trace_level);
+}
+
+void ecs_set_span(struct ecs *ecs,
+		  void (*span)(struct plugin *,
+			       const struct ecsys_span *span))
+{
+	ecsys_set_span(ecs->ecsys, span);
+}
+
+void ecs_add_span(struct ecs *ecs,
+		  const char *category,
+		  const char *name,
+		  u32 entity,
+		  struct timemono start)
+{
+	ecsys_add_span(ecs->ecsys, category, name, entity, start);
+}
+
+void ecs_set_batch(struct ecs *ecs,
+		   const char *system,
+		   u32 max_batch,
+		   struct timerel deadline)
+{
+	ecsys_set_batch(ecs->ecsys, system, max_batch, deadline);
+}
+
+void ecs_set_passed(struct ecs *ecs,
+		    const char *system,
+		    const struct ecsys_passed *passed)
+{
+	ecsys_set_passed(ecs->ecsys, system, passed);
+}
+
+void ecs_set_writes(struct ecs *ecs,
+		    const char *system,
+		    const char *const *writes)
+{
+	ecsys_set_writes(ecs->ecsys, system, writes);
+}
+
+void ecs_set_deadline(struct ecs *ecs,
+		      const char *system,
+		      struct timerel deadline)
+{
+	ecsys_set_deadline(ecs->ecsys, system, deadline);
+}
+
+void ecs_retry_method(struct ecs *ecs,
+		      const char *system)
+{
+	ecsys_retry_method(ecs->ecsys, system);
+}
+
+void ecs_set_dispatch_per_tick(struct ecs *ecs,
+			       u32 dispatch_per_tick)
+{
+	ecsys_set_dispatch_per_tick(ecs->ecsys, dispatch_per_tick);
+}
+
+u32 ecs_get_dispatch_per_tick(const struct ecs *ecs)
+{
+	return ecsys_get_dispatch_per_tick(ecs->ecsys);
+}
+
+void ecs_set_step_budget(struct ecs *ecs,
+			 u32 step_budget)
+{
+	ecsys_set_step_budget(ecs->ecsys, step_budget);
+}
+
+u32 ecs_get_step_budget(const struct ecs *ecs)
+{
+	return ecsys_get_step_budget(ecs->ecsys);
+}
+
+void ecs_get_readystats(const struct ecs *ecs,
+			enum ecready_priority priority,
+			struct ecready_stats *stats)
+{
+	ecsys_get_readystats(ecs->ecsys, priority, stats);
+}
+
+const struct ecsys_sysstats *ecs_get_sysstats(const struct ecs *ecs,
+					      const char *system)
+{
+	return ecsys_get_sysstats(ecs->ecsys, system);
+}
+
+const char **ecs_get_systems(const tal_t *ctx,
+			     const struct ecs *ecs)
+{
+	return ecsys_get_systems(ctx, ecs->ecsys);
+}
+
+void ecs_set_flowprofile(struct ecs *ecs, bool enable)
+{
+	ecsys_set_flowprofile(ecs->ecsys, enable);
+}
+
+bool ecs_get_flowprofile(const struct ecs *ecs)
+{
+	return ecsys_get_flowprofile(ecs->ecsys);
+}
+
+const struct ecsys_flowprofile **
+ecs_get_flowprofiles(const tal_t *ctx, const struct ecs *ecs)
+{
+	return ecsys_get_flowprofiles(ctx, ecs->ecsys);
+}
+
+bool ecs_systems_exclusive(const struct ecs *ecs,
+			   const char *a,
+			   const char *b)
+{
+	return ecsys_systems_exclusive(ecs->ecsys, a, b);
+}
+
 /*-----------------------------------------------------------------------------
 Triggering of Built-in Systems
 -----------------------------------------------------------------------------*/
@@ -311,9 +524,89 @@ struct command_result *ecs_system_notify(struct ecs *ecs,
 		}
 	}
 
+	if (wrapper->pure) {
+		wrapper->pure(ecs, eid, buffer, entity);
+		return ecs_advance_done(command, ecs, eid);
+	}
+	if (wrapper->worker) {
+		struct ecs_worker_job *job;
+		u64 lease;
+
+		/* The entity may have been advanced, or its
+		 * processing ended, before we got the
+		 * notification.  */
+		lease = ecsys_get_lease(ecs->ecsys, eid, wrapper->name);
+		if (lease == 0) {
+			plugin_log(command->plugin, LOG_DBG,
+				   "System '%s' no longer holds entity "
+				   "%"PRIu32", ignoring.",
+				   wrapper->name, eid);
+			return notification_handled(command);
+		}
+
+		job = tal(ecs, struct ecs_worker_job);
+		job->wrapper = wrapper;
+		job->plugin = command->plugin;
+		job->lease = lease;
+		ecworker_submit(ecs->workers, wrapper->worker,
+				eid, buffer, entity, job);
+		return notification_handled(command);
+	}
 	return wrapper->func(ecs, command, eid, buffer, entity);
 }
 
+/* Called on the event loop thread once a worker system is
+ * done.  */
+static void ecs_worker_done(struct ecs *ecs,
+			    u32 entity,
+			    void *payload,
+			    const char *result)
+{
+	struct ecs_worker_job *job = (struct ecs_worker_job *) payload;
+	const jsmntok_t *toks;
+	const jsmntok_t *t;
+	size_t i;
+
+	tal_steal(tmpctx, job);
+
+	/* If the entity was reclaimed (e.g. its deadline passed)
+	 * while the worker ran, it may already be processed by
+	 * other systems, so our writes are stale.  */
+	if (ecsys_get_lease(ecs->ecsys, entity, job->wrapper->name)
+	    != job->lease) {
+		plugin_log(job->plugin, LOG_UNUSUAL,
+			   "System '%s' finished entity %"PRIu32" after "
+			   "losing it, discarding its writes.",
+			   job->wrapper->name, entity);
+		return;
+	}
+
+	if (result) {
+		toks = json_parse_simple(tmpctx, result, strlen(result));
+		if (!toks || toks->type != JSMN_OBJECT)
+			plugin_log(job->plugin, LOG_BROKEN,
+				   "System '%s' on entity %"PRIu32" "
+				   "returned invalid writes: %s",
+				   job->wrapper->name, entity, result);
+		else
+			json_for_each_obj (i, t, toks)
+				ecs_set_component(ecs, entity,
+						  json_strdup(tmpctx,
+							      result, t),
+						  result, t + 1);
+	}
+
+	ecsys_advance_done(job->plugin, ecs->ecsys, entity);
+}
+
+static void ecs_pure_wrapper(struct ecs_system_wrapper *wrapper,
+			     u32 entity,
+			     const char *buffer,
+			     const jsmntok_t *components)
+{
+	wrapper->pure(wrapper->ecs, entity, buffer, components);
+}
+
 /*-----------------------------------------------------------------------------
 Registration
 -----------------------------------------------------------------------------*/
@@ -357,8 +650,12 @@ void ecs_register(struct ecs *ecs,
 
 	const char *name = NULL;
 	ecs_system_function func = NULL;
+	ecs_pure_function pure = NULL;
+	ecs_worker_function worker = NULL;
 	const char **required = NULL;
 	const char **disallowed = NULL;
+	const char *method = NULL;
+	const char **writes = NULL;
 
 	struct ecs_system_wrapper *wrapper;
 
@@ -377,10 +674,20 @@ void ecs_register(struct ecs *ecs,
 			break; 
 
 		case ECS_REGISTER_TYPE_FUNC:
-			assert(!func);
+			assert(!func && !pure && !worker);
 			func = (ecs_system_function) desc->pointer;
 			break;
 
+		case ECS_REGISTER_TYPE_PURE_FUNC:
+			assert(!func && !pure && !worker);
+			pure = (ecs_pure_function) desc->pointer;
+			break;
+
+		case ECS_REGISTER_TYPE_WORKER:
+			assert(!func && !pure && !worker);
+			worker = (ecs_worker_function) desc->pointer;
+			break;
+
 		case ECS_REGISTER_TYPE_REQUIRE:
 			assert(name);
 			if (!required)
@@ -397,19 +704,38 @@ void ecs_register(struct ecs *ecs,
 				       (const char*) desc->pointer);
 			break;
 
+		case ECS_REGISTER_TYPE_METHOD:
+			assert(name && !method);
+			method = (const char*) desc->pointer;
+			break;
+
+		case ECS_REGISTER_TYPE_WRITE:
+			assert(name);
+			if (!writes)
+				writes = tal_arr(owner, const char *, 0);
+			tal_arr_expand(&writes,
+				       (const char*) desc->pointer);
+			break;
+
 		case ECS_REGISTER_TYPE_DONE:
 			assert(name);
 
 			ecsys_register(ecs->ecsys, name,
 				       required, tal_count(required),
-				       disallowed, tal_count(disallowed));
+				       disallowed, tal_count(disallowed),
+				       method);
+			if (writes)
+				ecsys_set_writes(ecs->ecsys, name, writes);
 			/* Also register to our layer if a function is
 			 * declared.
 			 */
-			if (func) {
+			if (func || pure || worker) {
 				wrapper = tal(ecs, struct ecs_system_wrapper);
 				wrapper->name = tal_strdup(wrapper, name);
 				wrapper->func = func;
+				wrapper->pure = pure;
+				wrapper->worker = worker;
+				wrapper->ecs = ecs;
 				wrapper->required = tal_steal(wrapper,
 							      required);
 				strmap_add(&ecs->system_funcs,
@@ -417,13 +743,23 @@ void ecs_register(struct ecs *ecs,
 
 				/* wrapper took responsibility for it.  */
 				required = NULL;
+
+				if (pure)
+					ecsys_set_pure(ecs->ecsys,
+						       wrapper->name,
+						       &ecs_pure_wrapper,
+						       wrapper);
 			}
 
 			/* Clear the variables.  */
 			name = NULL;
 			func = NULL;
+			pure = NULL;
+			worker = NULL;
+			method = NULL;
 			required = tal_free(required);
 			disallowed = tal_free(disallowed);
+			writes = tal_free(writes);
 			break;
 
 		case ECS_REGISTER_TYPE_OVER_AND_OUT:
@@ -434,8 +770,12 @@ void ecs_register(struct ecs *ecs,
 
 	assert(!name);
 	assert(!func);
+	assert(!pure);
+	assert(!worker);
 	assert(!required);
 	assert(!disallowed);
+	assert(!method);
+	assert(!writes);
 
 	tal_free(owner);
 }
@@ -483,6 +823,13 @@ void ecs_register_disallow(struct ecs_register_desc **parray,
 			    (const void *) tal_strdup(*parray, component));
 }
 
+void ecs_register_method(struct ecs_register_desc **parray,
+			 const char *method TAKES)
+{
+	ecs_register_extend(parray, ECS_REGISTER_TYPE_METHOD,
+			    (const void *) tal_strdup(*parray, method));
+}
+
 void ecs_register_done(struct ecs_register_desc **parray)
 {
 	ecs_register_extend(parray, ECS_REGISTER_TYPE_DONE, NULL);
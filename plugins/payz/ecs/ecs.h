@@ -124,6 +124,13 @@ bool ecs_get_component(const struct ecs *ecs,
  *
  * If attaching or mutating, this creates a copy of the
  * given JSON object, owned by the given EC instance.
+ * If both buffer and tok are take()n, and tok is the first
+ * token of the buffer, they are used as they are instead.
+ *
+ * If the entity is reactive (its `lightningd:systems` has
+ * a `reactive` field set to `true`), it is advanced at the
+ * next iteration of the event loop if the change makes one
+ * of its systems match.
  *
  * @param ecs - The ECS framework to mutate.
  * @param entity - the numeric ID of the entity to mutate.
@@ -140,8 +147,8 @@ bool ecs_get_component(const struct ecs *ecs,
 void ecs_set_component(struct ecs *ecs,
 		       u32 entity,
 		       const char *component,
-		       const char *buffer,
-		       const jsmntok_t *tok);
+		       const char *buffer TAKES,
+		       const jsmntok_t *tok TAKES);
 
 /** ecs_set_component_datuml
  *
@@ -164,6 +171,96 @@ void ecs_set_component_datum(struct ecs *ecs,
 			     const char *component,
 			     const char *valuez);
 
+/** ecs_create_index
+ *
+ * @brief Starts maintaining an index from the values of the
+ * given component, or of a field within it, to the entities
+ * having that value.
+ * See ec_create_index.
+ */
+void ecs_create_index(struct ecs *ecs,
+		      const char *component,
+		      const char **field);
+
+/** ecs_lookup_index
+ *
+ * @brief Looks up the entities whose given component, or
+ * field within it, has the given value, such as finding the
+ * payment with a particular `payment_hash`.
+ * See ec_lookup_index.
+ *
+ * @return - a tal-allocated array of the entities with that
+ * value, in increasing order, or NULL if there is no index
+ * created by ecs_create_index for that component and field.
+ */
+u32 *ecs_lookup_index(const tal_t *ctx,
+		      const struct ecs *ecs,
+		      const char *component,
+		      const char **field,
+		      const char *buffer,
+		      const jsmntok_t *tok);
+
+/** ecs_get_index_size
+ *
+ * @brief Gets the number of distinct values and the number of
+ * entities in an index.
+ * See ec_get_index_size.
+ */
+bool ecs_get_index_size(const struct ecs *ecs,
+			const char *component,
+			const char **field,
+			size_t *values,
+			size_t *entities);
+
+struct ec_watch;
+
+/** ecs_watch_component
+ *
+ * @brief Calls the given function the next time the given
+ * component of the given entity is attached, mutated, or
+ * detached, including by a System.
+ * See ec_watch.
+ *
+ * @return - the watch, owned by ctx; free it to stop waiting.
+ */
+struct ec_watch *ecs_watch_component_(const tal_t *ctx,
+				      struct ecs *ecs,
+				      u32 entity,
+				      const char *component,
+				      void (*cb)(void *arg),
+				      void *arg);
+#define ecs_watch_component(ctx, ecs, entity, component, cb, arg) \
+	ecs_watch_component_((ctx), (ecs), (entity), (component), \
+			     typesafe_cb(void, void *, (cb), (arg)), \
+			     (arg))
+
+/** ecs_get_version
+ *
+ * @brief Gets the number of changes made to components so
+ * far.
+ * See ec_get_version.
+ */
+u64 ecs_get_version(const struct ecs *ecs);
+
+/** ecs_set_change_hook
+ *
+ * @brief Sets the function to call whenever a component of
+ * any entity is attached, mutated, or detached, including by
+ * a System.
+ * See ec_set_change_hook.
+ */
+void ecs_set_change_hook_(struct ecs *ecs,
+			  void (*cb)(u32 entity,
+				     const char *component,
+				     u64 version,
+				     void *arg),
+			  void *arg);
+#define ecs_set_change_hook(ecs, cb, arg) \
+	ecs_set_change_hook_((ecs), \
+			     typesafe_cb_preargs(void, void *, (cb), (arg), \
+						 u32, const char *, u64), \
+			     (arg))
+
 /** ecs_advance
  *
  * @brief Advances processing of the specified entity, triggering
@@ -251,6 +348,227 @@ struct command_result *ecs_done(struct command *command,
 bool ecs_system_exists(const struct ecs *ecs,
 		       const char *system);
 
+/** ecs_set_plugin
+ *
+ * @brief Set the plugin this is running in, so that the
+ * ECS framework can advance reactive entities on its own.
+ *
+ * @param ecs - the ECS framework to modify.
+ * @param plugin - the plugin this is running in.
+ */
+void ecs_set_plugin(struct ecs *ecs,
+		    struct plugin *plugin);
+
+/** ecs_set_trace
+ *
+ * @brief Set a function to call whenever a system is invoked
+ * via its RPC method rather than by notification.
+ *
+ * @param ecs - the ECS framework to modify.
+ * @param trace - the function to call, with the parameters
+ * the notification would have had, or NULL.
+ */
+void ecs_set_trace(struct ecs *ecs,
+		   void (*trace)(struct plugin *,
+				 const char *buffer,
+				 const jsmntok_t *params));
+
+/** ecs_set_trace_level
+ *
+ * @brief Set a function that decides how much of each
+ * invocation to give to the function set by ecs_set_trace,
+ * or NULL to give all of it.
+ */
+void ecs_set_trace_level(struct ecs *ecs,
+			 enum ecsys_trace_level
+			 (*trace_level)(u32 entity,
+					const char *system));
+
+/** ecs_set_span
+ *
+ * @brief Set a function to call with each span of time spent
+ * on an entity, or NULL.
+ */
+void ecs_set_span(struct ecs *ecs,
+		  void (*span)(struct plugin *,
+			       const struct ecsys_span *span));
+
+/** ecs_add_span
+ *
+ * @brief Report a span of time spent on an entity, ending now,
+ * such as a wait on an RPC command made by a system.
+ *
+ * @param ecs - the ECS framework to report to.
+ * @param category - what the time was spent on, e.g. `"rpc"`.
+ * @param name - the name of the span, e.g. the RPC command.
+ * @param entity - the entity the time was spent on.
+ * @param start - when the span started.
+ */
+void ecs_add_span(struct ecs *ecs,
+		  const char *category,
+		  const char *name,
+		  u32 entity,
+		  struct timemono start);
+
+/** ecs_set_batch
+ *
+ * @brief Set up a registered system to be invoked with
+ * batches of up to max_batch entities, each waiting at most
+ * deadline (zero meaning until the next iteration of the
+ * event loop).
+ * A max_batch of 0 disables batching.
+ */
+void ecs_set_batch(struct ecs *ecs,
+		   const char *system,
+		   u32 max_batch,
+		   struct timerel deadline);
+
+/** ecs_set_passed
+ *
+ * @brief Set the components, or fields of components, that
+ * are passed to a registered system when it is invoked,
+ * instead of all the components it requires.
+ * A passed of NULL restores the default.
+ */
+void ecs_set_passed(struct ecs *ecs,
+		    const char *system,
+		    const struct ecsys_passed *passed);
+
+/** ecs_set_writes
+ *
+ * @brief Declare the components a registered system may
+ * write, so that it can be launched together with other
+ * systems of the same entity.
+ * A writes of NULL marks them as undeclared.
+ */
+void ecs_set_writes(struct ecs *ecs,
+		    const char *system,
+		    const char *const *writes);
+
+/** ecs_set_deadline
+ *
+ * @brief Set how long a registered system may hold an entity
+ * before the entity is reclaimed with a `lightningd:error`.
+ * A deadline of 0 means no limit.
+ */
+void ecs_set_deadline(struct ecs *ecs,
+		      const char *system,
+		      struct timerel deadline);
+
+/** ecs_retry_method
+ *
+ * @brief Invoke a registered system via its RPC method again,
+ * after the method was not found.
+ */
+void ecs_retry_method(struct ecs *ecs,
+		      const char *system);
+
+/** ecs_set_dispatch_per_tick
+ *
+ * @brief Set the maximum number of systems to invoke in a
+ * single iteration of the event loop, 0 for no limit.
+ *
+ * @param ecs - the ECS framework to modify.
+ * @param dispatch_per_tick - the maximum number of system
+ * invocations per event loop iteration.
+ */
+void ecs_set_dispatch_per_tick(struct ecs *ecs,
+			       u32 dispatch_per_tick);
+
+/** ecs_get_dispatch_per_tick
+ *
+ * @brief Get the value set by ecs_set_dispatch_per_tick.
+ */
+u32 ecs_get_dispatch_per_tick(const struct ecs *ecs);
+
+/** ecs_set_step_budget
+ *
+ * @brief Set the default maximum number of systems launched
+ * on a single entity, 0 for no limit.
+ *
+ * @param ecs - the ECS framework to modify.
+ * @param step_budget - the maximum number of systems launched
+ * on an entity while it is being processed.
+ */
+void ecs_set_step_budget(struct ecs *ecs,
+			 u32 step_budget);
+
+/** ecs_get_step_budget
+ *
+ * @brief Get the value set by ecs_set_step_budget.
+ */
+u32 ecs_get_step_budget(const struct ecs *ecs);
+
+/** ecs_get_readystats
+ *
+ * @brief Get the statistics of the ready queue for the
+ * given priority class.
+ *
+ * @param ecs - the ECS framework to query.
+ * @param priority - the priority class to query.
+ * @param stats - output, the statistics.
+ */
+void ecs_get_readystats(const struct ecs *ecs,
+			enum ecready_priority priority,
+			struct ecready_stats *stats);
+
+/** ecs_get_sysstats
+ *
+ * @brief Get the statistics of a registered system.
+ *
+ * @param ecs - the ECS framework to query.
+ * @param system - the name of the system.
+ *
+ * @return - the statistics, or NULL if the system is not
+ * registered.
+ */
+const struct ecsys_sysstats *ecs_get_sysstats(const struct ecs *ecs,
+					      const char *system);
+
+/** ecs_get_systems
+ *
+ * @brief Get the names of all registered systems, in sorted
+ * order.
+ *
+ * @param ctx - the owner of the returned array.
+ * @param ecs - the ECS framework to query.
+ */
+const char **ecs_get_systems(const tal_t *ctx,
+			     const struct ecs *ecs);
+
+/** ecs_set_flowprofile
+ *
+ * @brief Enable or disable profiling of the matching costs of
+ * each flow.
+ * Enabling it discards the previous profiles.
+ */
+void ecs_set_flowprofile(struct ecs *ecs, bool enable);
+
+/** ecs_get_flowprofile
+ *
+ * @brief Return whether flow profiling is enabled.
+ */
+bool ecs_get_flowprofile(const struct ecs *ecs);
+
+/** ecs_get_flowprofiles
+ *
+ * @brief Get the profiles of all flows recorded so far.
+ *
+ * @param ctx - the owner of the returned array.
+ * @param ecs - the ECS framework to query.
+ */
+const struct ecsys_flowprofile **
+ecs_get_flowprofiles(const tal_t *ctx, const struct ecs *ecs);
+
+/** ecs_systems_exclusive
+ *
+ * @brief Check if two registered systems can never match the
+ * same entity at the same time.
+ */
+bool ecs_systems_exclusive(const struct ecs *ecs,
+			   const char *a,
+			   const char *b);
+
 /** ecs_system_notify
  *
  * @brief Call the actual system code if a function was
@@ -321,6 +639,10 @@ enum ecs_register_type {
 	ECS_REGISTER_TYPE_FUNC,
 	ECS_REGISTER_TYPE_REQUIRE,
 	ECS_REGISTER_TYPE_DISALLOW,
+	ECS_REGISTER_TYPE_METHOD,
+	ECS_REGISTER_TYPE_WRITE,
+	ECS_REGISTER_TYPE_PURE_FUNC,
+	ECS_REGISTER_TYPE_WORKER,
 	ECS_REGISTER_TYPE_DONE
 };
 
@@ -338,6 +660,28 @@ typedef struct command_result *
 (*ecs_system_function)(struct ecs *, struct command *,
 		       u32 entity,
 		       const char *buffer, const jsmntok_t *components);
+/* Same as above, but for a synchronous, side-effect-free system,
+ * which must only read the given components and write components
+ * of the given entity; see ecsys_set_pure.
+ * The ECS advances the entity after it returns.
+ */
+typedef void
+(*ecs_pure_function)(struct ecs *,
+		     u32 entity,
+		     const char *buffer, const jsmntok_t *components);
+/* Same as above, but run on a worker thread with a copy of the
+ * given components, so it cannot touch the ECS, nor use tal;
+ * see ecworker_function.
+ * It returns a malloc-allocated JSON object whose fields are the
+ * components of the entity to write (a null value to detach),
+ * or NULL to write nothing.
+ * The ECS writes them and advances the entity on the event loop
+ * thread, unless the system lost the entity meanwhile (e.g. its
+ * deadline passed), in which case they are discarded.
+ */
+typedef char *
+(*ecs_worker_function)(u32 entity,
+		       const char *buffer, const jsmntok_t *components);
 
 #define ECS_REGISTER_NAME(name) \
 	{ ECS_REGISTER_TYPE_NAME, \
@@ -355,12 +699,45 @@ typedef struct command_result *
 	  typesafe_cb_cast(const void *, \
 			   ecs_system_function, \
 			   (func)) }
+/* Use instead of ECS_REGISTER_FUNC for pure systems, which are
+ * then run without a notification round trip, and consecutive
+ * pure systems are run as a single step.
+ */
+#define ECS_REGISTER_PURE_FUNC(func) \
+	{ ECS_REGISTER_TYPE_PURE_FUNC, \
+	  typesafe_cb_cast(const void *, \
+			   ecs_pure_function, \
+			   (func)) }
+/* Use instead of ECS_REGISTER_FUNC for CPU-heavy systems, such
+ * as route computation, so that they do not block the event loop
+ * while they run.
+ */
+#define ECS_REGISTER_WORKER(func) \
+	{ ECS_REGISTER_TYPE_WORKER, \
+	  typesafe_cb_cast(const void *, \
+			   ecs_worker_function, \
+			   (func)) }
 #define ECS_REGISTER_REQUIRE(component) \
 	{ ECS_REGISTER_TYPE_REQUIRE, \
 	  typesafe_cb_cast(const void *, const char *, (component)) }
 #define ECS_REGISTER_DISALLOW(component) \
 	{ ECS_REGISTER_TYPE_DISALLOW, \
 	  typesafe_cb_cast(const void *, const char *, (component)) }
+/* Systems implemented by another plugin may name an RPC method
+ * of that plugin, which is then called to invoke the system
+ * instead of broadcasting ECS_SYSTEM_NOTIFICATION.
+ */
+#define ECS_REGISTER_METHOD(method) \
+	{ ECS_REGISTER_TYPE_METHOD, \
+	  typesafe_cb_cast(const void *, const char *, (method)) }
+/* Declares a component the system may write, so that it can be
+ * launched together with other systems; see ecsys_set_writes.
+ * A component name ending in `*` covers all components with
+ * that prefix.
+ */
+#define ECS_REGISTER_WRITE(component) \
+	{ ECS_REGISTER_TYPE_WRITE, \
+	  typesafe_cb_cast(const void *, const char *, (component)) }
 #define ECS_REGISTER_DONE() \
 	{ ECS_REGISTER_TYPE_DONE, NULL }
 #define ECS_REGISTER_OVER_AND_OUT() \
@@ -420,8 +797,11 @@ void ecs_register_require(struct ecs_register_desc **parray,
 			  const char *component TAKES);
 void ecs_register_disallow(struct ecs_register_desc **parray,
 			   const char *component TAKES);
+void ecs_register_method(struct ecs_register_desc **parray,
+			 const char *method TAKES);
 void ecs_register_done(struct ecs_register_desc **parray);
 
 #define ECS_SYSTEM_NOTIFICATION ECSYS_SYSTEM_NOTIFICATION
+#define ECS_SYSTEM_BATCH_NOTIFICATION ECSYS_SYSTEM_BATCH_NOTIFICATION
 
 #endif /* LIGHTNING_PLUGINS_PAYZ_ECS_ECS_H */
@@ -1,9 +1,12 @@
 #include"ecsys.h"
 #include<assert.h>
+#include<ccan/intmap/intmap.h>
 #include<ccan/json_out/json_out.h>
+#include<ccan/str/str.h>
 #include<ccan/strmap/strmap.h>
 #include<ccan/tal/str/str.h>
 #include<common/json_stream.h>
+#include<common/jsonrpc_errors.h>
 #include<common/status_levels.h>
 #include<common/utils.h>
 #include<errno.h>
@@ -11,6 +14,7 @@
 #include<plugins/payz/parsing.h>
 #include<plugins/payz/setsystems.h>
 #include<stdarg.h>
+#include<string.h>
 
 /*-----------------------------------------------------------------------------
 Objects
@@ -24,10 +28,167 @@ struct ecsys_registered {
 	const char *system;
 	char **requiredComponents;
 	char **disallowedComponents;
+	/* The RPC method to invoke the system with, or NULL to
+	 * broadcast a notification instead.  */
+	const char *method;
+	/* Whether the method was not found when last called, so
+	 * that we broadcast instead until it is retried.  */
+	bool method_missing;
+
+	/* The system handler that owns this.  */
+	struct ecsys *ecsys;
+	/* Maximum number of entities to invoke the system with at
+	 * once, or 0 if not batched.  */
+	u32 max_batch;
+	/* How long an entity may wait in the batch.  */
+	struct timerel batch_deadline;
+	/* The entities waiting in the batch, and the lease each
+	 * was added under.  */
+	u32 *batch;
+	u64 *batch_leases;
+	/* Timer for the deadline of the batch, or NULL.  */
+	struct plugin_timer *batch_timer;
+
+	/* The components passed to the system, or NULL to pass
+	 * the required components.  */
+	struct ecsys_passed *passed;
+
+	/* The components the system may write, or NULL if it did
+	 * not declare them.
+	 * An entry ending in `*` covers all components with that
+	 * prefix.  */
+	char **writes;
+
+	/* The code of a synchronous, side-effect-free builtin
+	 * system, which we call directly instead of invoking, or
+	 * NULL.  */
+	void (*pure)(void *arg,
+		     u32 entity,
+		     const char *buffer,
+		     const jsmntok_t *components);
+	void *pure_arg;
+
+	/* How long the system may hold an entity before it is
+	 * reclaimed, or 0 for no limit.  */
+	struct timerel deadline;
+
+	struct ecsys_sysstats stats;
+};
+
+/** struct ecsys_dirty
+ *
+ * @brief Represents the changes to a reactive entity that
+ * have not been reacted to yet.
+ */
+struct ecsys_dirty {
+	/* Whether `lightningd:systems` itself changed, in which
+	 * case all systems are considered.  */
+	bool all;
+	/* The names of the changed components.  */
+	const char **changed;
+};
+
+/** struct ecsys_join
+ *
+ * @brief Represents systems that were launched together on an
+ * entity, and have not all advanced it yet.
+ */
+struct ecsys_join {
+	/* Number of launched systems that have not advanced the
+	 * entity yet.  */
+	u32 pending;
+	/* Whether `lightningd:systems` was detached while the
+	 * systems were running, which ends the processing of the
+	 * entity.  */
+	bool cancelled;
+};
+
+/* Number of recent systems remembered per entity.  */
+#define ECSYS_RECENT_STEPS 8
+/* Number of times a system may be launched on an entity without
+ * any component changing, before we consider it a cycle.  */
+#define ECSYS_CYCLE_REPEATS 3
+
+/** struct ecsys_history
+ *
+ * @brief Represents the systems recently launched on an entity
+ * that is being processed.
+ */
+struct ecsys_history {
+	/* Incremented whenever a component of the entity is
+	 * attached, detached, or mutated.  */
+	u64 generation;
+	/* Number of systems launched on the entity so far.  */
+	u32 steps;
+	/* Ring of the most recently launched systems, and the
+	 * generation of the entity when they were launched.  */
+	struct {
+		const struct ecsys_registered *system;
+		u64 generation;
+	} recent[ECSYS_RECENT_STEPS];
+	/* Where the next entry goes in recent.  */
+	size_t next;
+};
+
+/** struct ecsys_lease
+ *
+ * @brief Represents an entity that was queued for, or handed
+ * to, a system, and has not been advanced since.
+ */
+struct ecsys_lease {
+	struct ecsys *ecsys;
+	u32 entity;
+	/* Distinguishes this lease from earlier ones on the same
+	 * entity.  */
+	u64 id;
+	/* The systems the entity was handed to, empty if it is
+	 * still waiting in the ready queue.  */
+	struct ecsys_registered **systems;
+	/* The main entity of the flow of the entity.  */
+	u32 main;
+	/* When the entity was handed to the first system.  */
+	struct timemono start;
+	/* The longest deadline of the systems, and whether any of
+	 * them has none, in which case neither does the lease.  */
+	struct timerel deadline;
+	bool unlimited;
+	/* Timer for the deadline, or NULL if there is none.  */
+	struct plugin_timer *timer;
+	/* Whether the deadline passed, in which case the system
+	 * never completed its service.  */
+	bool expired;
+};
+
+/** struct ecsys_queued
+ *
+ * @brief Represents an entity waiting in the ready queue.
+ */
+struct ecsys_queued {
+	struct ecsys_registered *system;
+	/* The lease the entity was queued under.  */
+	u64 lease;
 };
 
 struct ecsys {
 	STRMAP(struct ecsys_registered *) system_map;
+	/* Registered systems, indexed by each component they
+	 * require or disallow.  */
+	STRMAP(struct ecsys_registered **) watchers;
+	/* Reactive entities changed since we last reacted.  */
+	UINTMAP(struct ecsys_dirty *) dirty;
+	/* Entities with several systems running on them.  */
+	UINTMAP(struct ecsys_join *) joins;
+	/* Entities held by systems.  */
+	UINTMAP(struct ecsys_lease *) leases;
+	/* The ID of the next lease, never 0.  */
+	u64 next_lease_id;
+	/* Entities being processed.  */
+	UINTMAP(struct ecsys_history *) histories;
+	/* Matching costs of each distinct `systems` array, if
+	 * profiling.  */
+	STRMAP(struct ecsys_flowprofile *) flowprofiles;
+	size_t num_flowprofiles;
+	bool flowprofiling;
 
 	bool (*get_component)(const void *ec,
 			      const char **,
@@ -47,8 +208,60 @@ struct ecsys {
 	void (*plugin_log)(struct plugin *,
 			   enum log_level,
 			   const char *);
+	struct plugin_timer *(*start_timer)(struct plugin *,
+					     struct timerel,
+					     void (*)(void *),
+					     void *);
+
+	/* Entities whose matched system has not been invoked yet.  */
+	struct ecready *ready;
+	/* The plugin, as given in the most recent ecsys_advance.  */
+	struct plugin *plugin;
+	/* Maximum number of systems to invoke per event loop
+	 * iteration, 0 if unlimited.  */
+	u32 dispatch_per_tick;
+	/* Number of systems invoked in this event loop iteration.  */
+	u32 dispatched_this_tick;
+	/* Timer that marks the next event loop iteration, or NULL if
+	 * not armed.  */
+	struct plugin_timer *tick_timer;
+	/* Batched systems with pending entities, to flush at the
+	 * end of this event loop iteration.  */
+	struct ecsys_registered **batching;
+	/* Number of pure systems the advance being processed has
+	 * run inline so far.  */
+	u32 fused;
+	/* Maximum number of systems launched on an entity, unless
+	 * its `lightningd:systems` says otherwise, 0 if
+	 * unlimited.  */
+	u32 step_budget;
+	/* Called with the parameters of systems invoked via their
+	 * RPC method or run inline, or NULL.  */
+	void (*trace)(struct plugin *,
+		      const char *buffer,
+		      const jsmntok_t *params);
+	/* Decides how much of an invocation to trace, or NULL to
+	 * trace all of it.  */
+	enum ecsys_trace_level (*trace_level)(u32 entity,
+					      const char *system);
+	/* Called with each span of time spent on an entity, or
+	 * NULL.  */
+	void (*span)(struct plugin *,
+		     const struct ecsys_span *span);
 };
 
+/* The default for dispatch_per_tick.  */
+#define ECSYS_DEFAULT_DISPATCH_PER_TICK 64
+
+/* The default for step_budget.  */
+#define ECSYS_DEFAULT_STEP_BUDGET 10000
+
+/* The maximum number of pure systems a single advance runs
+ * inline, after which the next one is dispatched normally.
+ * This also keeps a pure system that fails to disable itself
+ * from looping forever without returning to the event loop.  */
+#define ECSYS_MAX_FUSED 32
+
 /*-----------------------------------------------------------------------------
 Construction
 -----------------------------------------------------------------------------*/
@@ -72,40 +285,96 @@ struct ecsys *ecsys_new_(const tal_t *ctx,
 				 			 struct json_stream *stream),
 			 void (*plugin_log)(struct plugin *,
 					    enum log_level,
-					    const char *))
+					    const char *),
+			 struct plugin_timer *(*start_timer)(struct plugin *,
+							      struct timerel,
+							      void (*)(void *),
+							      void *))
 {
 	struct ecsys *ecsys = tal(ctx, struct ecsys);
 
 	strmap_init(&ecsys->system_map);
+	strmap_init(&ecsys->watchers);
+	uintmap_init(&ecsys->dirty);
+	uintmap_init(&ecsys->joins);
+	uintmap_init(&ecsys->leases);
+	ecsys->next_lease_id = 1;
+	uintmap_init(&ecsys->histories);
+	strmap_init(&ecsys->flowprofiles);
+	ecsys->num_flowprofiles = 0;
+	ecsys->flowprofiling = false;
 	ecsys->get_component = get_component;
 	ecsys->set_component = set_component;
 	ecsys->ec = ec;
 	ecsys->plugin_notification_start = plugin_notification_start;
 	ecsys->plugin_notification_end = plugin_notification_end;
 	ecsys->plugin_log = plugin_log;
+	ecsys->start_timer = start_timer;
+
+	ecsys->ready = ecready_new(ecsys);
+	ecsys->plugin = NULL;
+	ecsys->dispatch_per_tick = ECSYS_DEFAULT_DISPATCH_PER_TICK;
+	ecsys->dispatched_this_tick = 0;
+	ecsys->tick_timer = NULL;
+	ecsys->trace = NULL;
+	ecsys->trace_level = NULL;
+	ecsys->span = NULL;
+	ecsys->fused = 0;
+	ecsys->step_budget = ECSYS_DEFAULT_STEP_BUDGET;
+	ecsys->batching = tal_arr(ecsys, struct ecsys_registered *, 0);
 
 	tal_add_destructor(ecsys, &ecsys_destroy);
 
 	return ecsys;
 }
+static bool free_batch_timer(const char *name,
+			     struct ecsys_registered *system,
+			     void *unused)
+{
+	system->batch_timer = tal_free(system->batch_timer);
+	return true;
+}
+
 static void ecsys_destroy(struct ecsys *ecsys)
 {
+	struct ecsys_lease *lease;
+	intmap_index_t entity;
+
+	/* Timers are not owned by us, so free them explicitly.  */
+	strmap_iterate(&ecsys->system_map, &free_batch_timer, NULL);
+	for (lease = uintmap_first(&ecsys->leases, &entity);
+	     lease;
+	     lease = uintmap_after(&ecsys->leases, &entity))
+		lease->timer = tal_free(lease->timer);
+
 	/* strmap uses malloc, so clear it to ensure everything
 	 * it uses is freed.
 	 */
 	strmap_clear(&ecsys->system_map);
+	strmap_clear(&ecsys->watchers);
+	uintmap_clear(&ecsys->dirty);
+	uintmap_clear(&ecsys->joins);
+	uintmap_clear(&ecsys->leases);
+	uintmap_clear(&ecsys->histories);
+	strmap_clear(&ecsys->flowprofiles);
+	tal_free(ecsys->tick_timer);
 }
 
 /*-----------------------------------------------------------------------------
 Registration
 -----------------------------------------------------------------------------*/
 
+static void add_watcher(struct ecsys *ecsys,
+			const char *component,
+			struct ecsys_registered *system);
+
 void ecsys_register(struct ecsys *ecsys,
 		    const char *system,
 		    const char *const *requiredComponents,
 		    size_t numRequiredComponents,
 		    const char *const *disallowedComponents,
-		    size_t numDisallowedComponents)
+		    size_t numDisallowedComponents,
+		    const char *method)
 {
 	struct ecsys_registered *sys;
 	size_t i;
@@ -127,10 +396,49 @@ void ecsys_register(struct ecsys *ecsys,
 	for (i = 0; i < numDisallowedComponents; ++i)
 		sys->disallowedComponents[i] =
 			tal_strdup(sys, disallowedComponents[i]);
+	sys->method = method ? tal_strdup(sys, method) : NULL;
+	sys->method_missing = false;
+	sys->ecsys = ecsys;
+	sys->max_batch = 0;
+	sys->batch_deadline = time_from_sec(0);
+	sys->batch = tal_arr(sys, u32, 0);
+	sys->batch_leases = tal_arr(sys, u64, 0);
+	sys->batch_timer = NULL;
+	sys->passed = NULL;
+	sys->writes = NULL;
+	sys->pure = NULL;
+	sys->pure_arg = NULL;
+	sys->deadline = time_from_sec(0);
+	memset(&sys->stats, 0, sizeof(sys->stats));
+	echist_init(&sys->stats.service);
 
 	errno = 0;
 	strmap_add(&ecsys->system_map, sys->system, sys);
 	assert(errno != EEXIST);
+
+	for (i = 0; i < numRequiredComponents; ++i)
+		add_watcher(ecsys, sys->requiredComponents[i], sys);
+	for (i = 0; i < numDisallowedComponents; ++i)
+		add_watcher(ecsys, sys->disallowedComponents[i], sys);
+}
+
+static void add_watcher(struct ecsys *ecsys,
+			const char *component,
+			struct ecsys_registered *system)
+{
+	struct ecsys_registered **watchers;
+
+	/* tal_arr_expand may move the array, so remove it from
+	 * the map and re-add it afterwards.  */
+	watchers = strmap_get(&ecsys->watchers, component);
+	if (watchers)
+		strmap_del(&ecsys->watchers, component, NULL);
+	else
+		watchers = tal_arr(ecsys, struct ecsys_registered *, 0);
+	tal_arr_expand(&watchers, system);
+	/* The key is owned by the system, which is never freed
+	 * before we are.  */
+	strmap_add(&ecsys->watchers, component, watchers);
 }
 
 /*-----------------------------------------------------------------------------
@@ -139,11 +447,80 @@ Advance
 
 static bool system_matches(const struct ecsys *ecsys,
 			   u32 entity,
-			   const struct ecsys_registered *system);
+			   const struct ecsys_registered *system,
+			   u64 *lookups);
 static void run_system(struct plugin *plugin,
 		       struct ecsys *ecsys,
 		       u32 entity,
 		       struct ecsys_registered *system);
+static const char *get_schedparams(const struct ecsys *ecsys,
+				   u32 entity,
+				   enum ecready_priority *priority,
+				   u32 *flow,
+				   u32 *weight,
+				   u32 *max_steps);
+static void ecsys_dispatch(struct ecsys *ecsys);
+static void ecsys_arm_tick(struct ecsys *ecsys);
+static bool system_affected(const struct ecsys_registered *system,
+			    const struct ecsys_dirty *dirty);
+static bool is_reactive(const struct ecsys *ecsys, u32 entity);
+static struct ecsys_lease *hold_lease(struct ecsys *ecsys, u32 entity);
+static void start_lease(struct plugin *plugin,
+			struct ecsys *ecsys,
+			u32 entity,
+			struct ecsys_registered *system);
+static void release_lease(struct ecsys *ecsys, u32 entity);
+static void fail_entity(struct ecsys *ecsys,
+			u32 entity,
+			errcode_t code,
+			const char *msg);
+static bool system_current(const struct ecsys *ecsys,
+			   u32 entity,
+			   struct ecsys_registered *system);
+static void skip_system(struct ecsys *ecsys,
+			u32 entity,
+			struct ecsys_registered *system);
+static u32 entity_main(const struct ecsys *ecsys, u32 entity);
+static void add_span(struct ecsys *ecsys,
+		     const char *category,
+		     const char *name,
+		     u32 entity,
+		     u32 main,
+		     struct timemono start,
+		     bool fused);
+static const char *check_history(const struct ecsys *ecsys,
+				 u32 entity,
+				 const struct ecsys_registered *system,
+				 u32 max_steps,
+				 errcode_t *code);
+static void record_step(struct ecsys *ecsys,
+			u32 entity,
+			const struct ecsys_registered *system);
+static struct ecsys_flowprofile *
+get_flowprofile(struct ecsys *ecsys, const char **systems);
+static void run_pure(struct plugin *plugin,
+		     struct ecsys *ecsys,
+		     u32 entity,
+		     struct ecsys_registered *system);
+static struct ecsys_registered **
+fan_out(const tal_t *ctx,
+	const struct ecsys *ecsys,
+	u32 entity,
+	const char **systems,
+	size_t first);
+static struct command_result *
+advance(struct plugin *plugin,
+	struct ecsys *ecsys,
+	u32 entity,
+	const struct ecsys_dirty *dirty,
+	struct command_result *(*cb)(struct plugin *,
+				     struct ecsys *,
+				     void *cbarg),
+	struct command_result *(*errcb)(struct plugin *,
+					struct ecsys *,
+					errcode_t,
+					void *cbarg),
+	void *cbarg);
 /* Call to add an `error` field to `lightningd:systems`.  */
 static struct command_result *
 PRINTF_FMT(7, 8)
@@ -169,6 +546,63 @@ struct command_result *ecsys_advance_(struct plugin *plugin,
 								      errcode_t,
 								      void *cbarg),
 				      void *cbarg)
+{
+	struct ecsys_dirty *dirty;
+	struct ecsys_join *join;
+	bool cancelled;
+	const char *buffer;
+	const jsmntok_t *toks;
+
+	/* An explicit advance considers all systems anyway.  */
+	dirty = uintmap_get(&ecsys->dirty, entity);
+	if (dirty) {
+		uintmap_del(&ecsys->dirty, entity);
+		tal_free(dirty);
+	}
+
+	/* If several systems were launched together, only the last
+	 * of them to advance actually advances the entity.  */
+	join = uintmap_get(&ecsys->joins, entity);
+	if (join && join->cancelled &&
+	    ecsys->get_component(ecsys->ec, &buffer, &toks,
+				 entity, "lightningd:systems")) {
+		/* Processing was ended, then restarted by
+		 * attaching a new `lightningd:systems`.  */
+		uintmap_del(&ecsys->joins, entity);
+		join = tal_free(join);
+	}
+	if (join) {
+		if (--join->pending != 0)
+			return cb(plugin, ecsys, cbarg);
+		cancelled = join->cancelled;
+		uintmap_del(&ecsys->joins, entity);
+		tal_free(join);
+		/* Processing was ended while they were running.  */
+		if (cancelled)
+			return cb(plugin, ecsys, cbarg);
+	}
+
+	/* Whatever held the entity is done with it.  */
+	release_lease(ecsys, entity);
+
+	return advance(plugin, ecsys, entity, NULL, cb, errcb, cbarg);
+}
+
+/* If dirty is non-NULL, only consider the systems affected by
+ * it, and do not fail if none match.  */
+static struct command_result *
+advance(struct plugin *plugin,
+	struct ecsys *ecsys,
+	u32 entity,
+	const struct ecsys_dirty *dirty,
+	struct command_result *(*cb)(struct plugin *,
+				     struct ecsys *,
+				     void *cbarg),
+	struct command_result *(*errcb)(struct plugin *,
+					struct ecsys *,
+					errcode_t,
+					void *cbarg),
+	void *cbarg)
 {
 	const char **systems;
 	size_t nsystems;
@@ -179,6 +613,24 @@ struct command_result *ecsys_advance_(struct plugin *plugin,
 	struct ecsys_registered *system;
 	bool found;
 
+	struct ecsys_registered **wave;
+	struct ecsys_registered **queued;
+	struct ecsys_join *join;
+	struct ecsys_lease *lease;
+	struct ecsys_queued *entry;
+
+	enum ecready_priority priority;
+	u32 flow;
+	u32 weight;
+	u32 max_steps;
+	const char *schederr;
+	const char *histerr;
+	errcode_t histcode;
+
+	struct ecsys_flowprofile *profile;
+	u64 lookups;
+	bool matches;
+
 	char *buffer;
 	jsmntok_t *toks;
 
@@ -196,6 +648,21 @@ struct command_result *ecsys_advance_(struct plugin *plugin,
 					   "invalid or absent `systems` field.");
 	nsystems = tal_count(systems);
 
+	schederr = get_schedparams(ecsys, entity,
+				   &priority, &flow, &weight, &max_steps);
+	if (schederr)
+		return ecsys_advance_error(plugin, ecsys, entity,
+					   errcb, cbarg,
+					   PAY_ECS_INVALID_SYSTEMS_COMPONENT,
+					   "Invalid `lightningd:systems`: %s",
+					   schederr);
+
+	profile = NULL;
+	if (ecsys->flowprofiling)
+		profile = get_flowprofile(ecsys, systems);
+	if (profile)
+		++profile->searches;
+
 	/* Search for matching system.  */
 	found = false;
 	for (i = 0; i < nsystems; ++i) {
@@ -210,17 +677,43 @@ struct command_result *ecsys_advance_(struct plugin *plugin,
 						   "unregistered system: %s",
 						   systems[i]);
 
-		if (system_matches(ecsys, entity, system)) {
+		if (dirty && !system_affected(system, dirty))
+			continue;
+
+		lookups = 0;
+		matches = system_matches(ecsys, entity, system, &lookups);
+		if (profile) {
+			++profile->evaluated[i];
+			profile->lookups[i] += lookups;
+			if (matches)
+				++profile->matched[i];
+		}
+		if (matches) {
 			found = true;
 			break;
 		}
+		++system->stats.match_failures;
 	}
+	if (profile && !found)
+		++profile->unmatched;
+	/* A change that does not make any system match is fine for
+	 * a reactive entity; it just waits for more changes.  */
+	if (!found && dirty)
+		return cb(plugin, ecsys, cbarg);
 	if (!found)
 		return ecsys_advance_error(plugin, ecsys, entity,
 					   errcb, cbarg,
 					   PAY_ECS_NOT_ADVANCEABLE,
 					   "No systems match, cannot advance.");
 
+	/* Stop runaway systems.  */
+	histerr = check_history(ecsys, entity, system, max_steps,
+				&histcode);
+	if (histerr)
+		return ecsys_advance_error(plugin, ecsys, entity,
+					   errcb, cbarg,
+					   histcode, "%s", histerr);
+
 	/* Update component.  */
 	current = i;
 	buffer = tal_fmt(tmpctx, "%u", current);
@@ -231,16 +724,213 @@ struct command_result *ecsys_advance_(struct plugin *plugin,
 				    entity, "current",
 				    buffer, toks);
 
-	/* Trigger execution.  */
-	run_system(plugin, ecsys, entity, system);
+	/* Pure systems are run right here, then we look for the
+	 * next system.
+	 * The pure system is what advances the entity from here,
+	 * so a failure to find the next system is logged, the
+	 * same as if it had been queued, and is not the failure
+	 * of the caller, whose own advance succeeded.  */
+	if (!dirty && system->pure && ecsys->fused < ECSYS_MAX_FUSED) {
+		record_step(ecsys, entity, system);
+		run_pure(plugin, ecsys, entity, system);
+		++ecsys->fused;
+		ecsys_advance_done(plugin, ecsys, entity);
+		--ecsys->fused;
+		return cb(plugin, ecsys, cbarg);
+	}
+
+	/* Launch every other system that can safely run at the
+	 * same time, for explicit advances of non-reactive
+	 * entities.  */
+	if (!dirty && system->writes && !is_reactive(ecsys, entity))
+		wave = fan_out(tmpctx, ecsys, entity, systems, current);
+	else {
+		wave = tal_arr(tmpctx, struct ecsys_registered *, 1);
+		wave[0] = system;
+	}
+
+	/* Pure systems launched alongside are run right here too,
+	 * and need not be joined.  */
+	queued = tal_arr(tmpctx, struct ecsys_registered *, 0);
+	for (i = 0; i < tal_count(wave); ++i) {
+		record_step(ecsys, entity, wave[i]);
+		if (i != 0 && wave[i]->pure)
+			run_pure(plugin, ecsys, entity, wave[i]);
+		else
+			tal_arr_expand(&queued, wave[i]);
+	}
+	if (tal_count(queued) > 1) {
+		join = tal(ecsys, struct ecsys_join);
+		join->pending = tal_count(queued);
+		join->cancelled = false;
+		uintmap_add(&ecsys->joins, entity, join);
+	}
+
+	/* Queue execution.
+	 * The entity is held from now on, so that nothing else is
+	 * queued for it until it is advanced.  */
+	ecsys->plugin = plugin;
+	lease = hold_lease(ecsys, entity);
+	for (i = 0; i < tal_count(queued); ++i) {
+		entry = tal(ecsys, struct ecsys_queued);
+		entry->system = queued[i];
+		entry->lease = lease->id;
+		ecready_push(ecsys->ready, time_mono(),
+			     priority, flow, weight,
+			     entity, entry);
+	}
+	ecsys_dispatch(ecsys);
 
 	/* Normal exit.  */
 	return cb(plugin, ecsys, cbarg);
 }
 
+static const char *get_schedparams(const struct ecsys *ecsys,
+				   u32 entity,
+				   enum ecready_priority *priority,
+				   u32 *flow,
+				   u32 *weight,
+				   u32 *max_steps)
+{
+	const char *buffer;
+	const jsmntok_t *toks;
+	const jsmntok_t *field;
+
+	char *name;
+
+	*priority = ECREADY_PRIORITY_NORMAL;
+	*flow = entity;
+	*weight = 1;
+	*max_steps = ecsys->step_budget;
+
+	/* Already validated by the caller to be an object with a
+	 * `systems` field.  */
+	(void) ecsys->get_component(ecsys->ec, &buffer, &toks,
+				    entity, "lightningd:systems");
+
+	field = json_get_member(buffer, toks, "priority");
+	if (field) {
+		name = json_strdup(tmpctx, buffer, field);
+		if (field->type != JSMN_STRING ||
+		    !ecready_priority_from_name(name, priority))
+			return tal_fmt(tmpctx,
+				       "unknown `priority`: %.*s",
+				       json_tok_full_len(field),
+				       json_tok_full(buffer, field));
+	}
+
+	field = json_get_member(buffer, toks, "main");
+	if (field && !json_to_u32(buffer, field, flow))
+		return "`main` must be an entity ID.";
+
+	field = json_get_member(buffer, toks, "weight");
+	if (field && (!json_to_u32(buffer, field, weight) || *weight == 0))
+		return "`weight` must be a positive integer.";
+
+	field = json_get_member(buffer, toks, "max_steps");
+	if (field && !json_to_u32(buffer, field, max_steps))
+		return "`max_steps` must be a non-negative integer.";
+
+	return NULL;
+}
+
+/*~
+ * Dispatching is bounded per iteration of the event loop.
+ * The first dispatch in an iteration arms a zero-length timer,
+ * which fires at the next iteration and resets the count, then
+ * continues draining the ready queue.
+ *
+ * Thus, if some plugin floods us with `payecs_advance` of
+ * background entities, only a bounded number are sent out before
+ * we get a chance to read the `payecs_advance` of an interactive
+ * payment, which will then be dispatched ahead of the remaining
+ * background entities.
+ */
+static void ecsys_tick(struct ecsys *ecsys);
+
+static void ecsys_dispatch(struct ecsys *ecsys)
+{
+	struct timemono now = time_mono();
+
+	u32 entity;
+	void *payload;
+	struct timemono enqueued;
+	struct ecsys_queued *entry;
+	struct ecsys_registered *system;
+	struct ecsys_lease *lease;
+	u64 lease_id;
+
+	while ((ecsys->dispatch_per_tick == 0 ||
+		ecsys->dispatched_this_tick < ecsys->dispatch_per_tick) &&
+	       ecready_pop(ecsys->ready, now, &entity, &payload,
+			   &enqueued)) {
+		entry = (struct ecsys_queued *) payload;
+		system = entry->system;
+		lease_id = entry->lease;
+		tal_free(entry);
+
+		/* The entity was advanced, or its processing ended,
+		 * while it was waiting.  */
+		lease = uintmap_get(&ecsys->leases, entity);
+		if (!lease || lease->id != lease_id)
+			continue;
+
+		++ecsys->dispatched_this_tick;
+		if (ecsys->span)
+			add_span(ecsys, "queue", system->system, entity,
+				 entity_main(ecsys, entity), enqueued, false);
+
+		/* Its components may have been changed while it
+		 * was waiting, so that the system no longer
+		 * matches.  */
+		if (!system_current(ecsys, entity, system)) {
+			skip_system(ecsys, entity, system);
+			continue;
+		}
+
+		run_system(ecsys->plugin, ecsys, entity, system);
+	}
+
+	if (ecsys->dispatched_this_tick != 0 ||
+	    !ecready_empty(ecsys->ready))
+		ecsys_arm_tick(ecsys);
+}
+
+static void ecsys_arm_tick(struct ecsys *ecsys)
+{
+	if (ecsys->tick_timer || !ecsys->plugin)
+		return;
+	ecsys->tick_timer = ecsys->start_timer(ecsys->plugin,
+						time_from_sec(0),
+						typesafe_cb(void,
+							    void *,
+							    &ecsys_tick,
+							    ecsys),
+						ecsys);
+}
+
+static void ecsys_react(struct ecsys *ecsys);
+static void flush_batches(struct ecsys *ecsys);
+
+static void ecsys_tick(struct ecsys *ecsys)
+{
+	/* The timer frees itself after we return.  */
+	ecsys->tick_timer = NULL;
+	ecsys->dispatched_this_tick = 0;
+
+	ecsys_react(ecsys);
+	ecsys_dispatch(ecsys);
+	flush_batches(ecsys);
+
+	timer_complete(ecsys->plugin);
+}
+
+/* If lookups is non-NULL, it is incremented by the number of
+ * components looked up.  */
 static bool system_matches(const struct ecsys *ecsys,
 			   u32 entity,
-			   const struct ecsys_registered *system)
+			   const struct ecsys_registered *system,
+			   u64 *lookups)
 {
 	const char *buffer;
 	const jsmntok_t *tok;
@@ -255,6 +945,8 @@ static bool system_matches(const struct ecsys *ecsys,
 
 	for (i = 0; i < tal_count(system->requiredComponents); ++i) {
 		component = system->requiredComponents[i];
+		if (lookups)
+			++*lookups;
 		if (!ecsys->get_component(ecsys->ec, &buffer, &tok,
 					  entity, component))
 			return false;
@@ -262,6 +954,8 @@ static bool system_matches(const struct ecsys *ecsys,
 
 	for (i = 0; i < tal_count(system->disallowedComponents); ++i) {
 		component = system->disallowedComponents[i];
+		if (lookups)
+			++*lookups;
 		if (ecsys->get_component(ecsys->ec, &buffer, &tok,
 					 entity, component))
 			return false;
@@ -270,40 +964,224 @@ static bool system_matches(const struct ecsys *ecsys,
 	return true;
 }
 
-static void run_system(struct plugin *plugin,
-		       struct ecsys *ecsys,
-		       u32 entity,
-		       struct ecsys_registered *system)
+/* Whether the system is still in the `systems` array of the
+ * entity, and still matches it.  */
+static bool system_current(const struct ecsys *ecsys,
+			   u32 entity,
+			   struct ecsys_registered *system)
 {
-	struct json_stream *js;
+	const char **systems;
+	size_t i;
 
-	unsigned int i;
+	if (!payz_generic_getsystems_tal(tmpctx,
+					 ecsys->get_component, ecsys->ec,
+					 entity, "systems",
+					 &json_to_array_of_strings,
+					 &systems))
+		return false;
+	for (i = 0; i < tal_count(systems); ++i)
+		if (streq(systems[i], system->system))
+			break;
+	if (i == tal_count(systems))
+		return false;
 
-	/* Construct params.  */
-	js = ecsys->plugin_notification_start(plugin, ECSYS_SYSTEM_NOTIFICATION);
-	json_add_string(js, "system", system->system);
+	return system_matches(ecsys, entity, system, NULL);
+}
 
-	/* Construct entity, pass in the components that are
-	 * required by the system.
-	 */
-	json_object_start(js, "entity");
+/* Advance an entity whose system no longer matches it by the
+ * time it would be handed to it, as if the system had advanced
+ * it without doing anything.  */
+static void skip_system(struct ecsys *ecsys,
+			u32 entity,
+			struct ecsys_registered *system)
+{
+	++system->stats.match_failures;
+	ecsys->plugin_log(ecsys->plugin, LOG_DBG,
+			  tal_fmt(tmpctx,
+				  "entity %"PRIu32": system %s no longer "
+				  "matches, advancing.",
+				  entity, system->system));
+	ecsys_advance_done(ecsys->plugin, ecsys, entity);
+}
+
+static bool system_affected(const struct ecsys_registered *system,
+			    const struct ecsys_dirty *dirty)
+{
+	size_t i, j;
+
+	if (dirty->all)
+		return true;
+
+	for (i = 0; i < tal_count(dirty->changed); ++i) {
+		for (j = 0; j < tal_count(system->requiredComponents); ++j)
+			if (streq(dirty->changed[i],
+				  system->requiredComponents[j]))
+				return true;
+		for (j = 0; j < tal_count(system->disallowedComponents); ++j)
+			if (streq(dirty->changed[i],
+				  system->disallowedComponents[j]))
+				return true;
+	}
+
+	return false;
+}
+
+/* Add a component, or only the given fields of it.  */
+static void json_add_passed(struct json_stream *js,
+			    const struct ecsys *ecsys,
+			    u32 entity,
+			    const struct ecsys_passed *passed)
+{
+	const char *cmpbuf;
+	const jsmntok_t *cmptok;
+	const jsmntok_t *field;
+	size_t i;
+
+	if (!ecsys->get_component(ecsys->ec, &cmpbuf, &cmptok,
+				  entity, passed->component))
+		return;
+
+	if (!passed->fields || cmptok->type != JSMN_OBJECT) {
+		json_add_tok(js, passed->component, cmptok, cmpbuf);
+		return;
+	}
+
+	json_object_start(js, passed->component);
+	for (i = 0; i < tal_count(passed->fields); ++i) {
+		field = json_get_member(cmpbuf, cmptok, passed->fields[i]);
+		if (field)
+			json_add_tok(js, passed->fields[i], field, cmpbuf);
+	}
+	json_object_end(js);
+}
+
+/* Add an object containing the entity ID and the components
+ * passed to the system, by default those it requires.  */
+static void json_add_entity(struct json_stream *js,
+			    const char *fieldname,
+			    const struct ecsys *ecsys,
+			    u32 entity,
+			    const struct ecsys_registered *system)
+{
+	unsigned int i;
+
+	json_object_start(js, fieldname);
 	json_add_u32(js, "entity", entity);
+	if (system->passed) {
+		for (i = 0; i < tal_count(system->passed); ++i)
+			json_add_passed(js, ecsys, entity,
+					&system->passed[i]);
+		json_object_end(js);
+		return;
+	}
 	for (i = 0; i < tal_count(system->requiredComponents); ++i) {
 		const char *component = system->requiredComponents[i];
 		const char *cmpbuf;
 		const jsmntok_t *cmptok;
 
-		(void) ecsys->get_component(ecsys->ec,
-					    &cmpbuf, &cmptok,
-					    entity, component);
+		if (!ecsys->get_component(ecsys->ec,
+					  &cmpbuf, &cmptok,
+					  entity, component))
+			continue;
 		json_add_tok(js, component, cmptok, cmpbuf);
 	}
 	json_object_end(js);
+}
+
+/* Add the `system` field and either the `entity` field, or the
+ * `entities` field if batch, of a system invocation to an object
+ * that has been started.  */
+static void json_add_invocation(struct json_stream *js,
+				const struct ecsys *ecsys,
+				const u32 *entities,
+				bool batch,
+				const struct ecsys_registered *system)
+{
+	size_t i;
+
+	json_add_string(js, "system", system->system);
+
+	/* Construct entity, pass in the components that are
+	 * required by the system.
+	 */
+	if (!batch) {
+		json_add_entity(js, "entity", ecsys, entities[0], system);
+		return;
+	}
+
+	json_array_start(js, "entities");
+	for (i = 0; i < tal_count(entities); ++i)
+		json_add_entity(js, NULL, ecsys, entities[i], system);
+	json_array_end(js);
+}
+
+/* Whether to invoke the system via its RPC method, rather than
+ * by broadcasting a notification.  */
+static bool use_method(const struct ecsys_registered *system)
+{
+	return system->method && !system->method_missing;
+}
+
+static void broadcast_system(struct plugin *plugin,
+			     struct ecsys *ecsys,
+			     const u32 *entities,
+			     bool batch,
+			     struct ecsys_registered *system)
+{
+	struct json_stream *js;
+
+	/* Construct params.  */
+	js = ecsys->plugin_notification_start(plugin,
+					      batch ?
+					      ECSYS_SYSTEM_BATCH_NOTIFICATION :
+					      ECSYS_SYSTEM_NOTIFICATION);
+	json_add_invocation(js, ecsys, entities, batch, system);
 
 	/* Now raise the notification.  */
 	ecsys->plugin_notification_end(plugin, js);
 }
 
+static void invoke_system(struct plugin *plugin,
+			  struct ecsys *ecsys,
+			  const u32 *entities TAKES,
+			  bool batch,
+			  struct ecsys_registered *system);
+static void batch_system(struct plugin *plugin,
+			 struct ecsys *ecsys,
+			 u32 entity,
+			 struct ecsys_registered *system);
+
+static void run_system(struct plugin *plugin,
+		       struct ecsys *ecsys,
+		       u32 entity,
+		       struct ecsys_registered *system)
+{
+	u32 *entities;
+
+	/* Pure systems only get here if they were queued by a
+	 * reactive advance or after too many pure systems.  */
+	if (system->pure) {
+		run_pure(plugin, ecsys, entity, system);
+		ecsys_advance_done(plugin, ecsys, entity);
+		return;
+	}
+
+	++system->stats.invoked;
+	start_lease(plugin, ecsys, entity, system);
+
+	if (system->max_batch != 0) {
+		batch_system(plugin, ecsys, entity, system);
+		return;
+	}
+
+	entities = tal_arr(tmpctx, u32, 1);
+	entities[0] = entity;
+	if (use_method(system))
+		invoke_system(plugin, ecsys, take(entities), false, system);
+	else
+		broadcast_system(plugin, ecsys, entities, false, system);
+}
+
 static struct command_result *
 PRINTF_FMT(7, 8)
 ecsys_advance_error(struct plugin *plugin,
@@ -429,6 +1307,1400 @@ ecsys_err_wrap(struct plugin *plugin,
 	return ecsys_done_wrap(plugin, ecsys, inf);
 }
 
+/*-----------------------------------------------------------------------------
+Targeted Invocation
+-----------------------------------------------------------------------------*/
+
+/*~
+ * A `payecs_system_invoke` notification is received by every
+ * plugin that subscribed to it, each of which has to parse it
+ * just to find out whether the `system` is one of its own.
+ *
+ * A system registered with an RPC method is instead invoked by
+ * calling that method, with the same `system` and `entity`
+ * parameters, so only the plugin that owns the system ever sees
+ * the invocation.
+ * If the method has gone away (e.g. the plugin was restarted and
+ * has not re-registered yet), we fall back to the broadcast, and
+ * keep broadcasting for that system until the method is retried,
+ * rather than pay for a failed call each time.
+ */
+
+struct ecsys_invoke_info {
+	struct ecsys *ecsys;
+	u32 *entities;
+	/* The lease each entity was held under when invoked.  */
+	u64 *leases;
+	bool batch;
+	struct ecsys_registered *system;
+	/* When the method was called.  */
+	struct timemono start;
+};
+
+static struct command_result *
+invoke_system_ok(struct command *cmd,
+		 const char *buf,
+		 const jsmntok_t *result,
+		 struct ecsys_invoke_info *inf);
+static struct command_result *
+invoke_system_ng(struct command *cmd,
+		 const char *buf,
+		 const jsmntok_t *error,
+		 struct ecsys_invoke_info *inf);
+
+static enum ecsys_trace_level
+get_trace_level(const struct ecsys *ecsys,
+		u32 entity,
+		const struct ecsys_registered *system)
+{
+	if (!ecsys->trace_level)
+		return ECSYS_TRACE_FULL;
+	return ecsys->trace_level(entity, system->system);
+}
+
+static void invoke_system(struct plugin *plugin,
+			  struct ecsys *ecsys,
+			  const u32 *entities TAKES,
+			  bool batch,
+			  struct ecsys_registered *system)
+{
+	struct ecsys_invoke_info *inf;
+	const struct ecsys_lease *lease;
+	struct out_req *req;
+	enum ecsys_trace_level level;
+	size_t i;
+
+	/* Trace each entity as if it had been invoked singly.  */
+	for (i = 0; ecsys->trace && i < tal_count(entities); ++i) {
+		struct json_stream *js;
+		const char *buffer;
+		size_t len;
+		const jsmntok_t *toks;
+
+		level = get_trace_level(ecsys, entities[i], system);
+		if (level == ECSYS_TRACE_OFF)
+			continue;
+
+		js = new_json_stream(tmpctx, NULL, NULL);
+		json_object_start(js, NULL);
+		if (level == ECSYS_TRACE_HEADERS) {
+			json_add_string(js, "system", system->system);
+			json_object_start(js, "entity");
+			json_add_u32(js, "entity", entities[i]);
+			json_object_end(js);
+		} else
+			json_add_invocation(js, ecsys, &entities[i], false,
+					    system);
+		json_object_end(js);
+
+		buffer = json_out_contents(js->jout, &len);
+		toks = json_parse_simple(tmpctx, buffer, len);
+		ecsys->trace(plugin, buffer, toks);
+	}
+
+	inf = tal(ecsys, struct ecsys_invoke_info);
+	inf->ecsys = ecsys;
+	inf->entities = tal_dup_talarr(inf, u32, entities);
+	inf->leases = tal_arr(inf, u64, tal_count(inf->entities));
+	for (i = 0; i < tal_count(inf->entities); ++i) {
+		lease = uintmap_get(&ecsys->leases, inf->entities[i]);
+		inf->leases[i] = lease ? lease->id : 0;
+	}
+	inf->batch = batch;
+	inf->system = system;
+	inf->start = time_mono();
+
+	req = jsonrpc_request_start(plugin, NULL, system->method,
+				    &invoke_system_ok,
+				    &invoke_system_ng,
+				    inf);
+	json_add_invocation(req->js, ecsys, inf->entities, batch, system);
+	(void) send_outreq(plugin, req);
+}
+
+static void invoke_system_span(const struct ecsys_invoke_info *inf)
+{
+	size_t i;
+
+	if (!inf->ecsys->span)
+		return;
+	for (i = 0; i < tal_count(inf->entities); ++i)
+		add_span(inf->ecsys, "rpc", inf->system->method,
+			 inf->entities[i],
+			 entity_main(inf->ecsys, inf->entities[i]),
+			 inf->start, false);
+}
+
+/* Whether the entity is still held under the lease it was
+ * invoked with, i.e. the system has not advanced it yet, and
+ * its processing has not ended.  */
+static bool invoke_still_held(const struct ecsys_invoke_info *inf,
+			      size_t i)
+{
+	const struct ecsys_lease *lease;
+
+	lease = uintmap_get(&inf->ecsys->leases, inf->entities[i]);
+	return lease && lease->id == inf->leases[i];
+}
+
+static struct command_result *
+invoke_system_ok(struct command *cmd,
+		 const char *buf,
+		 const jsmntok_t *result,
+		 struct ecsys_invoke_info *inf)
+{
+	struct ecsys *ecsys = inf->ecsys;
+	const jsmntok_t *advancetok;
+	bool advance;
+	size_t i;
+
+	tal_steal(tmpctx, inf);
+	invoke_system_span(inf);
+
+	/* The method may ask us to advance the entities it was
+	 * given, saving a `payecs_advance` round trip.  */
+	advancetok = json_get_member(buf, result, "advance");
+	if (!advancetok || !json_to_bool(buf, advancetok, &advance) ||
+	    !advance)
+		return command_still_pending(cmd);
+
+	for (i = 0; i < tal_count(inf->entities); ++i)
+		if (invoke_still_held(inf, i))
+			ecsys_advance_done(ecsys->plugin, ecsys,
+					   inf->entities[i]);
+
+	return command_still_pending(cmd);
+}
+
+static struct command_result *
+invoke_system_ng(struct command *cmd,
+		 const char *buf,
+		 const jsmntok_t *error,
+		 struct ecsys_invoke_info *inf)
+{
+	struct ecsys *ecsys = inf->ecsys;
+	const jsmntok_t *codetok;
+	errcode_t code;
+	const char *msg;
+	u32 *held;
+	size_t i;
+
+	tal_steal(tmpctx, inf);
+	invoke_system_span(inf);
+
+	codetok = json_get_member(buf, error, "code");
+	if (codetok && json_to_errcode(buf, codetok, &code) &&
+	    code == JSONRPC2_METHOD_NOT_FOUND) {
+		inf->system->method_missing = true;
+
+		/* Entities advanced, or reclaimed, in the meantime
+		 * have moved on.  */
+		held = tal_arr(tmpctx, u32, 0);
+		for (i = 0; i < tal_count(inf->entities); ++i)
+			if (invoke_still_held(inf, i))
+				tal_arr_expand(&held, inf->entities[i]);
+
+		ecsys->plugin_log(ecsys->plugin, LOG_UNUSUAL,
+				  tal_fmt(tmpctx,
+					  "system %s: method %s not found, "
+					  "broadcasting to %zu of %zu "
+					  "entities instead.",
+					  inf->system->system,
+					  inf->system->method,
+					  tal_count(held),
+					  tal_count(inf->entities)));
+		if (tal_count(held) != 0)
+			broadcast_system(ecsys->plugin, ecsys,
+					 held, inf->batch, inf->system);
+		return command_still_pending(cmd);
+	}
+
+	/* Nothing is going to advance the entities, so fail them
+	 * rather than leave them held until a deadline, if any.  */
+	msg = tal_fmt(tmpctx, "System %s: method %s failed: %.*s",
+		      inf->system->system,
+		      inf->system->method,
+		      json_tok_full_len(error),
+		      json_tok_full(buf, error));
+	ecsys->plugin_log(ecsys->plugin, LOG_UNUSUAL,
+			  tal_fmt(tmpctx, "entity %"PRIu32": %s",
+				  inf->entities[0], msg));
+	for (i = 0; i < tal_count(inf->entities); ++i)
+		if (invoke_still_held(inf, i))
+			fail_entity(ecsys, inf->entities[i],
+				    PAY_ECS_SYSTEM_FAILED, msg);
+
+	return command_still_pending(cmd);
+}
+
+/*-----------------------------------------------------------------------------
+Batched Invocation
+-----------------------------------------------------------------------------*/
+
+/*~
+ * When many entities become ready for the same external system at
+ * about the same time (e.g. all the parts of a multipart payment
+ * reaching a custom scoring system), invoking the system once per
+ * entity means one notification per entity, each of which has to
+ * be serialized by us, routed by lightningd, and parsed by every
+ * subscriber.
+ *
+ * A system registered with a maximum batch size instead gets its
+ * entities collected, and invoked once with all of them in a
+ * `payecs_system_invoke_batch` notification (or a single call to
+ * its RPC method), either when the batch is full, or when the
+ * flush deadline of the oldest entity in the batch passes.
+ * A zero deadline means the batch is flushed once we return to
+ * the event loop, which coalesces entities advanced by any number
+ * of commands we are handling in the current iteration.
+ */
+
+static void flush_batch(struct ecsys *ecsys,
+			struct ecsys_registered *system);
+static void flush_batch_timeout(struct ecsys_registered *system);
+
+static void batch_system(struct plugin *plugin,
+			 struct ecsys *ecsys,
+			 u32 entity,
+			 struct ecsys_registered *system)
+{
+	const struct ecsys_lease *lease;
+
+	if (tal_count(system->batch) == 0) {
+		if (!time_greater(system->batch_deadline, time_from_sec(0))) {
+			tal_arr_expand(&ecsys->batching, system);
+			ecsys_arm_tick(ecsys);
+		} else
+			system->batch_timer
+				= ecsys->start_timer(plugin,
+						     system->batch_deadline,
+						     typesafe_cb(void,
+								 void *,
+								 &flush_batch_timeout,
+								 system),
+						     system);
+	}
+
+	lease = uintmap_get(&ecsys->leases, entity);
+	tal_arr_expand(&system->batch, entity);
+	tal_arr_expand(&system->batch_leases, lease->id);
+
+	if (tal_count(system->batch) >= system->max_batch)
+		flush_batch(ecsys, system);
+}
+
+static void flush_batch(struct ecsys *ecsys,
+			struct ecsys_registered *system)
+{
+	const struct ecsys_lease *lease;
+	u32 *entities;
+	u32 *unmatched;
+	size_t i;
+
+	if (tal_count(system->batch) == 0)
+		return;
+
+	/* Drop the entities advanced, or whose processing ended,
+	 * while they waited, and those the system no longer
+	 * matches.  */
+	entities = tal_arr(tmpctx, u32, 0);
+	unmatched = tal_arr(tmpctx, u32, 0);
+	for (i = 0; i < tal_count(system->batch); ++i) {
+		lease = uintmap_get(&ecsys->leases, system->batch[i]);
+		if (!lease || lease->id != system->batch_leases[i])
+			continue;
+		if (system_current(ecsys, system->batch[i], system))
+			tal_arr_expand(&entities, system->batch[i]);
+		else
+			tal_arr_expand(&unmatched, system->batch[i]);
+	}
+	tal_resize(&system->batch, 0);
+	tal_resize(&system->batch_leases, 0);
+
+	if (tal_count(entities) != 0) {
+		if (use_method(system))
+			invoke_system(ecsys->plugin, ecsys,
+				      entities, true, system);
+		else
+			broadcast_system(ecsys->plugin, ecsys,
+					 entities, true, system);
+	}
+
+	system->batch_timer = tal_free(system->batch_timer);
+	for (i = 0; i < tal_count(ecsys->batching); ++i) {
+		if (ecsys->batching[i] != system)
+			continue;
+		tal_arr_remove(&ecsys->batching, i);
+		break;
+	}
+
+	for (i = 0; i < tal_count(unmatched); ++i)
+		skip_system(ecsys, unmatched[i], system);
+}
+
+static void flush_batch_timeout(struct ecsys_registered *system)
+{
+	struct ecsys *ecsys = system->ecsys;
+
+	/* The timer frees itself after we return.  */
+	system->batch_timer = NULL;
+	flush_batch(ecsys, system);
+
+	timer_complete(ecsys->plugin);
+}
+
+/* Flush all batches whose deadline is the end of the event loop
+ * iteration.  */
+static void flush_batches(struct ecsys *ecsys)
+{
+	while (tal_count(ecsys->batching) != 0)
+		flush_batch(ecsys, ecsys->batching[0]);
+}
+
+void ecsys_set_batch(struct ecsys *ecsys,
+		     const char *system,
+		     u32 max_batch,
+		     struct timerel deadline)
+{
+	struct ecsys_registered *sys;
+
+	sys = strmap_get(&ecsys->system_map, system);
+	assert(sys);
+
+	flush_batch(ecsys, sys);
+	sys->max_batch = max_batch;
+	sys->batch_deadline = deadline;
+}
+
+void ecsys_set_passed(struct ecsys *ecsys,
+		      const char *system,
+		      const struct ecsys_passed *passed)
+{
+	struct ecsys_registered *sys;
+	size_t i, j;
+
+	sys = strmap_get(&ecsys->system_map, system);
+	assert(sys);
+
+	sys->passed = tal_free(sys->passed);
+	if (!passed)
+		return;
+
+	sys->passed = tal_arr(sys, struct ecsys_passed, tal_count(passed));
+	for (i = 0; i < tal_count(passed); ++i) {
+		struct ecsys_passed *p = &sys->passed[i];
+
+		p->component = tal_strdup(sys->passed, passed[i].component);
+		if (!passed[i].fields) {
+			p->fields = NULL;
+			continue;
+		}
+		p->fields = tal_arr(sys->passed, const char *,
+				    tal_count(passed[i].fields));
+		for (j = 0; j < tal_count(passed[i].fields); ++j)
+			p->fields[j] = tal_strdup(p->fields,
+						  passed[i].fields[j]);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+Fused Pure Systems
+-----------------------------------------------------------------------------*/
+
+/*~
+ * Many builtin systems are tiny synchronous steps, such as filling
+ * in a default setting, yet each would cost a notification round
+ * trip through lightningd, and a pass through the ready queue.
+ *
+ * Builtins that declare themselves pure are instead called
+ * directly as soon as they match, and the search for the next
+ * system resumes immediately, so a chain of pure systems in the
+ * `systems` array is effectively fused into a single step.
+ * Each pure system is still traced, with a `fused` field, so the
+ * trace looks the same as if each had been invoked separately.
+ */
+
+static void run_pure(struct plugin *plugin,
+		     struct ecsys *ecsys,
+		     u32 entity,
+		     struct ecsys_registered *system)
+{
+	struct json_stream *js;
+	const char *buffer;
+	size_t len;
+	const jsmntok_t *toks;
+	struct timemono start;
+
+	js = new_json_stream(tmpctx, NULL, NULL);
+	json_object_start(js, NULL);
+	json_add_invocation(js, ecsys, &entity, false, system);
+	json_add_bool(js, "fused", true);
+	json_object_end(js);
+
+	buffer = json_out_contents(js->jout, &len);
+	toks = json_parse_simple(tmpctx, buffer, len);
+	if (ecsys->trace
+	 && get_trace_level(ecsys, entity, system) != ECSYS_TRACE_OFF)
+		ecsys->trace(plugin, buffer, toks);
+
+	start = time_mono();
+	system->pure(system->pure_arg, entity,
+		     buffer, json_get_member(buffer, toks, "entity"));
+	if (ecsys->span)
+		add_span(ecsys, "system", system->system, entity,
+			 entity_main(ecsys, entity), start, true);
+	++system->stats.invoked;
+	++system->stats.completed;
+	echist_record(&system->stats.service,
+		      time_to_usec(timemono_since(start)));
+}
+
+void ecsys_set_pure_(struct ecsys *ecsys,
+		     const char *system,
+		     void (*pure)(void *arg,
+				  u32 entity,
+				  const char *buffer,
+				  const jsmntok_t *components),
+		     void *arg)
+{
+	struct ecsys_registered *sys;
+
+	sys = strmap_get(&ecsys->system_map, system);
+	assert(sys);
+
+	sys->pure = pure;
+	sys->pure_arg = arg;
+}
+
+/*-----------------------------------------------------------------------------
+Parallel Fan-out
+-----------------------------------------------------------------------------*/
+
+/*~
+ * Normally only the first matching system of an entity runs, and
+ * the next is only found once it advances the entity.
+ * But many systems touch disjoint components: in the default
+ * flow, the defaulters can fill in their settings while the
+ * `decode` of `lightningd:parse_invoice` is still in flight.
+ *
+ * Systems may declare the components they write.
+ * When an entity is advanced, we also launch every later matching
+ * system that commutes with all the systems listed before it,
+ * i.e. neither writes what the other reads or writes.
+ * Running it now then gives the same result as running it after
+ * whatever the systems before it would do, so we can launch it
+ * immediately.
+ * The entity is advanced again only once every launched system
+ * has advanced it.
+ *
+ * `lightningd:systems` is managed by us, and systems only ever
+ * detach it to end processing, so it never counts as a
+ * conflict.
+ */
+
+/* Whether a written component (possibly a `*`-suffixed prefix)
+ * and another component (also possibly a prefix) can be the
+ * same component.  */
+static bool components_overlap(const char *a, const char *b)
+{
+	size_t alen, blen;
+
+	if (streq(a, "lightningd:systems") || streq(b, "lightningd:systems"))
+		return false;
+
+	alen = strlen(a);
+	blen = strlen(b);
+	if (alen != 0 && a[alen - 1] == '*')
+		return strncmp(a, b, alen - 1) == 0 ||
+		       (blen != 0 && b[blen - 1] == '*' &&
+			strncmp(a, b, blen - 1) == 0);
+	if (blen != 0 && b[blen - 1] == '*')
+		return strncmp(a, b, blen - 1) == 0;
+	return streq(a, b);
+}
+
+/* Whether the system writes any component that overlaps the
+ * given component.  */
+static bool system_writes(const struct ecsys_registered *system,
+			  const char *component)
+{
+	size_t i;
+
+	for (i = 0; i < tal_count(system->writes); ++i)
+		if (components_overlap(system->writes[i], component))
+			return true;
+	return false;
+}
+
+/* Whether writer writes anything reader reads, i.e. matches on
+ * or is passed.  */
+static bool writes_reads(const struct ecsys_registered *writer,
+			 const struct ecsys_registered *reader)
+{
+	size_t i;
+
+	for (i = 0; i < tal_count(reader->requiredComponents); ++i)
+		if (system_writes(writer, reader->requiredComponents[i]))
+			return true;
+	for (i = 0; i < tal_count(reader->disallowedComponents); ++i)
+		if (system_writes(writer, reader->disallowedComponents[i]))
+			return true;
+	for (i = 0; i < tal_count(reader->passed); ++i)
+		if (system_writes(writer, reader->passed[i].component))
+			return true;
+	return false;
+}
+
+static bool systems_commute(const struct ecsys_registered *a,
+			    const struct ecsys_registered *b)
+{
+	size_t i;
+
+	if (a == b || !a->writes || !b->writes)
+		return false;
+	if (writes_reads(a, b) || writes_reads(b, a))
+		return false;
+	for (i = 0; i < tal_count(a->writes); ++i)
+		if (system_writes(b, a->writes[i]))
+			return false;
+	return true;
+}
+
+/* Return the systems to launch on the entity, the first being
+ * the matched systems[first].  */
+static struct ecsys_registered **
+fan_out(const tal_t *ctx,
+	const struct ecsys *ecsys,
+	u32 entity,
+	const char **systems,
+	size_t first)
+{
+	struct ecsys_registered **wave;
+	struct ecsys_registered *system;
+	struct ecsys_registered *other;
+	size_t i, j;
+
+	wave = tal_arr(ctx, struct ecsys_registered *, 1);
+	wave[0] = strmap_get(&ecsys->system_map, systems[first]);
+
+	/* Any system listed before the first may start matching
+	 * once the first has run, so all of them must have
+	 * declared what they write.  */
+	for (i = 0; i < first; ++i)
+		if (!strmap_get(&ecsys->system_map, systems[i])->writes)
+			return wave;
+
+	for (i = first + 1; i < tal_count(systems); ++i) {
+		system = strmap_get(&ecsys->system_map, systems[i]);
+		/* Neither it nor any system after it can be
+		 * shown to commute with it.  */
+		if (!system || !system->writes)
+			break;
+		if (!system_matches(ecsys, entity, system, NULL))
+			continue;
+		for (j = 0; j < i; ++j) {
+			other = strmap_get(&ecsys->system_map, systems[j]);
+			if (!systems_commute(system, other))
+				break;
+		}
+		if (j == i)
+			tal_arr_expand(&wave, system);
+	}
+
+	return wave;
+}
+
+void ecsys_set_writes(struct ecsys *ecsys,
+		      const char *system,
+		      const char *const *writes)
+{
+	struct ecsys_registered *sys;
+	size_t i;
+
+	sys = strmap_get(&ecsys->system_map, system);
+	assert(sys);
+
+	sys->writes = tal_free(sys->writes);
+	if (!writes)
+		return;
+
+	sys->writes = tal_arr(sys, char *, tal_count(writes));
+	for (i = 0; i < tal_count(writes); ++i)
+		sys->writes[i] = tal_strdup(sys->writes, writes[i]);
+}
+
+/*-----------------------------------------------------------------------------
+Leases
+-----------------------------------------------------------------------------*/
+
+/*~
+ * Once an entity is handed to a system, nothing else happens to
+ * it until the system advances it.
+ * If the system never does, for example because the plugin
+ * implementing it hangs, the entity would be stuck forever.
+ *
+ * So we record a lease on the entity when it is queued for a
+ * system, start it when the entity is handed to the system, and
+ * release it when the entity is advanced or its processing ends.
+ * Each lease has its own ID, so an entry in the ready queue or a
+ * batch can tell that the lease it was queued under is gone, and
+ * that the entity must no longer be handed to the system.
+ * If the system has a deadline and the lease is still held once
+ * it passes, we reclaim the entity: we attach a
+ * `lightningd:error` and detach `lightningd:systems`, the same
+ * as a system that fails the payment.
+ * A late advance from the system then fails, as the entity is
+ * no longer being processed.
+ *
+ * When several systems are launched together, they share the
+ * lease, which is accounted as one unit: it starts when the
+ * first of them is handed the entity, its deadline is the
+ * longest of theirs (or none, if any of them has none), and it
+ * is released once all of them have advanced the entity.
+ * Each of them then counts as having completed (or timed out),
+ * with the service time of the whole lease.
+ */
+
+static void lease_expired(struct ecsys_lease *lease);
+
+static struct ecsys_lease *hold_lease(struct ecsys *ecsys, u32 entity)
+{
+	struct ecsys_lease *lease;
+
+	lease = uintmap_get(&ecsys->leases, entity);
+	if (lease)
+		return lease;
+
+	lease = tal(ecsys, struct ecsys_lease);
+	lease->ecsys = ecsys;
+	lease->entity = entity;
+	lease->id = ecsys->next_lease_id++;
+	lease->systems = tal_arr(lease, struct ecsys_registered *, 0);
+	lease->main = entity_main(ecsys, entity);
+	lease->deadline = time_from_sec(0);
+	lease->unlimited = false;
+	lease->timer = NULL;
+	lease->expired = false;
+	uintmap_add(&ecsys->leases, entity, lease);
+	return lease;
+}
+
+static void start_lease(struct plugin *plugin,
+			struct ecsys *ecsys,
+			u32 entity,
+			struct ecsys_registered *system)
+{
+	struct ecsys_lease *lease;
+
+	struct timerel remaining;
+	size_t i;
+
+	lease = uintmap_get(&ecsys->leases, entity);
+	assert(lease);
+	for (i = 0; i < tal_count(lease->systems); ++i)
+		if (lease->systems[i] == system)
+			return;
+
+	if (tal_count(lease->systems) == 0)
+		lease->start = time_mono();
+	tal_arr_expand(&lease->systems, system);
+
+	if (!time_greater(system->deadline, time_from_sec(0))) {
+		lease->unlimited = true;
+		lease->timer = tal_free(lease->timer);
+	}
+	if (lease->unlimited ||
+	    !time_greater(system->deadline, lease->deadline))
+		return;
+
+	/* Extend the deadline to that of this system, counted from
+	 * the start of the lease.  */
+	lease->deadline = system->deadline;
+	tal_free(lease->timer);
+	if (time_greater(lease->deadline, timemono_since(lease->start)))
+		remaining = time_sub(lease->deadline,
+				     timemono_since(lease->start));
+	else
+		remaining = time_from_sec(0);
+	lease->timer = ecsys->start_timer(plugin, remaining,
+					  typesafe_cb(void, void *,
+						      &lease_expired,
+						      lease),
+					  lease);
+}
+
+static void release_lease(struct ecsys *ecsys, u32 entity)
+{
+	struct ecsys_lease *lease;
+	struct ecsys_registered *system;
+	size_t i;
+
+	lease = uintmap_get(&ecsys->leases, entity);
+	if (!lease)
+		return;
+
+	uintmap_del(&ecsys->leases, entity);
+	/* Nothing to account if it was still waiting in the ready
+	 * queue.  */
+	for (i = 0; i < tal_count(lease->systems); ++i) {
+		system = lease->systems[i];
+		if (ecsys->span)
+			add_span(ecsys, "system", system->system, entity,
+				 lease->main, lease->start, false);
+		if (lease->expired)
+			continue;
+		++system->stats.completed;
+		echist_record(&system->stats.service,
+			      time_to_usec(timemono_since(lease->start)));
+	}
+	tal_free(lease->timer);
+	tal_free(lease);
+
+	/* Changes made while the entity was held are reacted to
+	 * now.  */
+	if (uintmap_get(&ecsys->dirty, entity))
+		ecsys_arm_tick(ecsys);
+}
+
+static void lease_expired(struct ecsys_lease *lease)
+{
+	struct ecsys *ecsys = lease->ecsys;
+	u32 entity = lease->entity;
+	const char *msg;
+	char *names;
+	size_t i;
+
+	/* The timer frees itself after we return.  */
+	lease->timer = NULL;
+	lease->expired = true;
+
+	names = tal_strdup(tmpctx, "");
+	for (i = 0; i < tal_count(lease->systems); ++i) {
+		++lease->systems[i]->stats.timeouts;
+		tal_append_fmt(&names, "%s%s", i == 0 ? "" : ", ",
+			       lease->systems[i]->system);
+	}
+
+	msg = tal_fmt(tmpctx,
+		      "%s %s did not advance the entity within "
+		      "%"PRIu64"msec.",
+		      tal_count(lease->systems) == 1 ? "System" : "Systems",
+		      names,
+		      time_to_msec(timemono_since(lease->start)));
+	ecsys->plugin_log(ecsys->plugin, LOG_UNUSUAL,
+			  tal_fmt(tmpctx, "entity %"PRIu32": %s",
+				  entity, msg));
+
+	fail_entity(ecsys, entity, PAY_ECS_SYSTEM_TIMEOUT, msg);
+
+	timer_complete(ecsys->plugin);
+}
+
+/* Fail a held entity the same way a system that fails the
+ * payment would: attach `lightningd:error` and detach
+ * `lightningd:systems`, which also releases the lease.  */
+static void fail_entity(struct ecsys *ecsys,
+			u32 entity,
+			errcode_t code,
+			const char *msg)
+{
+	struct json_out *jout;
+	const char *buffer;
+	const jsmntok_t *toks;
+	size_t len;
+
+	jout = json_out_new(tmpctx);
+	json_out_start(jout, NULL, '{');
+	json_out_add(jout, "code", false, "%"PRIerrcode, code);
+	json_out_add(jout, "message", true, "%s", msg);
+	json_out_end(jout, '}');
+	buffer = json_out_contents(jout, &len);
+	toks = json_parse_simple(tmpctx, buffer, len);
+	ecsys->set_component(ecsys->ec, entity, "lightningd:error",
+			     buffer, toks);
+	ecsys_component_changed(ecsys, entity, "lightningd:error");
+
+	ecsys->set_component(ecsys->ec, entity, "lightningd:systems",
+			     NULL, NULL);
+	ecsys_component_changed(ecsys, entity, "lightningd:systems");
+}
+
+void ecsys_set_deadline(struct ecsys *ecsys,
+			const char *system,
+			struct timerel deadline)
+{
+	struct ecsys_registered *sys;
+
+	sys = strmap_get(&ecsys->system_map, system);
+	assert(sys);
+
+	sys->deadline = deadline;
+}
+
+void ecsys_retry_method(struct ecsys *ecsys,
+			const char *system)
+{
+	struct ecsys_registered *sys;
+
+	sys = strmap_get(&ecsys->system_map, system);
+	assert(sys);
+
+	sys->method_missing = false;
+}
+
+u64 ecsys_get_lease(const struct ecsys *ecsys,
+		    u32 entity,
+		    const char *system)
+{
+	const struct ecsys_lease *lease;
+	size_t i;
+
+	lease = uintmap_get(&ecsys->leases, entity);
+	if (!lease)
+		return 0;
+	for (i = 0; i < tal_count(lease->systems); ++i)
+		if (streq(lease->systems[i]->system, system))
+			return lease->id;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Spans
+-----------------------------------------------------------------------------*/
+
+/*~
+ * For tracing where the time of a payment goes, we report spans
+ * of time spent on each entity: waiting in the ready queue, held
+ * by a system, and waiting for RPC commands.
+ * Spans are keyed by the `main` entity of `lightningd:systems`,
+ * so that all the sub-entities of a payment can be shown
+ * together.
+ */
+
+static u32 entity_main(const struct ecsys *ecsys, u32 entity)
+{
+	const char *buffer;
+	const jsmntok_t *toks;
+	const jsmntok_t *field;
+	u32 flow;
+
+	if (!ecsys->get_component(ecsys->ec, &buffer, &toks,
+				  entity, "lightningd:systems"))
+		return entity;
+	field = json_get_member(buffer, toks, "main");
+	if (!field || !json_to_u32(buffer, field, &flow))
+		return entity;
+	return flow;
+}
+
+static void add_span(struct ecsys *ecsys,
+		     const char *category,
+		     const char *name,
+		     u32 entity,
+		     u32 main,
+		     struct timemono start,
+		     bool fused)
+{
+	struct ecsys_span span;
+
+	span.category = category;
+	span.name = name;
+	span.entity = entity;
+	span.main = main;
+	span.start = start;
+	span.end = time_mono();
+	span.fused = fused;
+	ecsys->span(ecsys->plugin, &span);
+}
+
+void ecsys_add_span(struct ecsys *ecsys,
+		    const char *category,
+		    const char *name,
+		    u32 entity,
+		    struct timemono start)
+{
+	if (!ecsys->span)
+		return;
+	add_span(ecsys, category, name, entity,
+		 entity_main(ecsys, entity), start, false);
+}
+
+void ecsys_set_span(struct ecsys *ecsys,
+		    void (*span)(struct plugin *,
+				 const struct ecsys_span *span))
+{
+	ecsys->span = span;
+}
+
+/*-----------------------------------------------------------------------------
+Runaway Detection
+-----------------------------------------------------------------------------*/
+
+/*~
+ * A system that advances an entity without detaching what it
+ * requires (or attaching what it disallows) matches again, and
+ * again, forever.
+ *
+ * We count a generation for each entity being processed,
+ * incremented on every change to any of its components.
+ * Matching depends only on the components, so if a system
+ * keeps matching at the same generation as when it was last
+ * launched on that entity, nothing can ever change, and we fail
+ * the advance instead.
+ * A few repeats are allowed, since re-advancing an entity with
+ * nothing changed is a legitimate way to retry an invocation
+ * that got lost.
+ *
+ * Systems that do change something each time, but never
+ * finish, are caught by the step budget instead: a limit on the
+ * number of systems launched on one entity.
+ *
+ * Both are reported in the `error` of `lightningd:systems`,
+ * listing the most recently launched systems so that the
+ * culprit is easy to spot.
+ * The history is dropped when `lightningd:systems` is detached.
+ */
+
+static char *recent_systems(const tal_t *ctx,
+			    const struct ecsys_history *history)
+{
+	char *list = tal_strdup(ctx, "");
+	size_t n;
+	size_t i;
+
+	n = history->steps < ECSYS_RECENT_STEPS ?
+		history->steps : ECSYS_RECENT_STEPS;
+	for (i = 0; i < n; ++i) {
+		size_t idx = (history->next + ECSYS_RECENT_STEPS - n + i)
+			% ECSYS_RECENT_STEPS;
+		tal_append_fmt(&list, "%s%s", i == 0 ? "" : ", ",
+			       history->recent[idx].system->system);
+	}
+	return list;
+}
+
+static const char *check_history(const struct ecsys *ecsys,
+				 u32 entity,
+				 const struct ecsys_registered *system,
+				 u32 max_steps,
+				 errcode_t *code)
+{
+	const struct ecsys_history *history;
+	size_t repeats;
+	size_t i;
+
+	history = uintmap_get(&ecsys->histories, entity);
+	if (!history)
+		return NULL;
+
+	repeats = 0;
+	for (i = 0; i < ECSYS_RECENT_STEPS && i < history->steps; ++i)
+		if (history->recent[i].system == system &&
+		    history->recent[i].generation == history->generation)
+			++repeats;
+	if (repeats >= ECSYS_CYCLE_REPEATS) {
+		*code = PAY_ECS_CYCLE_DETECTED;
+		return tal_fmt(tmpctx,
+			       "System %s matched again, but no Component "
+			       "changed since it was launched %zu times; "
+			       "recent systems: %s",
+			       system->system, repeats,
+			       recent_systems(tmpctx, history));
+	}
+
+	if (max_steps != 0 && history->steps >= max_steps) {
+		*code = PAY_ECS_STEP_BUDGET_EXCEEDED;
+		return tal_fmt(tmpctx,
+			       "Entity exceeded its budget of %"PRIu32" "
+			       "steps; recent systems: %s",
+			       max_steps,
+			       recent_systems(tmpctx, history));
+	}
+
+	return NULL;
+}
+
+static void record_step(struct ecsys *ecsys,
+			u32 entity,
+			const struct ecsys_registered *system)
+{
+	struct ecsys_history *history;
+
+	history = uintmap_get(&ecsys->histories, entity);
+	if (!history) {
+		history = tal(ecsys, struct ecsys_history);
+		history->generation = 0;
+		history->steps = 0;
+		history->next = 0;
+		uintmap_add(&ecsys->histories, entity, history);
+	}
+
+	history->recent[history->next].system = system;
+	history->recent[history->next].generation = history->generation;
+	history->next = (history->next + 1) % ECSYS_RECENT_STEPS;
+	++history->steps;
+}
+
+void ecsys_set_step_budget(struct ecsys *ecsys,
+			   u32 step_budget)
+{
+	ecsys->step_budget = step_budget;
+}
+
+u32 ecsys_get_step_budget(const struct ecsys *ecsys)
+{
+	return ecsys->step_budget;
+}
+
+/*-----------------------------------------------------------------------------
+Flow Profiling
+-----------------------------------------------------------------------------*/
+
+/*~
+ * Advancing an entity evaluates each system of its `systems`
+ * array in turn until one matches, so a long flow whose commonly
+ * matching systems come late spends most of its time looking up
+ * components for systems that do not match.
+ *
+ * When profiling, we record for each distinct `systems` array,
+ * and each position in it, how often the system there was
+ * evaluated and matched, and how many component lookups that
+ * took.
+ * Profiling costs a string map lookup per advance, so it is off
+ * by default.
+ */
+
+/* Maximum number of distinct flows profiled, so that entities
+ * with arbitrary `systems` cannot make us use unbounded memory.  */
+#define ECSYS_MAX_FLOWPROFILES 256
+
+static struct ecsys_flowprofile *
+get_flowprofile(struct ecsys *ecsys, const char **systems)
+{
+	struct ecsys_flowprofile *profile;
+	char *key;
+	size_t nsystems = tal_count(systems);
+	size_t i;
+
+	/* The systems of the flow, one per line.  */
+	key = tal_strdup(tmpctx, "");
+	for (i = 0; i < nsystems; ++i)
+		tal_append_fmt(&key, "%s\n", systems[i]);
+
+	profile = strmap_get(&ecsys->flowprofiles, key);
+	if (profile)
+		return profile;
+
+	if (ecsys->num_flowprofiles >= ECSYS_MAX_FLOWPROFILES)
+		return NULL;
+
+	profile = tal(ecsys, struct ecsys_flowprofile);
+	profile->systems = tal_arr(profile, const char *, nsystems);
+	for (i = 0; i < nsystems; ++i)
+		profile->systems[i] = tal_strdup(profile->systems,
+						 systems[i]);
+	profile->searches = 0;
+	profile->unmatched = 0;
+	profile->evaluated = tal_arrz(profile, u64, nsystems);
+	profile->matched = tal_arrz(profile, u64, nsystems);
+	profile->lookups = tal_arrz(profile, u64, nsystems);
+	strmap_add(&ecsys->flowprofiles, tal_steal(profile, key), profile);
+	++ecsys->num_flowprofiles;
+
+	return profile;
+}
+
+void ecsys_set_flowprofile(struct ecsys *ecsys, bool enable)
+{
+	const struct ecsys_flowprofile **profiles;
+	size_t i;
+
+	/* Start afresh each time profiling is enabled.
+	 * The keys belong to the profiles, so clear the map
+	 * before freeing them.  */
+	if (enable && !ecsys->flowprofiling) {
+		profiles = ecsys_get_flowprofiles(tmpctx, ecsys);
+		strmap_clear(&ecsys->flowprofiles);
+		strmap_init(&ecsys->flowprofiles);
+		for (i = 0; i < tal_count(profiles); ++i)
+			tal_free(profiles[i]);
+		ecsys->num_flowprofiles = 0;
+	}
+	ecsys->flowprofiling = enable;
+}
+
+bool ecsys_get_flowprofile(const struct ecsys *ecsys)
+{
+	return ecsys->flowprofiling;
+}
+
+static bool add_flowprofile(const char *key,
+			    struct ecsys_flowprofile *profile,
+			    const struct ecsys_flowprofile ***profiles)
+{
+	tal_arr_expand(profiles, profile);
+	return true;
+}
+
+const struct ecsys_flowprofile **
+ecsys_get_flowprofiles(const tal_t *ctx,
+		       const struct ecsys *ecsys)
+{
+	const struct ecsys_flowprofile **profiles;
+
+	profiles = tal_arr(ctx, const struct ecsys_flowprofile *, 0);
+	strmap_iterate(&ecsys->flowprofiles, &add_flowprofile, &profiles);
+	return profiles;
+}
+
+static bool requires_component(const struct ecsys_registered *system,
+			       const char *component)
+{
+	size_t i;
+
+	for (i = 0; i < tal_count(system->requiredComponents); ++i)
+		if (streq(system->requiredComponents[i], component))
+			return true;
+	return false;
+}
+
+bool ecsys_systems_exclusive(const struct ecsys *ecsys,
+			     const char *a,
+			     const char *b)
+{
+	const struct ecsys_registered *sa, *sb;
+	size_t i;
+
+	sa = strmap_get(&ecsys->system_map, a);
+	sb = strmap_get(&ecsys->system_map, b);
+	if (!sa || !sb)
+		return false;
+
+	for (i = 0; i < tal_count(sa->disallowedComponents); ++i)
+		if (requires_component(sb, sa->disallowedComponents[i]))
+			return true;
+	for (i = 0; i < tal_count(sb->disallowedComponents); ++i)
+		if (requires_component(sa, sb->disallowedComponents[i]))
+			return true;
+	return false;
+}
+
+/*-----------------------------------------------------------------------------
+Reactive Triggering
+-----------------------------------------------------------------------------*/
+
+/*~
+ * A reactive entity does not need anyone to `payecs_advance` it.
+ * Instead, every change to one of its components marks it dirty,
+ * recording which component changed, and at the next iteration
+ * of the event loop we advance all dirty entities in one go.
+ *
+ * Only systems that require or disallow one of the changed
+ * components can have changed from not matching to matching, so
+ * those are the only ones we check.
+ * Changes to components that no registered system cares about do
+ * not even mark the entity.
+ *
+ * An entity that is queued for, or held by, a system is left
+ * dirty until the system advances it (or its processing ends),
+ * so a change made meanwhile never launches a second system on
+ * it.
+ */
+
+static bool is_reactive(const struct ecsys *ecsys, u32 entity)
+{
+	bool reactive;
+
+	return payz_generic_getsystems(ecsys->get_component, ecsys->ec,
+				       entity, "reactive",
+				       &json_to_bool, &reactive) &&
+	       reactive;
+}
+
+void ecsys_component_changed(struct ecsys *ecsys,
+			     u32 entity,
+			     const char *component)
+{
+	bool all;
+	struct ecsys_dirty *dirty;
+	struct ecsys_join *join;
+	struct ecsys_history *history;
+	const char *buffer;
+	const jsmntok_t *toks;
+	size_t i;
+
+	/* Detaching `lightningd:systems` ends processing, even if
+	 * several systems are still running.  */
+	history = uintmap_get(&ecsys->histories, entity);
+	if (history)
+		++history->generation;
+
+	if (streq(component, "lightningd:systems") &&
+	    !ecsys->get_component(ecsys->ec, &buffer, &toks,
+				  entity, "lightningd:systems")) {
+		join = uintmap_get(&ecsys->joins, entity);
+		if (join)
+			join->cancelled = true;
+		release_lease(ecsys, entity);
+		/* A new `lightningd:systems` starts over.  */
+		if (history) {
+			uintmap_del(&ecsys->histories, entity);
+			tal_free(history);
+		}
+	}
+
+	if (!is_reactive(ecsys, entity))
+		return;
+
+	all = streq(component, "lightningd:systems");
+	if (!all && !strmap_get(&ecsys->watchers, component))
+		return;
+
+	dirty = uintmap_get(&ecsys->dirty, entity);
+	if (!dirty) {
+		dirty = tal(ecsys, struct ecsys_dirty);
+		dirty->all = false;
+		dirty->changed = tal_arr(dirty, const char *, 0);
+		uintmap_add(&ecsys->dirty, entity, dirty);
+	}
+
+	if (all)
+		dirty->all = true;
+	else {
+		for (i = 0; i < tal_count(dirty->changed); ++i)
+			if (streq(dirty->changed[i], component))
+				break;
+		if (i == tal_count(dirty->changed))
+			tal_arr_expand(&dirty->changed,
+				       tal_strdup(dirty, component));
+	}
+
+	ecsys_arm_tick(ecsys);
+}
+
+static void ecsys_react(struct ecsys *ecsys)
+{
+	u32 *entities;
+	struct ecsys_dirty **dirties;
+	struct ecsys_dirty *d;
+	struct ecsys_advance_done_info *inf;
+	intmap_index_t entity;
+	size_t i;
+
+	/* Take the current set of dirty entities, so that changes
+	 * made while reacting are handled at the next iteration.
+	 * Entities still queued for, or held by, a system stay
+	 * dirty until they are released.  */
+	entities = tal_arr(tmpctx, u32, 0);
+	dirties = tal_arr(tmpctx, struct ecsys_dirty *, 0);
+	for (d = uintmap_first(&ecsys->dirty, &entity);
+	     d;
+	     d = uintmap_after(&ecsys->dirty, &entity)) {
+		if (uintmap_get(&ecsys->leases, entity))
+			continue;
+		tal_arr_expand(&entities, (u32) entity);
+		tal_arr_expand(&dirties, tal_steal(dirties, d));
+	}
+	for (i = 0; i < tal_count(entities); ++i)
+		uintmap_del(&ecsys->dirty, entities[i]);
+
+	for (i = 0; i < tal_count(entities); ++i) {
+		inf = tal(ecsys, struct ecsys_advance_done_info);
+		inf->entity = entities[i];
+		(void) advance(ecsys->plugin, ecsys, entities[i], dirties[i],
+			       typesafe_cb_preargs(struct command_result *,
+						   void *,
+						   &ecsys_done_wrap,
+						   inf,
+						   struct plugin *,
+						   struct ecsys *),
+			       typesafe_cb_preargs(struct command_result *,
+						   void *,
+						   &ecsys_err_wrap,
+						   inf,
+						   struct plugin *,
+						   struct ecsys *,
+						   errcode_t),
+			       inf);
+	}
+
+	tal_free(dirties);
+	tal_free(entities);
+}
+
+/*-----------------------------------------------------------------------------
+Scheduling Parameters
+-----------------------------------------------------------------------------*/
+
+void ecsys_set_plugin(struct ecsys *ecsys,
+		      struct plugin *plugin)
+{
+	ecsys->plugin = plugin;
+}
+
+void ecsys_set_trace(struct ecsys *ecsys,
+		     void (*trace)(struct plugin *,
+				   const char *buffer,
+				   const jsmntok_t *params))
+{
+	ecsys->trace = trace;
+}
+
+void ecsys_set_trace_level(struct ecsys *ecsys,
+			   enum ecsys_trace_level
+			   (*trace_level)(u32 entity,
+					  const char *system))
+{
+	ecsys->trace_level = trace_level;
+}
+
+void ecsys_set_dispatch_per_tick(struct ecsys *ecsys,
+				 u32 dispatch_per_tick)
+{
+	ecsys->dispatch_per_tick = dispatch_per_tick;
+}
+
+u32 ecsys_get_dispatch_per_tick(const struct ecsys *ecsys)
+{
+	return ecsys->dispatch_per_tick;
+}
+
+void ecsys_get_readystats(const struct ecsys *ecsys,
+			  enum ecready_priority priority,
+			  struct ecready_stats *stats)
+{
+	ecready_get_stats(ecsys->ready, priority, stats);
+}
+
+const struct ecsys_sysstats *
+ecsys_get_sysstats(const struct ecsys *ecsys,
+		   const char *system)
+{
+	const struct ecsys_registered *sys;
+
+	sys = strmap_get(&ecsys->system_map, system);
+	if (!sys)
+		return NULL;
+	return &sys->stats;
+}
+
+static bool add_system_name(const char *name,
+			    struct ecsys_registered *system,
+			    const char ***names)
+{
+	tal_arr_expand(names, system->system);
+	return true;
+}
+
+const char **ecsys_get_systems(const tal_t *ctx,
+			       const struct ecsys *ecsys)
+{
+	const char **names = tal_arr(ctx, const char *, 0);
+
+	strmap_iterate(&ecsys->system_map, &add_system_name, &names);
+	return names;
+}
+
 /*-----------------------------------------------------------------------------
 Exist
 -----------------------------------------------------------------------------*/
@@ -6,11 +6,14 @@
 #include<ccan/typesafe_cb/typesafe_cb.h>
 #include<common/errcode.h>
 #include<common/json.h>
+#include<plugins/payz/ecs/echist.h>
+#include<plugins/payz/ecs/ecready.h>
 #include<stddef.h>
 
 struct command_result;
 enum log_level;
 struct plugin;
+struct plugin_timer;
 
 /** struct ecsys
  *
@@ -18,6 +21,97 @@ struct plugin;
  */
 struct ecsys;
 
+/** struct ecsys_passed
+ *
+ * @brief Describes a component to pass to a system when it is
+ * invoked.
+ */
+struct ecsys_passed {
+	/* The name of the component.  */
+	const char *component;
+	/* The fields of the component to pass, if the component
+	 * is an object, or NULL to pass the entire component.  */
+	const char **fields;
+};
+
+/** struct ecsys_sysstats
+ *
+ * @brief Statistics for a single registered system.
+ */
+struct ecsys_sysstats {
+	/* Number of times the system was launched on an entity,
+	 * including pure systems run inline.  */
+	u64 invoked;
+	/* Number of times the system was considered for an entity
+	 * but did not match it.  */
+	u64 match_failures;
+	/* Number of times the system was done with an entity it
+	 * was launched on, by advancing it or ending its
+	 * processing.  */
+	u64 completed;
+	/* Number of times the system held an entity past its
+	 * deadline.  */
+	u64 timeouts;
+	/* Service time, in microseconds, from launching the system
+	 * on an entity to it being done with the entity.
+	 * If several systems are launched together, each of them
+	 * records the time until all of them are done.  */
+	struct echist service;
+};
+
+/** struct ecsys_flowprofile
+ *
+ * @brief The matching costs of one distinct `systems` array.
+ */
+struct ecsys_flowprofile {
+	/* The `systems` array of the flow.  */
+	const char **systems;
+	/* Number of times the flow was searched for a matching
+	 * system, and how many of those found none.  */
+	u64 searches;
+	u64 unmatched;
+	/* For each position in systems, the number of times the
+	 * system there was evaluated, how many of those it
+	 * matched, and the number of component lookups spent on
+	 * it.  */
+	u64 *evaluated;
+	u64 *matched;
+	u64 *lookups;
+};
+
+/** enum ecsys_trace_level
+ *
+ * @brief How much of a system invocation to trace.
+ */
+enum ecsys_trace_level {
+	/* Do not trace the invocation at all.  */
+	ECSYS_TRACE_OFF,
+	/* Trace only the system and entity ID.  */
+	ECSYS_TRACE_HEADERS,
+	/* Trace the entire notification parameters.  */
+	ECSYS_TRACE_FULL
+};
+
+/** struct ecsys_span
+ *
+ * @brief A span of time spent on an entity, for tracing.
+ */
+struct ecsys_span {
+	/* What the time was spent on: `"queue"` for waiting in
+	 * the ready queue, `"system"` for being held by a system,
+	 * or `"rpc"` for waiting on an RPC command.  */
+	const char *category;
+	/* The name of the system, or of the RPC command.  */
+	const char *name;
+	u32 entity;
+	/* The `main` entity of the flow of the entity.  */
+	u32 main;
+	struct timemono start;
+	struct timemono end;
+	/* Whether this was a pure system run directly.  */
+	bool fused;
+};
+
 /** ecsys_new
  *
  * @brief Constructs a new systems handler.
@@ -40,6 +134,7 @@ struct ecsys;
  * @param plugin_notification_end - the function to call to
  * actuall emit a notificaation.
  * @param plugin_log - the function to print a log message.
+ * @param start_timer - the function to start a timer.
  */
 struct ecsys *ecsys_new_(const tal_t *ctx,
 			 bool (*get_component)(const void *ec,
@@ -59,8 +154,12 @@ struct ecsys *ecsys_new_(const tal_t *ctx,
 				 			 struct json_stream *stream),
 			 void (*plugin_log)(struct plugin *,
 					    enum log_level,
-					    const char *));
-#define ecsys_new(ctx, getc, setc, ec, nstart, nend, log) \
+					    const char *),
+			 struct plugin_timer *(*start_timer)(struct plugin *,
+							      struct timerel,
+							      void (*)(void *),
+							      void *));
+#define ecsys_new(ctx, getc, setc, ec, nstart, nend, log, timer) \
 	ecsys_new_((ctx), \
 		   typesafe_cb_postargs(void, const void *, (getc), (ec), \
 					const char **, \
@@ -72,7 +171,7 @@ struct ecsys *ecsys_new_(const tal_t *ctx,
 					const char *, \
 					const char *, \
 					const jsmntok_t *), \
-		   (ec), (nstart), (nend), (log))
+		   (ec), (nstart), (nend), (log), (timer))
 
 /** ecsys_register
  *
@@ -99,13 +198,18 @@ struct ecsys *ecsys_new_(const tal_t *ctx,
  * May be NULL to indicate no disallowed components.
  * @param numDisallowedComponents - the length of the above
  * array.
+ * @param method - the RPC method to call to invoke the
+ * system, which will be copied.
+ * May be NULL, in which case the system is invoked by
+ * broadcasting a ECSYS_SYSTEM_NOTIFICATION notification.
  */
 void ecsys_register(struct ecsys *ecsys,
 		    const char *system,
 		    const char *const *requiredComponents,
 		    size_t numRequiredComponents,
 		    const char *const *disallowedComponents,
-		    size_t numDisallowedComponents);
+		    size_t numDisallowedComponents,
+		    const char *method);
 
 /** ecsys_advance
  *
@@ -124,6 +228,14 @@ void ecsys_register(struct ecsys *ecsys,
  * @desc The callback will be called after `lightningd:systems`
  * has been updated, but before the system code starts
  * executing.
+ *
+ * The matched system is not invoked immediately, but is put in
+ * a ready queue, ordered by the `priority` field of
+ * `lightningd:systems`, and fairly shared among the flows
+ * named by the `main` field of `lightningd:systems`.
+ * At most a fixed number of systems are invoked in a single
+ * iteration of the event loop; the rest are invoked in later
+ * iterations.
  */
 struct command_result *ecsys_advance_(struct plugin *plugin,
 				      struct ecsys *ecsys,
@@ -182,13 +294,430 @@ void ecsys_advance_done(struct plugin *plugin,
 bool ecsys_system_exists(const struct ecsys *ecsys,
 			 const char *system);
 
+/** ecsys_set_dispatch_per_tick
+ *
+ * @brief Set the maximum number of systems to invoke in a
+ * single iteration of the event loop.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param dispatch_per_tick - the maximum number of system
+ * invocations per event loop iteration, or 0 for no limit.
+ */
+void ecsys_set_dispatch_per_tick(struct ecsys *ecsys,
+				 u32 dispatch_per_tick);
+
+/** ecsys_get_dispatch_per_tick
+ *
+ * @brief Get the value set by ecsys_set_dispatch_per_tick.
+ */
+u32 ecsys_get_dispatch_per_tick(const struct ecsys *ecsys);
+
+/** ecsys_set_step_budget
+ *
+ * @brief Set the default maximum number of systems launched
+ * on a single entity while it is being processed, after which
+ * advancing it fails.
+ *
+ * @desc An entity may override this with the `max_steps` field
+ * of its `lightningd:systems` component.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param step_budget - the maximum number of systems, or 0 for
+ * no limit.
+ */
+void ecsys_set_step_budget(struct ecsys *ecsys,
+			   u32 step_budget);
+
+/** ecsys_get_step_budget
+ *
+ * @brief Get the value set by ecsys_set_step_budget.
+ */
+u32 ecsys_get_step_budget(const struct ecsys *ecsys);
+
+/** ecsys_get_readystats
+ *
+ * @brief Get the statistics of the ready queue for the
+ * given priority class.
+ *
+ * @param ecsys - the system handler to query.
+ * @param priority - the priority class to query.
+ * @param stats - output, the statistics.
+ */
+void ecsys_get_readystats(const struct ecsys *ecsys,
+			  enum ecready_priority priority,
+			  struct ecready_stats *stats);
+
+/** ecsys_get_sysstats
+ *
+ * @brief Get the statistics of a registered system.
+ *
+ * @param ecsys - the system handler to query.
+ * @param system - the name of the system.
+ *
+ * @return - the statistics, which remain owned by the system
+ * handler and are updated as it runs, or NULL if the system
+ * is not registered.
+ */
+const struct ecsys_sysstats *
+ecsys_get_sysstats(const struct ecsys *ecsys,
+		   const char *system);
+
+/** ecsys_get_systems
+ *
+ * @brief Get the names of all registered systems.
+ *
+ * @param ctx - the owner of the returned array.
+ * @param ecsys - the system handler to query.
+ *
+ * @return - a tal-allocated array of the names, in sorted
+ * order.
+ */
+const char **ecsys_get_systems(const tal_t *ctx,
+			       const struct ecsys *ecsys);
+
+/** ecsys_set_flowprofile
+ *
+ * @brief Enable or disable profiling of the matching costs of
+ * each flow.
+ *
+ * @desc Enabling profiling when it is disabled discards the
+ * previous profiles.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param enable - whether to profile.
+ */
+void ecsys_set_flowprofile(struct ecsys *ecsys, bool enable);
+
+/** ecsys_get_flowprofile
+ *
+ * @brief Return whether flow profiling is enabled.
+ */
+bool ecsys_get_flowprofile(const struct ecsys *ecsys);
+
+/** ecsys_get_flowprofiles
+ *
+ * @brief Get the profiles of all flows recorded so far.
+ *
+ * @param ctx - the owner of the returned array.
+ * @param ecsys - the system handler to query.
+ *
+ * @return - a tal-allocated array of the profiles, which remain
+ * owned by the system handler.
+ */
+const struct ecsys_flowprofile **
+ecsys_get_flowprofiles(const tal_t *ctx,
+		       const struct ecsys *ecsys);
+
+/** ecsys_systems_exclusive
+ *
+ * @brief Check if two systems can never match the same entity
+ * at the same time, i.e. one requires a component the other
+ * disallows.
+ *
+ * @return - true if the systems are registered and exclusive.
+ */
+bool ecsys_systems_exclusive(const struct ecsys *ecsys,
+			     const char *a,
+			     const char *b);
+
+/** ecsys_set_plugin
+ *
+ * @brief Set the plugin this is running in, so that the
+ * system handler can schedule work on its own without
+ * waiting for an ecsys_advance.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param plugin - the plugin this is running in.
+ */
+void ecsys_set_plugin(struct ecsys *ecsys,
+		      struct plugin *plugin);
+
+/** ecsys_set_trace
+ *
+ * @brief Set a function to call whenever a system is invoked
+ * via its RPC method, or is a pure system run directly.
+ *
+ * @desc Systems invoked by notification can be traced by
+ * receiving the notification, but systems invoked via their
+ * RPC method are only seen by their owning plugin, so this
+ * lets the caller see them as well.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param trace - the function to call, with the same
+ * parameters as would have been given to the notification.
+ * It is also called for pure systems; see ecsys_set_pure.
+ * May be NULL to disable.
+ */
+void ecsys_set_trace(struct ecsys *ecsys,
+		     void (*trace)(struct plugin *,
+				   const char *buffer,
+				   const jsmntok_t *params));
+
+/** ecsys_set_trace_level
+ *
+ * @brief Set a function that decides how much of each
+ * invocation to give to the function set by ecsys_set_trace.
+ *
+ * @desc Without it, every invocation is traced in full.
+ * With ECSYS_TRACE_HEADERS, the `entity` object only has
+ * the `entity` field, saving the cost of building the
+ * components of the entity just to trace them.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param trace_level - the function to call, with the entity
+ * and the name of the system, or NULL.
+ */
+void ecsys_set_trace_level(struct ecsys *ecsys,
+			   enum ecsys_trace_level
+			   (*trace_level)(u32 entity,
+					  const char *system));
+
+/** ecsys_set_span
+ *
+ * @brief Set a function to call with each span of time spent
+ * on an entity: waiting to be dispatched, being held by a
+ * system, and waiting on an RPC command.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param span - the function to call, or NULL to disable.
+ * The span is only valid during the call.
+ */
+void ecsys_set_span(struct ecsys *ecsys,
+		    void (*span)(struct plugin *,
+				 const struct ecsys_span *span));
+
+/** ecsys_add_span
+ *
+ * @brief Report a span of time spent on an entity, ending now,
+ * to the function set by ecsys_set_span.
+ *
+ * @desc This is intended for systems that wait on RPC
+ * commands, so the wait shows up in the trace.
+ *
+ * @param ecsys - the system handler to report to.
+ * @param category - what the time was spent on, e.g. `"rpc"`.
+ * @param name - the name of the span, e.g. the RPC command.
+ * @param entity - the entity the time was spent on.
+ * @param start - when the span started.
+ */
+void ecsys_add_span(struct ecsys *ecsys,
+		    const char *category,
+		    const char *name,
+		    u32 entity,
+		    struct timemono start);
+
+/** ecsys_set_batch
+ *
+ * @brief Set up a registered system to be invoked with
+ * batches of entities.
+ *
+ * @desc Instead of invoking the system once per entity,
+ * entities are collected and the system is invoked once with
+ * all of them, via a ECSYS_SYSTEM_BATCH_NOTIFICATION
+ * notification (or a single call to its RPC method) with an
+ * `entities` array instead of an `entity` object.
+ * A batch is invoked when it reaches max_batch entities, or
+ * when deadline passes after its first entity was added.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param system - the name of the registered system.
+ * @param max_batch - the maximum number of entities in a
+ * batch, or 0 to disable batching.
+ * @param deadline - the maximum time an entity waits in the
+ * batch.
+ * If zero, the batch is invoked at the next iteration of
+ * the event loop.
+ */
+void ecsys_set_batch(struct ecsys *ecsys,
+		     const char *system,
+		     u32 max_batch,
+		     struct timerel deadline);
+
+/** ecsys_set_passed
+ *
+ * @brief Set the components that are passed to a registered
+ * system when it is invoked.
+ *
+ * @desc By default, a system is passed all the components it
+ * requires.
+ * A system may need a component only to match, and not its
+ * value, or only need a few fields of a large component, in
+ * which case passing less makes its invocation cheaper.
+ * Components that are not attached to the entity are not
+ * passed.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param system - the name of the registered system.
+ * @param passed - a tal-allocated array of the components to
+ * pass, which is copied.
+ * May be NULL to restore the default.
+ */
+void ecsys_set_passed(struct ecsys *ecsys,
+		      const char *system,
+		      const struct ecsys_passed *passed);
+
+/** ecsys_set_deadline
+ *
+ * @brief Set how long a registered system may hold an entity
+ * it was handed before it advances it.
+ *
+ * @desc Once the deadline passes, the entity is reclaimed by
+ * attaching a `lightningd:error` with the code
+ * PAY_ECS_SYSTEM_TIMEOUT and detaching `lightningd:systems`.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param system - the name of the registered system.
+ * @param deadline - the time the system may hold an entity,
+ * or 0 for no limit, the default.
+ */
+void ecsys_set_deadline(struct ecsys *ecsys,
+			const char *system,
+			struct timerel deadline);
+
+/** ecsys_retry_method
+ *
+ * @brief Invoke a registered system via its RPC method again,
+ * after the method was not found and the system fell back to
+ * the `payecs_system_invoke` notification.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param system - the name of the registered system.
+ */
+void ecsys_retry_method(struct ecsys *ecsys,
+			const char *system);
+
+/** ecsys_get_lease
+ *
+ * @brief Determine whether the entity is held by the given
+ * system, i.e. was handed to it and not advanced since.
+ *
+ * @desc A system that finishes an entity long after it was
+ * handed it can use this to check that it still holds the
+ * entity before writing to it, by comparing the lease with
+ * the one it got when it was handed the entity.
+ *
+ * @param ecsys - the system handler to query.
+ * @param entity - the entity to check.
+ * @param system - the name of the system.
+ *
+ * @return - an ID of the lease under which the system holds
+ * the entity, different from that of any earlier lease, or 0
+ * if the system does not hold the entity.
+ */
+u64 ecsys_get_lease(const struct ecsys *ecsys,
+		    u32 entity,
+		    const char *system);
+
+/** ecsys_set_writes
+ *
+ * @brief Declare the components a registered system may
+ * attach, detach, or mutate.
+ *
+ * @desc A system that declared its writes may be launched at
+ * the same time as other matching systems of the same entity,
+ * if none of them writes what another matches on, is passed,
+ * or writes.
+ * The entity is then advanced once all of them have advanced
+ * it.
+ * Detaching `lightningd:systems` to end processing need not be
+ * declared.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param system - the name of the registered system.
+ * @param writes - a tal-allocated array of component names,
+ * which is copied.
+ * A name ending in `*` covers all components with that prefix.
+ * May be NULL to mark the writes as undeclared, which is the
+ * default.
+ */
+void ecsys_set_writes(struct ecsys *ecsys,
+		      const char *system,
+		      const char *const *writes);
+
+/** ecsys_set_pure
+ *
+ * @brief Provide the code of a registered system that is
+ * synchronous and side-effect-free, i.e. it only reads the
+ * components it is passed and writes components of the
+ * entity, then returns.
+ *
+ * @desc Instead of being invoked by notification, a pure system
+ * is called directly as soon as it matches, and the search for
+ * the next system continues immediately, so that chains of
+ * pure systems are run as a single step.
+ * Each call is still given to the function set by
+ * ecsys_set_trace, with an additional `fused` field.
+ *
+ * @param ecsys - the system handler to modify.
+ * @param system - the name of the registered system.
+ * @param pure - the function to call, with arg, the entity,
+ * and the `entity` object the system would have been invoked
+ * with.
+ * It must not advance the entity itself.
+ * @param arg - the first argument to pure.
+ */
+#define ecsys_set_pure(ecsys, system, pure, arg) \
+	ecsys_set_pure_((ecsys), (system), \
+			typesafe_cb_postargs(void, void *, \
+					    (pure), (arg), \
+					    u32, \
+					    const char *, \
+					    const jsmntok_t *), \
+			(arg))
+void ecsys_set_pure_(struct ecsys *ecsys,
+		     const char *system,
+		     void (*pure)(void *arg,
+				  u32 entity,
+				  const char *buffer,
+				  const jsmntok_t *components),
+		     void *arg);
+
+/** ecsys_component_changed
+ *
+ * @brief Inform the system handler that the given component
+ * of the given entity was attached, detached, or mutated.
+ *
+ * @desc If the entity has a `reactive` field set to `true`
+ * in its `lightningd:systems`, the entity is marked dirty,
+ * and at the next iteration of the event loop it is advanced
+ * as if by ecsys_advance, except that only systems whose
+ * required or disallowed components include a changed
+ * component are considered, and no error is reported if none
+ * match.
+ * A change to `lightningd:systems` itself makes all systems
+ * be considered.
+ * An explicit ecsys_advance of a dirty entity clears its
+ * dirty mark.
+ *
+ * Entities that are not reactive are ignored.
+ *
+ * @param ecsys - the system handler to inform.
+ * @param entity - the entity that was changed.
+ * @param component - the component that was changed.
+ */
+void ecsys_component_changed(struct ecsys *ecsys,
+			     u32 entity,
+			     const char *component);
+
 /* The `lightningd:systems` component is not attached, or
  * does not have a valid `systems` field or a valid `current`
  * field, or one of the listed `systems` is not registered.  */
 static const errcode_t PAY_ECS_INVALID_SYSTEMS_COMPONENT = 2200;
 /* None of the systems listed matched.  */
 static const errcode_t PAY_ECS_NOT_ADVANCEABLE = 2201;
+/* The system handed the entity did not advance it before its
+ * deadline.  */
+static const errcode_t PAY_ECS_SYSTEM_TIMEOUT = 2202;
+/* More systems were launched on the entity than its step
+ * budget allows.  */
+static const errcode_t PAY_ECS_STEP_BUDGET_EXCEEDED = 2203;
+/* A system matched the entity again without any component of
+ * the entity changing since it was last launched.  */
+static const errcode_t PAY_ECS_CYCLE_DETECTED = 2204;
+/* The RPC method of the system handed the entity failed.  */
+static const errcode_t PAY_ECS_SYSTEM_FAILED = 2205;
 
 #define ECSYS_SYSTEM_NOTIFICATION "payecs_system_invoke"
+#define ECSYS_SYSTEM_BATCH_NOTIFICATION "payecs_system_invoke_batch"
 
 #endif /* LIGHTNING_PLUGINS_PAYZ_ECS_ECSYS_H */
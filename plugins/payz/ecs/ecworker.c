@@ -0,0 +1,276 @@
+#include"ecworker.h"
+#include<assert.h>
+#include<ccan/io/io.h>
+#include<ccan/list/list.h>
+#include<ccan/tal/str/str.h>
+#include<common/utils.h>
+#include<errno.h>
+#include<pthread.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/eventfd.h>
+#include<unistd.h>
+
+/*~
+ * Jobs move from the pending list, to a worker thread, to the
+ * done list, and finally back to the event loop thread.
+ *
+ * Only the two lists, and the flag to stop, are shared between
+ * threads, and they are protected by the single mutex.
+ * Everything tal does happens on the event loop thread: a job
+ * and its copy of the JSON are allocated before it is queued
+ * and freed after it is delivered, and while a worker thread
+ * holds a job, the event loop thread does not touch it.
+ *
+ * When a worker thread finishes a job, it writes to an eventfd,
+ * which the event loop reads like any other connection, and
+ * then delivers every job on the done list.
+ */
+
+struct ecworker_job {
+	struct list_node list;
+
+	ecworker_function work;
+	u32 entity;
+	void *payload;
+
+	/* Our own copy of the JSON text.  */
+	char *buffer;
+	jsmntok_t *toks;
+
+	/* Set by the worker thread, malloc-allocated.  */
+	char *result;
+};
+
+struct ecworker {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	/* Protected by lock.  */
+	struct list_head pending;
+	struct list_head done;
+	bool stopping;
+
+	/* Owned by the event loop thread.  */
+	size_t num_threads;
+	pthread_t *threads;
+	bool started;
+	int efd;
+	u64 efd_count;
+	size_t outstanding;
+
+	void (*done_cb)(void *arg,
+			u32 entity,
+			void *payload,
+			const char *result);
+	void *arg;
+};
+
+static void ecworker_destroy(struct ecworker *ecworker);
+
+struct ecworker *ecworker_new_(const tal_t *ctx,
+			       size_t num_threads,
+			       void (*done)(void *arg,
+					    u32 entity,
+					    void *payload,
+					    const char *result),
+			       void *arg)
+{
+	struct ecworker *ecworker = tal(ctx, struct ecworker);
+
+	pthread_mutex_init(&ecworker->lock, NULL);
+	pthread_cond_init(&ecworker->wake, NULL);
+	list_head_init(&ecworker->pending);
+	list_head_init(&ecworker->done);
+	ecworker->stopping = false;
+
+	if (num_threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = cpus > 0 ? (size_t) cpus : 1;
+	}
+	ecworker->num_threads = num_threads;
+	ecworker->threads = tal_arr(ecworker, pthread_t, 0);
+	ecworker->started = false;
+	ecworker->efd = -1;
+	ecworker->outstanding = 0;
+
+	ecworker->done_cb = done;
+	ecworker->arg = arg;
+
+	tal_add_destructor(ecworker, &ecworker_destroy);
+
+	return ecworker;
+}
+
+static void ecworker_destroy(struct ecworker *ecworker)
+{
+	struct ecworker_job *job;
+	size_t i;
+
+	pthread_mutex_lock(&ecworker->lock);
+	ecworker->stopping = true;
+	pthread_cond_broadcast(&ecworker->wake);
+	pthread_mutex_unlock(&ecworker->lock);
+
+	for (i = 0; i < tal_count(ecworker->threads); ++i)
+		pthread_join(ecworker->threads[i], NULL);
+
+	/* The jobs themselves are tal-allocated from us, only the
+	 * results use malloc.  */
+	list_for_each(&ecworker->done, job, list)
+		free(job->result);
+
+	pthread_cond_destroy(&ecworker->wake);
+	pthread_mutex_destroy(&ecworker->lock);
+
+	/* The eventfd is closed along with its connection, which
+	 * is also tal-allocated from us.  */
+}
+
+/*-----------------------------------------------------------------------------
+Worker Threads
+-----------------------------------------------------------------------------*/
+
+static void *ecworker_thread(void *arg)
+{
+	struct ecworker *ecworker = (struct ecworker *) arg;
+	struct ecworker_job *job;
+	u64 one = 1;
+	ssize_t res;
+
+	pthread_mutex_lock(&ecworker->lock);
+	for (;;) {
+		while (!ecworker->stopping && list_empty(&ecworker->pending))
+			pthread_cond_wait(&ecworker->wake, &ecworker->lock);
+		if (ecworker->stopping)
+			break;
+
+		job = list_pop(&ecworker->pending, struct ecworker_job, list);
+		pthread_mutex_unlock(&ecworker->lock);
+
+		job->result = job->work(job->entity, job->buffer, job->toks);
+
+		pthread_mutex_lock(&ecworker->lock);
+		list_add_tail(&ecworker->done, &job->list);
+		/* An eventfd write only fails if the counter would
+		 * overflow, in which case the event loop has plenty
+		 * of wakeups pending anyway.  */
+		do {
+			res = write(ecworker->efd, &one, sizeof(one));
+		} while (res < 0 && errno == EINTR);
+	}
+	pthread_mutex_unlock(&ecworker->lock);
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Event Loop Side
+-----------------------------------------------------------------------------*/
+
+static void ecworker_deliver(struct ecworker *ecworker,
+			     struct ecworker_job *job)
+{
+	--ecworker->outstanding;
+	ecworker->done_cb(ecworker->arg, job->entity, job->payload,
+			  job->result);
+	free(job->result);
+	tal_free(job);
+}
+
+static struct io_plan *ecworker_read(struct io_conn *conn,
+				     struct ecworker *ecworker);
+
+static struct io_plan *ecworker_woken(struct io_conn *conn,
+				      struct ecworker *ecworker)
+{
+	struct list_head done;
+	struct ecworker_job *job;
+
+	/* Take every finished job at once, and deliver them
+	 * without holding the lock.  */
+	list_head_init(&done);
+	pthread_mutex_lock(&ecworker->lock);
+	list_append_list(&done, &ecworker->done);
+	pthread_mutex_unlock(&ecworker->lock);
+
+	while ((job = list_pop(&done, struct ecworker_job, list)) != NULL)
+		ecworker_deliver(ecworker, job);
+
+	return ecworker_read(conn, ecworker);
+}
+
+static struct io_plan *ecworker_read(struct io_conn *conn,
+				     struct ecworker *ecworker)
+{
+	return io_read(conn, &ecworker->efd_count,
+		       sizeof(ecworker->efd_count),
+		       &ecworker_woken, ecworker);
+}
+
+/* Start the threads and the eventfd.
+ * Return false if nothing could be started.  */
+static bool ecworker_start(struct ecworker *ecworker)
+{
+	pthread_t thread;
+	size_t i;
+
+	ecworker->started = true;
+
+	ecworker->efd = eventfd(0, EFD_CLOEXEC);
+	if (ecworker->efd < 0)
+		return false;
+	io_new_conn(ecworker, ecworker->efd, &ecworker_read, ecworker);
+
+	for (i = 0; i < ecworker->num_threads; ++i) {
+		if (pthread_create(&thread, NULL,
+				   &ecworker_thread, ecworker) != 0)
+			break;
+		tal_arr_expand(&ecworker->threads, thread);
+	}
+
+	return tal_count(ecworker->threads) != 0;
+}
+
+void ecworker_submit(struct ecworker *ecworker,
+		     ecworker_function work,
+		     u32 entity,
+		     const char *buffer,
+		     const jsmntok_t *tok,
+		     void *payload)
+{
+	struct ecworker_job *job;
+	const jsmntok_t *toks;
+
+	if (!ecworker->started)
+		ecworker_start(ecworker);
+
+	job = tal(ecworker, struct ecworker_job);
+	job->work = work;
+	job->entity = entity;
+	job->payload = payload;
+	job->buffer = tal_strndup(job, json_tok_full(buffer, tok),
+				  json_tok_full_len(tok));
+	toks = json_parse_simple(tmpctx, job->buffer,
+				 json_tok_full_len(tok));
+	assert(toks);
+	job->toks = tal_dup_talarr(job, jsmntok_t, toks);
+	job->result = NULL;
+
+	++ecworker->outstanding;
+
+	if (tal_count(ecworker->threads) == 0) {
+		job->result = work(entity, job->buffer, job->toks);
+		ecworker_deliver(ecworker, job);
+		return;
+	}
+
+	pthread_mutex_lock(&ecworker->lock);
+	list_add_tail(&ecworker->pending, &job->list);
+	pthread_cond_signal(&ecworker->wake);
+	pthread_mutex_unlock(&ecworker->lock);
+}
+
+size_t ecworker_pending(const struct ecworker *ecworker)
+{
+	return ecworker->outstanding;
+}
@@ -0,0 +1,108 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_ECS_ECWORKER_H
+#define LIGHTNING_PLUGINS_PAYZ_ECS_ECWORKER_H
+#include"config.h"
+#include<ccan/short_types/short_types.h>
+#include<ccan/tal/tal.h>
+#include<ccan/typesafe_cb/typesafe_cb.h>
+#include<common/json.h>
+#include<stddef.h>
+
+/** struct ecworker
+ *
+ * @brief Represents a pool of threads that run system code
+ * away from the event loop.
+ *
+ * @desc Each job is given its own copy of the JSON text it
+ * works on, so that it can run while the event loop keeps
+ * mutating the ECS.
+ * Once a job is done, its result is handed back to the event
+ * loop thread, which is woken via an eventfd.
+ *
+ * The threads are only started when the first job is
+ * submitted.
+ */
+struct ecworker;
+
+/** ecworker_function
+ *
+ * @brief The code of a job, run on a worker thread.
+ *
+ * @desc This must not use tal (including tmpctx), and must
+ * not call into the ECS or libplugin.
+ * It may read the given JSON via functions that do not
+ * allocate, such as json_get_member and json_to_number.
+ *
+ * @param entity - the entity the job is for.
+ * @param buffer - the JSON text of the job.
+ * @param toks - the top token of the job.
+ *
+ * @return - a malloc-allocated, null-terminated string, or
+ * NULL.
+ */
+typedef char *(*ecworker_function)(u32 entity,
+				   const char *buffer,
+				   const jsmntok_t *toks);
+
+/** ecworker_new
+ *
+ * @brief Constructs a new worker thread pool.
+ *
+ * @param ctx - the owner of this pool.
+ * Freeing the pool waits for jobs that are already running,
+ * and drops jobs that are not.
+ * @param num_threads - the number of threads to run, or 0 to
+ * use one per online CPU.
+ * @param done - the function to call on the event loop
+ * thread once a job completes, with arg, the entity and
+ * payload given to ecworker_submit, and the string returned
+ * by the job, which remains owned by the pool.
+ * @param arg - the first argument to done.
+ */
+struct ecworker *ecworker_new_(const tal_t *ctx,
+			       size_t num_threads,
+			       void (*done)(void *arg,
+					    u32 entity,
+					    void *payload,
+					    const char *result),
+			       void *arg);
+#define ecworker_new(ctx, num_threads, done, arg) \
+	ecworker_new_((ctx), (num_threads), \
+		      typesafe_cb_postargs(void, void *, \
+					  (done), (arg), \
+					  u32, \
+					  void *, \
+					  const char *), \
+		      (arg))
+
+/** ecworker_submit
+ *
+ * @brief Queue a job to be run on a worker thread.
+ *
+ * @desc If the threads could not be started, the job is run
+ * immediately on the calling thread instead, and done is
+ * called before this returns.
+ *
+ * @param ecworker - the pool to run the job in.
+ * @param work - the code of the job.
+ * @param entity - the entity the job is for.
+ * @param buffer - the JSON text the job works on.
+ * @param tok - the token within buffer to give to the job.
+ * Only the text of this token is copied for the job.
+ * @param payload - an arbitrary pointer to give to the done
+ * function of the pool.
+ */
+void ecworker_submit(struct ecworker *ecworker,
+		     ecworker_function work,
+		     u32 entity,
+		     const char *buffer,
+		     const jsmntok_t *tok,
+		     void *payload);
+
+/** ecworker_pending
+ *
+ * @brief Return the number of jobs submitted to the pool
+ * whose done function has not been called yet.
+ */
+size_t ecworker_pending(const struct ecworker *ecworker);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_ECS_ECWORKER_H */
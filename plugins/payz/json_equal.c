@@ -1,5 +1,6 @@
 #include"json_equal.h"
 #include<assert.h>
+#include<ccan/tal/str/str.h>
 
 bool
 json_equal(const char *buffer1, const jsmntok_t *tok1,
@@ -65,3 +66,10 @@ json_equal(const char *buffer1, const jsmntok_t *tok1,
 	}
 	abort();
 }
+
+char *json_tok_text(const tal_t *ctx,
+		    const char *buffer, const jsmntok_t *tok)
+{
+	return tal_strndup(ctx, json_tok_full(buffer, tok),
+			   json_tok_full_len(tok));
+}
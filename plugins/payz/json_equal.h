@@ -1,6 +1,7 @@
 #ifndef LIGHTNING_PLUGINS_PAYZ_JSON_EQUAL_H
 #define LIGHTNING_PLUGINS_PAYZ_JSON_EQUAL_H
 #include"config.h"
+#include<ccan/tal/tal.h>
 #include<common/json.h>
 
 /** json_equal
@@ -16,4 +17,12 @@ bool
 json_equal(const char *buffer1, const jsmntok_t *tok1,
 	   const char *buffer2, const jsmntok_t *tok2);
 
+/** json_tok_text
+ *
+ * @brief Copies the JSON text of a datum, including the quotes
+ * of a string, into a new string.
+ */
+char *json_tok_text(const tal_t *ctx,
+		    const char *buffer, const jsmntok_t *tok);
+
 #endif /* LIGHTNING_PLUGINS_PAYZ_JSON_EQUAL_H */
@@ -0,0 +1,575 @@
+#include"json_patch.h"
+#include<ccan/array_size/array_size.h>
+#include<ccan/json_escape/json_escape.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/utils.h>
+#include<plugins/payz/json_equal.h>
+
+/*-----------------------------------------------------------------------------
+Member Names
+-----------------------------------------------------------------------------*/
+
+/* Appends the UTF-8 encoding of the code point.  */
+static void append_utf8(char **s, u32 c)
+{
+	if (c < 0x80)
+		tal_append_fmt(s, "%c", (char) c);
+	else if (c < 0x800)
+		tal_append_fmt(s, "%c%c",
+			       (char) (0xC0 | (c >> 6)),
+			       (char) (0x80 | (c & 0x3F)));
+	else if (c < 0x10000)
+		tal_append_fmt(s, "%c%c%c",
+			       (char) (0xE0 | (c >> 12)),
+			       (char) (0x80 | ((c >> 6) & 0x3F)),
+			       (char) (0x80 | (c & 0x3F)));
+	else
+		tal_append_fmt(s, "%c%c%c%c",
+			       (char) (0xF0 | (c >> 18)),
+			       (char) (0x80 | ((c >> 12) & 0x3F)),
+			       (char) (0x80 | ((c >> 6) & 0x3F)),
+			       (char) (0x80 | (c & 0x3F)));
+}
+
+static bool hex4(const char *p, const char *end, u32 *c)
+{
+	size_t i;
+
+	if (end - p < 4)
+		return false;
+	*c = 0;
+	for (i = 0; i < 4; ++i) {
+		if (!cisxdigit(p[i]))
+			return false;
+		*c = *c * 16 + (cisdigit(p[i]) ? p[i] - '0'
+					       : (p[i] | 0x20) - 'a' + 10);
+	}
+	return true;
+}
+
+/* Gets the text of a JSON string with its escapes decoded, or
+ * NULL if it has an invalid escape, or one that decodes to a
+ * NUL character.  */
+static char *unescape_string(const tal_t *ctx,
+			     const char *buffer, const jsmntok_t *tok)
+{
+	const char *p = buffer + tok->start;
+	const char *end = buffer + tok->end;
+	char *s = tal_strdup(ctx, "");
+	u32 c, low;
+
+	while (p != end) {
+		if (*p != '\\') {
+			tal_append_fmt(&s, "%c", *p);
+			++p;
+			continue;
+		}
+		if (p + 1 == end)
+			return tal_free(s);
+		switch (p[1]) {
+		case '"': case '\\': case '/':
+			tal_append_fmt(&s, "%c", p[1]);
+			break;
+		case 'b': tal_append_fmt(&s, "\b"); break;
+		case 'f': tal_append_fmt(&s, "\f"); break;
+		case 'n': tal_append_fmt(&s, "\n"); break;
+		case 'r': tal_append_fmt(&s, "\r"); break;
+		case 't': tal_append_fmt(&s, "\t"); break;
+		case 'u':
+			if (!hex4(p + 2, end, &c) || c == 0)
+				return tal_free(s);
+			/* A surrogate pair encodes one code point.  */
+			if (c >= 0xD800 && c < 0xDC00) {
+				if (end - (p + 6) < 2 || p[6] != '\\'
+				 || p[7] != 'u'
+				 || !hex4(p + 8, end, &low)
+				 || low < 0xDC00 || low >= 0xE000)
+					return tal_free(s);
+				c = 0x10000 + ((c - 0xD800) << 10)
+					    + (low - 0xDC00);
+				p += 6;
+			} else if (c >= 0xDC00 && c < 0xE000)
+				return tal_free(s);
+			append_utf8(&s, c);
+			p += 4;
+			break;
+		default:
+			return tal_free(s);
+		}
+		p += 2;
+	}
+	return s;
+}
+
+/* Like json_get_member, but compares member names with their
+ * escapes decoded, so that e.g. "a\/b" and "a/b" are the same
+ * member.  */
+static const jsmntok_t *get_member(const char *buffer,
+				   const jsmntok_t *tok,
+				   const char *name)
+{
+	const jsmntok_t *key;
+	const char *keyname;
+	size_t i;
+
+	json_for_each_obj (i, key, tok) {
+		keyname = unescape_string(tmpctx, buffer, key);
+		if (keyname && streq(keyname, name))
+			return key + 1;
+	}
+	return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Merge Patch
+-----------------------------------------------------------------------------*/
+
+char *json_merge_patch(const tal_t *ctx,
+		       const char *buffer, const jsmntok_t *target,
+		       const char *pbuffer, const jsmntok_t *patch)
+{
+	const jsmntok_t *key;
+	const jsmntok_t *member;
+	const char *name;
+	const char *sep = "";
+	char *text;
+	char *inner;
+	size_t i;
+
+	if (patch->type != JSMN_OBJECT) {
+		if (json_tok_is_null(pbuffer, patch))
+			return NULL;
+		return json_tok_text(ctx, pbuffer, patch);
+	}
+	/* Anything else is replaced by an object.  */
+	if (target && target->type != JSMN_OBJECT)
+		target = NULL;
+
+	text = tal_strdup(ctx, "{");
+	if (target) {
+		json_for_each_obj (i, key, target) {
+			name = unescape_string(tmpctx, buffer, key);
+			member = name ? get_member(pbuffer, patch, name)
+				      : NULL;
+			if (!member)
+				inner = json_tok_text(tmpctx, buffer, key + 1);
+			else
+				inner = json_merge_patch(tmpctx,
+							 buffer, key + 1,
+							 pbuffer, member);
+			/* Patched to null, so removed.  */
+			if (!inner)
+				continue;
+			tal_append_fmt(&text, "%s%.*s: %s", sep,
+				       json_tok_full_len(key),
+				       json_tok_full(buffer, key),
+				       inner);
+			sep = ", ";
+		}
+	}
+	json_for_each_obj (i, key, patch) {
+		name = unescape_string(tmpctx, pbuffer, key);
+		if (target && name && get_member(buffer, target, name))
+			continue;
+		inner = json_merge_patch(tmpctx, NULL, NULL, pbuffer, key + 1);
+		if (!inner)
+			continue;
+		tal_append_fmt(&text, "%s%.*s: %s", sep,
+			       json_tok_full_len(key),
+			       json_tok_full(pbuffer, key),
+			       inner);
+		sep = ", ";
+	}
+	tal_append_fmt(&text, "}");
+	return text;
+}
+
+/*-----------------------------------------------------------------------------
+JSON Patch
+-----------------------------------------------------------------------------*/
+
+enum json_patch_edit {
+	EDIT_ADD,
+	EDIT_REMOVE,
+	EDIT_REPLACE
+};
+
+/* Parses an RFC 6901 JSON Pointer into its unescaped reference
+ * tokens, or returns NULL if invalid.
+ * The JSON string escapes are decoded first, then the `~0` and
+ * `~1` of the pointer.  */
+static const char **parse_pointer(const tal_t *ctx,
+				  const char *buffer,
+				  const jsmntok_t *tok)
+{
+	const char **path;
+	const char *pointer;
+	const char *p, *end;
+	char *name;
+
+	if (!tok || tok->type != JSMN_STRING)
+		return NULL;
+	pointer = unescape_string(tmpctx, buffer, tok);
+	if (!pointer)
+		return NULL;
+
+	path = tal_arr(ctx, const char *, 0);
+	p = pointer;
+	end = pointer + strlen(pointer);
+	if (p == end)
+		return path;
+	if (*p != '/')
+		return tal_free(path);
+
+	while (p != end) {
+		/* Skip the '/'.  */
+		++p;
+		name = tal_strdup(path, "");
+		while (p != end && *p != '/') {
+			if (*p != '~') {
+				tal_append_fmt(&name, "%c", *p);
+				++p;
+				continue;
+			}
+			if (p + 1 == end || (p[1] != '0' && p[1] != '1'))
+				return tal_free(path);
+			tal_append_fmt(&name, "%c", p[1] == '0' ? '~' : '/');
+			p += 2;
+		}
+		tal_arr_expand(&path, name);
+	}
+	return path;
+}
+
+/* Parses an array index, or "-" for the end of the array if
+ * append_ok.  */
+static bool array_index(const char *name, size_t size, bool append_ok,
+			size_t *index)
+{
+	const char *p;
+
+	if (streq(name, "-")) {
+		*index = size;
+		return append_ok;
+	}
+	/* No leading zeroes.  */
+	if (!*name || (name[0] == '0' && name[1]))
+		return false;
+
+	*index = 0;
+	for (p = name; *p; ++p) {
+		if (!cisdigit(*p))
+			return false;
+		*index = *index * 10 + (*p - '0');
+		if (*index > size)
+			return false;
+	}
+	return *index < size || (append_ok && *index == size);
+}
+
+static const jsmntok_t *pointer_get(const char *buffer,
+				    const jsmntok_t *tok,
+				    const char **path)
+{
+	size_t i, index;
+
+	for (i = 0; tok && i < tal_count(path); ++i) {
+		if (tok->type == JSMN_OBJECT)
+			tok = get_member(buffer, tok, path[i]);
+		else if (tok->type == JSMN_ARRAY
+		      && array_index(path[i], tok->size, false, &index))
+			tok = json_get_arr(tok, index);
+		else
+			tok = NULL;
+	}
+	return tok;
+}
+
+/* Edits the value at the path, rebuilding each of the objects
+ * and arrays it passes through.  */
+static const char *pointer_edit(const tal_t *ctx,
+				const char *buffer,
+				const jsmntok_t *tok,
+				const char **path,
+				size_t depth,
+				enum json_patch_edit edit,
+				const char *newtext,
+				char **result)
+{
+	const char *name;
+	const jsmntok_t *member;
+	const jsmntok_t *key;
+	const jsmntok_t *entry;
+	const char *sep = "";
+	const char *error;
+	char *inner;
+	bool last;
+	size_t i, index;
+
+	if (depth == tal_count(path)) {
+		/* The entire value.  */
+		if (!tok && edit != EDIT_ADD)
+			return tal_fmt(ctx, "there is no value");
+		*result = edit == EDIT_REMOVE ? NULL
+					      : tal_strdup(ctx, newtext);
+		return NULL;
+	}
+	if (!tok)
+		return tal_fmt(ctx, "there is no value");
+
+	name = path[depth];
+	last = depth + 1 == tal_count(path);
+
+	if (tok->type == JSMN_OBJECT) {
+		member = get_member(buffer, tok, name);
+		if (!member && !(last && edit == EDIT_ADD))
+			return tal_fmt(ctx, "there is no member '%s'", name);
+		if (last)
+			inner = edit == EDIT_REMOVE ? NULL
+						    : tal_strdup(tmpctx,
+								 newtext);
+		else {
+			error = pointer_edit(ctx, buffer, member,
+					     path, depth + 1,
+					     edit, newtext, &inner);
+			if (error)
+				return error;
+		}
+
+		*result = tal_strdup(ctx, "{");
+		json_for_each_obj (i, key, tok) {
+			if (key + 1 == member) {
+				if (!inner)
+					continue;
+				tal_append_fmt(result, "%s%.*s: %s", sep,
+					       json_tok_full_len(key),
+					       json_tok_full(buffer, key),
+					       inner);
+			} else
+				tal_append_fmt(result, "%s%.*s: %.*s", sep,
+					       json_tok_full_len(key),
+					       json_tok_full(buffer, key),
+					       json_tok_full_len(key + 1),
+					       json_tok_full(buffer, key + 1));
+			sep = ", ";
+		}
+		if (!member)
+			tal_append_fmt(result, "%s\"%s\": %s", sep,
+				       json_escape(tmpctx, name)->s, inner);
+		tal_append_fmt(result, "}");
+		return NULL;
+	}
+
+	if (tok->type == JSMN_ARRAY) {
+		if (!array_index(name, tok->size, last && edit == EDIT_ADD,
+				 &index))
+			return tal_fmt(ctx, "there is no entry '%s'", name);
+		if (last)
+			inner = edit == EDIT_REMOVE ? NULL
+						    : tal_strdup(tmpctx,
+								 newtext);
+		else {
+			error = pointer_edit(ctx, buffer,
+					     json_get_arr(tok, index),
+					     path, depth + 1,
+					     edit, newtext, &inner);
+			if (error)
+				return error;
+		}
+
+		*result = tal_strdup(ctx, "[");
+		json_for_each_arr (i, entry, tok) {
+			if (i == index) {
+				if (inner) {
+					tal_append_fmt(result, "%s%s",
+						       sep, inner);
+					sep = ", ";
+				}
+				/* Adding inserts before the entry.  */
+				if (!(last && edit == EDIT_ADD))
+					continue;
+			}
+			tal_append_fmt(result, "%s%.*s", sep,
+				       json_tok_full_len(entry),
+				       json_tok_full(buffer, entry));
+			sep = ", ";
+		}
+		if (index == tok->size)
+			tal_append_fmt(result, "%s%s", sep, inner);
+		tal_append_fmt(result, "]");
+		return NULL;
+	}
+
+	return tal_fmt(ctx, "%.*s has no member '%s'",
+		       json_tok_full_len(tok), json_tok_full(buffer, tok),
+		       name);
+}
+
+/* Whether the path is a proper descendant of the ancestor.  */
+static bool path_is_within(const char **path, const char **ancestor)
+{
+	size_t i;
+
+	if (tal_count(path) <= tal_count(ancestor))
+		return false;
+	for (i = 0; i < tal_count(ancestor); ++i)
+		if (!streq(path[i], ancestor[i]))
+			return false;
+	return true;
+}
+
+/* Edits the value in place, reparsing it.  */
+static const char *apply_edit(const tal_t *ctx,
+			      char **text,
+			      jsmntok_t **toks,
+			      const char **path,
+			      enum json_patch_edit edit,
+			      const char *newtext)
+{
+	const char *error;
+	char *result;
+
+	error = pointer_edit(ctx, *text, *toks, path, 0, edit, newtext,
+			     &result);
+	if (error)
+		return error;
+
+	*text = result;
+	*toks = NULL;
+	if (result)
+		*toks = json_parse_simple(ctx, result, strlen(result));
+	return NULL;
+}
+
+static const char *const json_patch_ops[] = {
+	"add", "remove", "replace", "move", "copy", "test"
+};
+
+const char *json_patch_check(const tal_t *ctx,
+			     const char *pbuffer,
+			     const jsmntok_t *patch)
+{
+	const jsmntok_t *op;
+	const jsmntok_t *name;
+	size_t i, j;
+
+	if (patch->type != JSMN_ARRAY)
+		return tal_fmt(ctx, "patch must be an array of "
+				    "operations");
+
+	json_for_each_arr (i, op, patch) {
+		if (op->type != JSMN_OBJECT)
+			return tal_fmt(ctx, "patch operation %zu must be "
+					    "an object", i);
+		name = json_get_member(pbuffer, op, "op");
+		for (j = 0; name && j < ARRAY_SIZE(json_patch_ops); ++j)
+			if (json_tok_streq(pbuffer, name, json_patch_ops[j]))
+				break;
+		if (!name || j == ARRAY_SIZE(json_patch_ops))
+			return tal_fmt(ctx, "patch operation %zu has no "
+					    "valid 'op'", i);
+		if (!parse_pointer(tmpctx, pbuffer,
+				   json_get_member(pbuffer, op, "path")))
+			return tal_fmt(ctx, "patch operation %zu has no "
+					    "valid 'path'", i);
+		if ((json_tok_streq(pbuffer, name, "add")
+		  || json_tok_streq(pbuffer, name, "replace")
+		  || json_tok_streq(pbuffer, name, "test"))
+		 && !json_get_member(pbuffer, op, "value"))
+			return tal_fmt(ctx, "patch operation %zu has no "
+					    "'value'", i);
+		if ((json_tok_streq(pbuffer, name, "move")
+		  || json_tok_streq(pbuffer, name, "copy"))
+		 && !parse_pointer(tmpctx, pbuffer,
+				   json_get_member(pbuffer, op, "from")))
+			return tal_fmt(ctx, "patch operation %zu has no "
+					    "valid 'from'", i);
+	}
+	return NULL;
+}
+
+const char *json_patch(const tal_t *ctx,
+		       const char *buffer, const jsmntok_t *target,
+		       const char *pbuffer, const jsmntok_t *patch,
+		       char **result)
+{
+	const jsmntok_t *op;
+	const jsmntok_t *name;
+	const jsmntok_t *value;
+	const jsmntok_t *from_tok;
+	const char **path;
+	const char **from;
+	const char *error;
+	char *text;
+	jsmntok_t *toks;
+	size_t i;
+
+	text = NULL;
+	toks = NULL;
+	if (target) {
+		text = json_tok_text(tmpctx, buffer, target);
+		toks = json_parse_simple(tmpctx, text, strlen(text));
+	}
+
+	json_for_each_arr (i, op, patch) {
+		name = json_get_member(pbuffer, op, "op");
+		path = parse_pointer(tmpctx, pbuffer,
+				     json_get_member(pbuffer, op, "path"));
+		from = parse_pointer(tmpctx, pbuffer,
+				     json_get_member(pbuffer, op, "from"));
+		value = json_get_member(pbuffer, op, "value");
+
+		if (json_tok_streq(pbuffer, name, "add"))
+			error = apply_edit(tmpctx, &text, &toks, path,
+					   EDIT_ADD,
+					   json_tok_text(tmpctx, pbuffer, value));
+		else if (json_tok_streq(pbuffer, name, "remove"))
+			error = apply_edit(tmpctx, &text, &toks, path,
+					   EDIT_REMOVE, NULL);
+		else if (json_tok_streq(pbuffer, name, "replace"))
+			error = apply_edit(tmpctx, &text, &toks, path,
+					   EDIT_REPLACE,
+					   json_tok_text(tmpctx, pbuffer, value));
+		else if (json_tok_streq(pbuffer, name, "test")) {
+			from_tok = pointer_get(text, toks, path);
+			error = NULL;
+			if (!from_tok
+			 || !json_equal(text, from_tok, pbuffer, value))
+				error = tal_fmt(tmpctx, "test failed");
+		} else {
+			/* Moving or copying.  */
+			from_tok = pointer_get(text, toks, from);
+			if (!from_tok)
+				error = tal_fmt(tmpctx, "there is no value "
+							"to %.*s",
+						json_tok_full_len(name),
+						json_tok_full(pbuffer, name));
+			else if (json_tok_streq(pbuffer, name, "copy"))
+				error = apply_edit(tmpctx, &text, &toks, path,
+						   EDIT_ADD,
+						   json_tok_text(tmpctx, text,
+								 from_tok));
+			else if (path_is_within(path, from))
+				error = tal_fmt(tmpctx, "cannot move a value "
+							"into itself");
+			else {
+				char *moved = json_tok_text(tmpctx, text,
+							    from_tok);
+				error = apply_edit(tmpctx, &text, &toks, from,
+						   EDIT_REMOVE, NULL);
+				if (!error)
+					error = apply_edit(tmpctx,
+							   &text, &toks,
+							   path, EDIT_ADD,
+							   moved);
+			}
+		}
+		if (error)
+			return tal_fmt(ctx, "patch operation %zu: %s",
+				       i, error);
+	}
+
+	*result = text ? tal_steal(ctx, text) : NULL;
+	return NULL;
+}
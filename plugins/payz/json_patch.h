@@ -0,0 +1,56 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_JSON_PATCH_H
+#define LIGHTNING_PLUGINS_PAYZ_JSON_PATCH_H
+#include"config.h"
+#include<ccan/tal/tal.h>
+#include<common/json.h>
+
+/** json_merge_patch
+ *
+ * @brief Applies an RFC 7386 JSON Merge Patch.
+ *
+ * @param ctx - the owner of the returned text.
+ * @param buffer - the buffer containing the target.
+ * @param target - the value to patch, or NULL if absent.
+ * @param pbuffer - the buffer containing the patch.
+ * @param patch - the merge patch.
+ *
+ * @return - the JSON text of the patched value, or NULL if
+ * the patched value is null.
+ */
+char *json_merge_patch(const tal_t *ctx,
+		       const char *buffer, const jsmntok_t *target,
+		       const char *pbuffer, const jsmntok_t *patch);
+
+/** json_patch_check
+ *
+ * @brief Checks that an RFC 6902 JSON Patch is well-formed.
+ *
+ * @return - NULL if it is, or an error message allocated from
+ * ctx.
+ */
+const char *json_patch_check(const tal_t *ctx,
+			     const char *pbuffer,
+			     const jsmntok_t *patch);
+
+/** json_patch
+ *
+ * @brief Applies an RFC 6902 JSON Patch, which must have passed
+ * json_patch_check.
+ *
+ * @param ctx - the owner of the returned text or error.
+ * @param buffer - the buffer containing the target.
+ * @param target - the value to patch, or NULL if absent.
+ * @param pbuffer - the buffer containing the patch.
+ * @param patch - the array of patch operations.
+ * @param result - set to the JSON text of the patched value,
+ * or NULL if the operations removed the entire value.
+ *
+ * @return - NULL on success, or an error message allocated
+ * from ctx if an operation fails.
+ */
+const char *json_patch(const tal_t *ctx,
+		       const char *buffer, const jsmntok_t *target,
+		       const char *pbuffer, const jsmntok_t *patch,
+		       char **result);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_JSON_PATCH_H */
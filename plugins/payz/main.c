@@ -4,6 +4,7 @@
 #include<common/utils.h>
 #include<plugins/libplugin.h>
 #include<plugins/payz/main.h>
+#include<plugins/payz/payecs_code.h>
 #include<plugins/payz/top.h>
 
 int payz_main(int argc, char **argv,
@@ -32,6 +33,52 @@ int payz_main(int argc, char **argv,
 		    plugin_option(disablempp_option, "flag",
 				  "Disable multi-part payments.",
 				  flag_option, &payz_top->disablempp),
+		    plugin_option("payecs-dispatch-per-tick", "int",
+				  "Maximum number of Payment ECS systems to "
+				  "invoke per event loop iteration, 0 for "
+				  "no limit.",
+				  u32_option, &payz_top->dispatch_per_tick),
+		    plugin_option("payecs-step-budget", "int",
+				  "Maximum number of Payment ECS systems to "
+				  "launch on a single entity, 0 for no "
+				  "limit.",
+				  u32_option, &payz_top->step_budget),
+		    plugin_option("payecs-systrace-bytes", "int",
+				  "Size in bytes of the buffer of recent "
+				  "Payment ECS system invocations kept for "
+				  "payecs_systrace.",
+				  u64_option, &payz_top->systrace_bytes),
+		    plugin_option("payecs-systrace-level", "string",
+				  "How much of each Payment ECS system "
+				  "invocation to keep for payecs_systrace: "
+				  "off, headers, or full.",
+				  payecs_systrace_level_option,
+				  &payz_top->systrace_level),
+		    plugin_option("payecs-systrace-sample", "int",
+				  "Keep Payment ECS system invocations for "
+				  "payecs_systrace for only one in this many "
+				  "entities.",
+				  u32_option, &payz_top->systrace_sample),
+		    plugin_option("payecs-systrace-log", "string",
+				  "Path of a trace log to also write the "
+				  "records of payecs_systrace to, for reading "
+				  "with payz-tracelog.",
+				  charp_option, &payz_top->systrace_log),
+		    plugin_option("payecs-systrace-log-segments", "int",
+				  "Number of 8 MiB segments of the "
+				  "payecs-systrace-log to keep, 0 to keep "
+				  "all.",
+				  u32_option,
+				  &payz_top->systrace_log_segments),
+		    plugin_option("payecs-tracedump", "flag",
+				  "Record spans of Payment ECS entity "
+				  "processing for payecs_tracedump from the "
+				  "start.",
+				  flag_option, &payz_top->tracedump),
+		    plugin_option("payecs-trace-file", "string",
+				  "File to continuously write a Chrome trace "
+				  "of Payment ECS entity processing to.",
+				  charp_option, &payz_top->trace_file),
 		    NULL);
 
 	shutdown_payz_top();
@@ -1,10 +1,13 @@
 #include"payecs_code.h"
 #include<assert.h>
 #include<ccan/array_size/array_size.h>
+#include<ccan/cast/cast.h>
 #include<ccan/compiler/compiler.h>
+#include<ccan/intmap/intmap.h>
 #include<ccan/json_out/json_out.h>
 #include<ccan/likely/likely.h>
 #include<ccan/list/list.h>
+#include<ccan/mem/mem.h>
 #include<ccan/str/str.h>
 #include<ccan/tal/str/str.h>
 #include<ccan/strmap/strmap.h>
@@ -14,10 +17,15 @@
 #include<common/json_tok.h>
 #include<common/jsonrpc_errors.h>
 #include<common/param.h>
+#include<common/utils.h>
+#include<errno.h>
 #include<plugins/payz/ecs/ecs.h>
 #include<plugins/payz/parsing.h>
 #include<plugins/payz/setsystems.h>
 #include<plugins/payz/top.h>
+#include<plugins/payz/tracelog.h>
+#include<plugins/payz/tracering.h>
+#include<stdio.h>
 #include<string.h>
 #include<time.h>
 
@@ -34,6 +42,10 @@ payecs_advance(struct command *cmd,
 	       const char *buf,
 	       const jsmntok_t *params);
 static struct command_result *
+payecs_advance_batch(struct command *cmd,
+		     const char *buf,
+		     const jsmntok_t *params);
+static struct command_result *
 payecs_getdefaultsystems(struct command *cmd,
 			 const char *buf,
 			 const jsmntok_t *params);
@@ -45,19 +57,63 @@ static struct command_result *
 payecs_systrace(struct command *cmd,
 		const char *buf,
 		const jsmntok_t *params);
+static struct command_result *
+payecs_systraceconfig(struct command *cmd,
+		      const char *buf,
+		      const jsmntok_t *params);
+static struct command_result *
+payecs_schedstats(struct command *cmd,
+		  const char *buf,
+		  const jsmntok_t *params);
+static struct command_result *
+payecs_sysstats(struct command *cmd,
+		const char *buf,
+		const jsmntok_t *params);
+static struct command_result *
+payecs_flowprofile(struct command *cmd,
+		   const char *buf,
+		   const jsmntok_t *params);
+static struct command_result *
+payecs_tracedump(struct command *cmd,
+		 const char *buf,
+		 const jsmntok_t *params);
+static struct command_result *
+payecs_tracedumpconfig(struct command *cmd,
+		       const char *buf,
+		       const jsmntok_t *params);
 
 static struct command_result *
 payecs_system_notification(struct command *cmd,
 			   const char *buf,
 			   const jsmntok_t *params);
+static struct command_result *
+payecs_system_batch_notification(struct command *cmd,
+				 const char *buf,
+				 const jsmntok_t *params);
+
+static void payecs_systrace_add(struct plugin *plugin,
+				const char *buf,
+				const jsmntok_t *params);
 
 const struct plugin_command payecs_code_commands[] = {
 	{
 		"payecs_newsystem",
 		"payment",
-		"Register a new {system}, which will invoke {command} if "
+		"Register a new {system}, which will be invoked if "
 		"it is used in an entity with all {required} components and "
-		"with none of the {disallowed} components.",
+		"with none of the {disallowed} components, by calling "
+		"{method} if given, or by broadcasting the "
+		"`payecs_system_invoke` notification if not.  "
+		"If {max_batch} is given, the system is invoked with "
+		"batches of up to that many entities, each waiting at "
+		"most {batch_deadline_msec}.  "
+		"If {passed} is given, only those components, or fields "
+		"of components, are passed to the system.  "
+		"If {writes} is given, the system may be launched "
+		"together with other systems that do not conflict "
+		"with those writes.  "
+		"If {deadline_msec} is given, entities the system does "
+		"not advance within that time are failed.",
 		"Register new system.",
 		&payecs_newsystem
 	},
@@ -68,6 +124,15 @@ const struct plugin_command payecs_code_commands[] = {
 		"Advance entity processing.",
 		&payecs_advance
 	},
+	{
+		"payecs_advance_batch",
+		"payment",
+		"Advance the processing of systems of each of the given "
+		"{entities}, returning the errors of those that could not "
+		"be advanced.",
+		"Advance processing of multiple entities.",
+		&payecs_advance_batch
+	},
 	{
 		"payecs_getdefaultsystems",
 		"payment",
@@ -80,7 +145,8 @@ const struct plugin_command payecs_code_commands[] = {
 		"payment",
 		"Set the given {entity} to use the built-in systmes for "
 		"normal payment flow, optionally adding {prepend}ed and "
-		"{append}ed systems.",
+		"{append}ed systems, and optionally setting its scheduling "
+		"{priority}.",
 		"Set entity to use normal payment flow, possibly with "
 		"additional systems.",
 		&payecs_setdefaultsystems
@@ -92,6 +158,58 @@ const struct plugin_command payecs_code_commands[] = {
 		"specified {entity}.",
 		"Trace the systems that ran on the given entity.",
 		&payecs_systrace
+	},
+	{
+		"payecs_systraceconfig",
+		"payment",
+		"Optionally set the {level} of detail of the systrace, "
+		"trace only one in {sample} entities, or only one in "
+		"a given number of entities for each of the given "
+		"{systems}, and return the systrace configuration.",
+		"Configure the systrace.",
+		&payecs_systraceconfig
+	},
+	{
+		"payecs_schedstats",
+		"payment",
+		"Return the depth and wait-time statistics of the queue "
+		"of entities waiting for their systems to be invoked.",
+		"Return system scheduling statistics.",
+		&payecs_schedstats
+	},
+	{
+		"payecs_sysstats",
+		"payment",
+		"Return the invocation counts and service-time histograms "
+		"of each registered system, or only the given {system}.",
+		"Return per-system dispatch statistics.",
+		&payecs_sysstats
+	},
+	{
+		"payecs_flowprofile",
+		"payment",
+		"Optionally {enable} or disable profiling of the cost of "
+		"matching systems, and return the profile of each flow "
+		"with suggestions for reordering its systems.",
+		"Profile the matching cost of flows.",
+		&payecs_flowprofile
+	},
+	{
+		"payecs_tracedump",
+		"payment",
+		"Return the recent spans of time spent on the entities "
+		"of the given {main} entity, in the Chrome trace event "
+		"format.",
+		"Dump a Chrome trace of entity processing.",
+		&payecs_tracedump
+	},
+	{
+		"payecs_tracedumpconfig",
+		"payment",
+		"Optionally {enable} or disable recording of spans for "
+		"payecs_tracedump, and return whether it is enabled.",
+		"Configure the trace dump.",
+		&payecs_tracedumpconfig
 	}
 };
 const size_t num_payecs_code_commands = ARRAY_SIZE(payecs_code_commands);
@@ -100,12 +218,17 @@ const struct plugin_notification payecs_code_notifications[] = {
 	{
 		ECS_SYSTEM_NOTIFICATION,
 		&payecs_system_notification
+	},
+	{
+		ECS_SYSTEM_BATCH_NOTIFICATION,
+		&payecs_system_batch_notification
 	}
 };
 const size_t num_payecs_code_notifications = ARRAY_SIZE(payecs_code_notifications);
 
 const char *payecs_code_topics[] = {
-	ECS_SYSTEM_NOTIFICATION
+	ECS_SYSTEM_NOTIFICATION,
+	ECS_SYSTEM_BATCH_NOTIFICATION
 };
 const size_t num_payecs_code_topics = ARRAY_SIZE(payecs_code_topics);
 
@@ -131,10 +254,10 @@ struct payecs_external_system {
 	/* The name of the system.  */
 	const char *system;
 	/* The components required by the system.
-	 * We will pass in these components to the system (to
-	 * reduce RPC-call overhead for components the system
-	 * is likely to want to look up anyway), so store them
-	 * here.
+	 * Unless `passed` is given, we will pass in these
+	 * components to the system (to reduce RPC-call overhead
+	 * for components the system is likely to want to look up
+	 * anyway).
 	 */
 	const char **required;
 	/* The components disallowed for matching the
@@ -144,6 +267,22 @@ struct payecs_external_system {
 	 * subsequent calls to `payecs_newsystem` as idempotent.
 	 */
 	const char **disallowed;
+	/* The RPC method to call to invoke the system, or NULL
+	 * to broadcast `payecs_system_invoke` instead.  */
+	const char *method;
+	/* The maximum batch size, or 0 if not batched.  */
+	u32 max_batch;
+	/* The flush deadline of batches, in milliseconds.  */
+	u32 batch_deadline_msec;
+	/* The components passed to the system, or NULL to pass
+	 * the required components.  */
+	struct ecsys_passed *passed;
+	/* The components the system may write, or NULL if not
+	 * declared.  */
+	const char **writes;
+	/* How long the system may hold an entity, in
+	 * milliseconds, or 0 for no limit.  */
+	u32 deadline_msec;
 };
 
 static bool payecs_registry_initialized = false;
@@ -158,6 +297,33 @@ static void payecs_registry_init_if_needed(void)
 	payecs_registry_initialized = true;
 }
 
+/* Determine if two `passed` specifications are the same.  */
+static bool passed_eq(const struct ecsys_passed *a,
+		      const struct ecsys_passed *b)
+{
+	size_t i, j;
+
+	if (!a || !b)
+		return !a == !b;
+	if (tal_count(a) != tal_count(b))
+		return false;
+	for (i = 0; i < tal_count(a); ++i) {
+		if (!streq(a[i].component, b[i].component))
+			return false;
+		if (!a[i].fields || !b[i].fields) {
+			if (!a[i].fields != !b[i].fields)
+				return false;
+			continue;
+		}
+		if (tal_count(a[i].fields) != tal_count(b[i].fields))
+			return false;
+		for (j = 0; j < tal_count(a[i].fields); ++j)
+			if (!streq(a[i].fields[j], b[i].fields[j]))
+				return false;
+	}
+	return true;
+}
+
 /** payecs_register
  *
  * @brief Add an entry to the registry.
@@ -167,6 +333,18 @@ static void payecs_registry_init_if_needed(void)
  * required for this system to trigger.
  * @param disallowed - an array of component names that
  * must not exist for this system to trigger.
+ * @param method - the RPC method to invoke the system
+ * with, or NULL.
+ * @param max_batch - the maximum number of entities to
+ * invoke the system with at once, or 0 to not batch.
+ * @param batch_deadline_msec - the maximum time an entity
+ * waits in a batch.
+ * @param passed - the components to pass to the system, or
+ * NULL to pass the required components.
+ * @param writes - the components the system may write, or
+ * NULL if not declared.
+ * @param deadline_msec - the time the system may hold an
+ * entity, or 0 for no limit.
  *
  * @return - True if registration was OK (system does not
  * exist, or system exists but has exactly the same
@@ -176,7 +354,13 @@ static void payecs_registry_init_if_needed(void)
  */
 static bool payecs_register(const char *system TAKES,
 			    const char **required TAKES,
-			    const char **disallowed TAKES)
+			    const char **disallowed TAKES,
+			    const char *method TAKES,
+			    u32 max_batch,
+			    u32 batch_deadline_msec,
+			    const struct ecsys_passed *passed TAKES,
+			    const char **writes TAKES,
+			    u32 deadline_msec)
 {
 	struct payecs_external_system *exsys;
 
@@ -198,6 +382,17 @@ static bool payecs_register(const char *system TAKES,
 			ok = streq(required[i], exsys->required[i]);
 		for (i = 0; ok && i < tal_count(disallowed); ++i)
 			ok = streq(disallowed[i], exsys->disallowed[i]);
+		ok = ok && (!method == !exsys->method);
+		ok = ok && (!method || streq(method, exsys->method));
+		ok = ok && (max_batch == exsys->max_batch);
+		ok = ok && (batch_deadline_msec == exsys->batch_deadline_msec);
+		ok = ok && passed_eq(passed, exsys->passed);
+		ok = ok && (!writes == !exsys->writes);
+		ok = ok &&
+		     (tal_count(writes) == tal_count(exsys->writes));
+		for (i = 0; ok && i < tal_count(writes); ++i)
+			ok = streq(writes[i], exsys->writes[i]);
+		ok = ok && (deadline_msec == exsys->deadline_msec);
 
 		/* Regardless of result, we will not use the
 		 * arguments, so free them if taken.  */
@@ -207,6 +402,17 @@ static bool payecs_register(const char *system TAKES,
 			tal_free(required);
 		if (taken(disallowed))
 			tal_free(disallowed);
+		if (taken(method))
+			tal_free(method);
+		if (taken(passed))
+			tal_free(passed);
+		if (taken(writes))
+			tal_free(writes);
+
+		/* The plugin providing the method may have been
+		 * restarted, and be registering its systems again.  */
+		if (ok && exsys->method)
+			ecs_retry_method(payz_top->ecs, exsys->system);
 
 		return ok;
 	}
@@ -223,6 +429,12 @@ static bool payecs_register(const char *system TAKES,
 			tal_free(required);
 		if (taken(disallowed))
 			tal_free(disallowed);
+		if (taken(method))
+			tal_free(method);
+		if (taken(passed))
+			tal_free(passed);
+		if (taken(writes))
+			tal_free(writes);
 
 		return false;
 	}
@@ -248,6 +460,44 @@ static bool payecs_register(const char *system TAKES,
 			exsys->disallowed[i] = tal_strdup(exsys,
 							  disallowed[i]);
 	}
+	exsys->method = method ? tal_strdup(exsys, method) : NULL;
+	if (!writes)
+		exsys->writes = NULL;
+	else if (taken(writes))
+		exsys->writes = tal_steal(exsys, writes);
+	else {
+		exsys->writes = tal_arr(exsys, const char *,
+					tal_count(writes));
+		for (i = 0; i < tal_count(writes); ++i)
+			exsys->writes[i] = tal_strdup(exsys, writes[i]);
+	}
+	exsys->max_batch = max_batch;
+	exsys->batch_deadline_msec = batch_deadline_msec;
+	exsys->deadline_msec = deadline_msec;
+	if (!passed)
+		exsys->passed = NULL;
+	else if (taken(passed))
+		exsys->passed = cast_const(struct ecsys_passed *,
+					   tal_steal(exsys, passed));
+	else {
+		exsys->passed = tal_dup_talarr(exsys, struct ecsys_passed,
+					       passed);
+		for (i = 0; i < tal_count(passed); ++i) {
+			struct ecsys_passed *p = &exsys->passed[i];
+			size_t j;
+
+			p->component = tal_strdup(exsys->passed,
+						  passed[i].component);
+			if (!passed[i].fields)
+				continue;
+			p->fields = tal_dup_talarr(exsys->passed,
+						   const char *,
+						   passed[i].fields);
+			for (j = 0; j < tal_count(p->fields); ++j)
+				p->fields[j] = tal_strdup(p->fields,
+							  p->fields[j]);
+		}
+	}
 
 	/* Add it to our externals registry.  */
 	payecs_registry_init_if_needed();
@@ -259,8 +509,21 @@ static bool payecs_register(const char *system TAKES,
 		ecs_register_require(&reg, exsys->required[i]);
 	for (i = 0; i < tal_count(exsys->disallowed); ++i)
 		ecs_register_disallow(&reg, exsys->disallowed[i]);
+	if (exsys->method)
+		ecs_register_method(&reg, exsys->method);
 	ecs_register_done(&reg);
 	ecs_register(payz_top->ecs, take(reg));
+	if (exsys->max_batch != 0)
+		ecs_set_batch(payz_top->ecs, exsys->system,
+			      exsys->max_batch,
+			      time_from_msec(exsys->batch_deadline_msec));
+	if (exsys->passed)
+		ecs_set_passed(payz_top->ecs, exsys->system, exsys->passed);
+	if (exsys->writes)
+		ecs_set_writes(payz_top->ecs, exsys->system, exsys->writes);
+	if (exsys->deadline_msec != 0)
+		ecs_set_deadline(payz_top->ecs, exsys->system,
+				 time_from_msec(exsys->deadline_msec));
 
 	return true;
 }
@@ -269,6 +532,67 @@ static bool payecs_register(const char *system TAKES,
 System Registration Command
 -----------------------------------------------------------------------------*/
 
+/** param_array_of_passed
+ *
+ * @brief Parses the `passed` argument of `payecs_newsystem`,
+ * an array whose entries are either a component name, or an
+ * object with a `component` name and an array of `fields`.
+ */
+static struct command_result *
+param_array_of_passed(struct command *cmd,
+		      const char *name,
+		      const char *buffer,
+		      const jsmntok_t *tok,
+		      struct ecsys_passed **passed)
+{
+	const jsmntok_t *entry;
+	const jsmntok_t *component;
+	const jsmntok_t *fields;
+	const jsmntok_t *field;
+	size_t i, j;
+
+	if (tok->type != JSMN_ARRAY)
+		goto fail;
+
+	*passed = tal_arr(cmd, struct ecsys_passed, tok->size);
+	json_for_each_arr (i, entry, tok) {
+		struct ecsys_passed *p = &(*passed)[i];
+
+		if (entry->type == JSMN_STRING) {
+			p->component = json_strdup(*passed, buffer, entry);
+			p->fields = NULL;
+			continue;
+		}
+		if (entry->type != JSMN_OBJECT)
+			goto fail;
+
+		component = json_get_member(buffer, entry, "component");
+		fields = json_get_member(buffer, entry, "fields");
+		if (!component || component->type != JSMN_STRING)
+			goto fail;
+		p->component = json_strdup(*passed, buffer, component);
+		if (!fields) {
+			p->fields = NULL;
+			continue;
+		}
+		if (fields->type != JSMN_ARRAY)
+			goto fail;
+		p->fields = tal_arr(*passed, const char *, fields->size);
+		json_for_each_arr (j, field, fields) {
+			if (field->type != JSMN_STRING)
+				goto fail;
+			p->fields[j] = json_strdup(p->fields, buffer, field);
+		}
+	}
+
+	return NULL;
+
+fail:
+	return command_fail_badparam(cmd, name, buffer, tok,
+				     "should be an array of component names "
+				     "or {component, fields} objects.");
+}
+
 static struct command_result *
 payecs_newsystem(struct command *cmd,
 		 const char *buf,
@@ -277,6 +601,13 @@ payecs_newsystem(struct command *cmd,
 	const char *system;
 	const char **required;
 	const char **disallowed;
+	const char *method;
+	unsigned int *max_batch;
+	unsigned int *batch_deadline_msec;
+	struct ecsys_passed *passed;
+	const char **writes;
+	unsigned int *deadline_msec;
+	size_t i;
 
 	if (!param(cmd, buf, params,
 		   p_req("system", &param_string, &system),
@@ -284,10 +615,36 @@ payecs_newsystem(struct command *cmd,
 			 &required),
 		   p_opt("disallowed", &param_array_of_strings,
 			 &disallowed),
+		   p_opt("method", &param_string, &method),
+		   p_opt_def("max_batch", &param_number, &max_batch, 0),
+		   p_opt_def("batch_deadline_msec", &param_number,
+			     &batch_deadline_msec, 0),
+		   p_opt("passed", &param_array_of_passed, &passed),
+		   p_opt("writes", &param_array_of_strings, &writes),
+		   p_opt_def("deadline_msec", &param_number,
+			     &deadline_msec, 0),
 		   NULL))
 		return command_param_failed();
 
-	if (!payecs_register(system, take(required), take(disallowed)))
+	if (*max_batch == 0 && *batch_deadline_msec != 0)
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "`batch_deadline_msec` requires "
+				    "`max_batch`");
+
+	for (i = 0; i < tal_count(writes); ++i) {
+		const char *star = strchr(writes[i], '*');
+		if (star && star[1] != '\0')
+			return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+					    "`writes` may only have `*` at "
+					    "the end: %s",
+					    writes[i]);
+	}
+
+	if (!payecs_register(system, take(required), take(disallowed),
+			     method, *max_batch, *batch_deadline_msec,
+			     passed ? take(passed) : NULL,
+			     writes ? take(writes) : NULL,
+			     *deadline_msec))
 		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
 				    "Conflict with existing `system`: %s",
 				    system);
@@ -354,32 +711,142 @@ payecs_advance_ok(struct plugin *plugin UNUSED, struct ecs *ecs UNUSED,
 	return command_success(cmd, json_out_obj(cmd, NULL, NULL));
 }
 
-static struct command_result *
-payecs_advance_ng(struct plugin *plugin UNUSED, struct ecs *ecs,
-		  errcode_t errcode,
-		  struct payecs_advance_closure *closure)
+/* Extract the message from the `error` field that a failed
+ * advance leaves in `lightningd:systems`.  */
+static const char *advance_error_message(const struct ecs *ecs,
+					 u32 entity)
 {
-	/* Fail!  */
-	struct command *cmd = closure->cmd;
-	u32 entity = closure->entity;
-
 	const char *compbuf;
 	const jsmntok_t *comptok;
 	const char *message;
 
 	const char *scan_err;
 
-	tal_steal(tmpctx, closure);
-
-	/* Extract message from `lightningd:systems` component.  */
 	ecs_get_component(ecs, &compbuf, &comptok,
 			  entity, "lightningd:systems");
 	scan_err = json_scan(tmpctx, compbuf, comptok,
 			     "{error:{message:%}}",
 			     JSON_SCAN_TAL(tmpctx, json_strdup, &message));
 	assert(!scan_err);
+	(void) scan_err;
+
+	return message;
+}
+
+static struct command_result *
+payecs_advance_ng(struct plugin *plugin UNUSED, struct ecs *ecs,
+		  errcode_t errcode,
+		  struct payecs_advance_closure *closure)
+{
+	/* Fail!  */
+	struct command *cmd = closure->cmd;
+	u32 entity = closure->entity;
+
+	tal_steal(tmpctx, closure);
+
+	return command_fail(cmd, errcode, "%s",
+			    advance_error_message(ecs, entity));
+}
+
+/** struct payecs_advance_batch_closure
+ *
+ * @brief Contains information about one entity of the
+ * advance_batch command given.
+ */
+struct payecs_advance_batch_closure {
+	struct json_stream *out;
+	u32 entity;
+};
+
+static struct command_result *
+payecs_advance_batch_ok(struct plugin *, struct ecs *,
+			struct payecs_advance_batch_closure *);
+static struct command_result *
+payecs_advance_batch_ng(struct plugin *, struct ecs *,
+			errcode_t errcode,
+			struct payecs_advance_batch_closure *);
+
+static struct command_result *
+payecs_advance_batch(struct command *cmd,
+		     const char *buf,
+		     const jsmntok_t *params)
+{
+	const jsmntok_t *entities;
+	const jsmntok_t *t;
+	u32 *ids;
+	size_t i;
+
+	struct json_stream *out;
+
+	if (!param(cmd, buf, params,
+		   p_req("entities", &param_array, &entities),
+		   NULL))
+		return command_param_failed();
+
+	/* Validate all before advancing any.  */
+	ids = tal_arr(cmd, u32, entities->size);
+	json_for_each_arr (i, t, entities) {
+		if (!json_to_u32(buf, t, &ids[i]))
+			return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+					    "`entities` must be an array of "
+					    "entity IDs, not '%.*s'",
+					    json_tok_full_len(t),
+					    json_tok_full(buf, t));
+	}
+
+	out = jsonrpc_stream_success(cmd);
+	payecs_json_advance(out, "errors", cmd->plugin, ids);
+
+	return command_finished(cmd, out);
+}
 
-	return command_fail(cmd, errcode, "%s", message);
+void payecs_json_advance(struct json_stream *out,
+			 const char *fieldname,
+			 struct plugin *plugin,
+			 const u32 *entities)
+{
+	struct payecs_advance_batch_closure *closure;
+	size_t i;
+
+	json_array_start(out, fieldname);
+	for (i = 0; i < tal_count(entities); ++i) {
+		closure = tal(tmpctx, struct payecs_advance_batch_closure);
+		closure->out = out;
+		closure->entity = entities[i];
+		/* The callbacks are called before ecs_advance
+		 * returns.  */
+		(void) ecs_advance(plugin, payz_top->ecs, entities[i],
+				   &payecs_advance_batch_ok,
+				   &payecs_advance_batch_ng,
+				   closure);
+	}
+	json_array_end(out);
+}
+
+static struct command_result *
+payecs_advance_batch_ok(struct plugin *plugin UNUSED, struct ecs *ecs UNUSED,
+			struct payecs_advance_batch_closure *closure)
+{
+	tal_free(closure);
+	return NULL;
+}
+
+static struct command_result *
+payecs_advance_batch_ng(struct plugin *plugin UNUSED, struct ecs *ecs,
+			errcode_t errcode,
+			struct payecs_advance_batch_closure *closure)
+{
+	struct json_stream *out = closure->out;
+
+	json_object_start(out, NULL);
+	json_add_u32(out, "entity", closure->entity);
+	json_add_errcode(out, "code", errcode);
+	json_add_string(out, "message",
+			advance_error_message(ecs, closure->entity));
+	json_object_end(out);
+
+	tal_free(closure);
+	return NULL;
 }
 
 /*-----------------------------------------------------------------------------
@@ -428,6 +895,8 @@ payecs_setdefaultsystems(struct command *cmd,
 	unsigned int *entity;
 	const char **prepend;
 	const char **append;
+	const char *priority;
+	enum ecready_priority priority_class;
 
 	size_t i;
 
@@ -440,9 +909,16 @@ payecs_setdefaultsystems(struct command *cmd,
 		   p_req("entity", &param_number, &entity),
 		   p_opt("prepend", &param_array_of_strings, &prepend),
 		   p_opt("append", &param_array_of_strings, &append),
+		   p_opt("priority", &param_string, &priority),
 		   NULL))
 		return command_param_failed();
 
+	if (priority &&
+	    !ecready_priority_from_name(priority, &priority_class))
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "Unknown priority: %s",
+				    priority);
+
 	/* Validate the prepended and appended systems.  */
 	for (i = 0; i < tal_count(prepend); ++i)
 		if (!ecs_system_exists(payz_top->ecs, prepend[i]))
@@ -469,11 +945,289 @@ payecs_setdefaultsystems(struct command *cmd,
 	newcompbuf = json_out_contents(js->jout, &newcomplen);
 	newcomptok = json_parse_simple(tmpctx, newcompbuf, newcomplen);
 	payz_setsystems_tok(*entity, "systems", newcompbuf, newcomptok);
+	if (priority)
+		payz_setsystems(*entity, "priority",
+				tal_fmt(tmpctx, "\"%s\"",
+					ecready_priority_name(priority_class)));
 
 	/* Return empty object.  */
 	return command_success(cmd, json_out_obj(cmd, NULL, NULL));
 }
 
+/*-----------------------------------------------------------------------------
+Scheduling Statistics
+-----------------------------------------------------------------------------*/
+
+static struct command_result *
+payecs_schedstats(struct command *cmd,
+		  const char *buf,
+		  const jsmntok_t *params)
+{
+	struct json_stream *out;
+	struct ecready_stats stats;
+	u64 wait_mean_usec;
+	size_t i;
+
+	if (!param(cmd, buf, params, NULL))
+		return command_param_failed();
+
+	out = jsonrpc_stream_success(cmd);
+	json_add_u32(out, "dispatch_per_tick",
+		     ecs_get_dispatch_per_tick(payz_top->ecs));
+	json_array_start(out, "priorities");
+	for (i = 0; i < ECREADY_NUM_PRIORITIES; ++i) {
+		ecs_get_readystats(payz_top->ecs,
+				   (enum ecready_priority) i,
+				   &stats);
+		if (stats.dispatched != 0)
+			wait_mean_usec = time_to_usec(stats.total_wait)
+				       / stats.dispatched;
+		else
+			wait_mean_usec = 0;
+
+		json_object_start(out, NULL);
+		json_add_string(out, "priority",
+				ecready_priority_name((enum ecready_priority) i));
+		json_add_u64(out, "depth", stats.depth);
+		json_add_u64(out, "max_depth", stats.max_depth);
+		json_add_u64(out, "enqueued", stats.enqueued);
+		json_add_u64(out, "dispatched", stats.dispatched);
+		json_add_u64(out, "wait_mean_usec", wait_mean_usec);
+		json_add_u64(out, "wait_max_usec",
+			     time_to_usec(stats.max_wait));
+		json_object_end(out);
+	}
+	json_array_end(out);
+	return command_finished(cmd, out);
+}
+
+/*-----------------------------------------------------------------------------
+System Statistics
+-----------------------------------------------------------------------------*/
+
+static void json_add_sysstats(struct json_stream *out,
+			      const char *system,
+			      const struct ecsys_sysstats *stats)
+{
+	const struct echist *service = &stats->service;
+	u64 low, high;
+	size_t i;
+
+	json_object_start(out, NULL);
+	json_add_string(out, "system", system);
+	json_add_u64(out, "invoked", stats->invoked);
+	json_add_u64(out, "match_failures", stats->match_failures);
+	json_add_u64(out, "completed", stats->completed);
+	json_add_u64(out, "timeouts", stats->timeouts);
+	json_add_u64(out, "service_mean_usec",
+		     service->count ? service->sum / service->count : 0);
+	json_add_u64(out, "service_min_usec", service->min);
+	json_add_u64(out, "service_p50_usec",
+		     echist_percentile(service, 50));
+	json_add_u64(out, "service_p90_usec",
+		     echist_percentile(service, 90));
+	json_add_u64(out, "service_p99_usec",
+		     echist_percentile(service, 99));
+	json_add_u64(out, "service_max_usec", service->max);
+
+	/* Only the buckets that have something in them.  */
+	json_array_start(out, "histogram");
+	for (i = 0; i < ECHIST_NUM_BUCKETS; ++i) {
+		if (service->buckets[i] == 0)
+			continue;
+		echist_bucket_range(i, &low, &high);
+		json_object_start(out, NULL);
+		json_add_u64(out, "min_usec", low);
+		json_add_u64(out, "max_usec", high);
+		json_add_u64(out, "count", service->buckets[i]);
+		json_object_end(out);
+	}
+	json_array_end(out);
+	json_object_end(out);
+}
+
+static struct command_result *
+payecs_sysstats(struct command *cmd,
+		const char *buf,
+		const jsmntok_t *params)
+{
+	const char *system;
+	const char **systems;
+	const struct ecsys_sysstats *stats;
+	struct json_stream *out;
+	size_t i;
+
+	if (!param(cmd, buf, params,
+		   p_opt("system", param_string, &system),
+		   NULL))
+		return command_param_failed();
+
+	if (system) {
+		if (!ecs_get_sysstats(payz_top->ecs, system))
+			return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+					    "Unknown system: %s", system);
+		systems = tal_arr(cmd, const char *, 1);
+		systems[0] = system;
+	} else
+		systems = ecs_get_systems(cmd, payz_top->ecs);
+
+	out = jsonrpc_stream_success(cmd);
+	json_array_start(out, "systems");
+	for (i = 0; i < tal_count(systems); ++i) {
+		stats = ecs_get_sysstats(payz_top->ecs, systems[i]);
+		json_add_sysstats(out, systems[i], stats);
+	}
+	json_array_end(out);
+	return command_finished(cmd, out);
+}
+
+/*-----------------------------------------------------------------------------
+Flow Profiling
+-----------------------------------------------------------------------------*/
+
+/* Number of searches of a flow before we make suggestions.  */
+#define PAYECS_FLOWPROFILE_MIN_SEARCHES 10
+/* Mean number of systems evaluated per search, above which we
+ * suggest reactive entities.  */
+#define PAYECS_FLOWPROFILE_SCAN_THRESHOLD 8
+
+/* Suggest moving the system at position j earlier, to the
+ * position that saves the most evaluations.
+ * It may only move past systems that can never match at the
+ * same time as it, so that the first match is unchanged.  */
+static void json_add_reorder(struct json_stream *out,
+			     const struct ecsys_flowprofile *profile,
+			     size_t j)
+{
+	const char **systems = profile->systems;
+	s64 saving, best_saving;
+	size_t k, best;
+
+	best = j;
+	best_saving = 0;
+	for (k = j; k > 0; --k) {
+		if (!ecs_systems_exclusive(payz_top->ecs,
+					   systems[k - 1], systems[j]))
+			break;
+		/* Searches that matched at j skip the systems from
+		 * k - 1 on, but every other search that reaches
+		 * k - 1 now also evaluates j.  */
+		saving = (s64) profile->matched[j] * (j - (k - 1))
+		       - (s64) (profile->evaluated[k - 1]
+				- profile->matched[j]);
+		if (saving > best_saving) {
+			best = k - 1;
+			best_saving = saving;
+		}
+	}
+	if (best == j)
+		return;
+
+	json_add_string(out, NULL,
+			tal_fmt(tmpctx,
+				"Move %s before %s: they cannot match at "
+				"the same time, and this would have saved "
+				"%"PRIi64" evaluations.",
+				systems[j], systems[best], best_saving));
+}
+
+static void json_add_flowprofile(struct json_stream *out,
+				 const struct ecsys_flowprofile *profile)
+{
+	size_t nsystems = tal_count(profile->systems);
+	u64 evaluated, lookups;
+	size_t i;
+
+	evaluated = 0;
+	lookups = 0;
+	for (i = 0; i < nsystems; ++i) {
+		evaluated += profile->evaluated[i];
+		lookups += profile->lookups[i];
+	}
+
+	json_object_start(out, NULL);
+	json_array_start(out, "systems");
+	for (i = 0; i < nsystems; ++i)
+		json_add_string(out, NULL, profile->systems[i]);
+	json_array_end(out);
+	json_add_u64(out, "searches", profile->searches);
+	json_add_u64(out, "unmatched", profile->unmatched);
+	json_add_u64(out, "evaluated", evaluated);
+	json_add_u64(out, "lookups", lookups);
+
+	json_array_start(out, "positions");
+	for (i = 0; i < nsystems; ++i) {
+		json_object_start(out, NULL);
+		json_add_string(out, "system", profile->systems[i]);
+		json_add_u64(out, "evaluated", profile->evaluated[i]);
+		json_add_u64(out, "matched", profile->matched[i]);
+		json_add_u64(out, "lookups", profile->lookups[i]);
+		json_object_end(out);
+	}
+	json_array_end(out);
+
+	json_array_start(out, "suggestions");
+	if (profile->searches >= PAYECS_FLOWPROFILE_MIN_SEARCHES) {
+		for (i = 0; i < nsystems; ++i) {
+			if (profile->matched[i] != 0)
+				json_add_reorder(out, profile, i);
+			else if (profile->evaluated[i] != 0)
+				json_add_string(out, NULL,
+						tal_fmt(tmpctx,
+							"%s was evaluated "
+							"%"PRIu64" times and "
+							"never matched; "
+							"consider removing it "
+							"from this flow.",
+							profile->systems[i],
+							profile->evaluated[i]));
+		}
+		if (evaluated >= (u64) PAYECS_FLOWPROFILE_SCAN_THRESHOLD
+				 * profile->searches)
+			json_add_string(out, NULL,
+					tal_fmt(tmpctx,
+						"Each search evaluated %.1f "
+						"systems on average; consider "
+						"making these entities "
+						"reactive, so that only the "
+						"systems affected by a change "
+						"are evaluated.",
+						(double) evaluated
+						/ profile->searches));
+	}
+	json_array_end(out);
+
+	json_object_end(out);
+}
+
+static struct command_result *
+payecs_flowprofile(struct command *cmd,
+		   const char *buf,
+		   const jsmntok_t *params)
+{
+	bool *enable;
+	const struct ecsys_flowprofile **profiles;
+	struct json_stream *out;
+	size_t i;
+
+	if (!param(cmd, buf, params,
+		   p_opt("enable", param_bool, &enable),
+		   NULL))
+		return command_param_failed();
+
+	if (enable)
+		ecs_set_flowprofile(payz_top->ecs, *enable);
+
+	out = jsonrpc_stream_success(cmd);
+	json_add_bool(out, "enabled", ecs_get_flowprofile(payz_top->ecs));
+	json_array_start(out, "flows");
+	profiles = ecs_get_flowprofiles(cmd, payz_top->ecs);
+	for (i = 0; i < tal_count(profiles); ++i)
+		json_add_flowprofile(out, profiles[i]);
+	json_array_end(out);
+	return command_finished(cmd, out);
+}
+
 /*-----------------------------------------------------------------------------
 Systrace
 -----------------------------------------------------------------------------*/
@@ -484,52 +1238,301 @@ Systrace
  *
  * This is just a trace of the most recent `payecs_system_invoke`
  * notifications, recording the `params` given.
+ * They are kept in a fixed-size ring, so that recording does not
+ * allocate, and a lookup only visits the records of the entity
+ * asked for.
+ *
+ * To keep tracing cheap enough to leave on, records are kept in a
+ * binary form that is only rendered as JSON when queried, the
+ * `entity` object can be left out, and only a sample of entities
+ * can be traced.
+ *
+ * The records can also be written to a trace log on disk, which
+ * survives a crash, and is read by the separate `payz-tracelog`
+ * program.
  */
 
-/** struct payecs_systrace_entry
+/** struct payecs_systrace_system
  *
- * @brief Represents an entry into the global systrace entry.
+ * @brief A system that appears in the systrace, which records
+ * refer to by index rather than by name.
  */
-struct payecs_systrace_entry {
-	struct list_node list;
-
-	/** The entity this was triggered on.  */
-	u32 entity;
-
-	/** The JSON 'system' and `entity` we got from the RPC
-	 * notification, plus a 'time' field.
-	 * This is a nul-terminated C string containing formatted
-	 * JSON text.
-	 */
-	char *json;
+struct payecs_systrace_system {
+	const char *name;
+	u32 index;
+	/* Trace the invocations of this system on only one in this
+	 * many entities.  */
+	u32 sample;
 };
 
-/** payecs_systraces_remaining
+/** struct payecs_systrace_record
+ *
+ * @brief The binary format of a systrace record, which is only
+ * rendered as JSON when queried by `payecs_systrace`.
  *
- * @brief The number of systraces we will accept until we start
- * removing old entries.
+ * @desc It is followed by the nul-terminated `entity` object
+ * from the RPC notification, or by an empty string if only
+ * the headers were traced.
  */
-static size_t payecs_systraces_remaining = 100000;
-/** systraces
+struct payecs_systrace_record {
+	/* When the system was invoked.  */
+	u64 sec;
+	u32 nsec;
+	/* The index of the system.  */
+	u32 system;
+	/* Whether it was a pure system run directly.  */
+	bool fused;
+};
+
+/** struct payecs_systrace
  *
- * @brief The actual list of systraces.
+ * @brief The global systrace state.
  */
-static LIST_HEAD(payecs_systraces);
+struct payecs_systrace {
+	/* The records, keyed by entity, allocated when the first
+	 * record is added.  */
+	struct tracering *ring;
+	/* The size of the buffer the records are kept in.  */
+	size_t bytes;
+	/* Where records are also written, or NULL.  */
+	struct tracelog *log;
+
+	/* How much of each invocation to trace.  */
+	enum ecsys_trace_level level;
+	/* Trace only one in this many entities.  */
+	u32 sample;
+
+	/* The systems that were traced or sampled, by name and by
+	 * index.  */
+	STRMAP(struct payecs_systrace_system *) by_name;
+	struct payecs_systrace_system **systems;
+};
+
+static struct payecs_systrace *payecs_systrace_state = NULL;
+
+static void destroy_systrace_state(struct payecs_systrace *state)
+{
+	/* strmap uses malloc.  */
+	strmap_clear(&state->by_name);
+	payecs_systrace_state = NULL;
+}
+
+static struct payecs_systrace *get_systrace_state(void)
+{
+	struct payecs_systrace *state = payecs_systrace_state;
+
+	if (state)
+		return state;
+
+	state = tal(payz_top, struct payecs_systrace);
+	state->ring = NULL;
+	state->bytes = PAYECS_SYSTRACE_BYTES;
+	state->log = NULL;
+	state->level = ECSYS_TRACE_FULL;
+	state->sample = 1;
+	strmap_init(&state->by_name);
+	state->systems = tal_arr(state,
+				 struct payecs_systrace_system *, 0);
+	tal_add_destructor(state, &destroy_systrace_state);
+
+	payecs_systrace_state = state;
+	return state;
+}
+
+static struct payecs_systrace_system *
+get_systrace_system(struct payecs_systrace *state, const char *name)
+{
+	struct payecs_systrace_system *sys;
+
+	sys = strmap_get(&state->by_name, name);
+	if (sys)
+		return sys;
+
+	sys = tal(state, struct payecs_systrace_system);
+	sys->name = tal_strdup(sys, name);
+	sys->index = tal_count(state->systems);
+	sys->sample = 1;
+	strmap_add(&state->by_name, sys->name, sys);
+	tal_arr_expand(&state->systems, sys);
+
+	return sys;
+}
+
+/* Every sample rate is applied to the same hash of the entity, so
+ * an entity that is picked at one in 100 is also picked by any
+ * rate that divides 100, and its trace stays complete.  */
+static bool in_sample(u32 entity, u32 sample)
+{
+	u32 h = entity;
+
+	if (sample <= 1)
+		return true;
+
+	/* The murmur3 finalizer, so that consecutive entities are
+	 * spread out.  */
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h % sample == 0;
+}
+
+/* Also given to the ECS, so that it does not build the entity
+ * object of an invocation we would not trace.  */
+static enum ecsys_trace_level payecs_systrace_level(u32 entity,
+						    const char *system)
+{
+	struct payecs_systrace *state = get_systrace_state();
+	struct payecs_systrace_system *sys;
+
+	if (state->level == ECSYS_TRACE_OFF)
+		return ECSYS_TRACE_OFF;
+	if (!in_sample(entity, state->sample))
+		return ECSYS_TRACE_OFF;
+	sys = strmap_get(&state->by_name, system);
+	if (sys && !in_sample(entity, sys->sample))
+		return ECSYS_TRACE_OFF;
+
+	return state->level;
+}
+
+static const char *const payecs_systrace_level_names[] = {
+	[ECSYS_TRACE_OFF] = "off",
+	[ECSYS_TRACE_HEADERS] = "headers",
+	[ECSYS_TRACE_FULL] = "full"
+};
+
+static bool systrace_level_from_name(const char *name,
+				     size_t len,
+				     enum ecsys_trace_level *level)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(payecs_systrace_level_names); ++i) {
+		if (memeq(name, len,
+			  payecs_systrace_level_names[i],
+			  strlen(payecs_systrace_level_names[i]))) {
+			*level = (enum ecsys_trace_level) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+char *payecs_systrace_level_option(const char *arg,
+				   enum ecsys_trace_level *level)
+{
+	if (!systrace_level_from_name(arg, strlen(arg), level))
+		return tal_fmt(NULL,
+			       "'%s' is not one of off, headers, or full",
+			       arg);
+	return NULL;
+}
+
+void payecs_code_set_systrace(size_t bytes,
+			      enum ecsys_trace_level level,
+			      u32 sample)
+{
+	struct payecs_systrace *state = get_systrace_state();
+
+	state->level = level;
+	state->sample = sample;
+	if (state->bytes != bytes) {
+		state->bytes = bytes;
+		/* Start afresh with the new size.  */
+		state->ring = tal_free(state->ring);
+	}
+}
+
+const char *payecs_code_set_systrace_log(const char *path,
+					 u32 max_segments)
+{
+	struct payecs_systrace *state = get_systrace_state();
+	const char *error;
+
+	tal_free(state->log);
+	state->log = tracelog_new(state, path,
+				  TRACELOG_SEGMENT_BYTES, max_segments,
+				  &error);
+	if (!state->log)
+		return error;
+	return NULL;
+}
 
 static char *format_time(const tal_t *ctx, struct timeabs time);
 
+static void payecs_systrace_record(const char *buf,
+				   u32 entity,
+				   const jsmntok_t *system,
+				   const jsmntok_t *entity_obj,
+				   bool fused)
+{
+	struct payecs_systrace *state = get_systrace_state();
+	struct payecs_systrace_record *record;
+	enum ecsys_trace_level level;
+	struct timeabs now;
+	const char *name;
+	size_t len;
+	char *data;
+
+	name = json_strdup(tmpctx, buf, system);
+	level = payecs_systrace_level(entity, name);
+	if (level == ECSYS_TRACE_OFF)
+		return;
+
+	now = time_now();
+	len = level == ECSYS_TRACE_FULL ? json_tok_full_len(entity_obj) : 0;
+
+	if (state->log) {
+		struct tracelog_record logged;
+
+		logged.entity = entity;
+		logged.time = now;
+		logged.system = name;
+		logged.system_len = strlen(name);
+		logged.fused = fused;
+		logged.entity_obj = level == ECSYS_TRACE_FULL ?
+				    json_tok_full(buf, entity_obj) : NULL;
+		logged.entity_obj_len = len;
+		tracelog_append(state->log, &logged);
+	}
+
+	if (!state->ring)
+		state->ring = tracering_new(state, state->bytes);
+
+	data = tracering_reserve(state->ring, entity,
+				 sizeof(*record) + len);
+	/* Too large to keep at all.  */
+	if (!data)
+		return;
+
+	record = (struct payecs_systrace_record *) data;
+	record->sec = now.ts.tv_sec;
+	record->nsec = now.ts.tv_nsec;
+	record->system = get_systrace_system(state, name)->index;
+	record->fused = fused;
+	memcpy(data + sizeof(*record), json_tok_full(buf, entity_obj), len);
+	data[sizeof(*record) + len] = '\0';
+}
+
 static void payecs_systrace_add(struct plugin *plugin,
 				const char *buf,
 				const jsmntok_t *params)
 {
-	struct payecs_systrace_entry *entry;
-
 	u32 entity;
 
 	const char *error;
 
 	const jsmntok_t *system;
 	const jsmntok_t *entity_obj;
+	const jsmntok_t *fused_tok;
+	bool fused;
+
+	/* Do not even look at the parameters if tracing is off.  */
+	if (get_systrace_state()->level == ECSYS_TRACE_OFF)
+		return;
 
 	/* Check if we can get the entity ID.  */
 	error = json_scan(tmpctx, buf, params,
@@ -544,14 +1547,6 @@ static void payecs_systrace_add(struct plugin *plugin,
 		return;
 	}
 
-	/* If the list is too long already, erase old entries.  */
-	if (payecs_systraces_remaining == 0) {
-		tal_free(list_pop(&payecs_systraces,
-				  struct payecs_systrace_entry,
-				  list));
-		++payecs_systraces_remaining;
-	}
-
 	/* Extract these.  */
 	system = json_get_member(buf, params, "system");
 	entity_obj = json_get_member(buf, params, "entity");
@@ -564,18 +1559,91 @@ static void payecs_systrace_add(struct plugin *plugin,
 		return;
 	}
 
-	entry = tal(payz_top, struct payecs_systrace_entry);
-	entry->entity = entity;
-	entry->json = tal_fmt(entry,
-			      "{\"time\": \"%s\", \"system\": %.*s,"
-			      " \"entity\": %.*s}",
-			      format_time(tmpctx, time_now()),
-			      json_tok_full_len(system),
-			      json_tok_full(buf, system),
-			      json_tok_full_len(entity_obj),
-			      json_tok_full(buf, entity_obj));
-	list_add_tail(&payecs_systraces, &entry->list);
-	--payecs_systraces_remaining;
+	/* Pure builtins are run directly instead of being invoked,
+	 * and say so.  */
+	fused_tok = json_get_member(buf, params, "fused");
+	if (!fused_tok || !json_to_bool(buf, fused_tok, &fused))
+		fused = false;
+
+	payecs_systrace_record(buf, entity, system, entity_obj, fused);
+}
+
+void payecs_code_init(struct ecs *ecs)
+{
+	/* Systems invoked via RPC, and pure builtins, do not pass
+	 * through our notification handler, so have them traced
+	 * directly.  */
+	ecs_set_trace(ecs, &payecs_systrace_add);
+	ecs_set_trace_level(ecs, &payecs_systrace_level);
+}
+
+static void payecs_systrace_add_batch(struct plugin *plugin,
+				      const char *buf,
+				      const jsmntok_t *params)
+{
+	u32 entity;
+
+	const jsmntok_t *system;
+	const jsmntok_t *entities;
+	const jsmntok_t *entity_obj;
+	const jsmntok_t *entity_id;
+
+	size_t i;
+
+	system = json_get_member(buf, params, "system");
+	entities = json_get_member(buf, params, "entities");
+	if (!system || !entities || entities->type != JSMN_ARRAY) {
+		plugin_log(plugin, LOG_UNUSUAL,
+			   "'%s' parameter missing 'system' or 'entities': "
+			   "%.*s",
+			   ECS_SYSTEM_BATCH_NOTIFICATION,
+			   json_tok_full_len(params),
+			   json_tok_full(buf, params));
+		return;
+	}
+
+	json_for_each_arr (i, entity_obj, entities) {
+		entity_id = json_get_member(buf, entity_obj, "entity");
+		if (!entity_id || !json_to_u32(buf, entity_id, &entity)) {
+			plugin_log(plugin, LOG_UNUSUAL,
+				   "Invalid '%s' entity: %.*s",
+				   ECS_SYSTEM_BATCH_NOTIFICATION,
+				   json_tok_full_len(entity_obj),
+				   json_tok_full(buf, entity_obj));
+			continue;
+		}
+		payecs_systrace_record(buf, entity, system, entity_obj, false);
+	}
+}
+
+static void json_add_systrace_record(struct json_stream *out,
+				     const struct payecs_systrace *state,
+				     u32 entity,
+				     const char *data)
+{
+	const struct payecs_systrace_record *record;
+	const char *entity_obj;
+	struct timeabs time;
+
+	record = (const struct payecs_systrace_record *) data;
+	entity_obj = data + sizeof(*record);
+	time.ts.tv_sec = record->sec;
+	time.ts.tv_nsec = record->nsec;
+
+	json_object_start(out, NULL);
+	json_add_string(out, "time", format_time(tmpctx, time));
+	json_add_string(out, "system", state->systems[record->system]->name);
+	if (entity_obj[0] != '\0')
+		json_add_literal(out, "entity",
+				 entity_obj, strlen(entity_obj));
+	else {
+		json_object_start(out, "entity");
+		json_add_u32(out, "entity", entity);
+		json_object_end(out);
+	}
+	if (record->fused)
+		json_add_bool(out, "fused", true);
+	json_object_end(out);
 }
 
 static struct command_result *
@@ -585,8 +1653,10 @@ payecs_systrace(struct command *cmd,
 {
 	unsigned int *entity;
 
+	struct payecs_systrace *state = get_systrace_state();
 	struct json_stream *out;
-	struct payecs_systrace_entry *entry;
+	const char **trace;
+	size_t i;
 
 	if (!param(cmd, buf, params,
 		   p_req("entity", &param_number, &entity),
@@ -596,16 +1666,116 @@ payecs_systrace(struct command *cmd,
 	out = jsonrpc_stream_success(cmd);
 	json_add_u32(out, "entity", (u32) *entity);
 	json_array_start(out, "trace");
-	list_for_each (&payecs_systraces, entry, list) {
-		if (entry->entity != *entity)
-			continue;
-		json_add_literal(out, NULL,
-				 entry->json, strlen(entry->json));
-	}
+	if (state->ring)
+		trace = tracering_get(cmd, state->ring, *entity);
+	else
+		trace = tal_arr(cmd, const char *, 0);
+	for (i = 0; i < tal_count(trace); ++i)
+		json_add_systrace_record(out, state, *entity, trace[i]);
 	json_array_end(out);
 	return command_finished(cmd, out);
 }
 
+static struct command_result *
+param_systrace_level(struct command *cmd,
+		     const char *name,
+		     const char *buffer,
+		     const jsmntok_t *tok,
+		     enum ecsys_trace_level **level)
+{
+	*level = tal(cmd, enum ecsys_trace_level);
+	if (tok->type == JSMN_STRING
+	 && systrace_level_from_name(buffer + tok->start,
+				     tok->end - tok->start,
+				     *level))
+		return NULL;
+
+	return command_fail_badparam(cmd, name, buffer, tok,
+				     "should be one of \"off\", "
+				     "\"headers\", or \"full\".");
+}
+
+/** struct payecs_systrace_sample
+ *
+ * @brief A sample rate to set for a system.
+ */
+struct payecs_systrace_sample {
+	const char *system;
+	u32 sample;
+};
+
+static struct command_result *
+param_systrace_samples(struct command *cmd,
+		       const char *name,
+		       const char *buffer,
+		       const jsmntok_t *tok,
+		       struct payecs_systrace_sample **samples)
+{
+	const jsmntok_t *key;
+	size_t i;
+
+	if (tok->type != JSMN_OBJECT)
+		goto fail;
+
+	*samples = tal_arr(cmd, struct payecs_systrace_sample, tok->size);
+	json_for_each_obj (i, key, tok) {
+		(*samples)[i].system = json_strdup(*samples, buffer, key);
+		if (!json_to_u32(buffer, key + 1, &(*samples)[i].sample))
+			goto fail;
+	}
+
+	return NULL;
+
+fail:
+	return command_fail_badparam(cmd, name, buffer, tok,
+				     "should be an object mapping system "
+				     "names to sample rates.");
+}
+
+static struct command_result *
+payecs_systraceconfig(struct command *cmd,
+		      const char *buf,
+		      const jsmntok_t *params)
+{
+	enum ecsys_trace_level *level;
+	unsigned int *sample;
+	struct payecs_systrace_sample *samples;
+
+	struct payecs_systrace *state = get_systrace_state();
+	struct payecs_systrace_system *sys;
+	struct json_stream *out;
+	size_t i;
+
+	if (!param(cmd, buf, params,
+		   p_opt("level", &param_systrace_level, &level),
+		   p_opt("sample", &param_number, &sample),
+		   p_opt("systems", &param_systrace_samples, &samples),
+		   NULL))
+		return command_param_failed();
+
+	if (level)
+		state->level = *level;
+	if (sample)
+		state->sample = *sample;
+	for (i = 0; samples && i < tal_count(samples); ++i)
+		get_systrace_system(state,
+				    samples[i].system)->sample
+			= samples[i].sample;
+
+	out = jsonrpc_stream_success(cmd);
+	json_add_string(out, "level",
+			payecs_systrace_level_names[state->level]);
+	json_add_u32(out, "sample", state->sample);
+	json_object_start(out, "systems");
+	for (i = 0; i < tal_count(state->systems); ++i) {
+		sys = state->systems[i];
+		if (sys->sample > 1)
+			json_add_u32(out, sys->name, sys->sample);
+	}
+	json_object_end(out);
+	return command_finished(cmd, out);
+}
+
 static char *format_time(const tal_t *ctx, struct timeabs time)
 {
 	char iso8601[sizeof("YYYY-mm-ddTHH:MM:SS")];
@@ -617,6 +1787,294 @@ static char *format_time(const tal_t *ctx, struct timeabs time)
 		       (int) time.ts.tv_nsec / 1000000);
 }
 
+/*-----------------------------------------------------------------------------
+Trace Dump
+-----------------------------------------------------------------------------*/
+
+/*~ While the systrace shows which systems ran on an entity, the
+ * trace dump shows where the time went, as spans of waiting in
+ * the ready queue, being held by a system, and waiting for RPC
+ * commands.
+ *
+ * Every step of every payment ends a few spans, so recording them
+ * is off unless asked for.
+ * When on, spans are kept like the systrace, in a trace ring of a
+ * fixed size, but keyed by the main payment entity so that the
+ * spans of one payment can be found without looking at any other.
+ * They are only turned into Chrome trace events, which can be
+ * loaded into Perfetto or `chrome://tracing`, when dumped.
+ * Each main payment entity becomes a process, and each of its
+ * entities a thread, so the parts of a multi-part payment are
+ * shown side by side.
+ */
+
+/* The size in bytes of the buffer spans are kept in.  */
+#define PAYECS_TRACEDUMP_BYTES ((size_t) 16 * 1024 * 1024)
+/* The size of the blocks the trace file is written in.  */
+#define PAYECS_TRACE_FILE_BLOCK 65536
+
+/** struct payecs_tracedump_record
+ *
+ * @brief The fixed part of a span in the trace ring, which is
+ * followed by the nul-terminated category and the name.
+ */
+struct payecs_tracedump_record {
+	u64 start_usec;
+	u64 dur_usec;
+	u32 entity;
+	/* Whether it was a pure system run directly.  */
+	bool fused;
+};
+
+/** struct payecs_tracedump
+ *
+ * @brief The global trace dump state.
+ */
+struct payecs_tracedump {
+	/* Whether spans are recorded.  */
+	bool enabled;
+	/* The spans, keyed by main entity, allocated when the first
+	 * span is recorded.  */
+	struct tracering *ring;
+	/* The file spans are also written to, or NULL.  */
+	FILE *file;
+};
+
+static struct payecs_tracedump *payecs_tracedump_state = NULL;
+
+static void destroy_tracedump_state(struct payecs_tracedump *state)
+{
+	if (state->file)
+		fclose(state->file);
+	payecs_tracedump_state = NULL;
+}
+
+static struct payecs_tracedump *get_tracedump_state(void)
+{
+	struct payecs_tracedump *state = payecs_tracedump_state;
+
+	if (state)
+		return state;
+
+	state = tal(payz_top, struct payecs_tracedump);
+	state->enabled = false;
+	state->ring = NULL;
+	state->file = NULL;
+	tal_add_destructor(state, &destroy_tracedump_state);
+
+	payecs_tracedump_state = state;
+	return state;
+}
+
+static u64 timemono_to_usec(struct timemono t)
+{
+	return (u64) t.ts.tv_sec * 1000000 + t.ts.tv_nsec / 1000;
+}
+
+/* Format a span as a Chrome trace event.  */
+static const char *format_span(const tal_t *ctx,
+			       u32 main,
+			       const struct payecs_tracedump_record *record,
+			       const char *category,
+			       const char *name,
+			       size_t *len)
+{
+	struct json_out *jout;
+
+	jout = json_out_new(ctx);
+	json_out_start(jout, NULL, '{');
+	json_out_addstr(jout, "name", name);
+	json_out_addstr(jout, "cat", category);
+	json_out_addstr(jout, "ph", "X");
+	json_out_add(jout, "ts", false, "%"PRIu64, record->start_usec);
+	json_out_add(jout, "dur", false, "%"PRIu64, record->dur_usec);
+	json_out_add(jout, "pid", false, "%"PRIu32, main);
+	json_out_add(jout, "tid", false, "%"PRIu32, record->entity);
+	if (record->fused) {
+		json_out_start(jout, "args", '{');
+		json_out_add(jout, "fused", false, "true");
+		json_out_end(jout, '}');
+	}
+	json_out_end(jout, '}');
+	json_out_finished(jout);
+	return json_out_contents(jout, len);
+}
+
+static void payecs_tracedump_add(struct plugin *plugin,
+				 const struct ecsys_span *span)
+{
+	struct payecs_tracedump *state = get_tracedump_state();
+	struct payecs_tracedump_record record;
+	size_t category_len, name_len;
+	char *data;
+
+	record.start_usec = timemono_to_usec(span->start);
+	record.dur_usec = time_to_usec(timemono_between(span->end,
+							span->start));
+	record.entity = span->entity;
+	record.fused = span->fused;
+
+	/* The trailing `]` of the array is optional, so the file
+	 * is a valid trace up to the last block written.  */
+	if (state->file) {
+		const char *json;
+		size_t len;
+
+		json = format_span(tmpctx, span->main, &record,
+				   span->category, span->name, &len);
+		fprintf(state->file, "%.*s,\n", (int) len, json);
+	}
+
+	if (!state->ring)
+		state->ring = tracering_new(state, PAYECS_TRACEDUMP_BYTES);
+
+	category_len = strlen(span->category);
+	name_len = strlen(span->name);
+	data = tracering_reserve(state->ring, span->main,
+				 sizeof(record) + category_len + 1
+				 + name_len);
+	/* Too large to keep at all.  */
+	if (!data)
+		return;
+
+	memcpy(data, &record, sizeof(record));
+	data += sizeof(record);
+	memcpy(data, span->category, category_len + 1);
+	data += category_len + 1;
+	memcpy(data, span->name, name_len + 1);
+}
+
+void payecs_code_set_tracedump(bool enable)
+{
+	struct payecs_tracedump *state = get_tracedump_state();
+
+	state->enabled = enable;
+	ecs_set_span(payz_top->ecs, enable ? &payecs_tracedump_add : NULL);
+}
+
+const char *payecs_code_set_trace_file(const char *path)
+{
+	struct payecs_tracedump *state = get_tracedump_state();
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file)
+		return tal_fmt(tmpctx, "Could not open trace file %s: %s",
+			       path, strerror(errno));
+	/* Write spans out in blocks, rather than making a system
+	 * call for each.  */
+	setvbuf(file, NULL, _IOFBF, PAYECS_TRACE_FILE_BLOCK);
+	fprintf(file, "[\n");
+
+	if (state->file)
+		fclose(state->file);
+	state->file = file;
+	payecs_code_set_tracedump(true);
+
+	return NULL;
+}
+
+/* Add the metadata event naming a process or thread.  */
+static void json_add_trace_name(struct json_stream *out,
+				const char *kind,
+				u32 pid, u32 tid,
+				const char *name)
+{
+	json_object_start(out, NULL);
+	json_add_string(out, "name", kind);
+	json_add_string(out, "ph", "M");
+	json_add_u32(out, "pid", pid);
+	json_add_u32(out, "tid", tid);
+	json_object_start(out, "args");
+	json_add_string(out, "name", name);
+	json_object_end(out);
+	json_object_end(out);
+}
+
+static struct command_result *
+payecs_tracedump(struct command *cmd,
+		 const char *buf,
+		 const jsmntok_t *params)
+{
+	unsigned int *main_entity;
+
+	struct payecs_tracedump *state = get_tracedump_state();
+	struct json_stream *out;
+	const struct payecs_tracedump_record *record;
+	const char *category;
+	const char *name;
+	const char *json;
+	const char **trace;
+	size_t i, len;
+	UINTMAP(const struct payecs_tracedump_record *) seen_entity;
+
+	if (!param(cmd, buf, params,
+		   p_req("main", &param_number, &main_entity),
+		   NULL))
+		return command_param_failed();
+
+	if (state->ring)
+		trace = tracering_get(cmd, state->ring, *main_entity);
+	else
+		trace = tal_arr(cmd, const char *, 0);
+
+	/* The result is itself a trace, so it can be saved as-is
+	 * and loaded into a trace viewer.  */
+	out = jsonrpc_stream_success(cmd);
+	json_add_string(out, "displayTimeUnit", "ms");
+	json_array_start(out, "traceEvents");
+
+	/* Name the payment, and each entity the first time we see
+	 * it.  */
+	if (tal_count(trace) != 0)
+		json_add_trace_name(out, "process_name",
+				    *main_entity, 0,
+				    tal_fmt(tmpctx, "payment %u",
+					    *main_entity));
+	uintmap_init(&seen_entity);
+	for (i = 0; i < tal_count(trace); ++i) {
+		record = (const struct payecs_tracedump_record *) trace[i];
+		category = trace[i] + sizeof(*record);
+		name = category + strlen(category) + 1;
+
+		if (uintmap_add(&seen_entity, record->entity, record))
+			json_add_trace_name(out, "thread_name",
+					    *main_entity, record->entity,
+					    tal_fmt(tmpctx, "entity %"PRIu32,
+						    record->entity));
+		json = format_span(tmpctx, *main_entity, record,
+				   category, name, &len);
+		json_add_literal(out, NULL, json, len);
+	}
+	uintmap_clear(&seen_entity);
+
+	json_array_end(out);
+	return command_finished(cmd, out);
+}
+
+static struct command_result *
+payecs_tracedumpconfig(struct command *cmd,
+		       const char *buf,
+		       const jsmntok_t *params)
+{
+	bool *enable;
+
+	struct payecs_tracedump *state = get_tracedump_state();
+	struct json_stream *out;
+
+	if (!param(cmd, buf, params,
+		   p_opt("enable", param_bool, &enable),
+		   NULL))
+		return command_param_failed();
+
+	if (enable)
+		payecs_code_set_tracedump(*enable);
+
+	out = jsonrpc_stream_success(cmd);
+	json_add_bool(out, "enabled", state->enabled);
+	return command_finished(cmd, out);
+}
+
 /*-----------------------------------------------------------------------------
 ECS System Trigger Notification
 -----------------------------------------------------------------------------*/
@@ -645,3 +2103,25 @@ payecs_system_notification(struct command *cmd,
 	payecs_systrace_add(cmd->plugin, buf, payload);
 	return ecs_system_notify(payz_top->ecs, cmd, buf, payload);
 }
+
+static struct command_result *
+payecs_system_batch_notification(struct command *cmd,
+				 const char *buf,
+				 const jsmntok_t *params)
+{
+	const jsmntok_t *payload;
+
+	payload = json_get_member(buf, params, "payload");
+	if (!payload) {
+		plugin_log(cmd->plugin, LOG_UNUSUAL,
+			   "%s parameters has no payload: %.*s",
+			   ECS_SYSTEM_BATCH_NOTIFICATION,
+			   json_tok_full_len(params),
+			   json_tok_full(buf, params));
+		return notification_handled(cmd);
+	}
+	/* Built-in systems are never batched, so we only need to
+	 * trace it.  */
+	payecs_systrace_add_batch(cmd->plugin, buf, payload);
+	return notification_handled(cmd);
+}
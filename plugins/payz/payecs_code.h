@@ -1,9 +1,14 @@
 #ifndef LIGHTNING_PLUGINS_PAYZ_PAYECS_CODE_H
 #define LIGHTNING_PLUGINS_PAYZ_PAYECS_CODE_H
 #include"config.h"
+#include<ccan/short_types/short_types.h>
 #include<plugins/libplugin.h>
+#include<plugins/payz/ecs/ecsys.h>
 #include<stddef.h>
 
+struct ecs;
+struct json_stream;
+
 /*~ This module implements a set of commands for causing
  * the ECS to invoke code on your plugins, i.e. the
  * "system" part of ECS.
@@ -18,4 +23,90 @@ extern const size_t num_payecs_code_notifications;
 extern const char *payecs_code_topics[];
 extern const size_t num_payecs_code_topics;
 
+/** payecs_json_advance
+ *
+ * @brief Advance each of the given entities, and add an array
+ * of the entities that could not be advanced, in the same form
+ * as the `payecs_advance_batch` result.
+ *
+ * @param out - the JSON stream to add the array to.
+ * @param fieldname - the name of the array field.
+ * @param plugin - the plugin we are running in.
+ * @param entities - a tal-allocated array of entities to advance.
+ */
+void payecs_json_advance(struct json_stream *out,
+			 const char *fieldname,
+			 struct plugin *plugin,
+			 const u32 *entities);
+
+/** payecs_code_init
+ *
+ * @brief Hook up the given ECS to this module, so that systems
+ * that are not invoked by notification still appear in
+ * `payecs_systrace`.
+ */
+void payecs_code_init(struct ecs *ecs);
+
+/** PAYECS_SYSTRACE_BYTES
+ *
+ * @brief The default size in bytes of the buffer that
+ * `payecs_systrace` keeps its records in.
+ */
+#define PAYECS_SYSTRACE_BYTES ((size_t) 16 * 1024 * 1024)
+
+/** payecs_code_set_systrace
+ *
+ * @brief Configure `payecs_systrace`.
+ *
+ * @param bytes - the size in bytes of the buffer the records
+ * are kept in; if changed, the current records are discarded.
+ * @param level - how much of each invocation to trace.
+ * @param sample - trace only one in this many entities, 0 or
+ * 1 to trace all.
+ */
+void payecs_code_set_systrace(size_t bytes,
+			      enum ecsys_trace_level level,
+			      u32 sample);
+
+/** payecs_code_set_systrace_log
+ *
+ * @brief Also write each record of `payecs_systrace` to the
+ * trace log at the given path, which can be read with
+ * `payz-tracelog`.
+ *
+ * @param path - the path of the trace log.
+ * @param max_segments - the number of segments of the trace
+ * log to keep, 0 to keep all.
+ *
+ * @return - NULL on success, or an error message.
+ */
+const char *payecs_code_set_systrace_log(const char *path,
+					 u32 max_segments);
+
+/** payecs_systrace_level_option
+ *
+ * @brief Parse the `off`, `headers`, or `full` trace level of
+ * a plugin option.
+ */
+char *payecs_systrace_level_option(const char *arg,
+				   enum ecsys_trace_level *level);
+
+/** payecs_code_set_tracedump
+ *
+ * @brief Start or stop recording the spans of time spent on
+ * entities for `payecs_tracedump`, which is off by default.
+ */
+void payecs_code_set_tracedump(bool enable);
+
+/** payecs_code_set_trace_file
+ *
+ * @brief Record spans for `payecs_tracedump`, and also write
+ * each of them to the given file, as a Chrome trace.
+ *
+ * @param path - the file to write, which is overwritten.
+ *
+ * @return - NULL on success, or an error message.
+ */
+const char *payecs_code_set_trace_file(const char *path);
+
 #endif /* LIGHTNING_PLUGINS_PAYZ_PAYECS_CODE_H */
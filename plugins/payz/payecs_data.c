@@ -1,14 +1,24 @@
 #include"payecs_data.h"
+#include<assert.h>
 #include<ccan/array_size/array_size.h>
+#include<ccan/json_out/json_out.h>
+#include<ccan/str/str.h>
 #include<ccan/strmap/strmap.h>
+#include<ccan/tal/str/str.h>
 #include<ccan/json_escape/json_escape.h>
+#include<ccan/time/time.h>
 #include<common/json_stream.h>
 #include<common/json_tok.h>
+#include<common/jsonrpc_errors.h>
 #include<common/param.h>
+#include<common/utils.h>
 #include<plugins/payz/ecs/ecs.h>
 #include<plugins/payz/json_equal.h>
 #include<plugins/payz/parsing.h>
+#include<plugins/payz/payecs_code.h>
+#include<plugins/payz/predicate.h>
 #include<plugins/payz/top.h>
+#include<plugins/payz/update.h>
 #include<string.h>
 
 static struct command_result *
@@ -24,9 +34,37 @@ payecs_getcomponents(struct command *cmd,
 		     const char *buf,
 		     const jsmntok_t *params);
 static struct command_result *
+payecs_waitcomponents(struct command *cmd,
+		      const char *buf,
+		      const jsmntok_t *params);
+static struct command_result *
+payecs_createindex(struct command *cmd,
+		   const char *buf,
+		   const jsmntok_t *params);
+static struct command_result *
 payecs_setcomponents(struct command *cmd,
 		     const char *buf,
 		     const jsmntok_t *params);
+static struct command_result *
+payecs_commit(struct command *cmd,
+	      const char *buf,
+	      const jsmntok_t *params);
+static struct command_result *
+payecs_updatecomponents(struct command *cmd,
+			const char *buf,
+			const jsmntok_t *params);
+static struct command_result *
+payecs_subscribecomponents(struct command *cmd,
+			   const char *buf,
+			   const jsmntok_t *params);
+static struct command_result *
+payecs_unsubscribecomponents(struct command *cmd,
+			     const char *buf,
+			     const jsmntok_t *params);
+static struct command_result *
+payecs_renewsubscription(struct command *cmd,
+			 const char *buf,
+			 const jsmntok_t *params);
 
 const struct plugin_command payecs_data_commands[] = {
 	{
@@ -34,7 +72,9 @@ const struct plugin_command payecs_data_commands[] = {
 		"payment",
 		"List all entities with attached components, or those "
 		"with {required} components and without {disallowed} "
-		"components",
+		"components, at most {limit} of them, starting after "
+		"the entity {start_after}, including only the given "
+		"{components}.",
 		"List entities.",
 		&payecs_listentities
 	},
@@ -48,10 +88,29 @@ const struct plugin_command payecs_data_commands[] = {
 	{
 		"payecs_getcomponents",
 		"payment",
-		"Look up {entity} for one or more {components}.",
-		"Look up components of an entity.",
+		"Look up {entity}, or an array of entities, for one or "
+		"more {components}.",
+		"Look up components of entities.",
 		&payecs_getcomponents
 	},
+	{
+		"payecs_waitcomponents",
+		"payment",
+		"Wait until one of the {components} of {entity} is "
+		"attached, changed or detached, or differs from its "
+		"{expected} value, or until {timeout} seconds pass.",
+		"Wait for components of an entity to change.",
+		&payecs_waitcomponents
+	},
+	{
+		"payecs_createindex",
+		"payment",
+		"Maintain an index from the values of {component}, or "
+		"of the given {field} within it, to the entities having "
+		"them.",
+		"Index component values.",
+		&payecs_createindex
+	},
 	{
 		"payecs_setcomponents",
 		"payment",
@@ -59,10 +118,59 @@ const struct plugin_command payecs_data_commands[] = {
 		"the optional {expected} still holds.",
 		"Set components of an entity.",
 		&payecs_setcomponents
+	},
+	{
+		"payecs_commit",
+		"payment",
+		"Perform specified {writes}, after atomically ensuring that "
+		"the optional {expected} still holds, then {advance} the "
+		"given entities (default: the entities written to).",
+		"Set components of entities, then advance them.",
+		&payecs_commit
+	},
+	{
+		"payecs_updatecomponents",
+		"payment",
+		"Perform specified {updates} on the current values of "
+		"components, after atomically ensuring that the optional "
+		"{expected} still holds.",
+		"Update components of entities.",
+		&payecs_updatecomponents
+	},
+	{
+		"payecs_subscribecomponents",
+		"payment",
+		"Send changes to the given {components}, or to "
+		"components starting with one of the {prefixes}, of "
+		"the given {entities}, in the "
+		"`payecs_component_changed` notification, for {ttl} "
+		"seconds unless renewed.",
+		"Subscribe to component changes.",
+		&payecs_subscribecomponents
+	},
+	{
+		"payecs_unsubscribecomponents",
+		"payment",
+		"Stop sending changes for {subscription}.",
+		"Unsubscribe from component changes.",
+		&payecs_unsubscribecomponents
+	},
+	{
+		"payecs_renewsubscription",
+		"payment",
+		"Keep sending changes for {subscription} for another "
+		"{ttl} seconds.",
+		"Renew a subscription to component changes.",
+		&payecs_renewsubscription
 	}
 };
 const size_t num_payecs_data_commands = ARRAY_SIZE(payecs_data_commands);
 
+const char *payecs_data_topics[] = {
+	PAYECS_COMPONENT_CHANGED_NOTIFICATION
+};
+const size_t num_payecs_data_topics = ARRAY_SIZE(payecs_data_topics);
+
 /*-----------------------------------------------------------------------------
 Parameter Parsing: Write Specifications
 -----------------------------------------------------------------------------*/
@@ -242,88 +350,348 @@ void json_splice_entity_components(struct json_stream *out,
 List Entities
 -----------------------------------------------------------------------------*/
 
-static struct command_result *
-payecs_listentities(struct command *cmd,
-		    const char *buf,
-		    const jsmntok_t *params)
-{
-	const char **required;
-	const char **disallowed;
-	char **components;
+/*~ A node can have a great many entities, so a single listing
+ * only covers one page, bounded both in the entities looked at and
+ * in the bytes of the response.
+ * Building a longer response would hold up everything else we send
+ * to lightningd, including the notifications that advance payments,
+ * until it is done; instead the caller gets a `next` cursor and asks
+ * for the following page itself.
+ */
 
+/* Stop a page after listing this many bytes...  */
+#define PAYECS_LISTENTITIES_PAGE_BYTES 65536
+/* ...or after looking at this many entities.  */
+#define PAYECS_LISTENTITIES_PAGE_ENTITIES 4096
+
+/** struct payecs_listentities_closure
+ *
+ * @brief Represents a `payecs_listentities` in progress.
+ */
+struct payecs_listentities_closure {
+	struct command *cmd;
 	struct json_stream *out;
 
-	u32 min_entity;
+	const char **required;
+	const char **disallowed;
+	/* Tests on component values, all of which must hold.  */
+	struct predicate **where;
+	/* The components to list, or NULL for all.  */
+	const char **projection;
+	/* If an index narrows down the entities that can be listed,
+	 * those entities in increasing order, and the next one to
+	 * look at; else NULL.  */
+	u32 *candidates;
+	size_t candidate;
+
+	/* The next entity to look at.  */
 	u32 entity;
-	u32 max_entity;
+	/* The number of entities we can still list.  */
+	u32 remaining;
+	/* The last entity looked at, or start_after (else 0) if none
+	 * yet; the next page starts after it.  */
+	u32 last;
+};
 
-	size_t i, j;
+static bool has_component(char **components, const char *component)
+{
+	size_t i;
 
-	/* We cannot use p_opt_def with arrays, as p_opt_def
-	 * would always allocate a 1-entry array.
-	 * p_opt will set the arrays to NULL, which is safe for
-	 * tal_count().
-	 */
-	if (!param(cmd, buf, params,
-		   p_opt("required", &param_array_of_strings,
-			 &required),
-		   p_opt("disallowed", &param_array_of_strings,
-			 &disallowed),
-		   NULL))
-		return command_param_failed();
+	for (i = 0; i < tal_count(components); ++i)
+		if (streq(components[i], component))
+			return true;
+	return false;
+}
 
-	/* Get entity bounds.  */
-	ecs_get_entity_bounds(payz_top->ecs, &min_entity, &max_entity);
+/* Whether an entity with the given components is to be listed.  */
+static bool entity_is_listed(const struct payecs_listentities_closure *c,
+			     u32 entity,
+			     char **components)
+{
+	const char *buffer;
+	const jsmntok_t *toks;
+	size_t i;
 
-	out = jsonrpc_stream_success(cmd);
+	/* Nothing attached?  Skip.  */
+	if (tal_count(components) == 0)
+		return false;
 
-	json_array_start(out, "entities");
-	for (entity = min_entity; entity < max_entity; ++entity) {
-		bool skip = false;
+	for (i = 0; i < tal_count(c->required); ++i)
+		if (!has_component(components, c->required[i]))
+			return false;
+	for (i = 0; i < tal_count(c->disallowed); ++i)
+		if (has_component(components, c->disallowed[i]))
+			return false;
+	for (i = 0; i < tal_count(c->where); ++i) {
+		if (!ecs_get_component(payz_top->ecs, &buffer, &toks,
+				       entity, c->where[i]->component))
+			return false;
+		if (!predicate_test(c->where[i], buffer, toks))
+			return false;
+	}
 
-		components = ecs_get_components(tmpctx, payz_top->ecs, entity);
+	return true;
+}
 
-		/* Nothing attached?  Skip.  */
-		if (tal_count(components) == 0)
-			continue;
+/* Keep only the components in the projection, if any.  */
+static const char **project_components(const tal_t *ctx,
+				       const char **projection,
+				       char **components)
+{
+	const char **projected;
+	size_t i;
 
-		/* Check if has required.  */
-		for (i = 0; i < tal_count(required); ++i) {
-			skip = true;
-			for (j = 0; j < tal_count(components); ++j) {
-				if (streq(required[i], components[j])) {
-					skip = false;
-					break;
-				}
-			}
-			if (skip)
+	if (!projection)
+		return (const char **) components;
+
+	projected = tal_arr(ctx, const char *, 0);
+	for (i = 0; i < tal_count(projection); ++i)
+		if (has_component(components, projection[i]))
+			tal_arr_expand(&projected, projection[i]);
+	return projected;
+}
+
+/** listentities_page
+ *
+ * @brief List one page of entities.
+ *
+ * @return - true if the listing is complete, false if it was
+ * cut off by the page bounds.
+ */
+static bool listentities_page(struct payecs_listentities_closure *c)
+{
+	struct json_stream *out = c->out;
+	char **components;
+	u32 min_entity, max_entity;
+	size_t looked = 0;
+	size_t start_len;
+	size_t len;
+
+	ecs_get_entity_bounds(payz_top->ecs, &min_entity, &max_entity);
+	if (c->entity < min_entity)
+		c->entity = min_entity;
+
+	json_out_contents(out->jout, &start_len);
+	for (; c->entity < max_entity; ++c->entity) {
+		if (c->remaining == 0)
+			return true;
+
+		/* Skip to the next entity the index allows.  */
+		if (c->candidates) {
+			while (c->candidate < tal_count(c->candidates)
+			    && c->candidates[c->candidate] < c->entity)
+				++c->candidate;
+			if (c->candidate == tal_count(c->candidates)) {
+				c->entity = max_entity;
 				break;
-		}
-		if (skip)
-			continue;
-		/* Check if has disallowed.  */
-		for (i = 9; i < tal_count(disallowed); ++i) {
-			for (j = 0; j < tal_count(components); ++j) {
-				if (streq(disallowed[i], components[j])) {
-					skip = true;
-					break;
-				}
 			}
-			if (skip)
+			c->entity = c->candidates[c->candidate];
+			if (c->entity >= max_entity)
 				break;
 		}
-		if (skip)
+
+		/* Leave the rest to the next page.  */
+		json_out_contents(out->jout, &len);
+		if (looked == PAYECS_LISTENTITIES_PAGE_ENTITIES
+		 || len - start_len >= PAYECS_LISTENTITIES_PAGE_BYTES)
+			return false;
+		++looked;
+		c->last = c->entity;
+
+		components = ecs_get_components(tmpctx, payz_top->ecs,
+						c->entity);
+		if (!entity_is_listed(c, c->entity, components))
 			continue;
 
 		/* Add entity.  */
 		json_object_start(out, NULL);
-		json_splice_entity_components(out, entity,
-					      (const char**) components);
+		json_splice_entity_components(out, c->entity,
+					      project_components(tmpctx,
+								 c->projection,
+								 components));
 		json_object_end(out);
+
+		--c->remaining;
 	}
+
+	return true;
+}
+
+static struct command_result *
+listentities_finish(struct payecs_listentities_closure *c,
+		    bool complete)
+{
+	struct json_stream *out = c->out;
+	u32 min_entity, max_entity;
+
 	json_array_end(out);
 
-	return command_finished(cmd, out);
+	/* Cut off by the page bounds or by the limit, with entities
+	 * left to look at?  Tell the caller where to continue.  */
+	ecs_get_entity_bounds(payz_top->ecs, &min_entity, &max_entity);
+	if ((!complete || c->remaining == 0) && c->entity < max_entity)
+		json_add_u32(out, "next", c->last);
+
+	return command_finished(c->cmd, out);
+}
+
+static int u32_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/** indexed_candidates
+ *
+ * @brief Uses an index created by `payecs_createindex` to
+ * find the only entities that can satisfy the `equals` or
+ * `in` test of one of the predicates.
+ *
+ * @return - the entities, in increasing order, or NULL if no
+ * predicate can use an index.
+ */
+static u32 *indexed_candidates(const tal_t *ctx,
+			       struct predicate **where)
+{
+	const struct predicate *p;
+	const jsmntok_t *entry;
+	u32 *candidates;
+	u32 *found;
+	size_t i, j, n;
+
+	for (i = 0; i < tal_count(where); ++i) {
+		p = where[i];
+		if (p->op == PREDICATE_EQUALS) {
+			found = ecs_lookup_index(ctx, payz_top->ecs,
+						 p->component, p->field,
+						 p->buffer, p->operand);
+			if (found)
+				return found;
+			continue;
+		}
+		if (p->op != PREDICATE_IN)
+			continue;
+
+		candidates = tal_arr(ctx, u32, 0);
+		json_for_each_arr (j, entry, p->operand) {
+			found = ecs_lookup_index(tmpctx, payz_top->ecs,
+						 p->component, p->field,
+						 p->buffer, entry);
+			if (!found)
+				break;
+			tal_expand(&candidates, found, tal_count(found));
+		}
+		if (j != p->operand->size) {
+			tal_free(candidates);
+			continue;
+		}
+
+		/* Sort, and drop entities found for several values.  */
+		qsort(candidates, tal_count(candidates),
+		      sizeof(candidates[0]), &u32_cmp);
+		for (j = 0, n = 0; j < tal_count(candidates); ++j)
+			if (n == 0 || candidates[n - 1] != candidates[j])
+				candidates[n++] = candidates[j];
+		tal_resize(&candidates, n);
+		return candidates;
+	}
+
+	return NULL;
+}
+
+/** param_predicates
+ *
+ * @brief Parses an array of predicates on component values.
+ * As a convenience, we also consider a single predicate.
+ */
+static struct command_result *
+param_predicates(struct command *cmd,
+		 const char *name,
+		 const char *buffer,
+		 const jsmntok_t *tok,
+		 struct predicate ***predicates)
+{
+	const jsmntok_t *entry;
+	const char *error;
+	size_t i;
+
+	if (tok->type == JSMN_OBJECT) {
+		*predicates = tal_arr(cmd, struct predicate *, 1);
+		error = predicate_parse(cmd, buffer, tok, &(*predicates)[0]);
+		if (error)
+			return command_fail_badparam(cmd, name, buffer, tok,
+						     error);
+		return NULL;
+	}
+
+	if (tok->type != JSMN_ARRAY)
+		return command_fail_badparam(cmd, name, buffer, tok,
+					     "should be an array of "
+					     "predicates");
+
+	*predicates = tal_arr(cmd, struct predicate *, tok->size);
+	json_for_each_arr (i, entry, tok) {
+		error = predicate_parse(cmd, buffer, entry,
+					&(*predicates)[i]);
+		if (error)
+			return command_fail_badparam(cmd, name, buffer, entry,
+						     error);
+	}
+
+	return NULL;
+}
+
+static struct command_result *
+payecs_listentities(struct command *cmd,
+		    const char *buf,
+		    const jsmntok_t *params)
+{
+	struct payecs_listentities_closure *c;
+	const char **required;
+	const char **disallowed;
+	struct predicate **where;
+	const char **projection;
+	unsigned int *limit;
+	unsigned int *start_after;
+
+	/* We cannot use p_opt_def with arrays, as p_opt_def
+	 * would always allocate a 1-entry array.
+	 * p_opt will set the arrays to NULL, which is safe for
+	 * tal_count().
+	 */
+	if (!param(cmd, buf, params,
+		   p_opt("required", &param_array_of_strings,
+			 &required),
+		   p_opt("disallowed", &param_array_of_strings,
+			 &disallowed),
+		   p_opt("where", &param_predicates, &where),
+		   p_opt("limit", &param_number, &limit),
+		   p_opt("start_after", &param_number, &start_after),
+		   p_opt("components", &param_array_of_strings,
+			 &projection),
+		   NULL))
+		return command_param_failed();
+
+	c = tal(cmd, struct payecs_listentities_closure);
+	c->cmd = cmd;
+	c->required = required;
+	c->disallowed = disallowed;
+	c->where = where;
+	c->projection = projection;
+	c->candidates = indexed_candidates(c, where);
+	c->candidate = 0;
+	c->entity = start_after ? *start_after + 1 : 0;
+	c->remaining = limit ? *limit : UINT32_MAX;
+	c->last = start_after ? *start_after : 0;
+	/* Entity IDs are u32, so there is nothing after the last.  */
+	if (start_after && *start_after == UINT32_MAX)
+		c->entity = UINT32_MAX;
+
+	c->out = jsonrpc_stream_success(cmd);
+	json_array_start(c->out, "entities");
+
+	return listentities_finish(c, listentities_page(c));
 }
 
 /*-----------------------------------------------------------------------------
@@ -352,86 +720,417 @@ payecs_newentity(struct command *cmd,
 Get Entity Components
 -----------------------------------------------------------------------------*/
 
+/** param_entities
+ *
+ * @brief Parses an array of entity IDs.
+ * As a convenience, we also consider a single entity ID.
+ */
+static struct command_result *
+param_entities(struct command *cmd,
+	       const char *name,
+	       const char *buffer,
+	       const jsmntok_t *tok,
+	       u32 **entities)
+{
+	const jsmntok_t *entry;
+	size_t i;
+
+	if (tok->type == JSMN_PRIMITIVE) {
+		*entities = tal_arr(cmd, u32, 1);
+		if (!json_to_u32(buffer, tok, &(*entities)[0]))
+			goto fail;
+		return NULL;
+	}
+
+	if (tok->type != JSMN_ARRAY)
+		goto fail;
+
+	*entities = tal_arr(cmd, u32, tok->size);
+	json_for_each_arr (i, entry, tok) {
+		if (!json_to_u32(buffer, entry, &(*entities)[i]))
+			goto fail;
+	}
+
+	return NULL;
+
+fail:
+	return command_fail_badparam(cmd, name, buffer, tok,
+				     "should be an array of entity IDs.");
+}
+
+/** writespec_entities
+ *
+ * @brief Returns the entities written to by the given `writes`,
+ * in order of first appearance.
+ */
+static u32 *
+writespec_entities(const tal_t *ctx,
+		   const struct payecs_writespec *writes)
+{
+	u32 *entities = tal_arr(ctx, u32, 0);
+	size_t i, j;
+
+	for (i = 0; i < tal_count(writes); ++i) {
+		for (j = 0; j < tal_count(entities); ++j)
+			if (entities[j] == writes[i].entity)
+				break;
+		if (j == tal_count(entities))
+			tal_arr_expand(&entities, writes[i].entity);
+	}
+
+	return entities;
+}
+
+/** struct payecs_getcomponents_entities
+ *
+ * @brief The entities to read in `payecs_getcomponents`, and
+ * whether they were given as an array, so that the result can
+ * be an array too.
+ */
+struct payecs_getcomponents_entities {
+	u32 *entities;
+	bool array;
+};
+
+static struct command_result *
+param_getcomponents_entities(struct command *cmd,
+			     const char *name,
+			     const char *buffer,
+			     const jsmntok_t *tok,
+			     struct payecs_getcomponents_entities **e)
+{
+	*e = tal(cmd, struct payecs_getcomponents_entities);
+	(*e)->array = tok->type == JSMN_ARRAY;
+	return param_entities(cmd, name, buffer, tok, &(*e)->entities);
+}
+
+/*~
+ * All the entities are read within this single command, without
+ * returning to the event loop in between, so no System or other
+ * command can write to them partway through: the result is a
+ * consistent snapshot.
+ */
+
 static struct command_result *
 payecs_getcomponents(struct command *cmd,
 		     const char *buf,
 		     const jsmntok_t *params)
 {
-	unsigned int *entity;
+	struct payecs_getcomponents_entities *e;
 	const char **components;
+	size_t i;
 
 	struct json_stream *out;
 
 	if (!param(cmd, buf, params,
-		   p_req("entity", &param_number, &entity),
+		   p_req("entity", &param_getcomponents_entities, &e),
 		   p_req("components", &param_array_of_strings, &components),
 		   NULL))
 		return command_param_failed();
 
 	out = jsonrpc_stream_success(cmd);
-	json_splice_entity_components(out, (u32) *entity, components);
+	if (!e->array) {
+		json_splice_entity_components(out, e->entities[0],
+					      components);
+		return command_finished(cmd, out);
+	}
+
+	json_array_start(out, "entities");
+	for (i = 0; i < tal_count(e->entities); ++i) {
+		json_object_start(out, NULL);
+		json_splice_entity_components(out, e->entities[i],
+					      components);
+		json_object_end(out);
+	}
+	json_array_end(out);
 	return command_finished(cmd, out);
 }
 
 /*-----------------------------------------------------------------------------
-Set Entity Components
+Wait for Entity Components
 -----------------------------------------------------------------------------*/
 
 /*~
- * payecs_setcomponents provides a generalized compare-and-swap operation.
- * When provided with an `expected` argument it can check, atomically, if 
- * the current values in the ECS are equal, and will only perform all
- * specified writes, again atomically, if validation passes.
+ * Rather than have clients poll payecs_getcomponents, they can
+ * wait for a change with payecs_waitcomponents.
+ * The response is sent from a timer rather than from within the
+ * write that wakes the waiter, so that a waiter woken by one of
+ * the writes of a payecs_setcomponents sees all of them.
  *
- * Thsi allows cross-entity coordination; you sample the current state of
- * the entities, compute, then write out the results, with the sampled
- * current state also passed in.
- * If that validation fails, then you re-sample again and re-compute.
+ * A change made between the client reading the components and
+ * the wait starting would be missed, so the client can give the
+ * values it last read as `expected`, and the wait completes at
+ * once if any of them is already stale.
  */
 
-/** struct payecs_setcomponents_data
+/** struct payecs_waitcomponents_waiter
  *
- * @brief passed to the iterating functions below.
+ * @brief Represents a `payecs_waitcomponents` in progress.
  */
-struct payecs_setcomponents_data {
+struct payecs_waitcomponents_waiter {
+	struct command *cmd;
 	u32 entity;
-	const char *buffer;
+	const char **components;
 
-	/* only used by payecs_setcomponents_validate.  */
-	bool success;
+	/* The owner of the watches on the components, or NULL
+	 * once one of them has fired.  */
+	tal_t *watches;
+	/* The timer for the timeout, or the timer to respond once
+	 * a component has changed, or NULL.  */
+	struct plugin_timer *timer;
+	/* The component that changed, or NULL if timed out.  */
+	const char *changed;
+};
+
+struct payecs_waitcomponents_watch {
+	struct payecs_waitcomponents_waiter *waiter;
+	const char *component;
 };
-/* Functions invoked via strmap_iterate over all components in each
- * payecs_writespec.  */
-static bool
-payecs_setcomponents_validate(const char *component, const jsmntok_t *value,
-			      struct payecs_setcomponents_data *validation);
-static bool
-payecs_setcomponents_write(const char *component, const jsmntok_t *value,
-			   struct payecs_setcomponents_data *info);
 
 static struct command_result *
-payecs_setcomponents(struct command *cmd,
-		     const char *buf,
-		     const jsmntok_t *params)
+waitcomponents_finish(struct payecs_waitcomponents_waiter *w)
 {
-	struct payecs_writespec *writes;
-	struct payecs_writespec *expected;
+	struct json_stream *out;
 
-	struct payecs_setcomponents_data info;
+	out = jsonrpc_stream_success(w->cmd);
+	json_splice_entity_components(out, w->entity, w->components);
+	if (w->changed)
+		json_add_string(out, "changed", w->changed);
+	else
+		json_add_bool(out, "timed_out", true);
+	return command_finished(w->cmd, out);
+}
 
-	size_t i, j;
+static void
+waitcomponents_respond(struct payecs_waitcomponents_waiter *w)
+{
+	struct plugin *plugin = w->cmd->plugin;
+
+	/* The timer is now firing, and will be freed after.  */
+	w->timer = NULL;
+	w->watches = tal_free(w->watches);
+
+	(void) waitcomponents_finish(w);
+	timer_complete(plugin);
+}
+
+static void
+waitcomponents_changed(struct payecs_waitcomponents_watch *watch)
+{
+	struct payecs_waitcomponents_waiter *w = watch->waiter;
+
+	w->changed = watch->component;
+	/* Stop watching the other components; this also frees
+	 * the watch that fired.  */
+	w->watches = tal_free(w->watches);
+
+	tal_free(w->timer);
+	w->timer = plugin_timer(w->cmd->plugin, time_from_sec(0),
+				&waitcomponents_respond, w);
+}
+
+static struct command_result *
+param_object(struct command *cmd,
+	     const char *name,
+	     const char *buffer,
+	     const jsmntok_t *tok,
+	     const jsmntok_t **object)
+{
+	if (tok->type != JSMN_OBJECT)
+		return command_fail_badparam(cmd, name, buffer, tok,
+					     "should be an object");
+	*object = tok;
+	return NULL;
+}
+
+/* Get the first of the components whose current value differs
+ * from its expected value, or NULL.  */
+static const char *
+waitcomponents_stale(u32 entity,
+		     const char **components,
+		     const char *buf,
+		     const jsmntok_t *expected)
+{
+	const jsmntok_t *value;
+	const char *ecsbuf;
+	const jsmntok_t *ecstok;
+	size_t i;
+
+	for (i = 0; i < tal_count(components); ++i) {
+		value = json_get_member(buf, expected, components[i]);
+		if (!value)
+			continue;
+		ecs_get_component(payz_top->ecs, &ecsbuf, &ecstok,
+				  entity, components[i]);
+		if (!json_equal(buf, value, ecsbuf, ecstok))
+			return components[i];
+	}
+	return NULL;
+}
+
+static struct command_result *
+payecs_waitcomponents(struct command *cmd,
+		      const char *buf,
+		      const jsmntok_t *params)
+{
+	unsigned int *entity;
+	const char **components;
+	unsigned int *timeout;
+	const jsmntok_t *expected;
+	struct payecs_waitcomponents_waiter *w;
+	struct payecs_waitcomponents_watch *watch;
+	size_t i;
 
 	if (!param(cmd, buf, params,
-		   p_req("writes", &param_array_of_payecs_writespec,
-			 &writes),
-		   p_opt("expected", &param_array_of_payecs_writespec,
-			 &expected),
+		   p_req("entity", &param_number, &entity),
+		   p_req("components", &param_array_of_strings, &components),
+		   p_opt("timeout", &param_number, &timeout),
+		   p_opt("expected", &param_object, &expected),
 		   NULL))
 		return command_param_failed();
 
-	/* Validate first.  */
+	/* Nothing could ever complete it.  */
+	if (tal_count(components) == 0 && !timeout)
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "components cannot be empty "
+				    "without a timeout");
+
+	w = tal(cmd, struct payecs_waitcomponents_waiter);
+	w->cmd = cmd;
+	w->entity = *entity;
+	w->components = components;
+	w->watches = tal(w, char);
+	w->timer = NULL;
+	w->changed = NULL;
+
+	/* Already changed since the client read it?  */
+	if (expected) {
+		w->changed = waitcomponents_stale(w->entity, components,
+						  buf, expected);
+		if (w->changed)
+			return waitcomponents_finish(w);
+	}
+
+	for (i = 0; i < tal_count(components); ++i) {
+		watch = tal(w->watches, struct payecs_waitcomponents_watch);
+		watch->waiter = w;
+		watch->component = components[i];
+		(void) ecs_watch_component(watch, payz_top->ecs,
+					   w->entity, components[i],
+					   &waitcomponents_changed, watch);
+	}
+	if (timeout)
+		w->timer = plugin_timer(cmd->plugin,
+					time_from_sec(*timeout),
+					&waitcomponents_respond, w);
+
+	return command_still_pending(cmd);
+}
+
+/*-----------------------------------------------------------------------------
+Create Index
+-----------------------------------------------------------------------------*/
+
+static struct command_result *
+param_field(struct command *cmd,
+	    const char *name,
+	    const char *buffer,
+	    const jsmntok_t *tok,
+	    const char ***field)
+{
+	const char *error = predicate_parse_field(cmd, buffer, tok, field);
+
+	if (error)
+		return command_fail_badparam(cmd, name, buffer, tok, error);
+	return NULL;
+}
+
+static struct command_result *
+payecs_createindex(struct command *cmd,
+		   const char *buf,
+		   const jsmntok_t *params)
+{
+	const char *component;
+	const char **field;
+	size_t values, entities;
+	size_t i;
+
+	struct json_stream *out;
+
+	if (!param(cmd, buf, params,
+		   p_req("component", &param_string, &component),
+		   p_opt("field", &param_field, &field),
+		   NULL))
+		return command_param_failed();
+	if (!field)
+		field = tal_arr(cmd, const char *, 0);
+
+	ecs_create_index(payz_top->ecs, component, field);
+	if (!ecs_get_index_size(payz_top->ecs, component, field,
+				&values, &entities))
+		abort();
+
+	out = jsonrpc_stream_success(cmd);
+	json_add_string(out, "component", component);
+	json_array_start(out, "field");
+	for (i = 0; i < tal_count(field); ++i)
+		json_add_string(out, NULL, field[i]);
+	json_array_end(out);
+	json_add_u64(out, "values", values);
+	json_add_u64(out, "entities", entities);
+	return command_finished(cmd, out);
+}
+
+/*-----------------------------------------------------------------------------
+Set Entity Components
+-----------------------------------------------------------------------------*/
+
+/*~
+ * payecs_setcomponents provides a generalized compare-and-swap operation.
+ * When provided with an `expected` argument it can check, atomically, if 
+ * the current values in the ECS are equal, and will only perform all
+ * specified writes, again atomically, if validation passes.
+ *
+ * Thsi allows cross-entity coordination; you sample the current state of
+ * the entities, compute, then write out the results, with the sampled
+ * current state also passed in.
+ * If that validation fails, then you re-sample again and re-compute.
+ */
+
+/** struct payecs_setcomponents_data
+ *
+ * @brief passed to the iterating functions below.
+ */
+struct payecs_setcomponents_data {
+	u32 entity;
+	const char *buffer;
+
+	/* only used by payecs_setcomponents_validate.  */
+	bool success;
+};
+/* Functions invoked via strmap_iterate over all components in each
+ * payecs_writespec.  */
+static bool
+payecs_setcomponents_validate(const char *component, const jsmntok_t *value,
+			      struct payecs_setcomponents_data *validation);
+static bool
+payecs_setcomponents_write(const char *component, const jsmntok_t *value,
+			   struct payecs_setcomponents_data *info);
+
+/** payecs_writespec_check
+ *
+ * @brief Determine if all the given `expected` specifications
+ * still hold.
+ */
+static bool
+payecs_writespec_check(const char *buf,
+		       const struct payecs_writespec *expected)
+{
+	struct payecs_setcomponents_data info;
+	size_t i;
+
 	for (i = 0; i < tal_count(expected); ++i) {
-		struct payecs_writespec *expect1 = &expected[i];
+		const struct payecs_writespec *expect1 = &expected[i];
 
 		info.entity = expect1->entity;
 		info.buffer = buf;
@@ -442,7 +1141,7 @@ payecs_setcomponents(struct command *cmd,
 			       &info);
 
 		if (!info.success)
-			goto validation_failed;
+			return false;
 
 		/* If exact, then the length of ecs_get_components should
 		 * be equal to the number of components we just scanned.
@@ -454,13 +1153,26 @@ payecs_setcomponents(struct command *cmd,
 							expect1->entity);
 			if (tal_count(components) !=
 			    expect1->num_components)
-				goto validation_failed;
+				return false;
 		}
 	}
 
-	/* Now perform writes.  */
+	return true;
+}
+
+/** payecs_writespec_apply
+ *
+ * @brief Perform all the given `writes` specifications.
+ */
+static void
+payecs_writespec_apply(const char *buf,
+		       const struct payecs_writespec *writes)
+{
+	struct payecs_setcomponents_data info;
+	size_t i, j;
+
 	for (i = 0; i < tal_count(writes); ++i) {
-		struct payecs_writespec *write1 = &writes[i];
+		const struct payecs_writespec *write1 = &writes[i];
 
 		if (write1->exact) {
 			/* Delete all components first.  */
@@ -471,7 +1183,7 @@ payecs_setcomponents(struct command *cmd,
 			for (j = 0; j < tal_count(components); ++j)
 				ecs_set_component(payz_top->ecs,
 						  write1->entity,
-						  components[i],
+						  components[j],
 						  NULL, NULL);
 		}
 
@@ -482,13 +1194,33 @@ payecs_setcomponents(struct command *cmd,
 			       &payecs_setcomponents_write,
 			       &info);
 	}
+}
+
+static struct command_result *
+payecs_setcomponents(struct command *cmd,
+		     const char *buf,
+		     const jsmntok_t *params)
+{
+	struct payecs_writespec *writes;
+	struct payecs_writespec *expected;
+
+	if (!param(cmd, buf, params,
+		   p_req("writes", &param_array_of_payecs_writespec,
+			 &writes),
+		   p_opt("expected", &param_array_of_payecs_writespec,
+			 &expected),
+		   NULL))
+		return command_param_failed();
+
+	if (!payecs_writespec_check(buf, expected))
+		return command_fail(cmd,
+				    PAYECS_SETCOMPONENTS_UNEXPECTED_COMPONENTS,
+				    "Validation of expected failed.");
+
+	payecs_writespec_apply(buf, writes);
 
 	/* Return empty object.  */
 	return command_success(cmd, json_out_obj(cmd, NULL, NULL));
-validation_failed:
-	return command_fail(cmd,
-			    PAYECS_SETCOMPONENTS_UNEXPECTED_COMPONENTS,
-			    "Validation of expected failed.");
 }
 
 static bool
@@ -517,3 +1249,615 @@ payecs_setcomponents_write(const char *component, const jsmntok_t *value,
 			  info->buffer, value);
 	return true;
 }
+
+/*-----------------------------------------------------------------------------
+Set Entity Components and Advance
+-----------------------------------------------------------------------------*/
+
+/*~
+ * An external system typically ends by writing out its results and
+ * then advancing the entity, which would be two RPC round trips
+ * through lightningd.
+ * payecs_commit does both in a single command.
+ */
+
+static struct command_result *
+payecs_commit(struct command *cmd,
+	      const char *buf,
+	      const jsmntok_t *params)
+{
+	struct payecs_writespec *writes;
+	struct payecs_writespec *expected;
+	u32 *advance;
+
+	struct json_stream *out;
+
+	if (!param(cmd, buf, params,
+		   p_req("writes", &param_array_of_payecs_writespec,
+			 &writes),
+		   p_opt("expected", &param_array_of_payecs_writespec,
+			 &expected),
+		   p_opt("advance", &param_entities, &advance),
+		   NULL))
+		return command_param_failed();
+
+	/* Nothing is written or advanced if validation fails.  */
+	if (!payecs_writespec_check(buf, expected))
+		return command_fail(cmd,
+				    PAYECS_SETCOMPONENTS_UNEXPECTED_COMPONENTS,
+				    "Validation of expected failed.");
+
+	payecs_writespec_apply(buf, writes);
+
+	if (!advance)
+		advance = writespec_entities(cmd, writes);
+
+	out = jsonrpc_stream_success(cmd);
+	payecs_json_advance(out, "errors", cmd->plugin, advance);
+	return command_finished(cmd, out);
+}
+
+/*-----------------------------------------------------------------------------
+Update Entity Components
+-----------------------------------------------------------------------------*/
+
+/*~
+ * A value shared by many entities, such as a count of parts in
+ * flight, would need a payecs_setcomponents with `expected` for
+ * each change, and under contention most of those would fail and
+ * have to be retried.
+ * payecs_updatecomponents instead computes the new value from the
+ * current one here, so that concurrent updates never conflict.
+ */
+
+/** struct payecs_updatecomponents_cell
+ *
+ * @brief The value of a component being updated, before it is
+ * written back to the ECS.
+ */
+struct payecs_updatecomponents_cell {
+	u32 entity;
+	const char *component;
+	/* Whether the entity had the component before the
+	 * updates.  */
+	bool present;
+	/* The current value, or NULL if absent.  */
+	const char *buffer;
+	const jsmntok_t *value;
+};
+
+static struct command_result *
+param_updates(struct command *cmd,
+	      const char *name,
+	      const char *buffer,
+	      const jsmntok_t *tok,
+	      struct update ***updates)
+{
+	const jsmntok_t *entry;
+	const char *error;
+	size_t i;
+
+	if (tok->type == JSMN_OBJECT) {
+		*updates = tal_arr(cmd, struct update *, 1);
+		error = update_parse(cmd, buffer, tok, &(*updates)[0]);
+		if (error)
+			return command_fail_badparam(cmd, name, buffer, tok,
+						     error);
+		return NULL;
+	}
+
+	if (tok->type != JSMN_ARRAY)
+		return command_fail_badparam(cmd, name, buffer, tok,
+					     "should be an array of "
+					     "updates");
+
+	*updates = tal_arr(cmd, struct update *, tok->size);
+	json_for_each_arr (i, entry, tok) {
+		error = update_parse(cmd, buffer, entry, &(*updates)[i]);
+		if (error)
+			return command_fail_badparam(cmd, name, buffer, entry,
+						     error);
+	}
+
+	return NULL;
+}
+
+/** updatecomponents_cell
+ *
+ * @brief Finds the cell being updated, or reads it from the
+ * ECS if not yet updated.
+ */
+static struct payecs_updatecomponents_cell *
+updatecomponents_cell(struct payecs_updatecomponents_cell **cells,
+		      u32 entity,
+		      const char *component)
+{
+	struct payecs_updatecomponents_cell cell;
+	size_t i;
+
+	for (i = 0; i < tal_count(*cells); ++i)
+		if ((*cells)[i].entity == entity
+		 && streq((*cells)[i].component, component))
+			return &(*cells)[i];
+
+	cell.entity = entity;
+	cell.component = component;
+	cell.present = ecs_get_component(payz_top->ecs,
+					 &cell.buffer, &cell.value,
+					 entity, component);
+	if (!cell.present) {
+		cell.buffer = NULL;
+		cell.value = NULL;
+	}
+	tal_arr_expand(cells, cell);
+	return &(*cells)[tal_count(*cells) - 1];
+}
+
+static struct command_result *
+payecs_updatecomponents(struct command *cmd,
+			const char *buf,
+			const jsmntok_t *params)
+{
+	struct update **updates;
+	struct payecs_writespec *expected;
+	struct payecs_updatecomponents_cell *cells;
+	struct payecs_updatecomponents_cell *cell;
+	char *text;
+	const char *error;
+	size_t i;
+
+	struct json_stream *out;
+
+	if (!param(cmd, buf, params,
+		   p_req("updates", &param_updates, &updates),
+		   p_opt("expected", &param_array_of_payecs_writespec,
+			 &expected),
+		   NULL))
+		return command_param_failed();
+
+	if (!payecs_writespec_check(buf, expected))
+		return command_fail(cmd,
+				    PAYECS_SETCOMPONENTS_UNEXPECTED_COMPONENTS,
+				    "Validation of expected failed.");
+
+	/* Compute every new value before writing any of them, so
+	 * that nothing is written if any update cannot apply.
+	 * Later updates to the same component see the earlier
+	 * ones.  */
+	cells = tal_arr(cmd, struct payecs_updatecomponents_cell, 0);
+	out = jsonrpc_stream_success(cmd);
+	json_array_start(out, "values");
+	for (i = 0; i < tal_count(updates); ++i) {
+		cell = updatecomponents_cell(&cells, updates[i]->entity,
+					     updates[i]->component);
+		error = update_apply(cmd, updates[i],
+				     cell->buffer, cell->value, &text);
+		if (error)
+			return command_fail(cmd,
+					    PAYECS_UPDATECOMPONENTS_INAPPLICABLE,
+					    "%s", error);
+		cell->buffer = text;
+		cell->value = NULL;
+		if (text) {
+			cell->value = json_parse_simple(cmd, text,
+							strlen(text));
+			assert(cell->value);
+			json_add_tok(out, NULL, cell->value, cell->buffer);
+		} else
+			json_add_null(out, NULL);
+	}
+	json_array_end(out);
+
+	/* Every cell now has its own buffer, so the ECS can keep it
+	 * rather than copy it.  */
+	for (i = 0; i < tal_count(cells); ++i) {
+		cell = &cells[i];
+		if (!cell->present && !cell->value)
+			continue;
+		if (cell->value)
+			ecs_set_component(payz_top->ecs,
+					  cell->entity, cell->component,
+					  take(cell->buffer),
+					  take(cell->value));
+		else
+			ecs_set_component(payz_top->ecs,
+					  cell->entity, cell->component,
+					  NULL, NULL);
+	}
+
+	json_add_u64(out, "version", ecs_get_version(payz_top->ecs));
+	return command_finished(cmd, out);
+}
+
+/*-----------------------------------------------------------------------------
+Component Change Feed
+-----------------------------------------------------------------------------*/
+
+/*~
+ * Rather than poll the whole ECS, a monitoring plugin can subscribe
+ * to the `payecs_component_changed` notification.
+ * Changes are collected as they happen, and sent at most once per
+ * event loop iteration, so a component changed several times in a
+ * tick is sent only once, with its latest value.
+ * Since notifications go to every plugin subscribed to the topic,
+ * each change says which subscriptions it matches.
+ *
+ * We cannot tell when a subscriber goes away, for example if its
+ * plugin crashes, so a subscription lasts only for its `ttl`,
+ * and the subscriber has to renew it before that passes.
+ * Otherwise we would keep checking, and sending, the changes it
+ * wanted forever.
+ */
+
+/* The default lifetime of a subscription, in seconds.  */
+#define PAYECS_FEED_DEFAULT_TTL 600
+
+/** struct payecs_feed_subscription
+ *
+ * @brief Represents the changes a subscriber wants.
+ */
+struct payecs_feed_subscription {
+	struct payecs_feed *feed;
+	u32 id;
+	/* The components, and component name prefixes, to send,
+	 * or NULL for all components.  */
+	const char **components;
+	const char **prefixes;
+	/* The entities to send, or NULL for all entities.  */
+	u32 *entities;
+	/* The timer for the end of its lifetime.  */
+	struct plugin_timer *timer;
+};
+
+/** struct payecs_feed_change
+ *
+ * @brief Represents a component changed in this tick.
+ */
+struct payecs_feed_change {
+	u32 entity;
+	const char *component;
+	/* The version of the latest change.  */
+	u64 version;
+};
+
+/** struct payecs_feed
+ *
+ * @brief The global change feed state.
+ */
+struct payecs_feed {
+	struct plugin *plugin;
+	struct payecs_feed_subscription **subscriptions;
+	u32 next_id;
+
+	/* The changes not yet sent, keyed by entity, then by
+	 * component, so that they are sent in that order.  */
+	STRMAP(struct payecs_feed_change *) changes;
+	/* The owner of the keys and changes above.  */
+	tal_t *pending;
+	/* The timer to send them, if any.  */
+	struct plugin_timer *timer;
+};
+
+static struct payecs_feed *payecs_feed_state = NULL;
+
+static void destroy_feed_state(struct payecs_feed *feed)
+{
+	ecs_set_change_hook_(payz_top->ecs, NULL, NULL);
+	/* strmap uses malloc.  */
+	strmap_clear(&feed->changes);
+	tal_free(feed->timer);
+	payecs_feed_state = NULL;
+}
+
+static bool feed_wants(const struct payecs_feed_subscription *sub,
+		       u32 entity,
+		       const char *component)
+{
+	size_t i;
+	bool found;
+
+	if (sub->entities) {
+		found = false;
+		for (i = 0; !found && i < tal_count(sub->entities); ++i)
+			found = sub->entities[i] == entity;
+		if (!found)
+			return false;
+	}
+
+	if (!sub->components && !sub->prefixes)
+		return true;
+	for (i = 0; i < tal_count(sub->components); ++i)
+		if (streq(sub->components[i], component))
+			return true;
+	for (i = 0; i < tal_count(sub->prefixes); ++i)
+		if (strstarts(component, sub->prefixes[i]))
+			return true;
+	return false;
+}
+
+static bool feed_any_wants(const struct payecs_feed *feed,
+			   u32 entity,
+			   const char *component)
+{
+	size_t i;
+
+	for (i = 0; i < tal_count(feed->subscriptions); ++i)
+		if (feed_wants(feed->subscriptions[i], entity, component))
+			return true;
+	return false;
+}
+
+static bool feed_add_change(const char *key,
+			    struct payecs_feed_change *change,
+			    struct json_stream *js)
+{
+	struct payecs_feed *feed = payecs_feed_state;
+	const char *buffer;
+	const jsmntok_t *toks;
+	size_t i;
+
+	/* Subscriptions may have gone since the change.  */
+	if (!feed_any_wants(feed, change->entity, change->component))
+		return true;
+
+	json_object_start(js, NULL);
+	json_add_u32(js, "entity", change->entity);
+	json_add_string(js, "component", change->component);
+	if (ecs_get_component(payz_top->ecs, &buffer, &toks,
+			      change->entity, change->component))
+		json_add_tok(js, "value", toks, buffer);
+	else
+		json_add_null(js, "value");
+	json_add_u64(js, "version", change->version);
+	json_array_start(js, "subscriptions");
+	for (i = 0; i < tal_count(feed->subscriptions); ++i)
+		if (feed_wants(feed->subscriptions[i],
+			       change->entity, change->component))
+			json_add_u32(js, NULL, feed->subscriptions[i]->id);
+	json_array_end(js);
+	json_object_end(js);
+
+	return true;
+}
+
+static void feed_flush(struct payecs_feed *feed)
+{
+	struct json_stream *js;
+
+	feed->timer = NULL;
+
+	js = plugin_notification_start(feed->plugin,
+				       PAYECS_COMPONENT_CHANGED_NOTIFICATION);
+	json_add_u64(js, "version", ecs_get_version(payz_top->ecs));
+	json_array_start(js, "changes");
+	strmap_iterate(&feed->changes, &feed_add_change, js);
+	json_array_end(js);
+	plugin_notification_end(feed->plugin, js);
+
+	strmap_clear(&feed->changes);
+	strmap_init(&feed->changes);
+	tal_free(feed->pending);
+	feed->pending = tal(feed, char);
+
+	timer_complete(feed->plugin);
+}
+
+static void feed_changed(u32 entity,
+			 const char *component,
+			 u64 version,
+			 struct payecs_feed *feed)
+{
+	struct payecs_feed_change *change;
+	char *key;
+
+	if (!feed_any_wants(feed, entity, component))
+		return;
+
+	/* Zero-padded, so entities sort numerically.  */
+	key = tal_fmt(feed->pending, "%010"PRIu32":%s", entity, component);
+	change = strmap_get(&feed->changes, key);
+	if (change) {
+		/* Only the latest change to the component is sent.  */
+		tal_free(key);
+		change->version = version;
+		return;
+	}
+
+	change = tal(key, struct payecs_feed_change);
+	change->entity = entity;
+	change->component = tal_strdup(change, component);
+	change->version = version;
+	strmap_add(&feed->changes, key, change);
+
+	/* Send on the next event loop iteration, after every other
+	 * change made in this one.  */
+	if (!feed->timer)
+		feed->timer = plugin_timer(feed->plugin, time_from_sec(0),
+					   &feed_flush, feed);
+}
+
+static void destroy_subscription(struct payecs_feed_subscription *sub)
+{
+	tal_free(sub->timer);
+}
+
+static void subscription_expired(struct payecs_feed_subscription *sub)
+{
+	struct payecs_feed *feed = sub->feed;
+	size_t i;
+
+	/* The timer frees itself after we return.  */
+	sub->timer = NULL;
+	plugin_log(feed->plugin, LOG_DBG,
+		   "Subscription %"PRIu32" expired.", sub->id);
+
+	for (i = 0; i < tal_count(feed->subscriptions); ++i) {
+		if (feed->subscriptions[i] != sub)
+			continue;
+		tal_arr_remove(&feed->subscriptions, i);
+		break;
+	}
+	tal_free(sub);
+
+	timer_complete(feed->plugin);
+}
+
+static void subscription_set_ttl(struct payecs_feed_subscription *sub,
+				 u32 ttl)
+{
+	tal_free(sub->timer);
+	sub->timer = plugin_timer(sub->feed->plugin, time_from_sec(ttl),
+				  &subscription_expired, sub);
+}
+
+static struct payecs_feed_subscription *
+find_subscription(const struct payecs_feed *feed, u32 id, size_t *index)
+{
+	size_t i;
+
+	for (i = 0; feed && i < tal_count(feed->subscriptions); ++i) {
+		if (feed->subscriptions[i]->id != id)
+			continue;
+		if (index)
+			*index = i;
+		return feed->subscriptions[i];
+	}
+	return NULL;
+}
+
+static struct command_result *
+param_ttl(struct command *cmd,
+	  const char *name,
+	  const char *buffer,
+	  const jsmntok_t *tok,
+	  unsigned int **ttl)
+{
+	*ttl = tal(cmd, unsigned int);
+	if (!json_to_number(buffer, tok, *ttl) || **ttl == 0)
+		return command_fail_badparam(cmd, name, buffer, tok,
+					     "should be a positive number "
+					     "of seconds");
+	return NULL;
+}
+
+static struct payecs_feed *get_feed_state(struct plugin *plugin)
+{
+	struct payecs_feed *feed = payecs_feed_state;
+
+	if (feed)
+		return feed;
+
+	feed = tal(payz_top, struct payecs_feed);
+	feed->plugin = plugin;
+	feed->subscriptions = tal_arr(feed,
+				      struct payecs_feed_subscription *, 0);
+	feed->next_id = 1;
+	strmap_init(&feed->changes);
+	feed->pending = tal(feed, char);
+	feed->timer = NULL;
+	tal_add_destructor(feed, &destroy_feed_state);
+	ecs_set_change_hook(payz_top->ecs, &feed_changed, feed);
+
+	payecs_feed_state = feed;
+	return feed;
+}
+
+static struct command_result *
+payecs_subscribecomponents(struct command *cmd,
+			   const char *buf,
+			   const jsmntok_t *params)
+{
+	struct payecs_feed *feed;
+	struct payecs_feed_subscription *sub;
+	const char **components;
+	const char **prefixes;
+	u32 *entities;
+	unsigned int *ttl;
+
+	struct json_stream *out;
+
+	if (!param(cmd, buf, params,
+		   p_opt("components", &param_array_of_strings, &components),
+		   p_opt("prefixes", &param_array_of_strings, &prefixes),
+		   p_opt("entities", &param_entities, &entities),
+		   p_opt_def("ttl", &param_ttl, &ttl,
+			     PAYECS_FEED_DEFAULT_TTL),
+		   NULL))
+		return command_param_failed();
+
+	feed = get_feed_state(cmd->plugin);
+	sub = tal(feed, struct payecs_feed_subscription);
+	sub->feed = feed;
+	sub->id = feed->next_id++;
+	sub->components = tal_steal(sub, components);
+	sub->prefixes = tal_steal(sub, prefixes);
+	sub->entities = tal_steal(sub, entities);
+	sub->timer = NULL;
+	tal_add_destructor(sub, &destroy_subscription);
+	subscription_set_ttl(sub, *ttl);
+	tal_arr_expand(&feed->subscriptions, sub);
+
+	out = jsonrpc_stream_success(cmd);
+	json_add_u32(out, "subscription", sub->id);
+	json_add_u64(out, "version", ecs_get_version(payz_top->ecs));
+	json_add_u32(out, "ttl", *ttl);
+	return command_finished(cmd, out);
+}
+
+static struct command_result *
+payecs_unsubscribecomponents(struct command *cmd,
+			     const char *buf,
+			     const jsmntok_t *params)
+{
+	struct payecs_feed *feed = payecs_feed_state;
+	struct payecs_feed_subscription *sub;
+	unsigned int *id;
+	size_t i;
+
+	if (!param(cmd, buf, params,
+		   p_req("subscription", &param_number, &id),
+		   NULL))
+		return command_param_failed();
+
+	sub = find_subscription(feed, *id, &i);
+	if (!sub)
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "Unknown subscription %u", *id);
+
+	tal_arr_remove(&feed->subscriptions, i);
+	tal_free(sub);
+	return command_success(cmd, json_out_obj(cmd, NULL, NULL));
+}
+
+static struct command_result *
+payecs_renewsubscription(struct command *cmd,
+			 const char *buf,
+			 const jsmntok_t *params)
+{
+	struct payecs_feed_subscription *sub;
+	unsigned int *id;
+	unsigned int *ttl;
+
+	struct json_stream *out;
+
+	if (!param(cmd, buf, params,
+		   p_req("subscription", &param_number, &id),
+		   p_opt_def("ttl", &param_ttl, &ttl,
+			     PAYECS_FEED_DEFAULT_TTL),
+		   NULL))
+		return command_param_failed();
+
+	/* An expired subscription may have missed changes, so the
+	 * subscriber has to subscribe again and catch up.  */
+	sub = find_subscription(payecs_feed_state, *id, NULL);
+	if (!sub)
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "Unknown subscription %u", *id);
+
+	subscription_set_ttl(sub, *ttl);
+
+	out = jsonrpc_stream_success(cmd);
+	json_add_u32(out, "subscription", sub->id);
+	json_add_u32(out, "ttl", *ttl);
+	return command_finished(cmd, out);
+}
@@ -12,6 +12,15 @@
 extern const struct plugin_command payecs_data_commands[];
 extern const size_t num_payecs_data_commands;
 
+extern const char *payecs_data_topics[];
+extern const size_t num_payecs_data_topics;
+
+/*~ Notification topic for changes to components that
+ * `payecs_subscribecomponents` subscribed to.
+ */
+#define PAYECS_COMPONENT_CHANGED_NOTIFICATION "payecs_component_changed"
+
 static const errcode_t PAYECS_SETCOMPONENTS_UNEXPECTED_COMPONENTS = 2244;
+static const errcode_t PAYECS_UPDATECOMPONENTS_INAPPLICABLE = 2245;
 
 #endif /* LIGHTNING_PLUGINS_PAYZ_PAYECS_DATA_H */
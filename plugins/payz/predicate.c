@@ -0,0 +1,262 @@
+#include"predicate.h"
+#include<ccan/array_size/array_size.h>
+#include<ccan/mem/mem.h>
+#include<ccan/tal/str/str.h>
+#include<common/amount.h>
+#include<common/utils.h>
+#include<plugins/payz/json_equal.h>
+
+static const struct {
+	const char *name;
+	enum predicate_op op;
+} predicate_ops[] = {
+	{"equals", PREDICATE_EQUALS},
+	{"lt", PREDICATE_LT},
+	{"le", PREDICATE_LE},
+	{"gt", PREDICATE_GT},
+	{"ge", PREDICATE_GE},
+	{"prefix", PREDICATE_PREFIX},
+	{"in", PREDICATE_IN}
+};
+
+bool predicate_to_number(const char *buffer, const jsmntok_t *tok,
+			 struct predicate_number *num)
+{
+	struct amount_msat msat;
+	s64 s;
+
+	if (tok->type == JSMN_STRING) {
+		if (!parse_amount_msat(&msat, buffer + tok->start,
+				       tok->end - tok->start))
+			return false;
+		num->amount = true;
+		num->negative = false;
+		num->magnitude = msat.millisatoshis; /* Raw: arithmetic */
+		return true;
+	}
+	if (tok->type != JSMN_PRIMITIVE || tok->end == tok->start)
+		return false;
+
+	num->amount = false;
+	if (buffer[tok->start] != '-') {
+		num->negative = false;
+		return json_to_u64(buffer, tok, &num->magnitude);
+	}
+	if (!json_to_s64(buffer, tok, &s))
+		return false;
+	num->negative = s < 0;
+	/* Negate as u64, so that INT64_MIN does not overflow.  */
+	num->magnitude = num->negative ? -(u64) s : (u64) s;
+	return true;
+}
+
+bool predicate_compare(const char *buffer1, const jsmntok_t *tok1,
+		       const char *buffer2, const jsmntok_t *tok2,
+		       int *cmp)
+{
+	struct predicate_number num1, num2;
+
+	if (!predicate_to_number(buffer1, tok1, &num1)
+	 || !predicate_to_number(buffer2, tok2, &num2))
+		return false;
+
+	if (num1.negative != num2.negative)
+		*cmp = num1.negative ? -1 : 1;
+	else if (num1.magnitude == num2.magnitude)
+		*cmp = 0;
+	else if (num1.magnitude < num2.magnitude)
+		*cmp = num1.negative ? 1 : -1;
+	else
+		*cmp = num1.negative ? -1 : 1;
+	return true;
+}
+
+const char *predicate_parse_field(const tal_t *ctx,
+				  const char *buffer,
+				  const jsmntok_t *tok,
+				  const char ***field)
+{
+	const jsmntok_t *entry;
+	size_t i;
+
+	if (!tok) {
+		*field = tal_arr(ctx, const char *, 0);
+		return NULL;
+	}
+	if (tok->type == JSMN_STRING) {
+		*field = tal_arr(ctx, const char *, 1);
+		(*field)[0] = json_strdup(*field, buffer, tok);
+		return NULL;
+	}
+	if (tok->type != JSMN_ARRAY)
+		goto fail;
+
+	*field = tal_arr(ctx, const char *, tok->size);
+	json_for_each_arr (i, entry, tok) {
+		if (entry->type != JSMN_STRING) {
+			*field = tal_free(*field);
+			goto fail;
+		}
+		(*field)[i] = json_strdup(*field, buffer, entry);
+	}
+	return NULL;
+
+fail:
+	return tal_fmt(ctx, "'field' must be a string or array of "
+			    "strings");
+}
+
+const char *predicate_parse(const tal_t *ctx,
+			    const char *buffer,
+			    const jsmntok_t *tok,
+			    struct predicate **predicate)
+{
+	struct predicate *p;
+	const jsmntok_t *component;
+	const jsmntok_t *operand = NULL;
+	const jsmntok_t *t;
+	const char *error;
+	size_t i;
+	int cmp;
+
+	if (tok->type != JSMN_OBJECT)
+		return tal_fmt(ctx, "predicate must be an object");
+
+	component = json_get_member(buffer, tok, "component");
+	if (!component || component->type != JSMN_STRING)
+		return tal_fmt(ctx, "predicate needs a 'component' string");
+
+	p = tal(ctx, struct predicate);
+	p->component = json_strdup(p, buffer, component);
+
+	error = predicate_parse_field(p, buffer,
+				      json_get_member(buffer, tok, "field"),
+				      &p->field);
+	if (error) {
+		error = tal_fmt(ctx, "predicate %s", error);
+		tal_free(p);
+		return error;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(predicate_ops); ++i) {
+		t = json_get_member(buffer, tok, predicate_ops[i].name);
+		if (!t)
+			continue;
+		if (operand) {
+			tal_free(p);
+			return tal_fmt(ctx, "predicate must have only one "
+					    "of 'equals', 'lt', 'le', 'gt', "
+					    "'ge', 'prefix', 'in'");
+		}
+		operand = t;
+		p->op = predicate_ops[i].op;
+	}
+	if (!operand) {
+		tal_free(p);
+		return tal_fmt(ctx, "predicate needs one of 'equals', "
+				    "'lt', 'le', 'gt', 'ge', 'prefix', 'in'");
+	}
+
+	switch (p->op) {
+	case PREDICATE_EQUALS:
+		break;
+	case PREDICATE_LT:
+	case PREDICATE_LE:
+	case PREDICATE_GT:
+	case PREDICATE_GE:
+		if (!predicate_compare(buffer, operand, buffer, operand, &cmp))
+			goto fail_operand;
+		break;
+	case PREDICATE_PREFIX:
+		if (operand->type != JSMN_STRING)
+			goto fail_operand;
+		break;
+	case PREDICATE_IN:
+		if (operand->type != JSMN_ARRAY)
+			goto fail_operand;
+		break;
+	}
+
+	/* Keep our own copy of the operand, so the predicate can
+	 * outlive the command that gave it.  */
+	p->buffer = json_tok_text(p, buffer, operand);
+	p->operand = json_parse_simple(p, p->buffer, strlen(p->buffer));
+	if (!p->operand)
+		goto fail_operand;
+
+	*predicate = p;
+	return NULL;
+
+fail_operand:
+	tal_free(p);
+	return tal_fmt(ctx, "predicate operand %.*s is invalid for "
+			    "its test",
+		       json_tok_full_len(operand),
+		       json_tok_full(buffer, operand));
+}
+
+const jsmntok_t *predicate_field(const struct predicate *predicate,
+				 const char *buffer,
+				 const jsmntok_t *component)
+{
+	size_t i;
+
+	for (i = 0; component && i < tal_count(predicate->field); ++i) {
+		if (component->type != JSMN_OBJECT)
+			return NULL;
+		component = json_get_member(buffer, component,
+					    predicate->field[i]);
+	}
+	return component;
+}
+
+bool predicate_test(const struct predicate *predicate,
+		    const char *buffer,
+		    const jsmntok_t *component)
+{
+	const jsmntok_t *value;
+	const jsmntok_t *entry;
+	const jsmntok_t *operand = predicate->operand;
+	size_t i;
+	int cmp;
+
+	value = predicate_field(predicate, buffer, component);
+	if (!value)
+		return false;
+
+	switch (predicate->op) {
+	case PREDICATE_EQUALS:
+		return json_equal(buffer, value, predicate->buffer, operand);
+	case PREDICATE_LT:
+	case PREDICATE_LE:
+	case PREDICATE_GT:
+	case PREDICATE_GE:
+		if (!predicate_compare(buffer, value,
+				       predicate->buffer, operand, &cmp))
+			return false;
+		switch (predicate->op) {
+		case PREDICATE_LT:
+			return cmp < 0;
+		case PREDICATE_LE:
+			return cmp <= 0;
+		case PREDICATE_GT:
+			return cmp > 0;
+		default:
+			return cmp >= 0;
+		}
+	case PREDICATE_PREFIX:
+		if (value->type != JSMN_STRING)
+			return false;
+		return memstarts(buffer + value->start,
+				 value->end - value->start,
+				 predicate->buffer + operand->start,
+				 operand->end - operand->start);
+	case PREDICATE_IN:
+		json_for_each_arr (i, entry, operand)
+			if (json_equal(buffer, value,
+				       predicate->buffer, entry))
+				return true;
+		return false;
+	}
+	abort();
+}
@@ -0,0 +1,144 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_PREDICATE_H
+#define LIGHTNING_PLUGINS_PAYZ_PREDICATE_H
+#include"config.h"
+#include<ccan/tal/tal.h>
+#include<common/json.h>
+#include<stdbool.h>
+
+/** enum predicate_op
+ *
+ * @brief The test a predicate makes on a value.
+ */
+enum predicate_op {
+	/* The value is equal to the operand.  */
+	PREDICATE_EQUALS,
+	/* The value, a number or amount, compares to the operand,
+	 * also a number or amount.  */
+	PREDICATE_LT,
+	PREDICATE_LE,
+	PREDICATE_GT,
+	PREDICATE_GE,
+	/* The value is a string starting with the operand.  */
+	PREDICATE_PREFIX,
+	/* The value is equal to one of the operand array.  */
+	PREDICATE_IN
+};
+
+/** struct predicate
+ *
+ * @brief Represents a test on the value of a component of an
+ * entity, such as `{"component": "lightningd:status",
+ * "equals": "pending"}`.
+ */
+struct predicate {
+	/* The component to test.  */
+	const char *component;
+	/* The members to descend into, within the component, to
+	 * get the value to test; empty to test the component
+	 * itself.  */
+	const char **field;
+	enum predicate_op op;
+	/* The operand, in its own buffer.  */
+	const char *buffer;
+	const jsmntok_t *operand;
+};
+
+/** predicate_parse
+ *
+ * @brief Parses a predicate object.
+ *
+ * @param ctx - the owner of the returned predicate.
+ * @param buffer - the buffer containing the predicate.
+ * @param tok - the predicate object.
+ * @param predicate - set to the parsed predicate.
+ *
+ * @return - NULL on success, or an error message allocated
+ * from ctx.
+ */
+const char *predicate_parse(const tal_t *ctx,
+			    const char *buffer,
+			    const jsmntok_t *tok,
+			    struct predicate **predicate);
+
+/** predicate_parse_field
+ *
+ * @brief Parses a `field`, a member name or an array of member
+ * names, into an array of member names.
+ *
+ * @param tok - the field, or NULL if not given, which is
+ * parsed as an empty array.
+ *
+ * @return - NULL on success, or an error message allocated
+ * from ctx.
+ */
+const char *predicate_parse_field(const tal_t *ctx,
+				  const char *buffer,
+				  const jsmntok_t *tok,
+				  const char ***field);
+
+/** predicate_field
+ *
+ * @brief Gets the value a predicate tests, from the value of
+ * its component.
+ *
+ * @return - the value, or NULL if the component does not have
+ * the field.
+ */
+const jsmntok_t *predicate_field(const struct predicate *predicate,
+				 const char *buffer,
+				 const jsmntok_t *component);
+
+/** predicate_test
+ *
+ * @brief Tests the value of a component against a predicate.
+ *
+ * @param predicate - the predicate to test.
+ * @param buffer - the buffer containing the component.
+ * @param component - the value of the component, or NULL if
+ * the entity does not have the component, in which case the
+ * predicate never holds.
+ */
+bool predicate_test(const struct predicate *predicate,
+		    const char *buffer,
+		    const jsmntok_t *component);
+
+/** struct predicate_number
+ *
+ * @brief A number or amount, as a sign and magnitude, so that
+ * both negative numbers and the full range of u64 amounts can be
+ * represented.
+ */
+struct predicate_number {
+	/* Whether it is an amount such as "1000msat", rather than
+	 * a plain number.  */
+	bool amount;
+	bool negative;
+	u64 magnitude;
+};
+
+/** predicate_to_number
+ *
+ * @brief Parses a number or amount, such as `42`, `-1`, or
+ * `"1000msat"`.
+ *
+ * @return - false if it is not a number or amount.
+ */
+bool predicate_to_number(const char *buffer, const jsmntok_t *tok,
+			 struct predicate_number *num);
+
+/** predicate_compare
+ *
+ * @brief Compares two numbers or amounts, such as `42`, `-1`,
+ * or `"1000msat"`.
+ *
+ * @param cmp - set to less than, equal to, or greater than 0,
+ * as the first is less than, equal to, or greater than the
+ * second.
+ *
+ * @return - false if either is not a number or amount.
+ */
+bool predicate_compare(const char *buffer1, const jsmntok_t *tok1,
+		       const char *buffer2, const jsmntok_t *tok2,
+		       int *cmp);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_PREDICATE_H */
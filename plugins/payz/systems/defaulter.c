@@ -32,66 +32,61 @@ static const char *default_exemptfee = "\"5000msat\"";
 /* We get this at init time.  */
 static char *default_maxdelay = NULL;
 
-static struct command_result *
-defaulter_riskfactor(struct ecs *ecs,
-		     struct command *cmd,
-		     u32 entity,
+static void
+defaulter_riskfactor(struct ecs *ecs, u32 entity,
 		     const char *buffer,
 		     const jsmntok_t *components);
-static struct command_result *
-defaulter_maxfeepercent(struct ecs *ecs,
-			struct command *cmd,
-			u32 entity,
+static void
+defaulter_maxfeepercent(struct ecs *ecs, u32 entity,
 			const char *buffer,
 			const jsmntok_t *components);
-static struct command_result *
-defaulter_retry_for(struct ecs *ecs,
-		    struct command *cmd,
-		    u32 entity,
+static void
+defaulter_retry_for(struct ecs *ecs, u32 entity,
 		    const char *buffer,
 		    const jsmntok_t *components);
-static struct command_result *
-defaulter_maxdelay(struct ecs *ecs,
-		   struct command *cmd,
-		   u32 entity,
+static void
+defaulter_maxdelay(struct ecs *ecs, u32 entity,
 		   const char *buffer,
 		   const jsmntok_t *components);
-static struct command_result *
-defaulter_exemptfee(struct ecs *ecs,
-		    struct command *cmd,
-		    u32 entity,
+static void
+defaulter_exemptfee(struct ecs *ecs, u32 entity,
 		    const char *buffer,
 		    const jsmntok_t *components);
 
 struct ecs_register_desc system_defaulter[] = {
 	ECS_REGISTER_NAME("lightningd:default_riskfactor"),
-	ECS_REGISTER_FUNC(&defaulter_riskfactor),
+	ECS_REGISTER_PURE_FUNC(&defaulter_riskfactor),
 	ECS_REGISTER_REQUIRE("lightningd:main-payment"),
 	ECS_REGISTER_DISALLOW("lightningd:riskfactor"),
+	ECS_REGISTER_WRITE("lightningd:riskfactor"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_NAME("lightningd:default_maxfeepercent"),
-	ECS_REGISTER_FUNC(&defaulter_maxfeepercent),
+	ECS_REGISTER_PURE_FUNC(&defaulter_maxfeepercent),
 	ECS_REGISTER_REQUIRE("lightningd:main-payment"),
 	ECS_REGISTER_DISALLOW("lightningd:maxfeepercent"),
+	ECS_REGISTER_WRITE("lightningd:maxfeepercent"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_NAME("lightningd:default_retry_for"),
-	ECS_REGISTER_FUNC(&defaulter_retry_for),
+	ECS_REGISTER_PURE_FUNC(&defaulter_retry_for),
 	ECS_REGISTER_REQUIRE("lightningd:main-payment"),
 	ECS_REGISTER_DISALLOW("lightningd:retry_for"),
+	ECS_REGISTER_WRITE("lightningd:retry_for"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_NAME("lightningd:default_maxdelay"),
-	ECS_REGISTER_FUNC(&defaulter_maxdelay),
+	ECS_REGISTER_PURE_FUNC(&defaulter_maxdelay),
 	ECS_REGISTER_REQUIRE("lightningd:main-payment"),
 	ECS_REGISTER_DISALLOW("lightningd:maxdelay"),
+	ECS_REGISTER_WRITE("lightningd:maxdelay"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_NAME("lightningd:default_exemptfee"),
-	ECS_REGISTER_FUNC(&defaulter_exemptfee),
+	ECS_REGISTER_PURE_FUNC(&defaulter_exemptfee),
 	ECS_REGISTER_REQUIRE("lightningd:main-payment"),
 	ECS_REGISTER_DISALLOW("lightningd:exemptfee"),
+	ECS_REGISTER_WRITE("lightningd:exemptfee"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_OVER_AND_OUT()
@@ -105,62 +100,48 @@ void system_defaulter_init(struct plugin *plugin)
 		 JSON_SCAN_TAL(plugin, json_strdup, &default_maxdelay));
 }
 
-static struct command_result *
-defaulter_riskfactor(struct ecs *ecs,
-		     struct command *cmd,
-		     u32 entity,
+static void
+defaulter_riskfactor(struct ecs *ecs, u32 entity,
 		     const char *buffer,
 		     const jsmntok_t *components)
 {
 	ecs_set_component_datum(ecs, entity,
 				"lightningd:riskfactor",
 				default_riskfactor);
-	return ecs_advance_done(cmd, ecs, entity);
 }
 
-static struct command_result *
-defaulter_maxfeepercent(struct ecs *ecs,
-			struct command *cmd,
-			u32 entity,
+static void
+defaulter_maxfeepercent(struct ecs *ecs, u32 entity,
 			const char *buffer,
 			const jsmntok_t *components)
 {
 	ecs_set_component_datum(ecs, entity,
 				"lightningd:maxfeepercent",
 				default_maxfeepercent);
-	return ecs_advance_done(cmd, ecs, entity);
 }
 
-static struct command_result *
-defaulter_retry_for(struct ecs *ecs,
-		    struct command *cmd,
-		    u32 entity,
+static void
+defaulter_retry_for(struct ecs *ecs, u32 entity,
 		    const char *buffer,
 		    const jsmntok_t *components)
 {
 	ecs_set_component_datum(ecs, entity,
 				"lightningd:retry_for",
 				default_retry_for);
-	return ecs_advance_done(cmd, ecs, entity);
 }
 
-static struct command_result *
-defaulter_exemptfee(struct ecs *ecs,
-		    struct command *cmd,
-		    u32 entity,
+static void
+defaulter_exemptfee(struct ecs *ecs, u32 entity,
 		    const char *buffer,
 		    const jsmntok_t *components)
 {
 	ecs_set_component_datum(ecs, entity,
 				"lightningd:exemptfee",
 				default_exemptfee);
-	return ecs_advance_done(cmd, ecs, entity);
 }
 
-static struct command_result *
-defaulter_maxdelay(struct ecs *ecs,
-		   struct command *cmd,
-		   u32 entity,
+static void
+defaulter_maxdelay(struct ecs *ecs, u32 entity,
 		   const char *buffer,
 		   const jsmntok_t *components)
 {
@@ -168,5 +149,4 @@ defaulter_maxdelay(struct ecs *ecs,
 	ecs_set_component_datum(ecs, entity,
 				"lightningd:maxdelay",
 				default_maxdelay);
-	return ecs_advance_done(cmd, ecs, entity);
 }
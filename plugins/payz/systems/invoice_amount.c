@@ -5,9 +5,8 @@
 #include<common/utils.h>
 #include<plugins/libplugin.h>
 
-static struct command_result *
-invoice_amount_msat(struct ecs *ecs, struct command *cmd,
-		    u32 entity,
+static void
+invoice_amount_msat(struct ecs *ecs, u32 entity,
 		    const char *buffer,
 		    const jsmntok_t *components);
 static struct command_result *
@@ -19,23 +18,25 @@ fail_invoice_amount_and_amount(struct ecs *ecs,
 
 struct ecs_register_desc system_invoice_amount[] = {
 	ECS_REGISTER_NAME("lightningd:invoice_amount_msat"),
-	ECS_REGISTER_FUNC(&invoice_amount_msat),
+	ECS_REGISTER_PURE_FUNC(&invoice_amount_msat),
 	ECS_REGISTER_REQUIRE("lightningd:invoice:amount_msat"),
 	ECS_REGISTER_DISALLOW("lightningd:amount"),
+	ECS_REGISTER_WRITE("lightningd:invoice:amount_msat"),
+	ECS_REGISTER_WRITE("lightningd:amount"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_NAME("lightningd:fail_invoice_amount_and_amount"),
 	ECS_REGISTER_FUNC(&fail_invoice_amount_and_amount),
 	ECS_REGISTER_REQUIRE("lightningd:invoice:amount_msat"),
 	ECS_REGISTER_REQUIRE("lightningd:amount"),
+	ECS_REGISTER_WRITE("lightningd:error"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_OVER_AND_OUT()
 };
 
-static struct command_result *
-invoice_amount_msat(struct ecs *ecs, struct command *cmd,
-		    u32 entity,
+static void
+invoice_amount_msat(struct ecs *ecs, u32 entity,
 		    const char *buffer,
 		    const jsmntok_t *components)
 {
@@ -48,8 +49,6 @@ invoice_amount_msat(struct ecs *ecs, struct command *cmd,
 	ecs_set_component_datum(ecs, entity, "lightningd:invoice:amount_msat",
 				NULL);
 	ecs_set_component(ecs, entity, "lightningd:amount", buffer, amount_msat);
-
-	return ecs_advance_done(cmd, ecs, entity);
 }
 
 static struct command_result *
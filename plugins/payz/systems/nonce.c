@@ -10,26 +10,23 @@
  * @brief Generates a random 32-byte nonce for each entity.
  */
 
-static struct command_result *
-generate_nonce(struct ecs *ecs,
-	       struct command *cmd,
-	       u32 entity,
+static void
+generate_nonce(struct ecs *ecs, u32 entity,
 	       const char *buffer,
 	       const jsmntok_t *eo);
 
 struct ecs_register_desc system_nonce[] = {
 	ECS_REGISTER_NAME("lightningd:generate_nonce"),
-	ECS_REGISTER_FUNC(&generate_nonce),
+	ECS_REGISTER_PURE_FUNC(&generate_nonce),
 	ECS_REGISTER_REQUIRE("lightningd:systems"), /* Dummy.  */
 	ECS_REGISTER_DISALLOW("lightningd:nonce"),
+	ECS_REGISTER_WRITE("lightningd:nonce"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_OVER_AND_OUT()
 };
-static struct command_result *
-generate_nonce(struct ecs *ecs,
-               struct command *cmd,
-               u32 entity,
+static void
+generate_nonce(struct ecs *ecs, u32 entity,
                const char *buffer,
                const jsmntok_t *eo)
 {
@@ -41,6 +38,4 @@ generate_nonce(struct ecs *ecs,
 
 	ecs_set_component_datum(ecs, entity, "lightningd:nonce",
 				tal_fmt(tmpctx, "\"%s\"", nonce_hex));
-
-	return ecs_advance_done(cmd, ecs, entity);
 }
@@ -11,9 +11,8 @@ static struct command_result *
 parse_invoice(struct ecs *, struct command *,
 	      u32 entity,
 	      const char *buffer, const jsmntok_t *eo);
-static struct command_result *
-promote_invoice_type(struct ecs *ecs, struct command *cmd,
-		     u32 entity,
+static void
+promote_invoice_type(struct ecs *ecs, u32 entity,
 		     const char *buffer, const jsmntok_t *eo);
 
 struct ecs_register_desc system_parse_invoice[] = {
@@ -21,12 +20,17 @@ struct ecs_register_desc system_parse_invoice[] = {
 	ECS_REGISTER_FUNC(&parse_invoice),
 	ECS_REGISTER_REQUIRE("lightningd:invoice"),
 	ECS_REGISTER_DISALLOW("lightningd:parse_invoice:ran"),
+	ECS_REGISTER_WRITE("lightningd:parse_invoice:ran"),
+	ECS_REGISTER_WRITE("lightningd:invoice:*"),
+	ECS_REGISTER_WRITE("lightningd:error"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_NAME("lightningd:promote_invoice_type"),
-	ECS_REGISTER_FUNC(&promote_invoice_type),
+	ECS_REGISTER_PURE_FUNC(&promote_invoice_type),
 	ECS_REGISTER_REQUIRE("lightningd:invoice:type"),
 	ECS_REGISTER_DISALLOW("lightningd:promote_invoice_type:ran"),
+	ECS_REGISTER_WRITE("lightningd:promote_invoice_type:ran"),
+	ECS_REGISTER_WRITE("lightningd:invoice:type:*"),
 	ECS_REGISTER_DONE(),
 
 	ECS_REGISTER_OVER_AND_OUT()
@@ -40,6 +44,8 @@ struct parse_invoice_closure {
 	struct ecs *ecs;
 	struct command *cmd;
 	u32 entity;
+	/* When we called `decode`.  */
+	struct timemono start;
 };
 
 static struct command_result *
@@ -74,6 +80,7 @@ parse_invoice(struct ecs *ecs, struct command *cmd,
 	closure->ecs = ecs;
 	closure->cmd = cmd;
 	closure->entity = entity;
+	closure->start = time_mono();
 
 	req = jsonrpc_request_start(cmd->plugin, cmd, "decode",
 				    &parse_invoice_decode_ok,
@@ -95,6 +102,8 @@ parse_invoice_decode_ok(struct command *cmd,
 	size_t i;
 
 	tal_steal(tmpctx, closure);
+	ecs_add_span(closure->ecs, "rpc", "decode",
+		     closure->entity, closure->start);
 
 	json_for_each_obj(i, key, res) {
 		value = key + 1;
@@ -121,6 +130,8 @@ parse_invoice_decode_ng(struct command *cmd,
 			 struct parse_invoice_closure *closure)
 {
 	tal_steal(tmpctx, closure);
+	ecs_add_span(closure->ecs, "rpc", "decode",
+		     closure->entity, closure->start);
 
 	ecs_set_component(closure->ecs, closure->entity,
 			  "lightningd:error", buf, res);
@@ -142,9 +153,8 @@ Invoice Type Promotion
  * `lightningd:invoice:type:bolt11 invoice`.
  */
 
-static struct command_result *
-promote_invoice_type(struct ecs *ecs, struct command *cmd,
-		     u32 entity,
+static void
+promote_invoice_type(struct ecs *ecs, u32 entity,
 		     const char *buffer, const jsmntok_t *eo)
 {
 	const jsmntok_t *type_tok;
@@ -157,6 +167,4 @@ promote_invoice_type(struct ecs *ecs, struct command *cmd,
 				tal_fmt(tmpctx, "lightningd:invoice:type:%s",
 					type),
 				"true");
-
-	return ecs_advance_done(cmd, ecs, entity);
 }
@@ -178,8 +178,9 @@ payz_tester_command_process(struct payz_tester_command *command,
 	/* Reflect payecs_system_trigger notifications back to the
 	 * plugin.
 	 */
-	if (is_notif && json_tok_streq(buffer, method,
-				       ECS_SYSTEM_NOTIFICATION)) {
+	if (is_notif &&
+	    (json_tok_streq(buffer, method, ECS_SYSTEM_NOTIFICATION) ||
+	     json_tok_streq(buffer, method, ECS_SYSTEM_BATCH_NOTIFICATION))) {
 		/* lightningd adds an additional `payload` wrapper
 		 * and an `origin` field to the `params`.
 		 */
@@ -187,10 +188,12 @@ payz_tester_command_process(struct payz_tester_command *command,
 
 		notif = tal_fmt(tmpctx,
 				"{\"jsonrpc\": \"2.0\","
-				" \"method\": \""ECS_SYSTEM_NOTIFICATION"\","
+				" \"method\": %.*s,"
 				" \"params\": "
 				"   {\"origin\": \"payz\","
 				"    \"payload\": %.*s}}",
+				json_tok_full_len(method),
+				json_tok_full(buffer, method),
 				json_tok_full_len(params),
 				json_tok_full(buffer, params));
 
@@ -1,6 +1,7 @@
 #include"tester.h"
 #include<assert.h>
 #include<ccan/err/err.h>
+#include<ccan/json_escape/json_escape.h>
 #include<ccan/json_out/json_out.h>
 #include<ccan/take/take.h>
 #include<ccan/tal/str/str.h>
@@ -37,9 +38,13 @@ struct payz_tester {
 	/* Spare buffers.  */
 	char *buffer;
 	jsmntok_t *toks;
+
+	/* Notification method being waited for.  */
+	const char *notif_method;
 };
 
 static bool wait_for_response(struct payz_tester *tester);
+static bool wait_for_notification(struct payz_tester *tester);
 
 static struct payz_tester *
 payz_tester_new(const tal_t *ctx,
@@ -62,6 +67,7 @@ payz_tester_new(const tal_t *ctx,
 	tester->id = 1;
 	tester->buffer = NULL;
 	tester->toks = NULL;
+	tester->notif_method = NULL;
 	/* Grab control of the spawn.  */
 	tester->spawn = tal_steal(tester, *spawn);
 	*spawn = NULL;
@@ -192,6 +198,53 @@ static bool wait_for_response(struct payz_tester *tester)
 	return false;
 }
 
+static bool
+payz_tester_wait_notification_impl(struct payz_tester *tester,
+				   const char **buffer,
+				   const jsmntok_t **params,
+				   const char *method)
+{
+	char *source = tal_fmt(NULL, "payz_tester_wait_notification(%s)",
+			       method);
+
+	tester->buffer = tal_free(tester->buffer);
+	tester->toks = tal_free(tester->toks);
+
+	tester->notif_method = method;
+	payz_tester_loop(source,
+			 tester->command, tester->rpc, tester->spawn,
+			 TESTER_TIMEOUT,
+			 &wait_for_notification, tester);
+	tester->notif_method = NULL;
+	tal_free(source);
+
+	*buffer = tester->buffer;
+	*params = json_get_member(tester->buffer, tester->toks, "params");
+	return *params != NULL;
+}
+
+static bool wait_for_notification(struct payz_tester *tester)
+{
+	const jsmntok_t *method;
+
+	/* Skip notifications for other methods.  */
+	while (payz_tester_command_get_notif(tester, tester->command,
+					     &tester->buffer,
+					     &tester->toks)) {
+		method = json_get_member(tester->buffer, tester->toks,
+					 "method");
+		if (method && json_tok_streq(tester->buffer, method,
+					     tester->notif_method))
+			/* We can finish now.  */
+			return false;
+		tester->buffer = tal_free(tester->buffer);
+		tester->toks = tal_free(tester->toks);
+	}
+
+	/* Keep going.  */
+	return true;
+}
+
 /*-----------------------------------------------------------------------------
 Static Top Object
 -----------------------------------------------------------------------------*/
@@ -338,6 +391,39 @@ void payz_tester_command_ok(const char *method,
 		     json_tok_full(buffer, result));
 }
 
+void payz_tester_wait_notification(const char **buffer,
+				   const jsmntok_t **params,
+				   const char *method)
+{
+	if (!payz_tester_wait_notification_impl(payz_tester,
+						buffer, params, method))
+		errx(1, "payz_tester_wait_notification(%s): "
+		     "Notification did not have params: %.*s",
+		     method,
+		     json_tok_full_len(payz_tester->toks),
+		     json_tok_full(payz_tester->buffer, payz_tester->toks));
+}
+
+/*-----------------------------------------------------------------------------
+RPC Responses
+-----------------------------------------------------------------------------*/
+
+void payz_tester_rpc_respond(const char *method,
+			     const char *result)
+{
+	payz_tester_rpc_add_response(payz_tester->rpc, method, result);
+}
+
+void payz_tester_rpc_fail(const char *method,
+			  errcode_t code,
+			  const char *message)
+{
+	payz_tester_rpc_add_error(payz_tester->rpc, method, code,
+				  tal_fmt(tmpctx, "\"%s\"",
+					  json_escape(tmpctx, message)->s),
+				  "null");
+}
+
 /*-----------------------------------------------------------------------------
 Component Waiting
 -----------------------------------------------------------------------------*/
@@ -354,10 +440,10 @@ payz_tester_wait_component_generic(const char *api_name,
 
 	const jsmntok_t *result;
 
-	bool found = false;
+	bool found;
 	bool ret;
 
-	do {
+	for (;;) {
 		const char *params;
 
 		if (time_greater(timemono_since(start), TESTER_TIMEOUT)) {
@@ -419,7 +505,35 @@ payz_tester_wait_component_generic(const char *api_name,
 			     json_tok_full_len(result),
 			     json_tok_full(*buffer, result));
 		found = !json_tok_is_null(*buffer, *component);
-	} while (found != expected_found);
+		if (found == expected_found)
+			break;
+
+		/* Wait for the component to change, rather than poll.
+		 * Give the value we saw as expected, so that a change
+		 * made since we looked completes the wait at once.
+		 * The timeout only lets us notice if we wait too long
+		 * in total.  */
+		params = tal_fmt(tmpctx,
+				 "{\"entity\": %"PRIu32", "
+				 " \"components\": [\"%s\"], "
+				 " \"timeout\": %"PRIu64", "
+				 " \"expected\": {\"%s\": %.*s}}",
+				 entity, component_name,
+				 time_to_sec(TESTER_TIMEOUT) / 2,
+				 component_name,
+				 json_tok_full_len(*component),
+				 json_tok_full(*buffer, *component));
+		ret = payz_tester_command(buffer, &result,
+					  "payecs_waitcomponents", params);
+		if (!ret)
+			errx(1,
+			     "%s(%"PRIu32", %s): "
+			     "payecs_waitcomponents failed! %.*s",
+			     api_name,
+			     entity, component_name,
+			     json_tok_full_len(result),
+			     json_tok_full(*buffer, result));
+	}
 }
 
 void payz_tester_wait_component(const char **buffer,
@@ -96,6 +96,48 @@ void payz_tester_command_expectfail(const char *method,
 void payz_tester_command_ok(const char *method,
 			    const char *params);
 
+/** payz_tester_wait_notification
+ *
+ * @brief Wait for the plugin to send a notification of the
+ * given method, discarding any notifications of other
+ * methods sent before it.
+ *
+ * @desc The returned buffer will be reused in future command
+ * calls.
+ *
+ * @param buffer - output, a buffer containing JSON text.
+ * @param params - output, the `params` of the notification.
+ * @param method - the notification method to wait for.
+ */
+void payz_tester_wait_notification(const char **buffer,
+				   const jsmntok_t **params,
+				   const char *method);
+
+/** payz_tester_rpc_respond
+ *
+ * @brief Respond to the next call the plugin makes to the
+ * given RPC method, such as the method of a system.
+ *
+ * @param method - the RPC method to respond to.
+ * @param result - the result to return, a nul-terminated C
+ * string containing valid JSON.
+ */
+void payz_tester_rpc_respond(const char *method,
+			     const char *result);
+
+/** payz_tester_rpc_fail
+ *
+ * @brief Fail the next call the plugin makes to the given
+ * RPC method.
+ *
+ * @param method - the RPC method to fail.
+ * @param code - the error code to return.
+ * @param message - the error message to return.
+ */
+void payz_tester_rpc_fail(const char *method,
+			  errcode_t code,
+			  const char *message);
+
 /** payz_tester_wait_component
  *
  * @brief Wait for the given entity to have the given
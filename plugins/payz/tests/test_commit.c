@@ -0,0 +1,97 @@
+# undef NDEBUG
+#include<assert.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/payecs_data.h>
+#include<plugins/payz/tester/tester.h>
+
+#define COMMIT_SYS "test:commit"
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *errors;
+	const jsmntok_t *trace;
+	u32 entity;
+	u32 code;
+	bool ret;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_commit.
+	 */
+
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""COMMIT_SYS"\", "
+			       " \"required\": [\"example\"]}");
+
+	/* Write and advance in one command; by default the entities
+	 * written to are advanced.  */
+	payz_tester_command_expect("payecs_commit",
+				   "{\"writes\": "
+				   " {\"entity\": 1, \"example\": 1, "
+				   "  \"lightningd:systems\": "
+				   "{\"systems\": [\""COMMIT_SYS"\"]}}}",
+				   "{\"errors\": []}");
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[1]");
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace);
+	assert(trace->type == JSMN_ARRAY);
+	assert(trace->size == 1);
+
+	/* A failed expectation writes and advances nothing.  */
+	payz_tester_command_expectfail("payecs_commit",
+				       "{\"writes\": "
+				       " {\"entity\": 1, \"example\": 2}, "
+				       " \"expected\": "
+				       " {\"entity\": 1, \"example\": 3}}",
+				       PAYECS_SETCOMPONENTS_UNEXPECTED_COMPONENTS);
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[1, [\"example\"]]",
+				   "{\"entity\": 1, \"example\": 1}");
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[1]");
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace->size == 1);
+
+	/* Entities to advance can be given explicitly, and failures
+	 * to advance are reported in the result.  */
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_commit",
+				  "{\"writes\": "
+				  " {\"entity\": 1, \"example\": 2}, "
+				  " \"expected\": "
+				  " {\"entity\": 1, \"example\": 1}, "
+				  " \"advance\": [1, 2]}");
+	assert(ret);
+	errors = json_get_member(buffer, result, "errors");
+	assert(errors);
+	assert(errors->type == JSMN_ARRAY);
+	assert(errors->size == 1);
+	assert(json_to_u32(buffer,
+			   json_get_member(buffer, json_get_arr(errors, 0),
+					   "entity"),
+			   &entity));
+	assert(entity == 2);
+	assert(json_to_u32(buffer,
+			   json_get_member(buffer, json_get_arr(errors, 0),
+					   "code"),
+			   &code));
+	assert(code == PAY_ECS_INVALID_SYSTEMS_COMPONENT);
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[1, [\"example\"]]",
+				   "{\"entity\": 1, \"example\": 2}");
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[1]");
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace->size == 2);
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/json_equal.h>
+#include<plugins/payz/tester/tester.h>
+
+/* Wait for the next changes sent, and return them.  */
+static const jsmntok_t *changes(const char **buffer, u64 *version)
+{
+	const jsmntok_t *params;
+	const jsmntok_t *changes;
+
+	payz_tester_wait_notification(buffer, &params,
+				      "payecs_component_changed");
+	assert(json_to_u64(*buffer,
+			   json_get_member(*buffer, params, "version"),
+			   version));
+	changes = json_get_member(*buffer, params, "changes");
+	assert(changes);
+	assert(changes->type == JSMN_ARRAY);
+	return changes;
+}
+
+static bool equal(const char *buffer, const jsmntok_t *tok,
+		  const char *expected)
+{
+	const jsmntok_t *exptoks;
+
+	exptoks = json_parse_simple(tmpctx, expected, strlen(expected));
+	assert(exptoks);
+	return tok && json_equal(buffer, tok, expected, exptoks);
+}
+
+/* Check a change, and return its version.  */
+static u64 check_change(const char *buffer,
+			const jsmntok_t *change,
+			u32 entity,
+			const char *component,
+			const char *value,
+			const char *subscriptions)
+{
+	u32 e;
+	u64 version;
+
+	assert(json_to_u32(buffer, json_get_member(buffer, change, "entity"),
+			   &e));
+	assert(e == entity);
+	assert(json_tok_streq(buffer,
+			      json_get_member(buffer, change, "component"),
+			      component));
+	assert(equal(buffer, json_get_member(buffer, change, "value"),
+		     value));
+	assert(equal(buffer, json_get_member(buffer, change,
+					     "subscriptions"),
+		     subscriptions));
+	assert(json_to_u64(buffer,
+			   json_get_member(buffer, change, "version"),
+			   &version));
+	return version;
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *cs;
+	u64 start, version, v;
+	bool ret;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_subscribecomponents.
+	 */
+
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_subscribecomponents",
+				  "{\"prefixes\": [\"feed:\"]}");
+	assert(ret);
+	assert(equal(buffer, json_get_member(buffer, result, "subscription"),
+		     "1"));
+	assert(json_to_u64(buffer, json_get_member(buffer, result, "version"),
+			   &start));
+
+	/* Changes in the same tick are sent once, with the latest
+	 * value.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 1, \"feed:a\": 1}, "
+			       "  {\"entity\": 2, \"other\": true}, "
+			       "  {\"entity\": 1, \"feed:a\": 2}]]");
+	cs = changes(&buffer, &version);
+	assert(cs->size == 1);
+	v = check_change(buffer, json_get_arr(cs, 0),
+			 1, "feed:a", "2", "[1]");
+	assert(start < v && v <= version);
+	start = version;
+
+	/* Only the given components of the given entities.  */
+	payz_tester_command_expect("payecs_subscribecomponents",
+				   "{\"components\": [\"other\"], "
+				   " \"entities\": [3]}",
+				   tal_fmt(tmpctx,
+					   "{\"subscription\": 2, "
+					   " \"version\": %"PRIu64", "
+					   " \"ttl\": 600}",
+					   version));
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 3, \"other\": 1, "
+			       "   \"feed:b\": \"x\", \"unwanted\": 0}, "
+			       "  {\"entity\": 2, \"other\": false}]]");
+	cs = changes(&buffer, &version);
+	assert(cs->size == 2);
+	v = check_change(buffer, json_get_arr(cs, 0),
+			 3, "feed:b", "\"x\"", "[1]");
+	assert(start < v && v <= version);
+	v = check_change(buffer, json_get_arr(cs, 1),
+			 3, "other", "1", "[2]");
+	assert(start < v && v <= version);
+
+	/* Detaching is a change.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 1, \"feed:a\": null}]]");
+	cs = changes(&buffer, &version);
+	assert(cs->size == 1);
+	check_change(buffer, json_get_arr(cs, 0),
+		     1, "feed:a", "null", "[1]");
+
+	/* Unsubscribed changes are no longer sent.  */
+	payz_tester_command_ok("payecs_unsubscribecomponents", "[1]");
+	payz_tester_command_expectfail("payecs_unsubscribecomponents", "[1]",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 1, \"feed:a\": 3}, "
+			       "  {\"entity\": 3, \"other\": 2}]]");
+	cs = changes(&buffer, &version);
+	assert(cs->size == 1);
+	check_change(buffer, json_get_arr(cs, 0),
+		     3, "other", "2", "[2]");
+
+	/* Subscriptions end unless renewed in time.  */
+	payz_tester_command_expect("payecs_renewsubscription", "[2, 30]",
+				   "{\"subscription\": 2, \"ttl\": 30}");
+	payz_tester_command_expectfail("payecs_subscribecomponents",
+				       "{\"ttl\": 0}",
+				       JSONRPC2_INVALID_PARAMS);
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_subscribecomponents",
+				  "{\"components\": [\"other\"], \"ttl\": 1}");
+	assert(ret);
+	assert(equal(buffer, json_get_member(buffer, result, "subscription"),
+		     "3"));
+	/* Let it expire.  */
+	payz_tester_command_ok("payecs_waitcomponents",
+			       "{\"entity\": 1, \"components\": [], "
+			       " \"timeout\": 2}");
+	payz_tester_command_expectfail("payecs_renewsubscription", "[3]",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_expectfail("payecs_unsubscribecomponents", "[3]",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 3, \"other\": 3}]]");
+	cs = changes(&buffer, &version);
+	assert(cs->size == 1);
+	check_change(buffer, json_get_arr(cs, 0),
+		     3, "other", "3", "[2]");
+
+	return 0;
+}
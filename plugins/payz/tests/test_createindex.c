@@ -0,0 +1,145 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/tester/tester.h>
+
+#define NUM_ENTITIES 100
+
+/* Get the entities listed.  */
+static const jsmntok_t *list(const char **buffer, const char *params)
+{
+	const jsmntok_t *result;
+	const jsmntok_t *entities;
+	bool ret;
+
+	ret = payz_tester_command(buffer, &result, "payecs_listentities",
+				  params);
+	assert(ret);
+	entities = json_get_member(*buffer, result, "entities");
+	assert(entities);
+	assert(entities->type == JSMN_ARRAY);
+	return entities;
+}
+
+static u32 entity_of(const char *buffer, const jsmntok_t *entity_obj)
+{
+	u32 entity;
+
+	assert(json_to_u32(buffer,
+			   json_get_member(buffer, entity_obj, "entity"),
+			   &entity));
+	return entity;
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *entities;
+	const jsmntok_t *entity_obj;
+	char *writes;
+	u32 entity;
+	size_t i;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_createindex.
+	 */
+
+	/* Every entity shares its hash with every tenth entity.  */
+	writes = tal_strdup(tmpctx, "[[");
+	for (entity = 1; entity <= NUM_ENTITIES; ++entity)
+		tal_append_fmt(&writes,
+			       "%s{\"entity\": %"PRIu32", \"example\": "
+			       "{\"hash\": \"h%"PRIu32"\", \"n\": %"PRIu32"}}",
+			       entity == 1 ? "" : ", ",
+			       entity, entity % 10, entity);
+	tal_append_fmt(&writes, "]]");
+	payz_tester_command_ok("payecs_setcomponents", writes);
+
+	/* Existing entities are indexed.  */
+	payz_tester_command_expect("payecs_createindex",
+				   "{\"component\": \"example\", "
+				   " \"field\": \"hash\"}",
+				   "{\"component\": \"example\", "
+				   " \"field\": [\"hash\"], "
+				   " \"values\": 10, \"entities\": 100}");
+	/* Creating it again does nothing.  */
+	payz_tester_command_expect("payecs_createindex",
+				   "[\"example\", [\"hash\"]]",
+				   "{\"component\": \"example\", "
+				   " \"field\": [\"hash\"], "
+				   " \"values\": 10, \"entities\": 100}");
+
+	entities = list(&buffer,
+			"{\"where\": {\"component\": \"example\", "
+			"             \"field\": \"hash\", \"equals\": \"h3\"}}");
+	assert(entities->size == 10);
+	json_for_each_arr (i, entity_obj, entities)
+		assert(entity_of(buffer, entity_obj) == 10 * i + 3);
+
+	/* Other predicates still apply.  */
+	entities = list(&buffer,
+			"{\"where\": [{\"component\": \"example\", "
+			"              \"field\": \"hash\", \"equals\": \"h3\"}, "
+			"             {\"component\": \"example\", "
+			"              \"field\": \"n\", \"gt\": 50}], "
+			" \"limit\": 2, \"start_after\": 53}");
+	assert(entities->size == 2);
+	assert(entity_of(buffer, json_get_arr(entities, 0)) == 63);
+	assert(entity_of(buffer, json_get_arr(entities, 1)) == 73);
+
+	/* The index follows changes.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 3, \"example\": "
+			       "   {\"hash\": \"h4\", \"n\": 3}}, "
+			       "  {\"entity\": 13, \"example\": null}, "
+			       "  {\"entity\": 23, \"example\": {\"n\": 23}}]]");
+	entities = list(&buffer,
+			"{\"where\": {\"component\": \"example\", "
+			"             \"field\": \"hash\", \"equals\": \"h3\"}}");
+	assert(entities->size == 7);
+	assert(entity_of(buffer, json_get_arr(entities, 0)) == 33);
+	entities = list(&buffer,
+			"{\"where\": {\"component\": \"example\", "
+			"             \"field\": \"hash\", "
+			"             \"in\": [\"h4\", \"h5\", \"h4\"]}}");
+	assert(entities->size == 21);
+	assert(entity_of(buffer, json_get_arr(entities, 0)) == 3);
+	payz_tester_command_expect("payecs_createindex",
+				   "[\"example\", \"hash\"]",
+				   "{\"component\": \"example\", "
+				   " \"field\": [\"hash\"], "
+				   " \"values\": 10, \"entities\": 98}");
+
+	/* Entire values are compared as JSON.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 200, \"other\": "
+			       "   {\"a\": 1, \"b\": [true, \"x\"]}}, "
+			       "  {\"entity\": 201, \"other\": "
+			       "   { \"b\" : [ true , \"x\" ] , \"a\" : 1 }}, "
+			       "  {\"entity\": 202, \"other\": "
+			       "   {\"a\": 1, \"b\": [\"x\", true]}}]]");
+	payz_tester_command_expect("payecs_createindex",
+				   "[\"other\"]",
+				   "{\"component\": \"other\", "
+				   " \"field\": [], "
+				   " \"values\": 2, \"entities\": 3}");
+	entities = list(&buffer,
+			"{\"where\": {\"component\": \"other\", "
+			"             \"equals\": {\"b\": [true, \"x\"], "
+			"                          \"a\": 1}}}");
+	assert(entities->size == 2);
+	assert(entity_of(buffer, json_get_arr(entities, 0)) == 200);
+	assert(entity_of(buffer, json_get_arr(entities, 1)) == 201);
+
+	payz_tester_command_expectfail("payecs_createindex",
+				       "[\"other\", 42]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/tal/tal.h>
+#include<plugins/payz/ecs/ecready.h>
+
+/* Pop the next entry, and check it is the given entity.  */
+static void expect_pop(struct ecready *ready, u32 expected)
+{
+	u32 entity;
+	void *payload;
+	bool ret;
+
+	ret = ecready_pop(ready, time_mono(), &entity, &payload, NULL);
+	assert(ret);
+	assert(entity == expected);
+	assert(payload == ready);
+}
+
+static void push(struct ecready *ready,
+		 enum ecready_priority priority,
+		 u32 flow,
+		 u32 weight,
+		 u32 entity)
+{
+	ecready_push(ready, time_mono(), priority, flow, weight,
+		     entity, ready);
+}
+
+int main(int argc, char **argv)
+{
+	struct ecready *ready;
+	struct ecready_stats stats;
+	u32 entity;
+	void *payload;
+	u32 i;
+
+	/**
+	 * Test program for the ready queue.
+	 */
+
+	ready = ecready_new(NULL);
+	assert(ecready_empty(ready));
+	assert(!ecready_pop(ready, time_mono(), &entity, &payload, NULL));
+
+	/* Priority classes are served strictly, regardless of the
+	 * order entries were pushed in.  */
+	push(ready, ECREADY_PRIORITY_BACKGROUND, 3, 1, 30);
+	push(ready, ECREADY_PRIORITY_NORMAL, 1, 1, 10);
+	push(ready, ECREADY_PRIORITY_NORMAL, 1, 1, 11);
+	push(ready, ECREADY_PRIORITY_NORMAL, 1, 1, 12);
+	push(ready, ECREADY_PRIORITY_NORMAL, 1, 1, 13);
+	push(ready, ECREADY_PRIORITY_NORMAL, 2, 1, 20);
+	push(ready, ECREADY_PRIORITY_NORMAL, 2, 1, 21);
+	push(ready, ECREADY_PRIORITY_INTERACTIVE, 4, 1, 40);
+
+	ecready_get_stats(ready, ECREADY_PRIORITY_NORMAL, &stats);
+	assert(stats.depth == 6 && stats.enqueued == 6);
+
+	expect_pop(ready, 40);
+	/* Flows of equal weight take turns, even though all of
+	 * the first flow was pushed before the second.  */
+	expect_pop(ready, 10);
+	expect_pop(ready, 20);
+	expect_pop(ready, 11);
+	expect_pop(ready, 21);
+	expect_pop(ready, 12);
+	expect_pop(ready, 13);
+	expect_pop(ready, 30);
+	assert(ecready_empty(ready));
+
+	ecready_get_stats(ready, ECREADY_PRIORITY_NORMAL, &stats);
+	assert(stats.depth == 0 && stats.max_depth == 6);
+	assert(stats.dispatched == 6);
+
+	/* A flow of weight 2 is served twice as often as a flow of
+	 * weight 1.  */
+	for (i = 0; i < 4; ++i)
+		push(ready, ECREADY_PRIORITY_NORMAL, 5, 2, 50 + i);
+	push(ready, ECREADY_PRIORITY_NORMAL, 6, 1, 60);
+	push(ready, ECREADY_PRIORITY_NORMAL, 6, 1, 61);
+
+	expect_pop(ready, 50);
+	expect_pop(ready, 51);
+	expect_pop(ready, 60);
+	expect_pop(ready, 52);
+	expect_pop(ready, 53);
+	expect_pop(ready, 61);
+	assert(ecready_empty(ready));
+
+	/* A flow that arrives after another queued many entries
+	 * does not wait for all of them.  */
+	for (i = 0; i < 200; ++i)
+		push(ready, ECREADY_PRIORITY_NORMAL, 7, 1, 1000 + i);
+	push(ready, ECREADY_PRIORITY_NORMAL, 8, 1, 2000);
+
+	expect_pop(ready, 1000);
+	expect_pop(ready, 2000);
+	for (i = 1; i < 200; ++i)
+		expect_pop(ready, 1000 + i);
+	assert(ecready_empty(ready));
+
+	tal_free(ready);
+
+	return 0;
+}
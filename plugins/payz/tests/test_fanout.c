@@ -0,0 +1,156 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+#include<unistd.h>
+
+#define SYS_A "test:fanout_a"
+#define SYS_B "test:fanout_b"
+#define SYS_C "test:fanout_c"
+
+/* Return the number of systrace entries of the entity.  */
+static size_t trace_size(u32 entity)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	bool ret;
+
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace",
+				  tal_fmt(tmpctx, "[%"PRIu32"]", entity));
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace);
+	assert(trace->type == JSMN_ARRAY);
+	return trace->size;
+}
+
+/* Get the number of completions and the longest service time
+ * of the system.  */
+static void get_stats(const char *system, u64 *completed, u64 *max_usec)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	bool ret;
+
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_sysstats",
+				  tal_fmt(tmpctx, "[\"%s\"]", system));
+	assert(ret);
+	assert(json_scan(tmpctx, buffer, result,
+			 "{systems:[0:{completed:%,service_max_usec:%}]}",
+			 JSON_SCAN(json_to_u64, completed),
+			 JSON_SCAN(json_to_u64, max_usec)) == NULL);
+}
+
+int main(int argc, char **argv)
+{
+	u64 completed;
+	u64 max_usec;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for launching independent systems together.
+	 */
+
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""SYS_A"\", "
+				       " \"required\": [\"a\"], "
+				       " \"writes\": [\"a*b\"]}",
+				       JSONRPC2_INVALID_PARAMS);
+
+	/* A and B touch disjoint components.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""SYS_A"\", "
+			       " \"required\": [\"a\"], "
+			       " \"disallowed\": [\"a:done\"], "
+			       " \"writes\": [\"a:*\"]}");
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""SYS_B"\", "
+			       " \"required\": [\"b\"], "
+			       " \"disallowed\": [\"b:done\"], "
+			       " \"writes\": [\"b:done\"]}");
+	/* C does not declare what it writes.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""SYS_C"\", "
+			       " \"required\": [\"c\"]}");
+
+	/* Both A and B are launched by a single advance.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"a\": 1, \"b\": 1, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""SYS_A"\", \""SYS_B"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+	assert(trace_size(1) == 2);
+
+	/* When A advances, B is still running, so nothing more
+	 * happens.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"a:done\": true}]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+	assert(trace_size(1) == 2);
+	get_stats(SYS_A, &completed, &max_usec);
+	assert(completed == 0);
+
+	/* When B advances as well, the entity is advanced for
+	 * real, and no system matches any more.  */
+	usleep(20000);
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"b:done\": true}]");
+	payz_tester_command_expectfail("payecs_advance", "[1]",
+				       PAY_ECS_NOT_ADVANCEABLE);
+	assert(trace_size(1) == 2);
+
+	/* The systems are accounted as one unit: both completed,
+	 * with the time until both were done.  */
+	get_stats(SYS_A, &completed, &max_usec);
+	assert(completed == 1 && max_usec >= 20000);
+	get_stats(SYS_B, &completed, &max_usec);
+	assert(completed == 1 && max_usec >= 20000);
+
+	/* A system that does not declare its writes blocks the
+	 * fan-out past it.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"a\": 1, \"b\": 1, "
+			       "  \"c\": 1, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""SYS_A"\", \""SYS_C"\", "
+			       "               \""SYS_B"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[2]");
+	assert(trace_size(2) == 1);
+
+	/* A system that writes what a later one matches on blocks
+	 * it.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \"test:fanout_d\", "
+			       " \"required\": [\"a:x\"], "
+			       " \"writes\": []}");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 3, \"a\": 1, \"a:x\": 1, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""SYS_A"\", "
+			       "               \"test:fanout_d\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[3]");
+	assert(trace_size(3) == 1);
+
+	/* Detaching `lightningd:systems` while systems run ends
+	 * processing without errors from the others.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 4, \"a\": 1, \"b\": 1, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""SYS_A"\", \""SYS_B"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[4]");
+	assert(trace_size(4) == 2);
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 4, "
+			       "  \"lightningd:systems\": null}]");
+	payz_tester_command_ok("payecs_advance", "[4]");
+
+	return 0;
+}
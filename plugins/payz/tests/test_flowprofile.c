@@ -0,0 +1,155 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/err/err.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/utils.h>
+#include<plugins/payz/tester/tester.h>
+#include<string.h>
+
+#define NEVER_SYS "payz:tests:flowprofile_never"
+#define FIRST_SYS "payz:tests:flowprofile_first"
+#define HOT_SYS "payz:tests:flowprofile_hot"
+
+#define NUM_ENTITIES 12
+
+/* Get the result of payecs_flowprofile, checking whether it is
+ * enabled and the number of flows.  */
+static const jsmntok_t *get_flows(const char **buffer,
+				  const char *params,
+				  bool expected_enabled,
+				  int expected_flows)
+{
+	const jsmntok_t *result;
+	const jsmntok_t *flows;
+	bool enabled;
+	bool ret;
+
+	ret = payz_tester_command(buffer, &result,
+				  "payecs_flowprofile", params);
+	assert(ret);
+	assert(json_to_bool(*buffer,
+			    json_get_member(*buffer, result, "enabled"),
+			    &enabled));
+	assert(enabled == expected_enabled);
+	flows = json_get_member(*buffer, result, "flows");
+	assert(flows);
+	assert(flows->type == JSMN_ARRAY);
+	assert(flows->size == expected_flows);
+
+	return flows;
+}
+
+static void add_entity(u32 entity)
+{
+	payz_tester_command_ok("payecs_setcomponents",
+			       tal_fmt(tmpctx,
+				       "[{\"entity\": %"PRIu32", "
+				       "  \"hot\": true, "
+				       "  \"lightningd:systems\": {"
+				       "\"systems\": [\""NEVER_SYS"\", "
+				       "              \""FIRST_SYS"\", "
+				       "              \""HOT_SYS"\"]}}]",
+				       entity));
+	payz_tester_command_ok("payecs_advance",
+			       tal_fmt(tmpctx, "[%"PRIu32"]", entity));
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *flows;
+	const jsmntok_t *flow;
+	const jsmntok_t *suggestions;
+	const jsmntok_t *suggestion;
+	const char *error;
+	u64 searches, unmatched;
+	u64 never_evaluated, never_matched;
+	u64 hot_evaluated, hot_matched, hot_lookups;
+	bool found_move, found_never;
+	char *text;
+	size_t i;
+	u32 entity;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_flowprofile.
+	 */
+
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""NEVER_SYS"\", [\"never\"]]");
+	/* The first and hot systems can never both match.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""FIRST_SYS"\", [\"first\"], [\"hot\"]]");
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""HOT_SYS"\", [\"hot\"]]");
+
+	/* Nothing is recorded until enabled.  */
+	add_entity(100);
+	get_flows(&buffer, "[]", false, 0);
+	get_flows(&buffer, "{\"enable\": true}", true, 0);
+
+	for (entity = 1; entity <= NUM_ENTITIES; ++entity)
+		add_entity(entity);
+
+	flows = get_flows(&buffer, "[]", true, 1);
+	flow = json_get_arr(flows, 0);
+	error = json_scan(tmpctx, buffer, flow,
+			  "{searches:%,unmatched:%,"
+			  "positions:[0:{evaluated:%,matched:%}]}",
+			  JSON_SCAN(json_to_u64, &searches),
+			  JSON_SCAN(json_to_u64, &unmatched),
+			  JSON_SCAN(json_to_u64, &never_evaluated),
+			  JSON_SCAN(json_to_u64, &never_matched));
+	if (error)
+		errx(1, "payecs_flowprofile: %s", error);
+	assert(searches == NUM_ENTITIES && unmatched == 0);
+	assert(never_evaluated == NUM_ENTITIES && never_matched == 0);
+	error = json_scan(tmpctx, buffer, flow,
+			  "{positions:[2:{evaluated:%,matched:%,"
+			  "lookups:%}]}",
+			  JSON_SCAN(json_to_u64, &hot_evaluated),
+			  JSON_SCAN(json_to_u64, &hot_matched),
+			  JSON_SCAN(json_to_u64, &hot_lookups));
+	if (error)
+		errx(1, "payecs_flowprofile: %s", error);
+	assert(hot_evaluated == NUM_ENTITIES);
+	assert(hot_matched == NUM_ENTITIES);
+	assert(hot_lookups == NUM_ENTITIES);
+
+	/* The hot system should be moved before the first system,
+	 * but not before the never system, which it is not
+	 * exclusive with.  */
+	suggestions = json_get_member(buffer, flow, "suggestions");
+	assert(suggestions);
+	found_move = false;
+	found_never = false;
+	json_for_each_arr (i, suggestion, suggestions) {
+		text = json_strdup(tmpctx, buffer, suggestion);
+		if (strstarts(text, "Move "HOT_SYS" before "FIRST_SYS":"))
+			found_move = true;
+		if (strstarts(text, NEVER_SYS" was evaluated"))
+			found_never = true;
+		assert(!strstarts(text, "Move "HOT_SYS" before "NEVER_SYS));
+	}
+	assert(found_move);
+	assert(found_never);
+
+	/* Disabling keeps the profile, but stops recording.  */
+	get_flows(&buffer, "{\"enable\": false}", false, 1);
+	add_entity(101);
+	flows = get_flows(&buffer, "[]", false, 1);
+	assert(json_to_u64(buffer,
+			   json_get_member(buffer,
+					   json_get_arr(flows, 0),
+					   "searches"),
+			   &searches));
+	assert(searches == NUM_ENTITIES);
+
+	/* Enabling again starts afresh.  */
+	get_flows(&buffer, "[true]", true, 0);
+
+	return 0;
+}
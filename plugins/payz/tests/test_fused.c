@@ -0,0 +1,117 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/array_size/array_size.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/utils.h>
+#include<plugins/payz/tester/tester.h>
+
+/* Pure builtins we expect to be run directly.  */
+static const char *pure_systems[] = {
+	"lightningd:generate_nonce",
+	"lightningd:default_riskfactor",
+	"lightningd:default_maxfeepercent",
+	"lightningd:default_retry_for",
+	"lightningd:default_maxdelay",
+	"lightningd:default_exemptfee"
+};
+
+#define DUMMY_SYS "test:fused"
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	const jsmntok_t *entry;
+	const jsmntok_t *system;
+	const jsmntok_t *fused;
+	bool found[ARRAY_SIZE(pure_systems)];
+	bool is_fused;
+	bool ret;
+	size_t i, j;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for running chains of pure builtins inline.
+	 */
+
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""DUMMY_SYS"\", "
+			       " [\"lightningd:nonce\", "
+			       "  \"lightningd:riskfactor\", "
+			       "  \"lightningd:maxfeepercent\", "
+			       "  \"lightningd:retry_for\", "
+			       "  \"lightningd:maxdelay\", "
+			       "  \"lightningd:exemptfee\"]]");
+
+	payz_tester_command_ok("payecs_setdefaultsystems",
+			       "[42, [\""DUMMY_SYS"\"]]");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 42, "
+			       "\"lightningd:main-payment\": true}]");
+
+	/* A single advance runs all the pure builtins before it
+	 * returns, without waiting for any notification.  */
+	payz_tester_command_ok("payecs_advance", "[42]");
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[42, [\"lightningd:riskfactor\", "
+				   "      \"lightningd:maxdelay\"]]",
+				   "{\"entity\": 42, "
+				   " \"lightningd:riskfactor\": 10, "
+				   " \"lightningd:maxdelay\": 2016}");
+
+	/* Each of them still appears in the trace, marked as
+	 * fused.  */
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[42]");
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace);
+	assert(trace->type == JSMN_ARRAY);
+
+	for (j = 0; j < ARRAY_SIZE(pure_systems); ++j)
+		found[j] = false;
+	json_for_each_arr (i, entry, trace) {
+		system = json_get_member(buffer, entry, "system");
+		fused = json_get_member(buffer, entry, "fused");
+		assert(system);
+		for (j = 0; j < ARRAY_SIZE(pure_systems); ++j) {
+			if (!json_tok_streq(buffer, system, pure_systems[j]))
+				continue;
+			assert(fused);
+			assert(json_to_bool(buffer, fused, &is_fused));
+			assert(is_fused);
+			found[j] = true;
+		}
+	}
+	for (j = 0; j < ARRAY_SIZE(pure_systems); ++j)
+		assert(found[j]);
+
+	/* Once a pure system has run, failing to find the next
+	 * system is reported on the entity, not as a failure of
+	 * the advance that ran it.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 43, "
+			       "  \"lightningd:main-payment\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": "
+			       " [\"lightningd:default_riskfactor\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[43]");
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[43, [\"lightningd:riskfactor\"]]",
+				   "{\"entity\": 43, "
+				   " \"lightningd:riskfactor\": 10}");
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_getcomponents",
+				  "[43, [\"lightningd:systems\"]]");
+	assert(ret);
+	entry = json_get_member(buffer, result, "lightningd:systems");
+	assert(entry);
+	assert(json_scan(tmpctx, buffer, entry,
+			 "{error:{code:2201}}") == NULL);
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+# undef NDEBUG
+#include<common/jsonrpc_errors.h>
+#include<plugins/payz/tester/tester.h>
+
+int main(int argc, char **argv)
+{
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_getcomponents.
+	 */
+
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 1, \"part\": 1, \"total\": 3},"
+			       "  {\"entity\": 2, \"part\": 2},"
+			       "  {\"entity\": 3, \"part\": 3}]]");
+
+	/* A single entity gives a single object.  */
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[1, [\"part\", \"total\"]]",
+				   "{\"entity\": 1, \"part\": 1, \"total\": 3}");
+
+	/* An array of entities gives an array, in the same order,
+	 * including entities without the components.  */
+	payz_tester_command_expect("payecs_getcomponents",
+				   "{\"entity\": [3, 1, 4, 2],"
+				   " \"components\": [\"part\", \"total\"]}",
+				   "{\"entities\": ["
+				   "  {\"entity\": 3, \"part\": 3, \"total\": null},"
+				   "  {\"entity\": 1, \"part\": 1, \"total\": 3},"
+				   "  {\"entity\": 4, \"part\": null, \"total\": null},"
+				   "  {\"entity\": 2, \"part\": 2, \"total\": null}"
+				   "]}");
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[[2], \"part\"]",
+				   "{\"entities\": [{\"entity\": 2, \"part\": 2}]}");
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[[], \"part\"]",
+				   "{\"entities\": []}");
+
+	payz_tester_command_expectfail("payecs_getcomponents",
+				       "[[1, \"two\"], \"part\"]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	return 0;
+}
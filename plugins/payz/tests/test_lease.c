@@ -0,0 +1,114 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+#include<unistd.h>
+
+#define STALL_SYS "test:lease_stall"
+#define WAVE_A_SYS "test:lease_wave_a"
+#define WAVE_B_SYS "test:lease_wave_b"
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *error;
+	errcode_t code;
+	char *msg;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for reclaiming entities from systems that
+	 * never advance them.
+	 */
+
+	/* Nobody implements this system, so it never advances the
+	 * entities it is handed.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""STALL_SYS"\", "
+			       " \"required\": [\"stall\"], "
+			       " \"disallowed\": [\"stall:done\"], "
+			       " \"deadline_msec\": 100}");
+	/* Re-registering with a different deadline conflicts.  */
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""STALL_SYS"\", "
+				       " \"required\": [\"stall\"], "
+				       " \"disallowed\": [\"stall:done\"], "
+				       " \"deadline_msec\": 200}",
+				       JSONRPC2_INVALID_PARAMS);
+
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"stall\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""STALL_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+
+	/* Once the deadline passes, the entity fails.  */
+	payz_tester_wait_component(&buffer, &error, 1, "lightningd:error");
+	assert(json_to_errcode(buffer,
+			       json_get_member(buffer, error, "code"),
+			       &code));
+	assert(code == PAY_ECS_SYSTEM_TIMEOUT);
+	payz_tester_wait_detach_component(1, "lightningd:systems");
+
+	/* A late advance from the system is refused.  */
+	payz_tester_command_expectfail("payecs_advance", "[1]",
+				       PAY_ECS_INVALID_SYSTEMS_COMPONENT);
+
+	/* An entity advanced in time is left alone.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"stall\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""STALL_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[2]");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"stall:done\": true}]");
+	payz_tester_command_expectfail("payecs_advance", "[2]",
+				       PAY_ECS_NOT_ADVANCEABLE);
+	usleep(300000);
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[2, [\"lightningd:error\"]]",
+				   "{\"entity\": 2, "
+				   " \"lightningd:error\": null}");
+
+	/* Systems launched together share the lease, with the
+	 * longest of their deadlines.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""WAVE_A_SYS"\", "
+			       " \"required\": [\"wave_a\"], "
+			       " \"writes\": [\"wave_a:*\"], "
+			       " \"deadline_msec\": 100}");
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""WAVE_B_SYS"\", "
+			       " \"required\": [\"wave_b\"], "
+			       " \"writes\": [\"wave_b:*\"], "
+			       " \"deadline_msec\": 5000}");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 3, \"wave_a\": true, "
+			       "  \"wave_b\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""WAVE_A_SYS"\", "
+			       "               \""WAVE_B_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[3]");
+	/* Well past the shorter deadline, and well short of the
+	 * longer, even when run slowly.  */
+	usleep(250000);
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[3, [\"lightningd:error\"]]",
+				   "{\"entity\": 3, "
+				   " \"lightningd:error\": null}");
+	payz_tester_wait_component(&buffer, &error, 3, "lightningd:error");
+	assert(json_to_errcode(buffer,
+			       json_get_member(buffer, error, "code"),
+			       &code));
+	assert(code == PAY_ECS_SYSTEM_TIMEOUT);
+	msg = json_strdup(tmpctx, buffer,
+			  json_get_member(buffer, error, "message"));
+	assert(strstarts(msg, "Systems "WAVE_A_SYS", "WAVE_B_SYS" "));
+
+	return 0;
+}
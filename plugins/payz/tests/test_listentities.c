@@ -0,0 +1,235 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/tester/tester.h>
+
+/* Enough to be listed in several pages.  */
+#define NUM_ENTITIES 10000
+/* Entities to create per command.  */
+#define BATCH 500
+
+/* Get the entities listed, and the `next` field, or 0 if absent.  */
+static const jsmntok_t *list(const char **buffer,
+			     const char *params,
+			     u32 *next)
+{
+	const jsmntok_t *result;
+	const jsmntok_t *entities;
+	const jsmntok_t *next_tok;
+	bool ret;
+
+	ret = payz_tester_command(buffer, &result, "payecs_listentities",
+				  params);
+	assert(ret);
+	entities = json_get_member(*buffer, result, "entities");
+	assert(entities);
+	assert(entities->type == JSMN_ARRAY);
+
+	next_tok = json_get_member(*buffer, result, "next");
+	*next = 0;
+	if (next_tok)
+		assert(json_to_u32(*buffer, next_tok, next));
+
+	return entities;
+}
+
+static u32 entity_of(const char *buffer, const jsmntok_t *entity_obj)
+{
+	u32 entity;
+
+	assert(json_to_u32(buffer,
+			   json_get_member(buffer, entity_obj, "entity"),
+			   &entity));
+	return entity;
+}
+
+/* List all pages with the given filter members, checking they are
+ * in order, and get the count and the first entity listed.  */
+static size_t list_all(const char *filter, u32 *first)
+{
+	const char *buffer;
+	const jsmntok_t *entities;
+	const jsmntok_t *entity_obj;
+	u32 next = 0, prev = 0, entity;
+	size_t count = 0;
+	size_t pages = 0;
+	size_t i;
+
+	do {
+		entities = list(&buffer,
+				tal_fmt(tmpctx,
+					"{%s%s\"start_after\": %"PRIu32"}",
+					filter, streq(filter, "") ? "" : ", ",
+					next),
+				&next);
+		json_for_each_arr (i, entity_obj, entities) {
+			entity = entity_of(buffer, entity_obj);
+			assert(entity > prev);
+			if (count == 0)
+				*first = entity;
+			prev = entity;
+			++count;
+		}
+		++pages;
+	} while (next != 0);
+
+	/* Every listing here needs more than one page.  */
+	assert(pages > 1);
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *entities;
+	const jsmntok_t *entity_obj;
+	char *writes;
+	u32 entity, next, first;
+	size_t i;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_listentities.
+	 */
+
+	/* Every tenth entity also has an "other" component.  */
+	for (entity = 1; entity <= NUM_ENTITIES; ++entity) {
+		if (entity % BATCH == 1)
+			writes = tal_strdup(tmpctx, "[[");
+		else
+			tal_append_fmt(&writes, ", ");
+		tal_append_fmt(&writes,
+			       "{\"entity\": %"PRIu32", \"example\": "
+			       "%"PRIu32"%s}",
+			       entity, entity,
+			       entity % 10 == 0 ? ", \"other\": true" : "");
+		if (entity % BATCH == 0) {
+			tal_append_fmt(&writes, "]]");
+			payz_tester_command_ok("payecs_setcomponents",
+					       writes);
+		}
+	}
+
+	/* A single call lists only one page, in order, and says
+	 * where the next one starts.  */
+	entities = list(&buffer, "[]", &next);
+	assert(entities->size > 0 && entities->size < NUM_ENTITIES);
+	assert(next == entities->size);
+	json_for_each_arr (i, entity_obj, entities)
+		assert(entity_of(buffer, entity_obj) == i + 1);
+
+	/* Everything, over several pages.  */
+	assert(list_all("", &first) == NUM_ENTITIES);
+	assert(first == 1);
+
+	/* Only those with, or without, the other component.  */
+	assert(list_all("\"required\": [\"other\"]", &first)
+	       == NUM_ENTITIES / 10);
+	assert(list_all("\"disallowed\": [\"other\"]", &first)
+	       == NUM_ENTITIES - NUM_ENTITIES / 10);
+	entities = list(&buffer, "{\"disallowed\": [\"other\"]}", &next);
+	json_for_each_arr (i, entity_obj, entities)
+		assert(!json_get_member(buffer, entity_obj, "other"));
+
+	/* Pages, continuing from the cursor.  */
+	entities = list(&buffer, "{\"limit\": 10}", &next);
+	assert(entities->size == 10);
+	assert(next == 10);
+	entities = list(&buffer,
+			tal_fmt(tmpctx,
+				"{\"limit\": 5, \"start_after\": %"PRIu32"}",
+				next),
+			&next);
+	assert(entities->size == 5);
+	assert(entity_of(buffer, json_get_arr(entities, 0)) == 11);
+	assert(next == 15);
+
+	/* An empty page keeps the cursor where it was.  */
+	entities = list(&buffer,
+			"{\"limit\": 0, \"start_after\": 20}", &next);
+	assert(entities->size == 0);
+	assert(next == 20);
+
+	/* The last page has no cursor.  */
+	entities = list(&buffer,
+			tal_fmt(tmpctx,
+				"{\"limit\": 10, \"start_after\": %d}",
+				NUM_ENTITIES - 5),
+			&next);
+	assert(entities->size == 5);
+	assert(next == 0);
+	entities = list(&buffer,
+			tal_fmt(tmpctx, "{\"start_after\": %d}",
+				NUM_ENTITIES),
+			&next);
+	assert(entities->size == 0);
+
+	/* Only the given components.  */
+	entities = list(&buffer,
+			"{\"required\": [\"other\"], \"limit\": 1, "
+			" \"components\": [\"other\", \"nonexistent\"]}",
+			&next);
+	assert(entities->size == 1);
+	entity_obj = json_get_arr(entities, 0);
+	assert(entity_of(buffer, entity_obj) == 10);
+	assert(json_get_member(buffer, entity_obj, "other"));
+	assert(!json_get_member(buffer, entity_obj, "example"));
+	assert(!json_get_member(buffer, entity_obj, "nonexistent"));
+
+	/* Predicates on component values.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 1, \"status\": "
+			       "   {\"state\": \"pending\", "
+			       "    \"amount\": \"1000msat\"}}, "
+			       "  {\"entity\": 2, \"status\": "
+			       "   {\"state\": \"pending-retry\", "
+			       "    \"amount\": \"2sat\"}}, "
+			       "  {\"entity\": 3, \"status\": "
+			       "   {\"state\": \"complete\", "
+			       "    \"amount\": \"3000msat\"}}]]");
+	assert(list_all("\"where\": {\"component\": \"example\", "
+			"           \"ge\": 9990}",
+			&first) == 11);
+	assert(first == 9990);
+	assert(list_all("\"where\": {\"component\": \"example\", "
+			"           \"lt\": \"100msat\"}",
+			&first) == 99);
+	assert(list_all("\"where\": [{\"component\": \"example\", "
+			"            \"in\": [5, 10, 15, \"10\"]}], "
+			"\"required\": [\"other\"]",
+			&first) == 1);
+	assert(first == 10);
+	assert(list_all("\"where\": {\"component\": \"status\", "
+			"           \"field\": \"state\", "
+			"           \"prefix\": \"pending\"}",
+			&first) == 2);
+	assert(list_all("\"where\": [{\"component\": \"status\", "
+			"            \"field\": [\"amount\"], "
+			"            \"gt\": \"1sat\"}, "
+			"           {\"component\": \"status\", "
+			"            \"field\": \"state\", "
+			"            \"equals\": \"complete\"}]",
+			&first) == 1);
+	assert(first == 3);
+	/* Entities without the field never match.  */
+	assert(list_all("\"where\": {\"component\": \"status\", "
+			"           \"field\": \"nonexistent\", "
+			"           \"equals\": null}",
+			&first) == 0);
+
+	payz_tester_command_expectfail("payecs_listentities",
+				       "{\"where\": {\"component\": \"example\","
+				       "             \"lt\": \"many\"}}",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_expectfail("payecs_listentities",
+				       "{\"where\": {\"component\": \"example\","
+				       "             \"lt\": 1, \"gt\": 0}}",
+				       JSONRPC2_INVALID_PARAMS);
+
+	return 0;
+}
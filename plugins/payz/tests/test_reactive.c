@@ -0,0 +1,118 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/utils.h>
+#include<plugins/payz/tester/tester.h>
+
+#define NONCE_SYS "lightningd:generate_nonce"
+#define DUMMY_SYS "test:reactive:dummy"
+
+/* Wait until the systrace of the given entity has at least the
+ * given number of entries, and return the trace.  */
+static const jsmntok_t *wait_trace(const char **buffer,
+				   u32 entity,
+				   int size)
+{
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	bool ret;
+
+	for (;;) {
+		ret = payz_tester_command(buffer, &result,
+					  "payecs_systrace",
+					  tal_fmt(tmpctx, "[%"PRIu32"]",
+						  entity));
+		assert(ret);
+
+		trace = json_get_member(*buffer, result, "trace");
+		assert(trace);
+		assert(trace->type == JSMN_ARRAY);
+
+		if (trace->size >= size)
+			return trace;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for reactive entities.
+	 */
+
+	/* Attaching a reactive `lightningd:systems` considers all
+	 * systems, without any payecs_advance.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"lightningd:systems\": "
+			       "{\"systems\": [\""NONCE_SYS"\"], "
+			       " \"reactive\": true}}]");
+	payz_tester_wait_component(&buffer, &result,
+				   1, "lightningd:nonce");
+
+	/* Register a dummy system.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""DUMMY_SYS"\", [\"example\"]]");
+
+	/* A non-reactive entity is not advanced by changes.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 3, \"lightningd:systems\": "
+			       "{\"systems\": [\""DUMMY_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 3, \"example\": 3}]");
+
+	/* A reactive entity that matches nothing does not get an
+	 * error.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"lightningd:systems\": "
+			       "{\"systems\": [\""DUMMY_SYS"\"], "
+			       " \"reactive\": true}}]");
+	/* Changing a component no system cares about does nothing.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"unrelated\": 1}]");
+	/* But attaching a required component triggers it.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"example\": 2}]");
+
+	trace = wait_trace(&buffer, 2, 1);
+	assert(trace->size == 1);
+	assert(json_tok_streq(buffer,
+			      json_get_member(buffer,
+					      json_get_arr(trace, 0),
+					      "system"),
+			      DUMMY_SYS));
+	/* No error was recorded.  */
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[2, [\"lightningd:systems\"]]",
+				   "{\"entity\": 2, \"lightningd:systems\": "
+				   "{\"systems\": [\""DUMMY_SYS"\"], "
+				   " \"reactive\": true, \"current\": 0}}");
+
+	/* The dummy system still holds the entity, so changing it
+	 * now does not hand it to the system again...  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"example\": 5}]");
+	payz_tester_command_ok("payecs_waitcomponents",
+			       "{\"entity\": 2, \"components\": [], "
+			       " \"timeout\": 1}");
+	trace = wait_trace(&buffer, 2, 1);
+	assert(trace->size == 1);
+	/* ...until the system advances it, once.  */
+	payz_tester_command_ok("payecs_advance", "[2]");
+	payz_tester_command_ok("payecs_waitcomponents",
+			       "{\"entity\": 2, \"components\": [], "
+			       " \"timeout\": 1}");
+	trace = wait_trace(&buffer, 2, 2);
+	assert(trace->size == 2);
+
+	/* The non-reactive entity was never advanced.  */
+	trace = wait_trace(&buffer, 3, 0);
+	assert(trace->size == 0);
+
+	return 0;
+}
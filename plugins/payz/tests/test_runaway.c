@@ -0,0 +1,82 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+
+#define LOOP_SYS "test:runaway_loop"
+
+int main(int argc, char **argv)
+{
+	u32 i;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for detecting runaway systems.
+	 */
+
+	/* Nobody implements this system, so it never detaches the
+	 * component that triggers it.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""LOOP_SYS"\", [\"loop\"]]");
+
+	/* Re-advancing with nothing changed is allowed a few
+	 * times, but eventually is reported as a cycle.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"loop\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""LOOP_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+	payz_tester_command_expectfail("payecs_advance", "[1]",
+				       PAY_ECS_CYCLE_DETECTED);
+
+	/* An entity whose components keep changing is stopped once
+	 * it runs out of steps.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"loop\": 0, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""LOOP_SYS"\"], "
+			       " \"max_steps\": 5}}]");
+	for (i = 0; i < 5; ++i) {
+		payz_tester_command_ok("payecs_advance", "[2]");
+		payz_tester_command_ok("payecs_setcomponents",
+				       tal_fmt(tmpctx,
+					       "[{\"entity\": 2, "
+					       "  \"loop\": %"PRIu32"}]",
+					       i + 1));
+	}
+	payz_tester_command_expectfail("payecs_advance", "[2]",
+				       PAY_ECS_STEP_BUDGET_EXCEEDED);
+
+	/* A budget of 0 means unlimited.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 3, \"loop\": 0, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""LOOP_SYS"\"], "
+			       " \"max_steps\": 0}}]");
+	for (i = 0; i < 20; ++i) {
+		payz_tester_command_ok("payecs_advance", "[3]");
+		payz_tester_command_ok("payecs_setcomponents",
+				       tal_fmt(tmpctx,
+					       "[{\"entity\": 3, "
+					       "  \"loop\": %"PRIu32"}]",
+					       i + 1));
+	}
+
+	/* An invalid budget is rejected.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 4, \"loop\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""LOOP_SYS"\"], "
+			       " \"max_steps\": -1}}]");
+	payz_tester_command_expectfail("payecs_advance", "[4]",
+				       PAY_ECS_INVALID_SYSTEMS_COMPONENT);
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/err/err.h>
+#include<ccan/short_types/short_types.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+
+#define DUMMY_SYS "payz:tests:test_schedstats"
+
+static void get_class_stats(const tal_t *ctx,
+			    size_t index,
+			    const char *expected_name,
+			    u64 *depth,
+			    u64 *max_depth,
+			    u64 *enqueued,
+			    u64 *dispatched)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const char *error;
+	char *name;
+	const char *guide;
+
+	payz_tester_command(&buffer, &result, "payecs_schedstats", "[]");
+	guide = tal_fmt(ctx,
+			"{priorities:[%zu:{priority:%%,"
+			"depth:%%,max_depth:%%,"
+			"enqueued:%%,dispatched:%%}]}",
+			index);
+	error = json_scan(ctx, buffer, result, guide,
+			  JSON_SCAN_TAL(ctx, json_strdup, &name),
+			  JSON_SCAN(json_to_u64, depth),
+			  JSON_SCAN(json_to_u64, max_depth),
+			  JSON_SCAN(json_to_u64, enqueued),
+			  JSON_SCAN(json_to_u64, dispatched));
+	if (error)
+		errx(1,
+		     "payecs_schedstats result: %s: %.*s",
+		     error,
+		     json_tok_full_len(result),
+		     json_tok_full(buffer, result));
+	assert(streq(name, expected_name));
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *priority;
+	char *tmp;
+	u64 depth, max_depth, enqueued, dispatched;
+
+	payz_tester_init(argv[0]);
+
+	tmp = tal(NULL, char);
+
+	/**
+	 * Test program for system scheduling priorities and
+	 * payecs_schedstats.
+	 */
+
+	/* Nothing has been queued yet.  */
+	get_class_stats(tmp, 1, "normal",
+			&depth, &max_depth, &enqueued, &dispatched);
+	assert(depth == 0 && max_depth == 0);
+	assert(enqueued == 0 && dispatched == 0);
+
+	/* Register the dummy system and give it to Entity 1 with the
+	 * default priority.  */
+	payz_tester_command_expect("payecs_newsystem",
+				   "[\""DUMMY_SYS"\", [\"example\"]]",
+				   "{}");
+	payz_tester_command_expect("payecs_setcomponents",
+				   "[{\"entity\": 1, \"example\": 1, "
+				   "  \"lightningd:systems\": {"
+				   "\"systems\": [\""DUMMY_SYS"\"]}}]",
+				   "{}");
+	payz_tester_command_expect("payecs_advance", "[1]", "{}");
+
+	/* It should have gone through the normal class.  */
+	get_class_stats(tmp, 1, "normal",
+			&depth, &max_depth, &enqueued, &dispatched);
+	assert(depth == 0 && max_depth == 1);
+	assert(enqueued == 1 && dispatched == 1);
+	get_class_stats(tmp, 0, "interactive",
+			&depth, &max_depth, &enqueued, &dispatched);
+	assert(enqueued == 0);
+
+	/* An unknown priority is rejected.  */
+	payz_tester_command_expect("payecs_setcomponents",
+				   "[{\"entity\": 2, \"example\": 2, "
+				   "  \"lightningd:systems\": {"
+				   "\"systems\": [\""DUMMY_SYS"\"], "
+				   "\"priority\": \"urgent\"}}]",
+				   "{}");
+	payz_tester_command_expectfail("payecs_advance", "[2]",
+				       PAY_ECS_INVALID_SYSTEMS_COMPONENT);
+	/* So is a zero weight.  */
+	payz_tester_command_expect("payecs_setcomponents",
+				   "[{\"entity\": 2, "
+				   "  \"lightningd:systems\": {"
+				   "\"systems\": [\""DUMMY_SYS"\"], "
+				   "\"weight\": 0}}]",
+				   "{}");
+	payz_tester_command_expectfail("payecs_advance", "[2]",
+				       PAY_ECS_INVALID_SYSTEMS_COMPONENT);
+
+	/* Setting the priority explicitly puts it in that class.  */
+	payz_tester_command_expect("payecs_setcomponents",
+				   "[{\"entity\": 2, "
+				   "  \"lightningd:systems\": {"
+				   "\"systems\": [\""DUMMY_SYS"\"], "
+				   "\"priority\": \"background\", "
+				   "\"main\": 1, \"weight\": 4}}]",
+				   "{}");
+	payz_tester_command_expect("payecs_advance", "[2]", "{}");
+	get_class_stats(tmp, 2, "background",
+			&depth, &max_depth, &enqueued, &dispatched);
+	assert(depth == 0 && max_depth == 1);
+	assert(enqueued == 1 && dispatched == 1);
+
+	/* payecs_setdefaultsystems can set the priority.  */
+	payz_tester_command_expectfail("payecs_setdefaultsystems",
+				       "{\"entity\": 3, \"priority\": \"urgent\"}",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_expect("payecs_setdefaultsystems",
+				   "{\"entity\": 3, "
+				   " \"priority\": \"interactive\"}",
+				   "{}");
+	payz_tester_wait_component(&buffer, &result,
+				   3, "lightningd:systems");
+	priority = json_get_member(buffer, result, "priority");
+	assert(priority);
+	assert(json_tok_streq(buffer, priority, "interactive"));
+
+	tal_free(tmp);
+
+	return 0;
+}
@@ -30,5 +30,20 @@ int main(int argc, char **argv)
 				   "[1, \"component\"]",
 				   "{\"entity\": 1, \"component\": {\"x\": 1}}");
 
+	/* Exact setcomponents detaches every existing component,
+	 * not just the first.  */
+	payz_tester_command_expect("payecs_setcomponents",
+				   "[[{\"entity\": 2, \"a\": 1, \"b\": 2, "
+				   "   \"c\": 3}]]",
+				   "{}");
+	payz_tester_command_expect("payecs_setcomponents",
+				   "[[{\"entity\": 2, \"exact\": true, "
+				   "   \"d\": 4}]]",
+				   "{}");
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[2, [\"a\", \"b\", \"c\", \"d\"]]",
+				   "{\"entity\": 2, \"a\": null, \"b\": null, "
+				   " \"c\": null, \"d\": 4}");
+
 	return 0;
 }
@@ -0,0 +1,162 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/err/err.h>
+#include<ccan/short_types/short_types.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+#include<unistd.h>
+
+#define DUMMY_SYS "payz:tests:test_sysstats"
+#define OTHER_SYS "payz:tests:test_sysstats_other"
+#define NONCE_SYS "lightningd:generate_nonce"
+
+struct stats {
+	u64 invoked;
+	u64 match_failures;
+	u64 completed;
+	u64 timeouts;
+	u64 service_min_usec;
+	u64 service_p50_usec;
+	u64 service_max_usec;
+	size_t buckets;
+};
+
+static void get_stats(const tal_t *ctx,
+		      const char *system,
+		      struct stats *stats)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *histogram;
+	const char *error;
+	char *name;
+
+	payz_tester_command(&buffer, &result, "payecs_sysstats",
+			    tal_fmt(ctx, "[\"%s\"]", system));
+	error = json_scan(ctx, buffer, result,
+			  "{systems:[0:{system:%,"
+			  "invoked:%,match_failures:%,"
+			  "completed:%,timeouts:%,"
+			  "service_min_usec:%,service_p50_usec:%,"
+			  "service_max_usec:%}]}",
+			  JSON_SCAN_TAL(ctx, json_strdup, &name),
+			  JSON_SCAN(json_to_u64, &stats->invoked),
+			  JSON_SCAN(json_to_u64, &stats->match_failures),
+			  JSON_SCAN(json_to_u64, &stats->completed),
+			  JSON_SCAN(json_to_u64, &stats->timeouts),
+			  JSON_SCAN(json_to_u64, &stats->service_min_usec),
+			  JSON_SCAN(json_to_u64, &stats->service_p50_usec),
+			  JSON_SCAN(json_to_u64, &stats->service_max_usec));
+	if (error)
+		errx(1,
+		     "payecs_sysstats result: %s: %.*s",
+		     error,
+		     json_tok_full_len(result),
+		     json_tok_full(buffer, result));
+	assert(streq(name, system));
+
+	histogram = json_get_member(buffer,
+				    json_get_arr(json_get_member(buffer,
+								 result,
+								 "systems"),
+						 0),
+				    "histogram");
+	assert(histogram);
+	assert(histogram->type == JSMN_ARRAY);
+	stats->buckets = histogram->size;
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *systems;
+	struct stats stats;
+	char *tmp;
+	bool ret;
+
+	payz_tester_init(argv[0]);
+
+	tmp = tal(NULL, char);
+
+	/**
+	 * Test program for payecs_sysstats.
+	 */
+
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""DUMMY_SYS"\", [\"example\"]]");
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""OTHER_SYS"\", [\"other\"]]");
+
+	/* Nothing has happened yet.  */
+	get_stats(tmp, DUMMY_SYS, &stats);
+	assert(stats.invoked == 0 && stats.match_failures == 0);
+	assert(stats.completed == 0 && stats.timeouts == 0);
+	assert(stats.service_max_usec == 0 && stats.buckets == 0);
+
+	/* Unknown systems are rejected.  */
+	payz_tester_command_expectfail("payecs_sysstats",
+				       "[\"payz:tests:no_such_system\"]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	/* The other system is tried first, and does not match.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"example\": 1, "
+			       "  \"lightningd:systems\": {"
+			       "\"systems\": [\""OTHER_SYS"\", "
+			       "              \""DUMMY_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+
+	get_stats(tmp, OTHER_SYS, &stats);
+	assert(stats.invoked == 0 && stats.match_failures == 1);
+	get_stats(tmp, DUMMY_SYS, &stats);
+	assert(stats.invoked == 1 && stats.match_failures == 0);
+	assert(stats.completed == 0);
+
+	/* Act as the dummy system, taking some time to do so.  */
+	usleep(20000);
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"example\": null}]");
+	payz_tester_command_expectfail("payecs_advance", "[1]",
+				       PAY_ECS_NOT_ADVANCEABLE);
+
+	get_stats(tmp, DUMMY_SYS, &stats);
+	assert(stats.invoked == 1 && stats.match_failures == 1);
+	assert(stats.completed == 1 && stats.timeouts == 0);
+	assert(stats.service_min_usec >= 20000);
+	assert(stats.service_max_usec == stats.service_min_usec);
+	assert(stats.service_p50_usec == stats.service_max_usec);
+	assert(stats.buckets == 1);
+	get_stats(tmp, OTHER_SYS, &stats);
+	assert(stats.invoked == 0 && stats.match_failures == 2);
+
+	/* Pure builtins count too.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, "
+			       "  \"lightningd:systems\": {"
+			       "\"systems\": [\""NONCE_SYS"\", "
+			       "              \""DUMMY_SYS"\"]}}]");
+	/* The pure builtin is what fails to advance the entity,
+	 * so the advance that ran it still succeeds.  */
+	payz_tester_command_ok("payecs_advance", "[2]");
+	get_stats(tmp, NONCE_SYS, &stats);
+	assert(stats.invoked == 1 && stats.completed == 1);
+	assert(stats.buckets == 1);
+
+	/* Without a system, all systems are listed.  */
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_sysstats", "[]");
+	assert(ret);
+	systems = json_get_member(buffer, result, "systems");
+	assert(systems);
+	assert(systems->type == JSMN_ARRAY);
+	assert(systems->size > 3);
+
+	tal_free(tmp);
+
+	return 0;
+}
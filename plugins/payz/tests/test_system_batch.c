@@ -0,0 +1,159 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/tal/str/str.h>
+#include<unistd.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+
+#define BATCH_SYS "test:system_batch"
+#define LATE_SYS "test:system_batch_late"
+
+/* Wait until the given entity has the given number of systrace
+ * entries.  */
+static void wait_trace(u32 entity, size_t count)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	bool ret;
+	size_t i;
+
+	for (i = 0; i < 100; ++i) {
+		ret = payz_tester_command(&buffer, &result,
+					  "payecs_systrace",
+					  tal_fmt(tmpctx, "[%"PRIu32"]",
+						  entity));
+		assert(ret);
+		trace = json_get_member(buffer, result, "trace");
+		assert(trace);
+		assert(trace->type == JSMN_ARRAY);
+		if (trace->size == count)
+			break;
+		assert(trace->size < count);
+		/* Let the plugin run a tick.  */
+		payz_tester_command_ok("payecs_listentities", "[]");
+	}
+	assert(trace->size == count);
+	assert(json_tok_streq(buffer,
+			      json_get_member(buffer,
+					      json_get_arr(trace, 0),
+					      "system"),
+			      BATCH_SYS));
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *errors;
+	const jsmntok_t *entry;
+	u32 entity;
+	u32 code;
+	bool ret;
+	size_t i;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for batched system invocation.
+	 */
+
+	/* A batch deadline without a batch size is meaningless.  */
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""BATCH_SYS"\", "
+				       " \"required\": [\"example\"], "
+				       " \"batch_deadline_msec\": 10}",
+				       JSONRPC2_INVALID_PARAMS);
+
+	/* Register a batching system.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""BATCH_SYS"\", "
+			       " \"required\": [\"example\"], "
+			       " \"max_batch\": 3}");
+	/* Re-registering with a different batch size fails.  */
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""BATCH_SYS"\", "
+				       " \"required\": [\"example\"], "
+				       " \"max_batch\": 4}",
+				       JSONRPC2_INVALID_PARAMS);
+
+	/* Set up three entities and advance them together.  */
+	for (entity = 1; entity <= 3; ++entity)
+		payz_tester_command_ok("payecs_setcomponents",
+				       tal_fmt(tmpctx,
+					       "[{\"entity\": %"PRIu32", "
+					       "  \"example\": %"PRIu32", "
+					       "  \"lightningd:systems\": "
+					       "{\"systems\": "
+					       "[\""BATCH_SYS"\"]}}]",
+					       entity, entity));
+	payz_tester_command_expect("payecs_advance_batch", "[[1, 2, 3]]",
+				   "{\"errors\": []}");
+
+	/* Each entity is traced once, from the batch
+	 * notification.  */
+	wait_trace(1, 1);
+	wait_trace(2, 1);
+	wait_trace(3, 1);
+
+	/* An entity that cannot be advanced is reported, but does
+	 * not prevent the others from being advanced.  */
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_advance_batch", "[[1, 4]]");
+	assert(ret);
+	errors = json_get_member(buffer, result, "errors");
+	assert(errors);
+	assert(errors->type == JSMN_ARRAY);
+	assert(errors->size == 1);
+	entry = json_get_arr(errors, 0);
+	assert(json_to_u32(buffer, json_get_member(buffer, entry, "entity"),
+			   &entity));
+	assert(entity == 4);
+	assert(json_to_u32(buffer, json_get_member(buffer, entry, "code"),
+			   &code));
+	assert(code == PAY_ECS_INVALID_SYSTEMS_COMPONENT);
+
+	wait_trace(1, 2);
+
+	/* An entity that no longer matches the system by the time
+	 * the batch is flushed is not handed to it, but advanced as
+	 * if the system had done so.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""LATE_SYS"\", "
+			       " \"required\": [\"late\"], "
+			       " \"max_batch\": 10, "
+			       " \"batch_deadline_msec\": 100}");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 5, \"late\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""LATE_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[5]");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 5, \"late\": null}]");
+	for (i = 0; i < 100; ++i) {
+		ret = payz_tester_command(&buffer, &result,
+					  "payecs_getcomponents",
+					  "[5, [\"lightningd:systems\"]]");
+		assert(ret);
+		entry = json_get_member(buffer, result,
+					"lightningd:systems");
+		assert(entry);
+		if (json_get_member(buffer, entry, "error"))
+			break;
+		usleep(10000);
+	}
+	assert(json_scan(tmpctx, buffer, entry, "{error:{code:%}}",
+			 JSON_SCAN(json_to_u32, &code)) == NULL);
+	assert(code == PAY_ECS_NOT_ADVANCEABLE);
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[5]");
+	assert(ret);
+	entry = json_get_member(buffer, result, "trace");
+	assert(entry);
+	assert(entry->type == JSMN_ARRAY && entry->size == 0);
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+# undef NDEBUG
+#include<assert.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+
+#define METHOD_SYS "test:system_method"
+#define METHOD "test_system_method_invoke"
+#define MISSING_SYS "test:system_method_missing"
+#define MISSING "test_system_method_missing"
+
+/* Wait for the system to be invoked on the entity via the
+ * broadcast notification.  */
+static void wait_broadcast(const char *system, u32 entity)
+{
+	const char *buffer;
+	const jsmntok_t *params;
+	const jsmntok_t *entity_obj;
+	u32 invoked;
+
+	payz_tester_wait_notification(&buffer, &params,
+				      "payecs_system_invoke");
+	assert(json_tok_streq(buffer,
+			      json_get_member(buffer, params, "system"),
+			      system));
+	entity_obj = json_get_member(buffer, params, "entity");
+	assert(json_to_u32(buffer,
+			   json_get_member(buffer, entity_obj, "entity"),
+			   &invoked));
+	assert(invoked == entity);
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	const jsmntok_t *entry;
+	errcode_t code;
+	bool ret;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for systems invoked via an RPC method.
+	 */
+
+	/* Register a system with an RPC method.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""METHOD_SYS"\", "
+			       " \"required\": [\"example\"], "
+			       " \"method\": \""METHOD"\"}");
+	/* Re-registering with the same method is idempotent.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""METHOD_SYS"\", "
+			       " \"required\": [\"example\"], "
+			       " \"method\": \""METHOD"\"}");
+	/* But not with a different method, or none at all.  */
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""METHOD_SYS"\", "
+				       " \"required\": [\"example\"], "
+				       " \"method\": \"other_method\"}",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""METHOD_SYS"\", "
+				       " \"required\": [\"example\"]}",
+				       JSONRPC2_INVALID_PARAMS);
+
+	/* Set up an entity and advance it.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"example\": 42, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""METHOD_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+
+	/* The invocation is traced immediately, without waiting for
+	 * a notification.  */
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[1]");
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace);
+	assert(trace->type == JSMN_ARRAY);
+	assert(trace->size == 1);
+	entry = json_get_arr(trace, 0);
+	assert(json_tok_streq(buffer,
+			      json_get_member(buffer, entry, "system"),
+			      METHOD_SYS));
+
+	/* And no notification was broadcast, so it never gets traced
+	 * a second time.  */
+	payz_tester_command_ok("payecs_listentities", "[]");
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[1]");
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace->size == 1);
+
+	/* If the method fails, nothing will advance the entity, so
+	 * it is failed.  */
+	payz_tester_rpc_fail(METHOD, -1, "System is broken");
+	payz_tester_wait_component(&buffer, &entry, 1, "lightningd:error");
+	assert(json_to_errcode(buffer,
+			       json_get_member(buffer, entry, "code"),
+			       &code));
+	assert(code == PAY_ECS_SYSTEM_FAILED);
+	payz_tester_wait_detach_component(1, "lightningd:systems");
+
+	/* The method can ask for the entity to be advanced, which
+	 * here invokes the system again.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"example\": 42, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""METHOD_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[2]");
+	payz_tester_rpc_respond(METHOD, "{\"advance\": true}");
+	do {
+		ret = payz_tester_command(&buffer, &result,
+					  "payecs_systrace", "[2]");
+		assert(ret);
+		trace = json_get_member(buffer, result, "trace");
+	} while (trace->size < 2);
+	assert(trace->size == 2);
+
+	/* If the method does not exist, the system falls back to the
+	 * broadcast.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""MISSING_SYS"\", "
+			       " \"required\": [\"missing\"], "
+			       " \"method\": \""MISSING"\"}");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 3, \"missing\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""MISSING_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[3]");
+	payz_tester_rpc_fail(MISSING, JSONRPC2_METHOD_NOT_FOUND,
+			     "Unknown command");
+	wait_broadcast(MISSING_SYS, 3);
+
+	/* And later invocations go straight to the broadcast, without
+	 * calling the method, which would go unanswered.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 4, \"missing\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""MISSING_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[4]");
+	wait_broadcast(MISSING_SYS, 4);
+
+	/* Registering the system again retries the method.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""MISSING_SYS"\", "
+			       " \"required\": [\"missing\"], "
+			       " \"method\": \""MISSING"\"}");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 5, \"missing\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""MISSING_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[5]");
+	payz_tester_rpc_respond(MISSING, "{\"advance\": true}");
+	do {
+		ret = payz_tester_command(&buffer, &result,
+					  "payecs_systrace", "[5]");
+		assert(ret);
+		trace = json_get_member(buffer, result, "trace");
+	} while (trace->size < 2);
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+# undef NDEBUG
+#include<assert.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<plugins/payz/tester/tester.h>
+
+#define PASSED_SYS "test:system_passed"
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	const jsmntok_t *entity;
+	const jsmntok_t *big;
+	u32 value;
+	bool ret;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for passing only some components, or some
+	 * fields of components, to a system.
+	 */
+
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""PASSED_SYS"\", "
+				       " \"required\": [\"example\"], "
+				       " \"passed\": [42]}",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""PASSED_SYS"\", "
+			       " \"required\": [\"example\", \"big\"], "
+			       " \"passed\": [{\"component\": \"big\", "
+			       "               \"fields\": [\"a\", \"c\"]}, "
+			       "              \"other\"]}");
+	/* Re-registering is idempotent only with the same
+	 * `passed`.  */
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""PASSED_SYS"\", "
+			       " \"required\": [\"example\", \"big\"], "
+			       " \"passed\": [{\"component\": \"big\", "
+			       "               \"fields\": [\"a\", \"c\"]}, "
+			       "              \"other\"]}");
+	payz_tester_command_expectfail("payecs_newsystem",
+				       "{\"system\": \""PASSED_SYS"\", "
+				       " \"required\": [\"example\", \"big\"]}",
+				       JSONRPC2_INVALID_PARAMS);
+
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"example\": 42, "
+			       "  \"big\": {\"a\": 1, \"b\": 2}, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""PASSED_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[1]");
+
+	/* Only the `a` field of `big` is passed: `example` is not
+	 * in `passed`, and `other` is not attached.  */
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_systrace", "[1]");
+	assert(ret);
+	trace = json_get_member(buffer, result, "trace");
+	assert(trace);
+	assert(trace->type == JSMN_ARRAY);
+	assert(trace->size == 1);
+	entity = json_get_member(buffer, json_get_arr(trace, 0), "entity");
+	assert(entity);
+	assert(entity->size == 2);
+	assert(!json_get_member(buffer, entity, "example"));
+	assert(!json_get_member(buffer, entity, "other"));
+	big = json_get_member(buffer, entity, "big");
+	assert(big);
+	assert(big->size == 1);
+	assert(json_to_u32(buffer, json_get_member(buffer, big, "a"),
+			   &value));
+	assert(value == 1);
+
+	return 0;
+}
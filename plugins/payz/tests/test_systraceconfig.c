@@ -0,0 +1,135 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+
+#define DUMMY_SYS "payz:tests:test_systraceconfig"
+
+/* Have the dummy system invoked on the given entity.  */
+static void invoke_dummy(u32 entity)
+{
+	payz_tester_command_ok("payecs_setcomponents",
+			       tal_fmt(tmpctx,
+				       "[{\"entity\": %"PRIu32", "
+				       "  \"example\": 42, "
+				       "  \"lightningd:systems\": {"
+				       "\"systems\": [\""DUMMY_SYS"\"]}}]",
+				       entity));
+	payz_tester_command_ok("payecs_advance",
+			       tal_fmt(tmpctx, "[%"PRIu32"]", entity));
+}
+
+/* Get the trace of the given entity.  */
+static const jsmntok_t *get_trace(const char **buffer, u32 entity)
+{
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	bool ret;
+
+	ret = payz_tester_command(buffer, &result, "payecs_systrace",
+				  tal_fmt(tmpctx, "[%"PRIu32"]", entity));
+	assert(ret);
+	trace = json_get_member(*buffer, result, "trace");
+	assert(trace);
+	assert(trace->type == JSMN_ARRAY);
+	return trace;
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *trace;
+	const jsmntok_t *entity_obj;
+	u32 entity;
+	u32 sample;
+	bool ret;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_systraceconfig.
+	 */
+
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""DUMMY_SYS"\", [\"example\"]]");
+
+	/* Everything is traced in full by default.  */
+	payz_tester_command_expect("payecs_systraceconfig", "[]",
+				   "{\"level\": \"full\", \"sample\": 1, "
+				   " \"systems\": {}}");
+	invoke_dummy(1);
+	trace = get_trace(&buffer, 1);
+	assert(trace->size == 1);
+	entity_obj = json_get_member(buffer, json_get_arr(trace, 0),
+				     "entity");
+	assert(json_get_member(buffer, entity_obj, "example"));
+
+	/* Headers leave out the components.  */
+	payz_tester_command_ok("payecs_systraceconfig",
+			       "{\"level\": \"headers\"}");
+	invoke_dummy(2);
+	trace = get_trace(&buffer, 2);
+	assert(trace->size == 1);
+	assert(json_tok_streq(buffer,
+			      json_get_member(buffer, json_get_arr(trace, 0),
+					      "system"),
+			      DUMMY_SYS));
+	entity_obj = json_get_member(buffer, json_get_arr(trace, 0),
+				     "entity");
+	assert(json_to_u32(buffer,
+			   json_get_member(buffer, entity_obj, "entity"),
+			   &entity));
+	assert(entity == 2);
+	assert(!json_get_member(buffer, entity_obj, "example"));
+
+	/* Nothing is traced when off, but old records remain.  */
+	payz_tester_command_ok("payecs_systraceconfig", "[\"off\"]");
+	invoke_dummy(3);
+	assert(get_trace(&buffer, 3)->size == 0);
+	assert(get_trace(&buffer, 1)->size == 1);
+
+	/* Sampling a system at a rate no entity here meets leaves
+	 * it out.  */
+	payz_tester_command_expect("payecs_systraceconfig",
+				   "{\"level\": \"full\", "
+				   " \"systems\": {\""DUMMY_SYS"\": "
+				   "               4294967295}}",
+				   "{\"level\": \"full\", \"sample\": 1, "
+				   " \"systems\": {\""DUMMY_SYS"\": "
+				   "               4294967295}}");
+	for (entity = 4; entity < 20; ++entity) {
+		invoke_dummy(entity);
+		assert(get_trace(&buffer, entity)->size == 0);
+	}
+
+	/* As does sampling all entities at that rate.  */
+	payz_tester_command_ok("payecs_systraceconfig",
+			       "{\"sample\": 4294967295, "
+			       " \"systems\": {\""DUMMY_SYS"\": 1}}");
+	invoke_dummy(20);
+	assert(get_trace(&buffer, 20)->size == 0);
+
+	/* Back to tracing everything.  */
+	ret = payz_tester_command(&buffer, &result, "payecs_systraceconfig",
+				  "{\"sample\": 1}");
+	assert(ret);
+	assert(json_to_u32(buffer, json_get_member(buffer, result, "sample"),
+			   &sample));
+	assert(sample == 1);
+	assert(json_get_member(buffer, result, "systems")->size == 0);
+	invoke_dummy(21);
+	assert(get_trace(&buffer, 21)->size == 1);
+
+	/* Unknown levels are rejected.  */
+	payz_tester_command_expectfail("payecs_systraceconfig",
+				       "[\"verbose\"]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	return 0;
+}
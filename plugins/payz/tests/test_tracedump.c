@@ -0,0 +1,167 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/ecs/ecsys.h>
+#include<plugins/payz/tester/tester.h>
+#include<unistd.h>
+
+#define DUMMY_SYS "payz:tests:test_tracedump"
+#define NONCE_SYS "lightningd:generate_nonce"
+
+/* Find the first event with the given phase and category (or
+ * name, for metadata events) in a trace dump.  */
+static const jsmntok_t *find_event(const char *buffer,
+				   const jsmntok_t *events,
+				   const char *ph,
+				   const char *field,
+				   const char *value)
+{
+	const jsmntok_t *event;
+	size_t i;
+
+	json_for_each_arr (i, event, events) {
+		if (!json_tok_streq(buffer,
+				    json_get_member(buffer, event, "ph"),
+				    ph))
+			continue;
+		if (json_tok_streq(buffer,
+				   json_get_member(buffer, event, field),
+				   value))
+			return event;
+	}
+	return NULL;
+}
+
+static const jsmntok_t *get_events(const char **buffer,
+				   u32 main_entity)
+{
+	const jsmntok_t *result;
+	const jsmntok_t *events;
+	bool ret;
+
+	ret = payz_tester_command(buffer, &result, "payecs_tracedump",
+				  tal_fmt(tmpctx, "[%"PRIu32"]",
+					  main_entity));
+	assert(ret);
+	assert(json_tok_streq(*buffer,
+			      json_get_member(*buffer, result,
+					      "displayTimeUnit"),
+			      "ms"));
+	events = json_get_member(*buffer, result, "traceEvents");
+	assert(events);
+	assert(events->type == JSMN_ARRAY);
+	return events;
+}
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *events;
+	const jsmntok_t *event;
+	const jsmntok_t *args;
+	u32 pid, tid;
+	u64 dur;
+	bool fused;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_tracedump.
+	 */
+
+	/* Nothing is recorded until asked for.  */
+	payz_tester_command_expect("payecs_tracedumpconfig", "{}",
+				   "{\"enabled\": false}");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 4, "
+			       "  \"lightningd:systems\": {"
+			       "\"systems\": [\""NONCE_SYS"\"]}}]");
+	payz_tester_command_ok("payecs_advance", "[4]");
+	events = get_events(&buffer, 4);
+	assert(events->size == 0);
+	payz_tester_command_expect("payecs_tracedumpconfig",
+				   "{\"enable\": true}",
+				   "{\"enabled\": true}");
+
+	/* Only one payment is dumped at a time.  */
+	payz_tester_command_expectfail("payecs_tracedump", "[]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	payz_tester_command_ok("payecs_newsystem",
+			       "[\""DUMMY_SYS"\", [\"example\"]]");
+
+	/* Entity 2 is part of the payment of entity 1.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"example\": true, "
+			       "  \"lightningd:systems\": {"
+			       "\"systems\": [\""DUMMY_SYS"\"], "
+			       "\"main\": 1}}]");
+	payz_tester_command_ok("payecs_advance", "[2]");
+
+	/* Act as the dummy system, taking some time to do so.  */
+	usleep(10000);
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 2, \"example\": null}]");
+	payz_tester_command_expectfail("payecs_advance", "[2]",
+				       PAY_ECS_NOT_ADVANCEABLE);
+
+	events = get_events(&buffer, 1);
+
+	/* The payment and its entity are named.  */
+	event = find_event(buffer, events, "M", "name", "process_name");
+	assert(event);
+	assert(json_to_u32(buffer, json_get_member(buffer, event, "pid"),
+			   &pid));
+	assert(pid == 1);
+	event = find_event(buffer, events, "M", "name", "thread_name");
+	assert(event);
+	assert(json_to_u32(buffer, json_get_member(buffer, event, "tid"),
+			   &tid));
+	assert(tid == 2);
+
+	/* The entity waited in the queue, then was held by the
+	 * dummy system.  */
+	event = find_event(buffer, events, "X", "cat", "queue");
+	assert(event);
+	assert(json_tok_streq(buffer, json_get_member(buffer, event, "name"),
+			      DUMMY_SYS));
+	event = find_event(buffer, events, "X", "cat", "system");
+	assert(event);
+	assert(json_tok_streq(buffer, json_get_member(buffer, event, "name"),
+			      DUMMY_SYS));
+	assert(json_to_u32(buffer, json_get_member(buffer, event, "pid"),
+			   &pid));
+	assert(json_to_u32(buffer, json_get_member(buffer, event, "tid"),
+			   &tid));
+	assert(pid == 1 && tid == 2);
+	assert(json_to_u64(buffer, json_get_member(buffer, event, "dur"),
+			   &dur));
+	assert(dur >= 10000);
+
+	/* Pure builtins are marked as such.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 3, "
+			       "  \"lightningd:systems\": {"
+			       "\"systems\": [\""NONCE_SYS"\"]}}]");
+	/* The pure builtin is what fails to advance the entity,
+	 * so the advance that ran it still succeeds.  */
+	payz_tester_command_ok("payecs_advance", "[3]");
+	events = get_events(&buffer, 3);
+	event = find_event(buffer, events, "X", "name", NONCE_SYS);
+	assert(event);
+	args = json_get_member(buffer, event, "args");
+	assert(args);
+	assert(json_to_bool(buffer, json_get_member(buffer, args, "fused"),
+			    &fused));
+	assert(fused);
+
+	/* Other payments are left out.  */
+	events = get_events(&buffer, 99);
+	assert(events->size == 0);
+
+	return 0;
+}
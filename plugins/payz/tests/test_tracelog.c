@@ -0,0 +1,149 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/mem/mem.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/utils.h>
+#include<dirent.h>
+#include<inttypes.h>
+#include<plugins/payz/tracelog.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+
+#define SEGMENT_BYTES 256
+#define MAX_SEGMENTS 3
+#define NUM_RECORDS 20
+
+static void append(struct tracelog *log, u32 entity, bool full)
+{
+	struct tracelog_record record;
+	const char *entity_obj = tal_fmt(tmpctx, "{\"entity\": %"PRIu32"}",
+					 entity);
+
+	record.entity = entity;
+	record.time.ts.tv_sec = entity;
+	record.time.ts.tv_nsec = 0;
+	record.system = "example:system";
+	record.system_len = strlen(record.system);
+	record.fused = entity % 2;
+	record.entity_obj = full ? entity_obj : NULL;
+	record.entity_obj_len = full ? strlen(entity_obj) : 0;
+	assert(tracelog_append(log, &record));
+}
+
+/* Read the entities of all records in the trace log.  */
+static u32 *read_entities(const char *path)
+{
+	struct tracelog_reader *reader;
+	struct tracelog_record record;
+	const char *error;
+	u32 *entities = tal_arr(tmpctx, u32, 0);
+
+	reader = tracelog_reader_new(tmpctx, path, &error);
+	assert(reader);
+	while (tracelog_next(reader, &record)) {
+		assert(memeq(record.system, record.system_len,
+			     "example:system", strlen("example:system")));
+		assert(record.fused == (record.entity % 2));
+		assert(record.time.ts.tv_sec == record.entity);
+		if (record.entity_obj)
+			assert(memstarts(record.entity_obj,
+				     record.entity_obj_len,
+				     "{\"entity\": ", 11));
+		tal_arr_expand(&entities, record.entity);
+	}
+	tal_free(reader);
+	return entities;
+}
+
+static size_t count_segments(const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *ent;
+	size_t n = 0;
+
+	assert(d);
+	while ((ent = readdir(d)) != NULL)
+		if (strstarts(ent->d_name, "trace."))
+			++n;
+	closedir(d);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/payz-test-tracelog-XXXXXX";
+	struct tracelog *log;
+	struct tracelog_record big;
+	const char *path;
+	const char *error;
+	u32 *entities;
+	size_t i;
+	DIR *d;
+	struct dirent *ent;
+
+	setup_locale();
+	setup_tmpctx();
+
+	/**
+	 * Test program for tracelog.
+	 */
+
+	assert(mkdtemp(dir));
+	path = tal_fmt(tmpctx, "%s/trace", dir);
+
+	/* Nothing to read yet.  */
+	assert(!tracelog_reader_new(tmpctx, path, &error));
+
+	log = tracelog_new(NULL, path, SEGMENT_BYTES, MAX_SEGMENTS, &error);
+	assert(log);
+
+	/* Records too large for a segment are refused.  */
+	big.entity = 0;
+	big.time = time_now();
+	big.system = tal_arrz(tmpctx, char, SEGMENT_BYTES);
+	big.system_len = SEGMENT_BYTES;
+	big.fused = false;
+	big.entity_obj = NULL;
+	big.entity_obj_len = 0;
+	assert(!tracelog_append(log, &big));
+
+	/* Fill several segments; only the newest are kept.  */
+	for (i = 0; i < NUM_RECORDS; ++i)
+		append(log, i, i % 3 != 0);
+	assert(count_segments(dir) == MAX_SEGMENTS);
+
+	/* The records can be read while still being written, and
+	 * are the most recent, in order.  */
+	entities = read_entities(path);
+	assert(tal_count(entities) > 0);
+	assert(tal_count(entities) < NUM_RECORDS);
+	for (i = 0; i < tal_count(entities); ++i)
+		assert(entities[i] == NUM_RECORDS - tal_count(entities) + i);
+
+	/* A new writer, as after a restart, continues in a new
+	 * segment and keeps the newest old segments.  */
+	tal_free(log);
+	log = tracelog_new(NULL, path, SEGMENT_BYTES, MAX_SEGMENTS, &error);
+	assert(log);
+	append(log, 100, true);
+	assert(count_segments(dir) == MAX_SEGMENTS);
+	entities = read_entities(path);
+	assert(tal_count(entities) > 1);
+	assert(entities[tal_count(entities) - 2] == NUM_RECORDS - 1);
+	assert(entities[tal_count(entities) - 1] == 100);
+	tal_free(log);
+
+	d = opendir(dir);
+	while ((ent = readdir(d)) != NULL)
+		if (strstarts(ent->d_name, "trace."))
+			unlink(tal_fmt(tmpctx, "%s/%s", dir, ent->d_name));
+	closedir(d);
+	rmdir(dir);
+
+	tal_free(tmpctx);
+
+	return 0;
+}
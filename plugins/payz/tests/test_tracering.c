@@ -0,0 +1,111 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/utils.h>
+#include<inttypes.h>
+#include<plugins/payz/tracering.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#define NUM_KEYS 3
+#define NUM_RECORDS 1000
+
+/* Add a record numbered n, padded to a varying length so that
+ * records do not fit evenly at the end of the buffer.  */
+static void add_numbered(struct tracering *ring, u32 key, size_t n)
+{
+	char *record = tal_fmt(tmpctx, "%zu %.*s",
+			       n, (int) (n % 37), "....................."
+						  "....................");
+
+	assert(tracering_add(ring, key, record, strlen(record)));
+}
+
+/* Check that the records of the key are a contiguous run of its
+ * most recent records, oldest first.  */
+static size_t check_numbered(struct tracering *ring, u32 key, size_t last)
+{
+	const char **records = tracering_get(tmpctx, ring, key);
+	size_t i, n = tal_count(records);
+
+	assert(n > 0);
+	for (i = 0; i < n; ++i)
+		assert(strtoul(records[i], NULL, 10)
+		       == last - (n - 1 - i) * NUM_KEYS);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct tracering *ring;
+	const char **records;
+	char *big;
+	size_t i, n, last;
+
+	setup_locale();
+	setup_tmpctx();
+
+	/**
+	 * Test program for tracering.
+	 */
+
+	ring = tracering_new(NULL, 1024);
+
+	/* Records are kept per key, oldest first.  */
+	assert(tracering_add(ring, 1, "a", 1));
+	assert(tracering_add(ring, 2, "b", 1));
+	assert(tracering_add(ring, 1, "cd", 2));
+	records = tracering_get(tmpctx, ring, 1);
+	assert(tal_count(records) == 2);
+	assert(streq(records[0], "a"));
+	assert(streq(records[1], "cd"));
+	records = tracering_get(tmpctx, ring, 2);
+	assert(tal_count(records) == 1);
+	assert(streq(records[0], "b"));
+	assert(tal_count(tracering_get(tmpctx, ring, 3)) == 0);
+
+	/* Records too large for the whole ring are refused.  */
+	big = tal_arrz(tmpctx, char, 2048);
+	memset(big, 'x', 2047);
+	assert(!tracering_add(ring, 4, big, 2047));
+	assert(!tracering_reserve(ring, 4, 2047));
+	assert(tal_count(tracering_get(tmpctx, ring, 4)) == 0);
+
+	/* Fill the ring many times over, wrapping around.  */
+	for (i = 0; i < NUM_RECORDS; ++i)
+		add_numbered(ring, i % NUM_KEYS, i);
+
+	/* Only the most recent records of each key survive.  */
+	n = 0;
+	for (i = 0; i < NUM_KEYS; ++i) {
+		last = NUM_RECORDS - 1;
+		while (last % NUM_KEYS != i)
+			--last;
+		n += check_numbered(ring, i, last);
+	}
+	assert(n < NUM_RECORDS / 10);
+
+	/* Keys whose records were all overwritten are gone.  */
+	assert(tal_count(tracering_get(tmpctx, ring, 1)) > 0);
+	for (i = 0; i < NUM_RECORDS; ++i)
+		add_numbered(ring, 5, i);
+	for (i = 0; i < NUM_KEYS; ++i)
+		assert(tal_count(tracering_get(tmpctx, ring, i)) == 0);
+	records = tracering_get(tmpctx, ring, 5);
+	assert(tal_count(records) > 0);
+	assert(strtoul(records[tal_count(records) - 1], NULL, 10)
+	       == NUM_RECORDS - 1);
+
+	/* Reserved space is written in place.  */
+	strcpy(tracering_reserve(ring, 6, 5), "hello");
+	records = tracering_get(tmpctx, ring, 6);
+	assert(tal_count(records) == 1);
+	assert(streq(records[0], "hello"));
+
+	tal_free(ring);
+	tal_free(tmpctx);
+
+	return 0;
+}
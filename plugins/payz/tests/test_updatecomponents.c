@@ -0,0 +1,272 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/json_equal.h>
+#include<plugins/payz/payecs_data.h>
+#include<plugins/payz/tester/tester.h>
+
+/* Perform the updates and check the values after each.  */
+static void update(const char *updates, const char *values)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *actual;
+	const jsmntok_t *exptoks;
+	u64 version;
+	bool ret;
+
+	ret = payz_tester_command(&buffer, &result,
+				  "payecs_updatecomponents", updates);
+	assert(ret);
+	assert(json_to_u64(buffer, json_get_member(buffer, result, "version"),
+			   &version));
+	actual = json_get_member(buffer, result, "values");
+	exptoks = json_parse_simple(tmpctx, values, strlen(values));
+	assert(exptoks);
+	assert(actual);
+	assert(json_equal(buffer, actual, values, exptoks));
+}
+
+int main(int argc, char **argv)
+{
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_updatecomponents.
+	 */
+
+	/* Updates see the earlier updates to the same component.  */
+	update("[[{\"entity\": 1, \"component\": \"parts\", \"add\": 1}, "
+	       "  {\"entity\": 1, \"component\": \"parts\", \"add\": 1}, "
+	       "  {\"entity\": 2, \"component\": \"parts\", \"add\": 5}, "
+	       "  {\"entity\": 1, \"component\": \"parts\", \"add\": 1}]]",
+	       "[1, 2, 5, 3]");
+	update("[{\"entity\": 1, \"component\": \"parts\", \"subtract\": 5}]",
+	       "[-2]");
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[[1, 2], [\"parts\"]]",
+				   "{\"entities\": "
+				   "  [{\"entity\": 1, \"parts\": -2}, "
+				   "   {\"entity\": 2, \"parts\": 5}]}");
+
+	/* Amounts.  */
+	update("[[{\"entity\": 1, \"component\": \"sent\", "
+	       "   \"add\": \"1000msat\"}, "
+	       "  {\"entity\": 1, \"component\": \"sent\", \"subtract\": 400}, "
+	       "  {\"entity\": 1, \"component\": \"sent\", "
+	       "   \"add\": \"2sat\"}]]",
+	       "[\"1000msat\", \"600msat\", \"2600msat\"]");
+	/* Nothing is written if any update cannot apply.  */
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[[{\"entity\": 1, \"component\": "
+				       "   \"parts\", \"add\": 1}, "
+				       "  {\"entity\": 1, \"component\": "
+				       "   \"sent\", \"subtract\": \"3sat\"}]]",
+				       PAYECS_UPDATECOMPONENTS_INAPPLICABLE);
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[{\"entity\": 1, \"component\": "
+				       "  \"parts\", \"add\": \"1sat\"}]",
+				       PAYECS_UPDATECOMPONENTS_INAPPLICABLE);
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[1, [\"parts\", \"sent\"]]",
+				   "{\"entity\": 1, \"parts\": -2, "
+				   " \"sent\": \"2600msat\"}");
+
+	/* Minimum and maximum.  */
+	update("[[{\"entity\": 3, \"component\": \"low\", \"min\": 10}, "
+	       "  {\"entity\": 3, \"component\": \"low\", \"min\": 20}, "
+	       "  {\"entity\": 3, \"component\": \"low\", \"min\": 7}, "
+	       "  {\"entity\": 3, \"component\": \"high\", "
+	       "   \"max\": \"1sat\"}, "
+	       "  {\"entity\": 3, \"component\": \"high\", "
+	       "   \"max\": 999}]]",
+	       "[10, 10, 7, \"1sat\", \"1sat\"]");
+
+	/* Fields within objects, and arrays.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 4, \"payment\": "
+			       "   {\"status\": \"pending\", "
+			       "    \"parts\": {\"list\": [1, 2]}}}]]");
+	update("[[{\"entity\": 4, \"component\": \"payment\", "
+	       "   \"field\": [\"parts\", \"list\"], \"append\": 3}, "
+	       "  {\"entity\": 4, \"component\": \"payment\", "
+	       "   \"field\": [\"parts\", \"list\"], \"remove\": 1}, "
+	       "  {\"entity\": 4, \"component\": \"payment\", "
+	       "   \"field\": [\"parts\", \"count\"], \"add\": 2}, "
+	       "  {\"entity\": 4, \"component\": \"payment\", "
+	       "   \"field\": \"status\", \"set\": {\"done\": true}}]]",
+	       "[{\"status\": \"pending\", "
+	       "  \"parts\": {\"list\": [1, 2, 3]}}, "
+	       " {\"status\": \"pending\", "
+	       "  \"parts\": {\"list\": [2, 3]}}, "
+	       " {\"status\": \"pending\", "
+	       "  \"parts\": {\"list\": [2, 3], \"count\": 2}}, "
+	       " {\"status\": {\"done\": true}, "
+	       "  \"parts\": {\"list\": [2, 3], \"count\": 2}}]");
+	update("[[{\"entity\": 5, \"component\": \"set\", "
+	       "   \"remove\": 1}, "
+	       "  {\"entity\": 5, \"component\": \"set\", "
+	       "   \"append\": \"x\"}, "
+	       "  {\"entity\": 5, \"component\": \"set\", "
+	       "   \"set\": null}]]",
+	       "[null, [\"x\"], null]");
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[{\"entity\": 4, \"component\": "
+				       "  \"payment\", \"field\": \"status\", "
+				       "  \"append\": 1}]",
+				       PAYECS_UPDATECOMPONENTS_INAPPLICABLE);
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[5, [\"set\"]]",
+				   "{\"entity\": 5, \"set\": null}");
+
+	/* Expected components.  */
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "{\"updates\": {\"entity\": 1, "
+				       "              \"component\": \"parts\", "
+				       "              \"add\": 1}, "
+				       " \"expected\": {\"entity\": 1, "
+				       "                \"parts\": 3}}",
+				       PAYECS_SETCOMPONENTS_UNEXPECTED_COMPONENTS);
+	update("{\"updates\": {\"entity\": 1, \"component\": \"parts\", "
+	       "              \"add\": 1}, "
+	       " \"expected\": {\"entity\": 1, \"parts\": -2}}",
+	       "[-1]");
+
+	/* Merge patches.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 6, \"route\": "
+			       "   {\"amount\": \"1000msat\", "
+			       "    \"hops\": [{\"scid\": \"1x1x1\"}, "
+			       "             {\"scid\": \"2x2x2\"}], "
+			       "    \"fee\": {\"base\": 1, \"ppm\": 10}}}]]");
+	update("[[{\"entity\": 6, \"component\": \"route\", "
+	       "   \"merge\": {\"amount\": \"2000msat\", "
+	       "             \"fee\": {\"ppm\": null, \"prop\": 1}, "
+	       "             \"new\": {\"a\": null, \"b\": 2}}}, "
+	       "  {\"entity\": 7, \"component\": \"route\", "
+	       "   \"merge\": {\"a\": [1, {\"b\": null}]}}, "
+	       "  {\"entity\": 7, \"component\": \"route\", "
+	       "   \"merge\": null}]]",
+	       "[{\"amount\": \"2000msat\", "
+	       "  \"hops\": [{\"scid\": \"1x1x1\"}, "
+	       "           {\"scid\": \"2x2x2\"}], "
+	       "  \"fee\": {\"base\": 1, \"prop\": 1}, "
+	       "  \"new\": {\"b\": 2}}, "
+	       " {\"a\": [1, {\"b\": null}]}, "
+	       " null]");
+	update("[{\"entity\": 6, \"component\": \"route\", "
+	       "  \"field\": \"fee\", \"merge\": null}]",
+	       "[{\"amount\": \"2000msat\", "
+	       "  \"hops\": [{\"scid\": \"1x1x1\"}, "
+	       "           {\"scid\": \"2x2x2\"}], "
+	       "  \"new\": {\"b\": 2}}]");
+
+	/* JSON Patches.  */
+	update("[{\"entity\": 6, \"component\": \"route\", "
+	       "  \"patch\": "
+	       "  [{\"op\": \"test\", \"path\": \"/hops/0/scid\", "
+	       "    \"value\": \"1x1x1\"}, "
+	       "   {\"op\": \"add\", \"path\": \"/hops/1\", "
+	       "    \"value\": {\"scid\": \"3x3x3\"}}, "
+	       "   {\"op\": \"add\", \"path\": \"/hops/-\", "
+	       "    \"value\": {\"scid\": \"4x4x4\"}}, "
+	       "   {\"op\": \"remove\", \"path\": \"/hops/0\"}, "
+	       "   {\"op\": \"replace\", \"path\": \"/amount\", "
+	       "    \"value\": \"3000msat\"}, "
+	       "   {\"op\": \"move\", \"from\": \"/new/b\", "
+	       "    \"path\": \"/a~1b\"}, "
+	       "   {\"op\": \"copy\", \"from\": \"/hops/2\", "
+	       "    \"path\": \"/last\"}, "
+	       "   {\"op\": \"remove\", \"path\": \"/new\"}]}]",
+	       "[{\"amount\": \"3000msat\", "
+	       "  \"hops\": [{\"scid\": \"3x3x3\"}, "
+	       "           {\"scid\": \"2x2x2\"}, "
+	       "           {\"scid\": \"4x4x4\"}], "
+	       "  \"a/b\": 2, "
+	       "  \"last\": {\"scid\": \"4x4x4\"}}]");
+	/* A failed test fails the whole command.  */
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[[{\"entity\": 6, \"component\": "
+				       "   \"route\", \"patch\": "
+				       "   [{\"op\": \"remove\", "
+				       "     \"path\": \"/last\"}]}, "
+				       "  {\"entity\": 6, \"component\": "
+				       "   \"route\", \"patch\": "
+				       "   [{\"op\": \"test\", "
+				       "     \"path\": \"/last\", "
+				       "     \"value\": null}]}]]",
+				       PAYECS_UPDATECOMPONENTS_INAPPLICABLE);
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[{\"entity\": 6, \"component\": "
+				       "  \"route\", \"patch\": "
+				       "  [{\"op\": \"replace\", "
+				       "    \"path\": \"/hops/3\", "
+				       "    \"value\": 1}]}]",
+				       PAYECS_UPDATECOMPONENTS_INAPPLICABLE);
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[{\"entity\": 6, \"component\": "
+				       "  \"route\", \"patch\": "
+				       "  [{\"op\": \"move\", "
+				       "    \"from\": \"/hops\", "
+				       "    \"path\": \"/hops/0\"}]}]",
+				       PAYECS_UPDATECOMPONENTS_INAPPLICABLE);
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[6, [\"route\"]]",
+				   "{\"entity\": 6, \"route\": "
+				   " {\"amount\": \"3000msat\", "
+				   "  \"hops\": [{\"scid\": \"3x3x3\"}, "
+				   "           {\"scid\": \"2x2x2\"}, "
+				   "           {\"scid\": \"4x4x4\"}], "
+				   "  \"a/b\": 2, "
+				   "  \"last\": {\"scid\": \"4x4x4\"}}}");
+	/* Removing the whole value detaches it.  */
+	update("[{\"entity\": 6, \"component\": \"route\", "
+	       "  \"patch\": [{\"op\": \"remove\", \"path\": \"\"}]}]",
+	       "[null]");
+	payz_tester_command_expect("payecs_getcomponents",
+				   "[6, [\"route\"]]",
+				   "{\"entity\": 6, \"route\": null}");
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[{\"entity\": 6, \"component\": "
+				       "  \"route\", \"patch\": "
+				       "  [{\"op\": \"add\", "
+				       "    \"path\": \"hops\", "
+				       "    \"value\": 1}]}]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	/* Paths and member names are compared with their JSON
+	 * escapes decoded.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[[{\"entity\": 8, \"names\": "
+			       "   {\"a\\/b\": 1, \"q\\\"t\": 2, "
+			       "    \"caf\\u00e9\": 3}}]]");
+	update("[{\"entity\": 8, \"component\": \"names\", "
+	       "  \"patch\": "
+	       "  [{\"op\": \"replace\", \"path\": \"/a~1b\", "
+	       "    \"value\": 10}, "
+	       "   {\"op\": \"test\", \"path\": \"\\/a~1b\", "
+	       "    \"value\": 10}, "
+	       "   {\"op\": \"replace\", \"path\": \"/q\\\"t\", "
+	       "    \"value\": 20}, "
+	       "   {\"op\": \"remove\", \"path\": \"/caf\\u00e9\"}, "
+	       "   {\"op\": \"add\", \"path\": \"/new\\\"key\", "
+	       "    \"value\": 4}]}]",
+	       "[{\"a\\/b\": 10, \"q\\\"t\": 20, \"new\\\"key\": 4}]");
+	update("[{\"entity\": 8, \"component\": \"names\", "
+	       "  \"merge\": {\"a/b\": null, \"new\\u0022key\": 5}}]",
+	       "[{\"q\\\"t\": 20, \"new\\\"key\": 5}]");
+
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[{\"entity\": 1, \"component\": "
+				       "  \"parts\", \"add\": 1, \"max\": 1}]",
+				       JSONRPC2_INVALID_PARAMS);
+	payz_tester_command_expectfail("payecs_updatecomponents",
+				       "[{\"entity\": 1, \"component\": "
+				       "  \"parts\", \"add\": true}]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/str/str.h>
+#include<ccan/time/time.h>
+#include<common/json.h>
+#include<common/jsonrpc_errors.h>
+#include<common/utils.h>
+#include<plugins/payz/tester/tester.h>
+
+#define STALL_SYS "payz:tests:waitcomponents_stall"
+
+int main(int argc, char **argv)
+{
+	const char *buffer;
+	const jsmntok_t *result;
+	const jsmntok_t *tok;
+	struct timemono start;
+	bool ret;
+
+	payz_tester_init(argv[0]);
+
+	/**
+	 * Test program for payecs_waitcomponents.
+	 */
+
+	payz_tester_command_ok("payecs_newsystem",
+			       "{\"system\": \""STALL_SYS"\", "
+			       " \"required\": [\"stall\"], "
+			       " \"deadline_msec\": 500}");
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"stall\": true, "
+			       "  \"lightningd:systems\": "
+			       "{\"systems\": [\""STALL_SYS"\"]}}]");
+
+	/* Nothing changes, so it times out.  */
+	start = time_mono();
+	payz_tester_command_expect("payecs_waitcomponents",
+				   "[1, [\"stall\", \"other\"], 1]",
+				   "{\"entity\": 1, \"stall\": true, "
+				   " \"other\": null, \"timed_out\": true}");
+	assert(time_greater(timemono_since(start), time_from_msec(900)));
+
+	/* The system never advances the entity, so once its deadline
+	 * passes, the entity is failed while we wait.  */
+	payz_tester_command_ok("payecs_advance", "[1]");
+	ret = payz_tester_command(&buffer, &result, "payecs_waitcomponents",
+				  "{\"entity\": 1, "
+				  " \"components\": [\"lightningd:systems\", "
+				  "                  \"lightningd:error\"], "
+				  " \"timeout\": 30}");
+	assert(ret);
+	assert(!json_get_member(buffer, result, "timed_out"));
+	tok = json_get_member(buffer, result, "changed");
+	assert(tok && json_tok_streq(buffer, tok, "lightningd:error"));
+	/* All the changes made together are seen.  */
+	tok = json_get_member(buffer, result, "lightningd:error");
+	assert(tok && tok->type == JSMN_OBJECT);
+	tok = json_get_member(buffer, result, "lightningd:systems");
+	assert(tok && json_tok_is_null(buffer, tok));
+
+	/* Only changes made while waiting are reported, and
+	 * components can be given as a single string.  */
+	payz_tester_command_ok("payecs_setcomponents",
+			       "[{\"entity\": 1, \"stall\": true}]");
+	payz_tester_command_expect("payecs_waitcomponents",
+				   "[1, \"stall\", 1]",
+				   "{\"entity\": 1, \"stall\": true, "
+				   " \"timed_out\": true}");
+
+	/* A change made before the wait, as seen by comparing with
+	 * the values last read, completes it at once.  */
+	payz_tester_command_expect("payecs_waitcomponents",
+				   "{\"entity\": 1, "
+				   " \"components\": [\"stall\", \"other\"], "
+				   " \"expected\": {\"other\": null, "
+				   "               \"stall\": false}}",
+				   "{\"entity\": 1, \"stall\": true, "
+				   " \"other\": null, \"changed\": \"stall\"}");
+	payz_tester_command_expect("payecs_waitcomponents",
+				   "{\"entity\": 1, "
+				   " \"components\": [\"stall\", \"other\"], "
+				   " \"timeout\": 1, "
+				   " \"expected\": {\"other\": null, "
+				   "               \"stall\": true}}",
+				   "{\"entity\": 1, \"stall\": true, "
+				   " \"other\": null, \"timed_out\": true}");
+
+	/* Nothing could complete a wait on no components.  */
+	payz_tester_command_expectfail("payecs_waitcomponents",
+				       "[1, []]",
+				       JSONRPC2_INVALID_PARAMS);
+
+	return 0;
+}
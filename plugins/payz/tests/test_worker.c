@@ -0,0 +1,109 @@
+# undef NDEBUG
+#include<assert.h>
+#include<ccan/io/io.h>
+#include<ccan/tal/str/str.h>
+#include<common/json.h>
+#include<common/utils.h>
+#include<inttypes.h>
+#include<plugins/payz/ecs/ecworker.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#define NUM_JOBS 64
+
+struct test_state {
+	u64 expected[NUM_JOBS];
+	bool seen[NUM_JOBS];
+	size_t num_done;
+};
+
+/* Sum the numbers in the given array, plus the entity.  */
+static char *work_sum(u32 entity,
+		      const char *buffer,
+		      const jsmntok_t *toks)
+{
+	const jsmntok_t *t;
+	size_t i;
+	u64 sum = entity;
+	u64 n;
+	char *result;
+
+	assert(toks->type == JSMN_ARRAY);
+	json_for_each_arr (i, t, toks) {
+		assert(json_to_u64(buffer, t, &n));
+		sum += n;
+	}
+
+	result = malloc(32);
+	snprintf(result, 32, "%"PRIu64, sum);
+	return result;
+}
+
+static void done(struct test_state *state,
+		 u32 entity,
+		 void *payload,
+		 const char *result)
+{
+	assert(entity < NUM_JOBS);
+	assert(!state->seen[entity]);
+	assert(payload == &state->expected[entity]);
+	assert(result);
+	assert(strtoull(result, NULL, 10) == state->expected[entity]);
+
+	state->seen[entity] = true;
+	if (++state->num_done == NUM_JOBS)
+		io_break(state);
+}
+
+int main(int argc, char **argv)
+{
+	struct test_state *state;
+	struct ecworker *workers;
+	char *json;
+	const jsmntok_t *toks;
+	u32 i;
+	u32 j;
+
+	setup_locale();
+	setup_tmpctx();
+
+	/**
+	 * Test program for the worker thread pool.
+	 */
+
+	state = tal(NULL, struct test_state);
+	state->num_done = 0;
+	workers = ecworker_new(state, 4, &done, state);
+
+	for (i = 0; i < NUM_JOBS; ++i) {
+		state->expected[i] = i;
+		state->seen[i] = false;
+
+		/* Surround the array, to check that only the given
+		 * token is given to the job.  */
+		json = tal_strdup(tmpctx, "{\"ignored\": 1, \"array\": [");
+		for (j = 0; j < 100 + i; ++j) {
+			tal_append_fmt(&json, "%s%"PRIu32, j ? ", " : "", j);
+			state->expected[i] += j;
+		}
+		tal_append_fmt(&json, "]}");
+
+		toks = json_parse_simple(tmpctx, json, strlen(json));
+		assert(toks);
+		ecworker_submit(workers, &work_sum, i,
+				json, json_get_member(json, toks, "array"),
+				&state->expected[i]);
+	}
+	assert(ecworker_pending(workers) == NUM_JOBS);
+
+	/* Results are delivered from the event loop.  */
+	assert(io_loop(NULL, NULL) == state);
+	assert(ecworker_pending(workers) == 0);
+	for (i = 0; i < NUM_JOBS; ++i)
+		assert(state->seen[i]);
+
+	tal_free(state);
+	tal_free(tmpctx);
+
+	return 0;
+}
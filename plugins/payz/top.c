@@ -24,6 +24,16 @@ void setup_payz_top(const char *pay_command,
 
 	payz_top->disablempp = false;
 	payz_top->ecs = ecs_new(payz_top);
+	payz_top->dispatch_per_tick = ecs_get_dispatch_per_tick(payz_top->ecs);
+	payz_top->step_budget = ecs_get_step_budget(payz_top->ecs);
+	payz_top->systrace_bytes = PAYECS_SYSTRACE_BYTES;
+	payz_top->systrace_level = ECSYS_TRACE_FULL;
+	payz_top->systrace_sample = 1;
+	payz_top->systrace_log = NULL;
+	payz_top->systrace_log_segments = 16;
+	payz_top->tracedump = false;
+	payz_top->trace_file = NULL;
+	payecs_code_init(payz_top->ecs);
 
 	payz_top->commands = tal_arr(payz_top, struct plugin_command, 0);
 	tal_expand(&payz_top->commands,
@@ -64,6 +74,8 @@ void setup_payz_top(const char *pay_command,
 	payz_top->notif_topics = tal_arr(payz_top, const char *, 0);
 	tal_expand(&payz_top->notif_topics,
 		   payecs_code_topics, num_payecs_code_topics);
+	tal_expand(&payz_top->notif_topics,
+		   payecs_data_topics, num_payecs_data_topics);
 }
 
 void shutdown_payz_top(void)
@@ -77,6 +89,27 @@ const char *payz_top_init(struct plugin *plugin,
 			  const char *buffer,
 			  const jsmntok_t *tok)
 {
+	ecs_set_plugin(payz_top->ecs, plugin);
+	ecs_set_dispatch_per_tick(payz_top->ecs, payz_top->dispatch_per_tick);
+	ecs_set_step_budget(payz_top->ecs, payz_top->step_budget);
+	payecs_code_set_systrace(payz_top->systrace_bytes,
+				 payz_top->systrace_level,
+				 payz_top->systrace_sample);
+	if (payz_top->systrace_log) {
+		const char *err;
+		err = payecs_code_set_systrace_log(
+				payz_top->systrace_log,
+				payz_top->systrace_log_segments);
+		if (err)
+			return err;
+	}
+	payecs_code_set_tracedump(payz_top->tracedump);
+	if (payz_top->trace_file) {
+		const char *err;
+		err = payecs_code_set_trace_file(payz_top->trace_file);
+		if (err)
+			return err;
+	}
 	system_defaulter_init(plugin);
 	/* TODO.  */
 	return NULL;
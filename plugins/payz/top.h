@@ -1,7 +1,9 @@
 #ifndef LIGHTNING_PLUGINS_PAYZ_TOP_H
 #define LIGHTNING_PLUGINS_PAYZ_TOP_H
 #include"config.h"
+#include<ccan/short_types/short_types.h>
 #include<common/json.h>
+#include<plugins/payz/ecs/ecsys.h>
 #include<stdbool.h>
 
 struct ecs;
@@ -22,6 +24,69 @@ struct payz_top {
 	 */
 	bool disablempp;
 
+	/** dispatch_per_tick
+	 *
+	 * @brief The maximum number of systems the ECS will
+	 * invoke per event loop iteration, 0 if unlimited.
+	 */
+	u32 dispatch_per_tick;
+
+	/** step_budget
+	 *
+	 * @brief The maximum number of systems the ECS will
+	 * launch on an entity, 0 if unlimited.
+	 */
+	u32 step_budget;
+
+	/** systrace_bytes
+	 *
+	 * @brief The size in bytes of the buffer of the most
+	 * recent system invocations for `payecs_systrace`.
+	 */
+	u64 systrace_bytes;
+
+	/** systrace_level
+	 *
+	 * @brief How much of each system invocation to keep
+	 * for `payecs_systrace`.
+	 */
+	enum ecsys_trace_level systrace_level;
+
+	/** systrace_sample
+	 *
+	 * @brief Keep system invocations for `payecs_systrace`
+	 * for only one in this many entities.
+	 */
+	u32 systrace_sample;
+
+	/** systrace_log
+	 *
+	 * @brief The path of the trace log to also write
+	 * `payecs_systrace` records to, or NULL.
+	 */
+	char *systrace_log;
+
+	/** systrace_log_segments
+	 *
+	 * @brief The number of segments of the trace log to
+	 * keep, 0 to keep all.
+	 */
+	u32 systrace_log_segments;
+
+	/** tracedump
+	 *
+	 * @brief Whether to record spans for `payecs_tracedump`
+	 * from the start.
+	 */
+	bool tracedump;
+
+	/** trace_file
+	 *
+	 * @brief The file to write a Chrome trace of entity
+	 * processing to, or NULL.
+	 */
+	char *trace_file;
+
 	/** ecs
 	 *
 	 * @brief the entity component system framework.
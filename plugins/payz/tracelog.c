@@ -0,0 +1,406 @@
+#include"tracelog.h"
+#include<assert.h>
+#include<ccan/mem/mem.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/utils.h>
+#include<dirent.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<inttypes.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+/*~
+ * A segment starts with a header, followed by records one after
+ * the other, each starting with a record header and padded to a
+ * multiple of 8 bytes.
+ * A segment is created at its full size, so that the rest of it
+ * reads as zeroes, and a record size of 0 marks the end.
+ *
+ * The header also keeps the end of the last complete record,
+ * updated after each record is written, so a reader never sees
+ * a record that was only partly written when the writer
+ * crashed.
+ * As the segment is a shared mapping, the kernel still writes
+ * out what the writer put in it even if the writer crashes.
+ */
+
+#define TRACELOG_MAGIC "PAYZTLOG"
+#define TRACELOG_VERSION 1
+
+#define TRACELOG_FUSED 1
+#define TRACELOG_HAS_ENTITY 2
+
+struct tracelog_segment_header {
+	char magic[8];
+	u32 version;
+	u32 header_size;
+	/* Offset just past the last complete record.  */
+	u64 end;
+};
+
+struct tracelog_record_header {
+	/* Size of the record including this header and padding,
+	 * or 0 at the end.  */
+	u32 size;
+	u32 entity;
+	u64 sec;
+	u32 nsec;
+	u16 system_len;
+	u8 flags;
+	u8 reserved;
+	u32 entity_obj_len;
+	u32 reserved2;
+	/* Followed by the system name, then the entity object.  */
+};
+
+static size_t align8(size_t size)
+{
+	return (size + 7) & ~(size_t) 7;
+}
+
+static const char *segment_path(const tal_t *ctx, const char *path, u64 seq)
+{
+	return tal_fmt(ctx, "%s.%06"PRIu64, path, seq);
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *) a, y = *(const u64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Get the numbers of the existing segments of the trace log,
+ * in order.  */
+static u64 *list_segments(const tal_t *ctx, const char *path)
+{
+	u64 *segments = tal_arr(ctx, u64, 0);
+	const char *slash = strrchr(path, '/');
+	const char *dirname;
+	const char *prefix;
+	struct dirent *ent;
+	DIR *dir;
+	char *endp;
+	u64 seq;
+
+	if (slash) {
+		dirname = tal_strndup(tmpctx, path, slash - path + 1);
+		prefix = tal_fmt(tmpctx, "%s.", slash + 1);
+	} else {
+		dirname = ".";
+		prefix = tal_fmt(tmpctx, "%s.", path);
+	}
+
+	dir = opendir(dirname);
+	if (!dir)
+		return segments;
+	while ((ent = readdir(dir)) != NULL) {
+		if (!strstarts(ent->d_name, prefix))
+			continue;
+		if (!cisdigit(ent->d_name[strlen(prefix)]))
+			continue;
+		errno = 0;
+		seq = strtoull(ent->d_name + strlen(prefix), &endp, 10);
+		if (*endp || errno)
+			continue;
+		tal_arr_expand(&segments, seq);
+	}
+	closedir(dir);
+
+	qsort(segments, tal_count(segments), sizeof(u64), &u64_cmp);
+	return segments;
+}
+
+/*-----------------------------------------------------------------------------
+Writer
+-----------------------------------------------------------------------------*/
+
+struct tracelog {
+	const char *path;
+	size_t segment_bytes;
+	u32 max_segments;
+
+	/* The current segment, mapped at map if not NULL.  */
+	u64 seq;
+	int fd;
+	char *map;
+	/* Offset just past the last record in the segment.  */
+	size_t used;
+};
+
+static void close_segment(struct tracelog *log)
+{
+	if (!log->map)
+		return;
+	munmap(log->map, log->segment_bytes);
+	close(log->fd);
+	log->map = NULL;
+}
+
+static const char *open_segment(const tal_t *ctx, struct tracelog *log)
+{
+	const char *path = segment_path(tmpctx, log->path, log->seq);
+	struct tracelog_segment_header *hdr;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return tal_fmt(ctx, "Could not create %s: %s",
+			       path, strerror(errno));
+	if (ftruncate(fd, log->segment_bytes) < 0) {
+		close(fd);
+		return tal_fmt(ctx, "Could not extend %s: %s",
+			       path, strerror(errno));
+	}
+	map = mmap(NULL, log->segment_bytes,
+		   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return tal_fmt(ctx, "Could not map %s: %s",
+			       path, strerror(errno));
+	}
+
+	log->fd = fd;
+	log->map = map;
+	log->used = sizeof(*hdr);
+
+	hdr = (struct tracelog_segment_header *) log->map;
+	memcpy(hdr->magic, TRACELOG_MAGIC, sizeof(hdr->magic));
+	hdr->version = TRACELOG_VERSION;
+	hdr->header_size = sizeof(*hdr);
+	hdr->end = log->used;
+
+	/* Drop the oldest segment we are no longer keeping.  */
+	if (log->max_segments != 0 && log->seq >= log->max_segments)
+		unlink(segment_path(tmpctx, log->path,
+				    log->seq - log->max_segments));
+
+	return NULL;
+}
+
+struct tracelog *tracelog_new(const tal_t *ctx,
+			      const char *path,
+			      size_t segment_bytes,
+			      u32 max_segments,
+			      const char **error)
+{
+	struct tracelog *log;
+	u64 *segments;
+	size_t i, n;
+
+	if (segment_bytes < sizeof(struct tracelog_segment_header)
+			    + sizeof(struct tracelog_record_header)) {
+		*error = tal_fmt(ctx, "Trace log segments of %zu bytes "
+				 "are too small", segment_bytes);
+		return NULL;
+	}
+
+	log = tal(ctx, struct tracelog);
+	log->path = tal_strdup(log, path);
+	log->segment_bytes = segment_bytes;
+	log->max_segments = max_segments;
+	log->map = NULL;
+
+	/* Continue after the last segment, and drop any we no longer
+	 * keep.  */
+	segments = list_segments(tmpctx, path);
+	n = tal_count(segments);
+	log->seq = n == 0 ? 0 : segments[n - 1] + 1;
+	for (i = 0; max_segments != 0 && i < n; ++i) {
+		if (segments[i] + max_segments <= log->seq)
+			unlink(segment_path(tmpctx, path, segments[i]));
+	}
+
+	*error = open_segment(ctx, log);
+	if (*error)
+		return tal_free(log);
+	tal_add_destructor(log, &close_segment);
+
+	return log;
+}
+
+bool tracelog_append(struct tracelog *log,
+		     const struct tracelog_record *record)
+{
+	struct tracelog_segment_header *hdr;
+	struct tracelog_record_header *rec;
+	size_t entity_obj_len;
+	size_t size;
+	char *p;
+
+	entity_obj_len = record->entity_obj ? record->entity_obj_len : 0;
+	size = align8(sizeof(*rec) + record->system_len + entity_obj_len);
+	if (record->system_len > UINT16_MAX
+	 || size > log->segment_bytes - sizeof(*hdr))
+		return false;
+
+	if (!log->map || log->used + size > log->segment_bytes) {
+		close_segment(log);
+		++log->seq;
+		if (open_segment(tmpctx, log))
+			return false;
+	}
+
+	p = log->map + log->used;
+	rec = (struct tracelog_record_header *) p;
+	rec->size = size;
+	rec->entity = record->entity;
+	rec->sec = record->time.ts.tv_sec;
+	rec->nsec = record->time.ts.tv_nsec;
+	rec->system_len = record->system_len;
+	rec->flags = (record->fused ? TRACELOG_FUSED : 0)
+		   | (record->entity_obj ? TRACELOG_HAS_ENTITY : 0);
+	rec->reserved = 0;
+	rec->entity_obj_len = entity_obj_len;
+	rec->reserved2 = 0;
+	p += sizeof(*rec);
+	memcpy(p, record->system, record->system_len);
+	p += record->system_len;
+	memcpy(p, record->entity_obj, entity_obj_len);
+
+	/* Only now is the record complete.  */
+	log->used += size;
+	hdr = (struct tracelog_segment_header *) log->map;
+	hdr->end = log->used;
+
+	return true;
+}
+
+/*-----------------------------------------------------------------------------
+Reader
+-----------------------------------------------------------------------------*/
+
+struct tracelog_reader {
+	const char *path;
+	u64 *segments;
+	/* Index of the next segment to map.  */
+	size_t next;
+
+	/* The current segment, mapped at map if not NULL.  */
+	char *map;
+	size_t map_len;
+	/* Offset of the next record, and the end of the records.  */
+	size_t pos;
+	size_t end;
+};
+
+static void unmap_segment(struct tracelog_reader *reader)
+{
+	if (!reader->map)
+		return;
+	munmap(reader->map, reader->map_len);
+	reader->map = NULL;
+}
+
+/* Map the next readable segment.  */
+static bool map_next_segment(struct tracelog_reader *reader)
+{
+	const struct tracelog_segment_header *hdr;
+	const char *path;
+	struct stat st;
+	void *map;
+	int fd;
+
+	unmap_segment(reader);
+	while (reader->next < tal_count(reader->segments)) {
+		path = segment_path(tmpctx, reader->path,
+				    reader->segments[reader->next++]);
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			continue;
+		if (fstat(fd, &st) < 0
+		 || (size_t) st.st_size < sizeof(*hdr)) {
+			close(fd);
+			continue;
+		}
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+			continue;
+
+		hdr = map;
+		if (!memeq(hdr->magic, sizeof(hdr->magic),
+			   TRACELOG_MAGIC, strlen(TRACELOG_MAGIC))
+		 || hdr->version != TRACELOG_VERSION
+		 || hdr->header_size < sizeof(*hdr)
+		 || hdr->header_size > st.st_size) {
+			munmap(map, st.st_size);
+			continue;
+		}
+
+		reader->map = map;
+		reader->map_len = st.st_size;
+		reader->pos = hdr->header_size;
+		reader->end = hdr->end < reader->map_len ?
+			      hdr->end : reader->map_len;
+		return true;
+	}
+	return false;
+}
+
+struct tracelog_reader *tracelog_reader_new(const tal_t *ctx,
+					    const char *path,
+					    const char **error)
+{
+	struct tracelog_reader *reader = tal(ctx, struct tracelog_reader);
+
+	reader->path = tal_strdup(reader, path);
+	reader->segments = list_segments(reader, path);
+	if (tal_count(reader->segments) == 0) {
+		*error = tal_fmt(ctx, "No trace log segments at %s.*",
+				 path);
+		return tal_free(reader);
+	}
+	reader->next = 0;
+	reader->map = NULL;
+	tal_add_destructor(reader, &unmap_segment);
+
+	return reader;
+}
+
+bool tracelog_next(struct tracelog_reader *reader,
+		   struct tracelog_record *record)
+{
+	const struct tracelog_record_header *rec;
+	const char *p;
+
+	for (;;) {
+		if (!reader->map && !map_next_segment(reader))
+			return false;
+
+		rec = (const struct tracelog_record_header *)
+			(reader->map + reader->pos);
+		if (reader->end - reader->pos < sizeof(*rec)
+		 || rec->size < sizeof(*rec)
+		 || rec->size > reader->end - reader->pos
+		 || sizeof(*rec) + rec->system_len + rec->entity_obj_len
+		    > rec->size) {
+			/* End of this segment.  */
+			unmap_segment(reader);
+			continue;
+		}
+		reader->pos += rec->size;
+
+		p = (const char *) (rec + 1);
+		record->entity = rec->entity;
+		record->time.ts.tv_sec = rec->sec;
+		record->time.ts.tv_nsec = rec->nsec;
+		record->system = p;
+		record->system_len = rec->system_len;
+		record->fused = rec->flags & TRACELOG_FUSED;
+		if (rec->flags & TRACELOG_HAS_ENTITY) {
+			record->entity_obj = p + rec->system_len;
+			record->entity_obj_len = rec->entity_obj_len;
+		} else {
+			record->entity_obj = NULL;
+			record->entity_obj_len = 0;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,126 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_TRACELOG_H
+#define LIGHTNING_PLUGINS_PAYZ_TRACELOG_H
+#include"config.h"
+#include<ccan/short_types/short_types.h>
+#include<ccan/tal/tal.h>
+#include<ccan/time/time.h>
+#include<stdbool.h>
+#include<stddef.h>
+
+/** TRACELOG_SEGMENT_BYTES
+ *
+ * @brief The default size of each segment of a trace log.
+ */
+#define TRACELOG_SEGMENT_BYTES ((size_t) 8 * 1024 * 1024)
+
+/** struct tracelog
+ *
+ * @brief Represents a trace log being written: an append-only
+ * sequence of fixed-size segment files, each mapped into memory
+ * while it is written.
+ *
+ * @desc The segments of the trace log at `path` are the files
+ * `path.000000`, `path.000001`, and so on.
+ * Each run of the writer starts a new segment, so the segments
+ * of a crashed run are left as they were.
+ *
+ * Appending a record is only a copy into the mapped segment;
+ * system calls are only made when moving to the next segment.
+ */
+struct tracelog;
+
+/** struct tracelog_record
+ *
+ * @brief A system invocation in a trace log.
+ */
+struct tracelog_record {
+	/* The entity the system was invoked on.  */
+	u32 entity;
+	/* When it was invoked.  */
+	struct timeabs time;
+	/* The name of the system, not nul-terminated.  */
+	const char *system;
+	size_t system_len;
+	/* Whether it was a pure system run directly.  */
+	bool fused;
+	/* The `entity` object the system was invoked with, not
+	 * nul-terminated, or NULL if it was not traced.  */
+	const char *entity_obj;
+	size_t entity_obj_len;
+};
+
+/** tracelog_new
+ *
+ * @brief Starts writing a new segment of the trace log at the
+ * given path.
+ *
+ * @param ctx - the owner of the trace log; freeing it unmaps
+ * and closes the current segment.
+ * @param path - the path of the trace log, to which the
+ * segment number is appended.
+ * @param segment_bytes - the size of each segment.
+ * @param max_segments - the number of segments to keep, older
+ * segments being deleted; 0 to keep all.
+ * @param error - set to an error message on failure.
+ *
+ * @return - the trace log, or NULL on failure.
+ */
+struct tracelog *tracelog_new(const tal_t *ctx,
+			      const char *path,
+			      size_t segment_bytes,
+			      u32 max_segments,
+			      const char **error);
+
+/** tracelog_append
+ *
+ * @brief Appends a record to the trace log, moving to the next
+ * segment if it does not fit in the current one.
+ *
+ * @param log - the trace log to append to.
+ * @param record - the record to append.
+ *
+ * @return - false if the record is too large for a segment,
+ * or a new segment could not be created.
+ */
+bool tracelog_append(struct tracelog *log,
+		     const struct tracelog_record *record);
+
+/** struct tracelog_reader
+ *
+ * @brief Represents a pass over the records of all segments
+ * of a trace log, oldest first.
+ */
+struct tracelog_reader;
+
+/** tracelog_reader_new
+ *
+ * @brief Starts reading the trace log at the given path.
+ *
+ * @param ctx - the owner of the reader.
+ * @param path - the path of the trace log, as given to
+ * tracelog_new.
+ * @param error - set to an error message on failure.
+ *
+ * @return - the reader, or NULL if the trace log has no
+ * segments.
+ */
+struct tracelog_reader *tracelog_reader_new(const tal_t *ctx,
+					    const char *path,
+					    const char **error);
+
+/** tracelog_next
+ *
+ * @brief Reads the next record of the trace log.
+ *
+ * @desc Segments that cannot be read are skipped.
+ *
+ * @param reader - the reader.
+ * @param record - set to the record read, which points into
+ * the segment and is only valid until the next call.
+ *
+ * @return - false if there are no more records.
+ */
+bool tracelog_next(struct tracelog_reader *reader,
+		   struct tracelog_record *record);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_TRACELOG_H */
@@ -0,0 +1,206 @@
+#include"tracering.h"
+#include<assert.h>
+#include<ccan/intmap/intmap.h>
+#include<common/utils.h>
+#include<string.h>
+
+/*~
+ * Records are laid out one after the other, each a header
+ * followed by its nul-terminated contents, padded so that every
+ * header is aligned.
+ * Positions are counted in bytes from the first record ever
+ * written, and never wrap; the offset in the buffer is the
+ * position modulo the capacity.
+ * A record never straddles the end of the buffer: if it does
+ * not fit, the rest of the buffer is skipped.
+ *
+ * Every record with a position at or after the tail is intact,
+ * so a chain of records of the same key ends at the first link
+ * before the tail.
+ * We only need to look at the evicted records themselves in
+ * order to drop the index entries of keys with no records left.
+ */
+
+#define TRACERING_ALIGN 16
+/* Marks the rest of the buffer as skipped.  */
+#define TRACERING_SKIP UINT32_MAX
+/* The end of a chain.  */
+#define TRACERING_NONE UINT64_MAX
+
+struct tracering_header {
+	u32 key;
+	/* Length of the contents, not including the nul, or
+	 * TRACERING_SKIP.  */
+	u32 len;
+	/* Position of the previous record with the same key, or
+	 * TRACERING_NONE.  */
+	u64 prev;
+};
+
+struct tracering_key {
+	/* Position of the most recent record with this key.  */
+	u64 latest;
+};
+
+struct tracering {
+	char *buf;
+	size_t capacity;
+
+	/* Position of the next record to write.  */
+	u64 head;
+	/* Position of the oldest record still in the buffer.  */
+	u64 tail;
+
+	/* The keys with records in the buffer.  */
+	UINTMAP(struct tracering_key *) keys;
+};
+
+static void tracering_destroy(struct tracering *ring)
+{
+	/* intmap uses malloc.  */
+	uintmap_clear(&ring->keys);
+}
+
+struct tracering *tracering_new(const tal_t *ctx, size_t capacity)
+{
+	struct tracering *ring = tal(ctx, struct tracering);
+
+	ring->capacity = capacity - capacity % TRACERING_ALIGN;
+	ring->buf = tal_arr(ring, char, ring->capacity);
+	ring->head = 0;
+	ring->tail = 0;
+	uintmap_init(&ring->keys);
+	tal_add_destructor(ring, &tracering_destroy);
+
+	return ring;
+}
+
+static size_t record_size(size_t len)
+{
+	size_t size = len + 1;
+
+	size += TRACERING_ALIGN - 1;
+	size -= size % TRACERING_ALIGN;
+	return sizeof(struct tracering_header) + size;
+}
+
+static struct tracering_header *header_at(const struct tracering *ring,
+					  u64 pos)
+{
+	return (struct tracering_header *) &ring->buf[pos % ring->capacity];
+}
+
+/* Discard the oldest records until the head can be moved to
+ * new_head.  */
+static void evict(struct tracering *ring, u64 new_head)
+{
+	struct tracering_header *hdr;
+	struct tracering_key *k;
+
+	while (new_head - ring->tail > ring->capacity) {
+		hdr = header_at(ring, ring->tail);
+		if (hdr->len == TRACERING_SKIP) {
+			ring->tail += ring->capacity
+				    - ring->tail % ring->capacity;
+			continue;
+		}
+
+		/* The last record of its key.  */
+		k = uintmap_get(&ring->keys, hdr->key);
+		if (k && k->latest == ring->tail) {
+			uintmap_del(&ring->keys, hdr->key);
+			tal_free(k);
+		}
+		ring->tail += record_size(hdr->len);
+	}
+}
+
+char *tracering_reserve(struct tracering *ring, u32 key, size_t len)
+{
+	struct tracering_header *hdr;
+	struct tracering_key *k;
+	size_t size = record_size(len);
+	size_t left;
+	char *data;
+
+	if (len >= TRACERING_SKIP || size > ring->capacity)
+		return NULL;
+
+	/* Skip the rest of the buffer if the record does not fit;
+	 * there is always room for the header that says so.  */
+	left = ring->capacity - ring->head % ring->capacity;
+	if (left < size) {
+		evict(ring, ring->head + left);
+		hdr = header_at(ring, ring->head);
+		hdr->key = 0;
+		hdr->len = TRACERING_SKIP;
+		hdr->prev = TRACERING_NONE;
+		ring->head += left;
+	}
+
+	evict(ring, ring->head + size);
+
+	k = uintmap_get(&ring->keys, key);
+	if (!k) {
+		k = tal(ring, struct tracering_key);
+		k->latest = TRACERING_NONE;
+		uintmap_add(&ring->keys, key, k);
+	}
+
+	hdr = header_at(ring, ring->head);
+	hdr->key = key;
+	hdr->len = len;
+	hdr->prev = k->latest;
+	k->latest = ring->head;
+	ring->head += size;
+
+	data = (char *) (hdr + 1);
+	data[len] = '\0';
+	return data;
+}
+
+bool tracering_add(struct tracering *ring,
+		   u32 key,
+		   const char *data,
+		   size_t len)
+{
+	char *dest = tracering_reserve(ring, key, len);
+
+	if (!dest)
+		return false;
+	memcpy(dest, data, len);
+	return true;
+}
+
+const char **tracering_get(const tal_t *ctx,
+			   const struct tracering *ring,
+			   u32 key)
+{
+	const char **records = tal_arr(ctx, const char *, 0);
+	const struct tracering_header *hdr;
+	const struct tracering_key *k;
+	u64 pos;
+	size_t i, n;
+
+	k = uintmap_get(&ring->keys, key);
+	if (!k)
+		return records;
+
+	for (pos = k->latest;
+	     pos != TRACERING_NONE && pos >= ring->tail;
+	     pos = hdr->prev) {
+		hdr = header_at(ring, pos);
+		assert(hdr->key == key);
+		tal_arr_expand(&records, (const char *) (hdr + 1));
+	}
+
+	/* We walked the chain from the newest.  */
+	n = tal_count(records);
+	for (i = 0; i < n / 2; ++i) {
+		const char *tmp = records[i];
+		records[i] = records[n - 1 - i];
+		records[n - 1 - i] = tmp;
+	}
+
+	return records;
+}
@@ -0,0 +1,81 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_TRACERING_H
+#define LIGHTNING_PLUGINS_PAYZ_TRACERING_H
+#include"config.h"
+#include<ccan/short_types/short_types.h>
+#include<ccan/tal/tal.h>
+#include<stddef.h>
+
+/** struct tracering
+ *
+ * @brief Represents a fixed-size byte buffer of the most recent
+ * trace records, each tagged with a key such as an entity ID.
+ *
+ * @desc Records are written one after the other into a single
+ * preallocated buffer, overwriting the oldest records once the
+ * buffer is full.
+ * Each record links to the previous record with the same key,
+ * so all the surviving records of one key can be found without
+ * looking at the records of any other key.
+ */
+struct tracering;
+
+/** tracering_new
+ *
+ * @brief Constructs an empty trace ring.
+ *
+ * @param ctx - the owner of this trace ring.
+ * @param capacity - the size of the buffer in bytes, including
+ * a small per-record overhead.
+ */
+struct tracering *tracering_new(const tal_t *ctx, size_t capacity);
+
+/** tracering_reserve
+ *
+ * @brief Adds a record to the trace ring, and returns the space
+ * to write its contents to.
+ *
+ * @desc The oldest records are discarded to make room.
+ *
+ * @param ring - the trace ring to add to.
+ * @param key - the key of the record.
+ * @param len - the length of the contents of the record.
+ *
+ * @return - a pointer to len + 1 bytes, to be filled in with
+ * the contents of the record followed by a nul, valid until
+ * the next record is added, or NULL if the record is too large
+ * for the trace ring.
+ */
+char *tracering_reserve(struct tracering *ring, u32 key, size_t len);
+
+/** tracering_add
+ *
+ * @brief Adds a record with the given contents to the trace
+ * ring.
+ *
+ * @return - false if the record is too large for the trace
+ * ring.
+ */
+bool tracering_add(struct tracering *ring,
+		   u32 key,
+		   const char *data,
+		   size_t len);
+
+/** tracering_get
+ *
+ * @brief Gets the records of the given key that are still in
+ * the trace ring.
+ *
+ * @param ctx - the owner of the returned array.
+ * @param ring - the trace ring to query.
+ * @param key - the key to look up.
+ *
+ * @return - a tal-allocated array of the contents of the
+ * records, each followed by a nul, oldest first, which point
+ * into the trace ring and are only valid until the next record
+ * is added.
+ */
+const char **tracering_get(const tal_t *ctx,
+			   const struct tracering *ring,
+			   u32 key);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_TRACERING_H */
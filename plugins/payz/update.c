@@ -0,0 +1,350 @@
+#include"update.h"
+#include<ccan/array_size/array_size.h>
+#include<ccan/tal/str/str.h>
+#include<common/utils.h>
+#include<inttypes.h>
+#include<plugins/payz/json_equal.h>
+#include<plugins/payz/json_patch.h>
+#include<plugins/payz/predicate.h>
+#include<stdarg.h>
+
+static const struct {
+	const char *name;
+	enum update_op op;
+} update_ops[] = {
+	{"set", UPDATE_SET},
+	{"add", UPDATE_ADD},
+	{"subtract", UPDATE_SUBTRACT},
+	{"min", UPDATE_MIN},
+	{"max", UPDATE_MAX},
+	{"append", UPDATE_APPEND},
+	{"remove", UPDATE_REMOVE},
+	{"merge", UPDATE_MERGE},
+	{"patch", UPDATE_PATCH}
+};
+
+/* Adds b to a, returning false on overflow.  */
+static bool number_add(struct predicate_number *a,
+		       const struct predicate_number *b)
+{
+	if (a->negative == b->negative) {
+		if (a->magnitude + b->magnitude < a->magnitude)
+			return false;
+		a->magnitude += b->magnitude;
+	} else if (a->magnitude >= b->magnitude)
+		a->magnitude -= b->magnitude;
+	else {
+		a->magnitude = b->magnitude - a->magnitude;
+		a->negative = b->negative;
+	}
+	if (a->magnitude == 0)
+		a->negative = false;
+	return true;
+}
+
+static const char *PRINTF_FMT(3, 4)
+update_error(const tal_t *ctx, const struct update *update,
+	     const char *fmt, ...)
+{
+	va_list ap;
+	char *msg;
+
+	va_start(ap, fmt);
+	msg = tal_vfmt(ctx, fmt, ap);
+	va_end(ap);
+
+	return tal_fmt(ctx, "'%s' of entity %"PRIu32": %s",
+		       update->component, update->entity, msg);
+}
+
+const char *update_parse(const tal_t *ctx,
+			 const char *buffer,
+			 const jsmntok_t *tok,
+			 struct update **update)
+{
+	struct update *u;
+	const jsmntok_t *component;
+	const jsmntok_t *operand = NULL;
+	const jsmntok_t *t;
+	struct predicate_number num;
+	const char *error;
+	size_t i;
+
+	if (tok->type != JSMN_OBJECT)
+		return tal_fmt(ctx, "update must be an object");
+
+	u = tal(ctx, struct update);
+	t = json_get_member(buffer, tok, "entity");
+	if (!t || !json_to_u32(buffer, t, &u->entity)) {
+		tal_free(u);
+		return tal_fmt(ctx, "update needs an 'entity' ID");
+	}
+
+	component = json_get_member(buffer, tok, "component");
+	if (!component || component->type != JSMN_STRING) {
+		tal_free(u);
+		return tal_fmt(ctx, "update needs a 'component' string");
+	}
+	u->component = json_strdup(u, buffer, component);
+
+	error = predicate_parse_field(u, buffer,
+				      json_get_member(buffer, tok, "field"),
+				      &u->field);
+	if (error) {
+		error = tal_fmt(ctx, "update %s", error);
+		tal_free(u);
+		return error;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(update_ops); ++i) {
+		t = json_get_member(buffer, tok, update_ops[i].name);
+		if (!t)
+			continue;
+		if (operand) {
+			tal_free(u);
+			return tal_fmt(ctx, "update must have only one "
+					    "of 'set', 'add', 'subtract', "
+					    "'min', 'max', 'append', 'remove', "
+					    "'merge', 'patch'");
+		}
+		operand = t;
+		u->op = update_ops[i].op;
+	}
+	if (!operand) {
+		tal_free(u);
+		return tal_fmt(ctx, "update needs one of 'set', 'add', "
+				    "'subtract', 'min', 'max', 'append', "
+				    "'remove', 'merge', 'patch'");
+	}
+
+	switch (u->op) {
+	case UPDATE_SET:
+	case UPDATE_APPEND:
+	case UPDATE_REMOVE:
+	case UPDATE_MERGE:
+		break;
+	case UPDATE_PATCH:
+		error = json_patch_check(ctx, buffer, operand);
+		if (error) {
+			tal_free(u);
+			return error;
+		}
+		break;
+	case UPDATE_ADD:
+	case UPDATE_SUBTRACT:
+	case UPDATE_MIN:
+	case UPDATE_MAX:
+		if (!predicate_to_number(buffer, operand, &num)) {
+			error = tal_fmt(ctx, "update operand %.*s is not "
+					     "a number or amount",
+					json_tok_full_len(operand),
+					json_tok_full(buffer, operand));
+			tal_free(u);
+			return error;
+		}
+		break;
+	}
+
+	/* Keep our own copy of the operand, so the update can
+	 * outlive the command that gave it.  */
+	u->buffer = json_tok_text(u, buffer, operand);
+	u->operand = json_parse_simple(u, u->buffer, strlen(u->buffer));
+	if (!u->operand) {
+		tal_free(u);
+		return tal_fmt(ctx, "update operand is invalid");
+	}
+
+	*update = u;
+	return NULL;
+}
+
+/* Applies the update to the value it targets, which may be
+ * NULL if absent.  */
+static const char *apply_value(const tal_t *ctx,
+			       const struct update *u,
+			       const char *buffer,
+			       const jsmntok_t *value,
+			       char **result)
+{
+	struct predicate_number num, operand;
+	const jsmntok_t *entry;
+	const char *error;
+	const char *sep;
+	size_t i;
+	int cmp;
+
+	switch (u->op) {
+	case UPDATE_SET:
+		*result = json_tok_text(ctx, u->buffer, u->operand);
+		return NULL;
+
+	case UPDATE_ADD:
+	case UPDATE_SUBTRACT:
+		if (!predicate_to_number(u->buffer, u->operand, &operand))
+			abort();
+		if (!value) {
+			num.amount = operand.amount;
+			num.negative = false;
+			num.magnitude = 0;
+		} else if (!predicate_to_number(buffer, value, &num))
+			return update_error(ctx, u, "%.*s is not a number "
+						    "or amount",
+					    json_tok_full_len(value),
+					    json_tok_full(buffer, value));
+		if (operand.amount && !num.amount)
+			return update_error(ctx, u, "cannot add an amount "
+						    "to the number %.*s",
+					    json_tok_full_len(value),
+					    json_tok_full(buffer, value));
+		if (u->op == UPDATE_SUBTRACT && operand.magnitude != 0)
+			operand.negative = !operand.negative;
+		if (!number_add(&num, &operand))
+			return update_error(ctx, u, "overflow");
+		if (num.amount && num.negative)
+			return update_error(ctx, u, "amount would be "
+						    "negative");
+		if (num.amount)
+			*result = tal_fmt(ctx, "\"%"PRIu64"msat\"",
+					  num.magnitude);
+		else
+			*result = tal_fmt(ctx, "%s%"PRIu64,
+					  num.negative ? "-" : "",
+					  num.magnitude);
+		return NULL;
+
+	case UPDATE_MIN:
+	case UPDATE_MAX:
+		if (!value) {
+			*result = json_tok_text(ctx, u->buffer, u->operand);
+			return NULL;
+		}
+		if (!predicate_compare(buffer, value,
+				       u->buffer, u->operand, &cmp))
+			return update_error(ctx, u, "%.*s is not a number "
+						    "or amount",
+					    json_tok_full_len(value),
+					    json_tok_full(buffer, value));
+		if (u->op == UPDATE_MIN ? cmp <= 0 : cmp >= 0)
+			*result = json_tok_text(ctx, buffer, value);
+		else
+			*result = json_tok_text(ctx, u->buffer, u->operand);
+		return NULL;
+
+	case UPDATE_APPEND:
+	case UPDATE_REMOVE:
+		if (!value) {
+			*result = u->op == UPDATE_APPEND ?
+				tal_fmt(ctx, "[%s]", u->buffer) : NULL;
+			return NULL;
+		}
+		if (value->type != JSMN_ARRAY)
+			return update_error(ctx, u, "%.*s is not an array",
+					    json_tok_full_len(value),
+					    json_tok_full(buffer, value));
+		*result = tal_strdup(ctx, "[");
+		sep = "";
+		json_for_each_arr (i, entry, value) {
+			if (u->op == UPDATE_REMOVE
+			 && json_equal(buffer, entry, u->buffer, u->operand))
+				continue;
+			tal_append_fmt(result, "%s%.*s", sep,
+				       json_tok_full_len(entry),
+				       json_tok_full(buffer, entry));
+			sep = ", ";
+		}
+		if (u->op == UPDATE_APPEND)
+			tal_append_fmt(result, "%s%s", sep, u->buffer);
+		tal_append_fmt(result, "]");
+		return NULL;
+
+	case UPDATE_MERGE:
+		*result = json_merge_patch(ctx, buffer, value,
+					   u->buffer, u->operand);
+		return NULL;
+
+	case UPDATE_PATCH:
+		error = json_patch(tmpctx, buffer, value,
+				   u->buffer, u->operand, result);
+		if (error)
+			return update_error(ctx, u, "%s", error);
+		if (*result)
+			tal_steal(ctx, *result);
+		return NULL;
+	}
+	abort();
+}
+
+/* Descends into the field of the value, creating members as
+ * needed, then rebuilds the value around the updated field.  */
+static const char *apply_field(const tal_t *ctx,
+			       const struct update *u,
+			       const char *buffer,
+			       const jsmntok_t *value,
+			       size_t depth,
+			       char **result)
+{
+	const char *name;
+	const jsmntok_t *member;
+	const jsmntok_t *key;
+	const char *error;
+	const char *sep;
+	char *inner;
+	size_t i;
+
+	if (depth == tal_count(u->field))
+		return apply_value(ctx, u, buffer, value, result);
+
+	if (value && value->type != JSMN_OBJECT)
+		return update_error(ctx, u, "%.*s is not an object",
+				    json_tok_full_len(value),
+				    json_tok_full(buffer, value));
+
+	name = u->field[depth];
+	member = value ? json_get_member(buffer, value, name) : NULL;
+	error = apply_field(ctx, u, buffer, member, depth + 1, &inner);
+	if (error)
+		return error;
+
+	/* Nothing to remove, so nothing changes.  */
+	if (!inner && !member) {
+		*result = value ? json_tok_text(ctx, buffer, value) : NULL;
+		return NULL;
+	}
+
+	*result = tal_strdup(ctx, "{");
+	sep = "";
+	if (value) {
+		json_for_each_obj (i, key, value) {
+			if (key == member - 1) {
+				/* Patched away, so removed.  */
+				if (!inner)
+					continue;
+				tal_append_fmt(result, "%s%.*s: %s", sep,
+					       json_tok_full_len(key),
+					       json_tok_full(buffer, key),
+					       inner);
+			} else
+				tal_append_fmt(result, "%s%.*s: %.*s", sep,
+					       json_tok_full_len(key),
+					       json_tok_full(buffer, key),
+					       json_tok_full_len(key + 1),
+					       json_tok_full(buffer, key + 1));
+			sep = ", ";
+		}
+	}
+	/* The name is as it was in the JSON of the update, so it
+	 * is still escaped.  */
+	if (!member)
+		tal_append_fmt(result, "%s\"%s\": %s", sep, name, inner);
+	tal_append_fmt(result, "}");
+	return NULL;
+}
+
+const char *update_apply(const tal_t *ctx,
+			 const struct update *update,
+			 const char *buffer,
+			 const jsmntok_t *component,
+			 char **result)
+{
+	return apply_field(ctx, update, buffer, component, 0, result);
+}
@@ -0,0 +1,94 @@
+#ifndef LIGHTNING_PLUGINS_PAYZ_UPDATE_H
+#define LIGHTNING_PLUGINS_PAYZ_UPDATE_H
+#include"config.h"
+#include<ccan/short_types/short_types.h>
+#include<ccan/tal/tal.h>
+#include<common/json.h>
+
+/** enum update_op
+ *
+ * @brief The operation an update performs on a value.
+ */
+enum update_op {
+	/* Replace the value with the operand.  */
+	UPDATE_SET,
+	/* Add the operand, a number or amount, to the value, a
+	 * number or amount; an absent value counts as 0.  */
+	UPDATE_ADD,
+	UPDATE_SUBTRACT,
+	/* Replace the value with the operand if the operand is
+	 * less, or greater; an absent value is replaced.  */
+	UPDATE_MIN,
+	UPDATE_MAX,
+	/* Add the operand to the end of the value, an array; an
+	 * absent value counts as an empty array.  */
+	UPDATE_APPEND,
+	/* Remove every entry equal to the operand from the value,
+	 * an array.  */
+	UPDATE_REMOVE,
+	/* Apply the operand, an RFC 7386 JSON Merge Patch.  */
+	UPDATE_MERGE,
+	/* Apply the operand, an RFC 6902 JSON Patch.  */
+	UPDATE_PATCH
+};
+
+/** struct update
+ *
+ * @brief Represents an operation on the value of a component of
+ * an entity, such as `{"entity": 1, "component":
+ * "example:parts", "add": 1}`.
+ */
+struct update {
+	/* The component to update.  */
+	u32 entity;
+	const char *component;
+	/* The members to descend into, within the component, to
+	 * get the value to update; empty to update the component
+	 * itself.
+	 * Absent members are created.  */
+	const char **field;
+	enum update_op op;
+	/* The operand, in its own buffer.  */
+	const char *buffer;
+	const jsmntok_t *operand;
+};
+
+/** update_parse
+ *
+ * @brief Parses an update object.
+ *
+ * @param ctx - the owner of the returned update.
+ * @param buffer - the buffer containing the update.
+ * @param tok - the update object.
+ * @param update - set to the parsed update.
+ *
+ * @return - NULL on success, or an error message allocated
+ * from ctx.
+ */
+const char *update_parse(const tal_t *ctx,
+			 const char *buffer,
+			 const jsmntok_t *tok,
+			 struct update **update);
+
+/** update_apply
+ *
+ * @brief Computes the new value of a component after an update.
+ *
+ * @param ctx - the owner of the returned value or error.
+ * @param update - the update to apply.
+ * @param buffer - the buffer containing the component.
+ * @param component - the current value of the component, or
+ * NULL if the entity does not have it.
+ * @param result - set to the JSON text of the new value of the
+ * component, or NULL if the entity would not have it.
+ *
+ * @return - NULL on success, or an error message allocated from
+ * ctx if the update cannot apply to the current value.
+ */
+const char *update_apply(const tal_t *ctx,
+			 const struct update *update,
+			 const char *buffer,
+			 const jsmntok_t *component,
+			 char **result);
+
+#endif /* LIGHTNING_PLUGINS_PAYZ_UPDATE_H */
@@ -0,0 +1,109 @@
+#include<ccan/err/err.h>
+#include<ccan/json_escape/json_escape.h>
+#include<ccan/mem/mem.h>
+#include<ccan/str/str.h>
+#include<ccan/tal/str/str.h>
+#include<common/utils.h>
+#include<inttypes.h>
+#include<plugins/payz/tracelog.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+
+/* Print the trace log written by the payecs-systrace-log option,
+ * one JSON object per line, in the format of payecs_systrace.  */
+
+static void usage(void)
+{
+	errx(1, "Usage: payz-tracelog [--entity=ID] [--system=NAME] "
+		"[--since=UNIXTIME] [--until=UNIXTIME] PATH");
+}
+
+static double parse_time(const char *arg)
+{
+	char *endp;
+	double t = strtod(arg, &endp);
+
+	if (!arg[0] || *endp)
+		usage();
+	return t;
+}
+
+static void print_record(const struct tracelog_record *record)
+{
+	char iso8601[sizeof("YYYY-mm-ddTHH:MM:SS")];
+	/* System names are arbitrary strings given by clients.  */
+	const struct json_escape *system
+		= json_escape_len(tmpctx, record->system, record->system_len);
+
+	strftime(iso8601, sizeof(iso8601),
+		 "%FT%T", gmtime(&record->time.ts.tv_sec));
+	printf("{\"time\": \"%s.%03dZ\", \"system\": \"%s\", ",
+	       iso8601, (int) record->time.ts.tv_nsec / 1000000,
+	       system->s);
+	if (record->entity_obj)
+		printf("\"entity\": %.*s",
+		       (int) record->entity_obj_len, record->entity_obj);
+	else
+		printf("\"entity\": {\"entity\": %"PRIu32"}", record->entity);
+	printf("%s}\n", record->fused ? ", \"fused\": true" : "");
+}
+
+int main(int argc, char **argv)
+{
+	struct tracelog_reader *reader;
+	struct tracelog_record record;
+	const char *path = NULL;
+	const char *system = NULL;
+	const char *error;
+	bool have_entity = false;
+	u32 entity = 0;
+	double since = 0, until = -1;
+	double t;
+	char *endp;
+	int i;
+
+	setup_locale();
+	setup_tmpctx();
+
+	for (i = 1; i < argc; ++i) {
+		if (strstarts(argv[i], "--entity=")) {
+			entity = strtoul(argv[i] + strlen("--entity="),
+					 &endp, 10);
+			if (*endp)
+				usage();
+			have_entity = true;
+		} else if (strstarts(argv[i], "--system="))
+			system = argv[i] + strlen("--system=");
+		else if (strstarts(argv[i], "--since="))
+			since = parse_time(argv[i] + strlen("--since="));
+		else if (strstarts(argv[i], "--until="))
+			until = parse_time(argv[i] + strlen("--until="));
+		else if (!path && !strstarts(argv[i], "--"))
+			path = argv[i];
+		else
+			usage();
+	}
+	if (!path)
+		usage();
+
+	reader = tracelog_reader_new(tmpctx, path, &error);
+	if (!reader)
+		errx(1, "%s", error);
+
+	while (tracelog_next(reader, &record)) {
+		if (have_entity && record.entity != entity)
+			continue;
+		if (system && !memeq(record.system, record.system_len,
+				     system, strlen(system)))
+			continue;
+		t = record.time.ts.tv_sec + record.time.ts.tv_nsec / 1e9;
+		if (t < since || (until >= 0 && t > until))
+			continue;
+		print_record(&record);
+	}
+
+	tal_free(tmpctx);
+	return 0;
+}